@@ -0,0 +1,325 @@
+#include "concurrent_profile_t.h"
+#include "gecowatchert.h"
+
+#include <string.h>
+
+/// per thread counters of one ConcurrentProfile
+struct ConcurrentProfile::Shard
+{
+	/// ConcurrentProfile::epoch_ when the owner last cleared it
+	std::atomic<uint32> epoch_;
+	std::atomic<uint64> sum_;
+	std::atomic<uint64> max_;
+	std::atomic<uint64> counts_[LatencyHistogram::BUCKETS];
+	/// keep the hot head of the next shard off our last line
+	char pad_[64];
+};
+
+namespace
+{
+const uint OVERFLOW_SLOT = GECO_PROFILE_MAX_THREAD_SHARDS;
+
+/// bit n set <=> slot n is owned by a live thread
+std::atomic<uint64> s_usedSlots(0);
+
+/// slot of the calling thread, released when the thread exits so that a
+/// later thread takes over its shards. the RMWs on s_usedSlots order the
+/// last writes of the old owner before the first writes of the new one.
+struct ThreadSlot
+{
+	uint slot_;
+
+	ThreadSlot() : slot_(OVERFLOW_SLOT)
+	{
+		uint64 used = s_usedSlots.load(std::memory_order_relaxed);
+		while (used != ~uint64(0))
+		{
+			uint slot = geco::ultils::ctz64(~used);
+			if (s_usedSlots.compare_exchange_weak(used, used | (uint64(1) << slot),
+				std::memory_order_acquire, std::memory_order_relaxed))
+			{
+				slot_ = slot;
+				break;
+			}
+		}
+	}
+	~ThreadSlot()
+	{
+		if (slot_ != OVERFLOW_SLOT)
+			s_usedSlots.fetch_and(~(uint64(1) << slot_), std::memory_order_release);
+	}
+};
+
+thread_local ThreadSlot t_threadSlot;
+
+/// the owner is the only writer, a load and a store is enough
+inline void ownerAdd(std::atomic<uint64>& counter, uint64 value)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + value,
+		std::memory_order_relaxed);
+}
+inline void sharedMax(std::atomic<uint64>& counter, uint64 value)
+{
+	uint64 old = counter.load(std::memory_order_relaxed);
+	while (value > old && !counter.compare_exchange_weak(old, value,
+		std::memory_order_relaxed))
+	{
+	}
+}
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// 　　　　　　　　　　　　 Section: LatencyHistogram
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+const uint LatencyHistogram::SUB_BITS;
+const uint LatencyHistogram::SUB_COUNT;
+const uint LatencyHistogram::HALF_COUNT;
+const uint LatencyHistogram::BUCKETS;
+
+void LatencyHistogram::reset()
+{
+	memset(counts_, 0, sizeof(counts_));
+	count_ = 0;
+	sum_ = 0;
+	max_ = 0;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+	for (uint i = 0; i < BUCKETS; i++)
+		counts_[i] += other.counts_[i];
+	count_ += other.count_;
+	sum_ += other.sum_;
+	if (other.max_ > max_) max_ = other.max_;
+}
+
+uint64 LatencyHistogram::valueAtPercentile(double percentile) const
+{
+	if (count_ == 0)
+		return 0;
+	if (percentile >= 100.0)
+		return max_;
+	uint64 rank = (uint64)(percentile / 100.0 * double(count_) + 0.999999);
+	if (rank < 1) rank = 1;
+	if (rank > count_) rank = count_;
+
+	uint64 seen = 0;
+	for (uint i = 0; i < BUCKETS; i++)
+	{
+		seen += counts_[i];
+		if (seen >= rank)
+		{
+			uint64 highest = highestOf(i);
+			return highest < max_ ? highest : max_;
+		}
+	}
+	return max_;
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// 　　　　　　　　　　　　 Section: ConcurrentProfile
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ConcurrentProfile::ConcurrentProfile(const char* name) :
+#if ENABLE_WATCHERS
+	pWatchSnapshot_(NULL),
+	watchUint_(0),
+	watchDouble_(0.0),
+	watchBool_(false),
+#endif
+	name_(name == NULL ? "" : name),
+	epoch_(0)
+{
+	for (uint i = 0; i <= OVERFLOW_SLOT; i++)
+		shards_[i].store(NULL, std::memory_order_relaxed);
+	if (!name_.empty())
+		this->initWatchers();
+}
+
+ConcurrentProfile::~ConcurrentProfile()
+{
+#if ENABLE_WATCHERS
+	if (!watchPath_.empty())
+	{
+		/// remove the directory, its path is the watch path without the
+		/// trailing separator
+		std::string dir = watchPath_.substr(0, watchPath_.size() - 1);
+		geco_watcher_base_t::get_root_watcher().remove_watcher(dir.c_str());
+	}
+	delete pWatchSnapshot_;
+#endif
+	for (uint i = 0; i <= OVERFLOW_SLOT; i++)
+		delete shards_[i].load(std::memory_order_relaxed);
+}
+
+ConcurrentProfile::Shard* ConcurrentProfile::prepareShard(uint slot, uint32 epoch)
+{
+	Shard* shard = shards_[slot].load(std::memory_order_acquire);
+	if (shard == NULL)
+	{
+		Shard* fresh = new Shard;
+		fresh->sum_.store(0, std::memory_order_relaxed);
+		fresh->max_.store(0, std::memory_order_relaxed);
+		for (uint i = 0; i < LatencyHistogram::BUCKETS; i++)
+			fresh->counts_[i].store(0, std::memory_order_relaxed);
+		fresh->epoch_.store(epoch, std::memory_order_relaxed);
+		/// only the overflow slot can race here
+		if (shards_[slot].compare_exchange_strong(shard, fresh,
+			std::memory_order_acq_rel, std::memory_order_acquire))
+			return fresh;
+		delete fresh;
+		if (shard->epoch_.load(std::memory_order_acquire) == epoch)
+			return shard;
+	}
+
+	uint32 old = shard->epoch_.load(std::memory_order_relaxed);
+	if (slot == OVERFLOW_SLOT)
+	{
+		/// one thread wins the right to clear, samples the others add
+		/// meanwhile may be wiped with the old window
+		if (old == epoch ||
+			!shard->epoch_.compare_exchange_strong(old, epoch, std::memory_order_acq_rel))
+			return shard;
+	}
+	shard->sum_.store(0, std::memory_order_relaxed);
+	shard->max_.store(0, std::memory_order_relaxed);
+	for (uint i = 0; i < LatencyHistogram::BUCKETS; i++)
+		shard->counts_[i].store(0, std::memory_order_relaxed);
+	/// publish the cleared shard, snapshot() skips it until then
+	if (slot != OVERFLOW_SLOT)
+		shard->epoch_.store(epoch, std::memory_order_release);
+	return shard;
+}
+
+void ConcurrentProfile::record(uint64 stamps)
+{
+	uint slot = t_threadSlot.slot_;
+	uint32 epoch = epoch_.load(std::memory_order_relaxed);
+	Shard* shard = shards_[slot].load(std::memory_order_acquire);
+	if (shard == NULL || shard->epoch_.load(std::memory_order_relaxed) != epoch)
+		shard = this->prepareShard(slot, epoch);
+
+	uint bucket = LatencyHistogram::bucketOf(stamps);
+	if (slot != OVERFLOW_SLOT)
+	{
+		ownerAdd(shard->counts_[bucket], 1);
+		ownerAdd(shard->sum_, stamps);
+		if (stamps > shard->max_.load(std::memory_order_relaxed))
+			shard->max_.store(stamps, std::memory_order_relaxed);
+	}
+	else
+	{
+		shard->counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+		shard->sum_.fetch_add(stamps, std::memory_order_relaxed);
+		sharedMax(shard->max_, stamps);
+	}
+}
+
+void ConcurrentProfile::snapshot(LatencyHistogram& out) const
+{
+	out.reset();
+	uint32 epoch = epoch_.load(std::memory_order_acquire);
+	for (uint slot = 0; slot <= OVERFLOW_SLOT; slot++)
+	{
+		const Shard* shard = shards_[slot].load(std::memory_order_acquire);
+		if (shard == NULL || shard->epoch_.load(std::memory_order_acquire) != epoch)
+			continue;
+		/// the count is the sum of the buckets, so percentiles always rank
+		/// within what was actually merged
+		uint64 count = 0;
+		for (uint i = 0; i < LatencyHistogram::BUCKETS; i++)
+		{
+			uint64 n = shard->counts_[i].load(std::memory_order_relaxed);
+			out.counts_[i] += n;
+			count += n;
+		}
+		out.count_ += count;
+		out.sum_ += shard->sum_.load(std::memory_order_relaxed);
+		uint64 max = shard->max_.load(std::memory_order_relaxed);
+		if (max > out.max_) out.max_ = max;
+	}
+}
+
+void ConcurrentProfile::reset()
+{
+	epoch_.fetch_add(1, std::memory_order_acq_rel);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// 　　　　　　　　　　　　 Section: watchers
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+bool ConcurrentProfile::initWatchers(const char* path)
+{
+#if ENABLE_WATCHERS
+	if (!watchPath_.empty())
+		return true;
+	if (path == NULL && name_.empty())
+		return false;
+	watchPath_ = path != NULL ? path : "Profiles/Concurrent/" + name_;
+	if (watchPath_.empty())
+		return false;
+	if (watchPath_[watchPath_.size() - 1] != '/')
+		watchPath_ += '/';
+	pWatchSnapshot_ = new LatencyHistogram;
+
+	GECO_WATCH((watchPath_ + "count").c_str(), *this,
+		CAST_METHOD_R(uint64, ConcurrentProfile, watchCount));
+	GECO_WATCH((watchPath_ + "meanUs").c_str(), *this,
+		CAST_METHOD_R(double, ConcurrentProfile, watchMeanUs));
+	GECO_WATCH((watchPath_ + "p50Us").c_str(), *this,
+		CAST_METHOD_R(double, ConcurrentProfile, watchP50Us));
+	GECO_WATCH((watchPath_ + "p99Us").c_str(), *this,
+		CAST_METHOD_R(double, ConcurrentProfile, watchP99Us));
+	GECO_WATCH((watchPath_ + "p999Us").c_str(), *this,
+		CAST_METHOD_R(double, ConcurrentProfile, watchP999Us));
+	GECO_WATCH((watchPath_ + "maxUs").c_str(), *this,
+		CAST_METHOD_R(double, ConcurrentProfile, watchMaxUs));
+	GECO_WATCH((watchPath_ + "reset").c_str(), *this,
+		CAST_METHOD_RW(bool, ConcurrentProfile, watchReset, setReset));
+	return true;
+#else
+	return false;
+#endif
+}
+
+#if ENABLE_WATCHERS
+uint64& ConcurrentProfile::watchCount()
+{
+	this->snapshot(*pWatchSnapshot_);
+	return watchUint_ = pWatchSnapshot_->count();
+}
+double& ConcurrentProfile::watchMeanUs()
+{
+	this->snapshot(*pWatchSnapshot_);
+	return watchDouble_ = pWatchSnapshot_->mean() * 1000000.0 / stamps_per_sec_double();
+}
+double& ConcurrentProfile::watchPercentileUs(double percentile)
+{
+	this->snapshot(*pWatchSnapshot_);
+	return watchDouble_ = stamps2sec(pWatchSnapshot_->valueAtPercentile(percentile)) * 1000000.0;
+}
+double& ConcurrentProfile::watchP50Us()
+{
+	return this->watchPercentileUs(50.0);
+}
+double& ConcurrentProfile::watchP99Us()
+{
+	return this->watchPercentileUs(99.0);
+}
+double& ConcurrentProfile::watchP999Us()
+{
+	return this->watchPercentileUs(99.9);
+}
+double& ConcurrentProfile::watchMaxUs()
+{
+	return this->watchPercentileUs(100.0);
+}
+bool& ConcurrentProfile::watchReset()
+{
+	return watchBool_ = false;
+}
+void ConcurrentProfile::setReset(bool& reset)
+{
+	if (reset)
+		this->reset();
+}
+#endif
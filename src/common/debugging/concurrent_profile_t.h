@@ -0,0 +1,222 @@
+/*
+* Copyright (c) 2016
+* Geco Gaming Company
+*
+* Permission to use, copy, modify, distribute and sell this software
+* and its documentation for GECO purpose is hereby granted without fee,
+* provided that the above copyright notice appear in all copies and
+* that both that copyright notice and this permission notice appear
+* in supporting documentation. Geco Gaming makes no
+* representations about the suitability of this software for GECO
+* purpose.  It is provided "as is" without express or implied warranty.
+*
+*/
+
+/**
+* concurrent_profile_t.h
+*
+* thread safe counterpart of Profile/ProfileVal. Profile keeps its sums in
+* plain fields and nests through a shared stack, so it is only valid on one
+* thread. ConcurrentProfile has no stack and no lock:
+* 1. every thread owns a shard of counters and a latency histogram, the
+*    owner updates it with plain relaxed loads and stores, no RMW
+* 2. readers merge the shards on demand, see snapshot()
+* 3. the histogram is log-linear (HDR style): values below 2^SUB_BITS are
+*    exact, above that every power of two is split in 2^(SUB_BITS-1)
+*    buckets, so the relative error of a percentile is below 2^(1-SUB_BITS)
+*
+* static ConcurrentProfile s_decode("Net/decode");
+* {
+*	SCOPED_CONCURRENT_PROFILE(s_decode);  // from any thread
+*	...
+* }
+* LatencyHistogram h; s_decode.snapshot(h);
+* stamps2sec(h.valueAtPercentile(99.0));
+*
+* named profiles are watched under "Profiles/Concurrent/<name>/", count,
+* meanUs, p50Us, p99Us, p999Us and maxUs are merged on every read and
+* writing "reset" starts a new window.
+*/
+
+#ifndef __INCLUDE_CONCURRENT_PROFILE_H
+#define __INCLUDE_CONCURRENT_PROFILE_H
+
+#include <atomic>
+#include <string>
+
+#include "../geco-engine-feature.h"
+#include "../geco-plateform.h"
+#include "../ultils/ultils.h"
+
+#include "timestamp.h"
+
+/// sub bucket bits of LatencyHistogram, 5 gives 976 buckets per shard and
+/// 6.25% worst case percentile error, 6 gives 1920 buckets and 3.1%
+#ifndef GECO_PROFILE_HIST_SUB_BITS
+#define GECO_PROFILE_HIST_SUB_BITS 5
+#endif
+
+/// threads that get a shard of their own, later threads share one shard
+/// through atomic RMWs
+#define GECO_PROFILE_MAX_THREAD_SHARDS 64
+
+/// @brief
+/// log-linear latency histogram over uint64 values (time stamps). plain
+/// fields, single threaded, it is what ConcurrentProfile::snapshot() fills.
+struct GECOAPI LatencyHistogram
+{
+	static const uint SUB_BITS = GECO_PROFILE_HIST_SUB_BITS;
+	static const uint SUB_COUNT = 1 << SUB_BITS;
+	static const uint HALF_COUNT = SUB_COUNT >> 1;
+	static const uint BUCKETS = SUB_COUNT + (64 - SUB_BITS) * HALF_COUNT;
+
+	/// values [0, SUB_COUNT) map to themselves, a larger value keeps its
+	/// top SUB_BITS bits, the bucket is its exponent and those bits
+	static uint bucketOf(uint64 value)
+	{
+		if (value < SUB_COUNT)
+			return (uint)value;
+		uint shift = 63 - geco::ultils::clz64(value) - SUB_BITS + 1;
+		return SUB_COUNT + (shift - 1) * HALF_COUNT
+			+ (uint)((value >> shift) - HALF_COUNT);
+	}
+	/// smallest value of @bucket
+	static uint64 lowestOf(uint bucket)
+	{
+		if (bucket < SUB_COUNT)
+			return bucket;
+		uint shift = (bucket - SUB_COUNT) / HALF_COUNT + 1;
+		return uint64((bucket - SUB_COUNT) % HALF_COUNT + HALF_COUNT) << shift;
+	}
+	/// largest value of @bucket
+	static uint64 highestOf(uint bucket)
+	{
+		if (bucket < SUB_COUNT)
+			return bucket;
+		uint shift = (bucket - SUB_COUNT) / HALF_COUNT + 1;
+		return (uint64((bucket - SUB_COUNT) % HALF_COUNT + HALF_COUNT + 1) << shift) - 1;
+	}
+
+	LatencyHistogram() { this->reset(); }
+
+	void reset();
+	void record(uint64 value)
+	{
+		counts_[bucketOf(value)]++;
+		count_++;
+		sum_ += value;
+		if (value > max_) max_ = value;
+	}
+	/// add every bucket of @other
+	void merge(const LatencyHistogram& other);
+
+	/// @return the highest value of the bucket holding the sample ranked
+	/// @percentile (0-100], clamped to max(). 0 if empty.
+	uint64 valueAtPercentile(double percentile) const;
+
+	uint64 count() const { return count_; }
+	uint64 sum() const { return sum_; }
+	uint64 max() const { return max_; }
+	double mean() const { return count_ ? double(sum_) / double(count_) : 0.0; }
+	uint64 countAt(uint bucket) const { return counts_[bucket]; }
+
+	uint64 counts_[BUCKETS];
+	uint64 count_;
+	uint64 sum_;
+	uint64 max_;
+};
+
+/// @brief
+/// profile that can be started and stopped from any number of threads.
+/// start() returns the stamp the matching stop() takes back, so nothing is
+/// shared between the two calls and nesting works without a stack. there
+/// is no internal time, a parent's duration includes its children.
+class GECOAPI ConcurrentProfile
+{
+public:
+	/// a non empty @name adds the watchers when ENABLE_WATCHERS is set,
+	/// they are removed again by the destructor
+	explicit ConcurrentProfile(const char* name = "");
+	~ConcurrentProfile();
+
+	uint64 start() const
+	{
+		return gettimestamp();
+	}
+	void stop(uint64 startStamp)
+	{
+		this->record(gettimestamp() - startStamp);
+	}
+	/// add one sample of @stamps to the calling thread's shard
+	void record(uint64 stamps);
+
+	/// merge every shard into @out, which is reset first. samples recorded
+	/// concurrently may or may not be included, each is either in or out.
+	void snapshot(LatencyHistogram& out) const;
+	/// start a new window. shards are cleared by their owners on their next
+	/// record(), until then snapshot() skips them.
+	void reset();
+
+	const char* name() const { return name_.c_str(); }
+
+	/// add the watchers under @path, "Profiles/Concurrent/<name>/" if NULL
+	bool initWatchers(const char* path = NULL);
+
+private:
+	struct Shard;
+
+	ConcurrentProfile(const ConcurrentProfile&);
+	ConcurrentProfile& operator=(const ConcurrentProfile&);
+
+	Shard* prepareShard(uint slot, uint32 epoch);
+
+#if ENABLE_WATCHERS
+	uint64& watchCount();
+	double& watchMeanUs();
+	double& watchP50Us();
+	double& watchP99Us();
+	double& watchP999Us();
+	double& watchMaxUs();
+	bool& watchReset();
+	void setReset(bool& reset);
+	double& watchPercentileUs(double percentile);
+
+	LatencyHistogram* pWatchSnapshot_;
+	uint64 watchUint_;
+	double watchDouble_;
+	bool watchBool_;
+#endif
+	std::string name_;
+	std::string watchPath_;
+
+	/// bumped by reset(), a shard whose epoch differs holds an old window
+	std::atomic<uint32> epoch_;
+	/// one per thread slot, plus the shared overflow shard at the end
+	std::atomic<Shard*> shards_[GECO_PROFILE_MAX_THREAD_SHARDS + 1];
+};
+
+struct GECOAPI AutoScopedConcurrentProfile
+{
+	explicit AutoScopedConcurrentProfile(ConcurrentProfile& profile) :
+		profile_(profile),
+		startStamp_(profile.start())
+	{
+	}
+
+	~AutoScopedConcurrentProfile()
+	{
+		profile_.stop(startStamp_);
+	}
+
+	ConcurrentProfile& profile_;
+	uint64 startStamp_;
+};
+
+#define AUTO_SCOPED_CONCURRENT_PROFILE( NAME )	\
+static ConcurrentProfile _localConcurrentProfile( NAME );\
+AutoScopedConcurrentProfile _autoScopedConcurrentProfile( _localConcurrentProfile );
+
+#define SCOPED_CONCURRENT_PROFILE(PROFILE)\
+AutoScopedConcurrentProfile PROFILE##_AutoScopedConcurrentProfile(PROFILE);
+
+#endif
@@ -26,8 +26,14 @@
 #include <string.h>     /* strlen, strcat */
 #include <stdarg.h>     /* va_list, va_start, va_copy, va_arg, va_end */
 #include <time.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <signal.h>
 
 #include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #if defined(_WIN32)
 #include <windows.h>
 #include <time.h>
@@ -289,7 +295,7 @@ namespace geco
 #include <cxxabi.h>
 		void log_msg_helper::msg_back_trace()
 		{
-			void** trace_buf = new void*[MAX_DEPTH];
+			void* trace_buf[MAX_DEPTH];
 			uint32 depth = backtrace(trace_buf, MAX_DEPTH);
 			char ** traceStringBuffer = backtrace_symbols(trace_buf, depth);
 			if (traceStringBuffer == NULL)
@@ -346,7 +352,6 @@ namespace geco
 #else
 			free(traceStringBuffer);
 #endif
-			delete[] trace_buf;
 		}
 #else
 		inline void log_msg_helper::msg_back_trace()
@@ -359,6 +364,9 @@ namespace geco
 		void log_msg_helper::critical_msg_aux(bool isDevAssertion, const char * format,
 			va_list argPtr)
 		{
+			// whatever is still queued happened before this
+			async_log_t::flush();
+
 			char buffer[LOG_BUFSIZ];
 			geco_vsnprintf(buffer, sizeof(buffer), format, argPtr);
 			buffer[sizeof(buffer) - 1] = '\0';
@@ -535,9 +543,16 @@ namespace geco
 			if (!log_msg_filter_t::should_accept(cpn_priority_, msg_priority_))
 				return;
 
-			bool handled = false;
 			va_list argPtr;
 			va_start(argPtr, format);
+			if (!async_log_t::push(cpn_priority_, msg_priority_, format, argPtr))
+				this->message_aux(format, argPtr);
+			va_end(argPtr);
+		}
+
+		void log_msg_helper::message_aux(const char * format, va_list argPtr)
+		{
+			bool handled = false;
 
 #if !defined( _WIN32 ) && !defined( PLAYSTATION3 )
 			// send to syslog if it's been initialised
@@ -612,7 +627,895 @@ namespace geco
 					vdprintf(cpn_priority_, msg_priority_, format, argPtr);
 				}
 			}
-			va_end(argPtr);
+		}
+
+
+		//-------------------------------------------------------
+		// Section: async_log_t
+		//-------------------------------------------------------
+		namespace
+		{
+			/* first 8 bytes of every record, followed by a copy of the
+			 format and then the arguments. a PAD record only skips the rest
+			 of the ring up to the wrap */
+			struct async_record_t
+			{
+				uint32 size;
+				int16 cpn_priority;
+				uint8 msg_priority;
+				uint8 flags;
+			};
+			enum { RECORD_PAD = 0x01 };
+			const uint RECORD_ALIGN = 8;
+
+			/* single producer (the owning thread) single consumer (whoever
+			 holds s_drain_mutex) byte ring */
+			struct async_ring_t
+			{
+				std::atomic<uint64> head;
+				/* set by the owning thread while it is in push(), stop()
+				 waits for it to clear before the last drain */
+				std::atomic<bool> pushing;
+				char pad0[64 - sizeof(std::atomic<uint64>) - sizeof(std::atomic<bool>)];
+				std::atomic<uint64> tail;
+				char pad1[64 - sizeof(std::atomic<uint64>)];
+				/* false once the owning thread exited, the next new thread
+				 takes the ring over instead of allocating one */
+				std::atomic<bool> owned;
+				/* the registry is push-only, rings are never freed */
+				async_ring_t* next;
+				uint64 capacity;
+				char* buf;
+			};
+
+			std::atomic<async_ring_t*> s_rings(NULL);
+			std::atomic<bool> s_started(false);
+			std::atomic<int> s_policy(async_log_t::OVERFLOW_DROP);
+			std::atomic<uint64> s_dropped(0);
+			std::atomic<uint64> s_written(0);
+			uint64 s_reported_drops = 0;
+			uint64 s_ring_bytes = 64 * 1024;
+			std::mutex s_drain_mutex;
+			std::mutex s_wake_mutex;
+			std::condition_variable s_wake;
+			std::thread* s_log_thread = NULL;
+			std::atomic<bool> s_stopping(false);
+			/* set on the log thread, whose own messages stay synchronous */
+			thread_local bool t_is_log_thread = false;
+
+			struct async_ring_holder_t
+			{
+				async_ring_t* ring;
+				async_ring_holder_t() : ring(NULL) {}
+				~async_ring_holder_t()
+				{
+					if (ring != NULL)
+						ring->owned.store(false, std::memory_order_release);
+				}
+			};
+			thread_local async_ring_holder_t t_ring;
+
+			async_ring_t* get_thread_ring()
+			{
+				async_ring_t* ring = t_ring.ring;
+				if (ring != NULL)
+					return ring;
+				for (ring = s_rings.load(std::memory_order_acquire); ring != NULL; ring = ring->next)
+				{
+					bool owned = false;
+					if (!ring->owned.load(std::memory_order_relaxed) &&
+						ring->owned.compare_exchange_strong(owned, true, std::memory_order_acquire))
+						return t_ring.ring = ring;
+				}
+				ring = new async_ring_t;
+				ring->head.store(0, std::memory_order_relaxed);
+				ring->pushing.store(false, std::memory_order_relaxed);
+				ring->tail.store(0, std::memory_order_relaxed);
+				ring->owned.store(true, std::memory_order_relaxed);
+				ring->capacity = s_ring_bytes;
+				ring->buf = (char*)malloc(ring->capacity);
+				/* fault the pages in now rather than on the first lap */
+				memset(ring->buf, 0, ring->capacity);
+				/* seq_cst so that stop() finds the ring once push() has
+				 marked it */
+				ring->next = s_rings.load(std::memory_order_relaxed);
+				while (!s_rings.compare_exchange_weak(ring->next, ring, std::memory_order_seq_cst,
+					std::memory_order_relaxed))
+				{
+				}
+				return t_ring.ring = ring;
+			}
+
+			/* marks @ring as being written by push() for its scope */
+			struct async_push_scope_t
+			{
+				async_ring_t* ring;
+				explicit async_push_scope_t(async_ring_t* r) : ring(r)
+				{
+					ring->pushing.store(true, std::memory_order_seq_cst);
+				}
+				~async_push_scope_t()
+				{
+					ring->pushing.store(false, std::memory_order_release);
+				}
+			};
+
+			/* one printf conversion, shared by the encoder and the decoder
+			 so both walk the arguments the same way */
+			struct conv_spec_t
+			{
+				const char* start; /* the '%' */
+				const char* length; /* first char of the length modifier */
+				int stars; /* '*' width and precision, each an int argument */
+				int prec; /* -1 without a precision, -2 for '.*' */
+				int len; /* length_t */
+				char conv;
+			};
+			enum length_t
+			{
+				LEN_NONE, LEN_HH, LEN_H, LEN_L, LEN_LL, LEN_J, LEN_Z, LEN_T, LEN_LONG_DOUBLE
+			};
+
+			/* advance @f to the next conversion and parse it
+			 @return false at the end of the format */
+			bool next_spec(const char*& f, conv_spec_t& spec)
+			{
+				for (;;)
+				{
+					while (*f != '\0' && *f != '%')
+						f++;
+					if (*f == '\0')
+						return false;
+					if (f[1] == '%')
+					{
+						f += 2;
+						continue;
+					}
+					break;
+				}
+				spec.start = f++;
+				spec.stars = 0;
+				spec.prec = -1;
+				while (*f != '\0' && strchr("-+ #0'", *f) != NULL)
+					f++;
+				if (*f == '*')
+				{
+					spec.stars++;
+					f++;
+				}
+				while (*f >= '0' && *f <= '9')
+					f++;
+				if (*f == '.')
+				{
+					f++;
+					if (*f == '*')
+					{
+						spec.stars++;
+						spec.prec = -2;
+						f++;
+					}
+					else
+					{
+						spec.prec = 0;
+						while (*f >= '0' && *f <= '9')
+							spec.prec = spec.prec * 10 + (*f++ - '0');
+					}
+				}
+				spec.length = f;
+				switch (*f)
+				{
+				case 'h':
+					spec.len = f[1] == 'h' ? LEN_HH : LEN_H;
+					f += f[1] == 'h' ? 2 : 1;
+					break;
+				case 'l':
+					spec.len = f[1] == 'l' ? LEN_LL : LEN_L;
+					f += f[1] == 'l' ? 2 : 1;
+					break;
+				case 'q': spec.len = LEN_LL; f++; break;
+				case 'j': spec.len = LEN_J; f++; break;
+				case 'z': spec.len = LEN_Z; f++; break;
+				case 't': spec.len = LEN_T; f++; break;
+				case 'L': spec.len = LEN_LONG_DOUBLE; f++; break;
+				default: spec.len = LEN_NONE; break;
+				}
+				spec.conv = *f;
+				if (*f != '\0')
+					f++;
+				return true;
+			}
+
+			struct record_writer_t
+			{
+				char* p;
+				char* end;
+				bool put(const void* data, size_t size, size_t padded)
+				{
+					if (p + padded > end)
+						return false;
+					memcpy(p, data, size);
+					p += padded;
+					return true;
+				}
+				bool put_u64(uint64 v)
+				{
+					return put(&v, sizeof(v), sizeof(v));
+				}
+				/* @n bytes of @str and a NUL */
+				bool put_str(const char* str, size_t n)
+				{
+					size_t padded = (n + 1 + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+					if (p + padded > end)
+						return false;
+					memcpy(p, str, n);
+					p[n] = '\0';
+					p += padded;
+					return true;
+				}
+			};
+
+			/* copy @format and then its arguments out of @argPtr after the
+			 header, the caller's format need not outlive the call
+			 @return false if the format has something we cannot defer */
+			bool encode_args(record_writer_t& w, const char* format, va_list argPtr)
+			{
+				if (!w.put_str(format, strlen(format)))
+					return false;
+				conv_spec_t spec;
+				const char* f = format;
+				while (next_spec(f, spec))
+				{
+					int star[2] = { 0, 0 };
+					for (int i = 0; i < spec.stars; i++)
+					{
+						star[i] = va_arg(argPtr, int);
+						if (!w.put_u64((uint64)(int64)star[i]))
+							return false;
+					}
+
+					bool ok = true;
+					switch (spec.conv)
+					{
+					case 'd':
+					case 'i':
+					{
+						int64 v;
+						switch (spec.len)
+						{
+						case LEN_HH: v = (signed char)va_arg(argPtr, int); break;
+						case LEN_H: v = (short)va_arg(argPtr, int); break;
+						case LEN_L: v = va_arg(argPtr, long); break;
+						case LEN_LL: v = va_arg(argPtr, long long); break;
+						case LEN_J: v = va_arg(argPtr, intmax_t); break;
+						case LEN_Z: v = (int64)va_arg(argPtr, size_t); break;
+						case LEN_T: v = va_arg(argPtr, ptrdiff_t); break;
+						case LEN_NONE: v = va_arg(argPtr, int); break;
+						default: return false;
+						}
+						ok = w.put_u64((uint64)v);
+						break;
+					}
+					case 'o':
+					case 'u':
+					case 'x':
+					case 'X':
+					{
+						uint64 v;
+						switch (spec.len)
+						{
+						case LEN_HH: v = (unsigned char)va_arg(argPtr, unsigned int); break;
+						case LEN_H: v = (unsigned short)va_arg(argPtr, unsigned int); break;
+						case LEN_L: v = va_arg(argPtr, unsigned long); break;
+						case LEN_LL: v = va_arg(argPtr, unsigned long long); break;
+						case LEN_J: v = va_arg(argPtr, uintmax_t); break;
+						case LEN_Z: v = va_arg(argPtr, size_t); break;
+						case LEN_T: v = (uint64)va_arg(argPtr, ptrdiff_t); break;
+						case LEN_NONE: v = va_arg(argPtr, unsigned int); break;
+						default: return false;
+						}
+						ok = w.put_u64(v);
+						break;
+					}
+					case 'c':
+						if (spec.len != LEN_NONE)
+							return false;
+						ok = w.put_u64((uint64)va_arg(argPtr, int));
+						break;
+					case 'e':
+					case 'E':
+					case 'f':
+					case 'F':
+					case 'g':
+					case 'G':
+					case 'a':
+					case 'A':
+						if (spec.len == LEN_LONG_DOUBLE)
+						{
+							long double v = va_arg(argPtr, long double);
+							ok = w.put(&v, sizeof(v), (sizeof(v) + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1));
+						}
+						else
+						{
+							double v = va_arg(argPtr, double);
+							ok = w.put(&v, sizeof(v), sizeof(v));
+						}
+						break;
+					case 'p':
+						ok = w.put_u64((uint64)(uintptr_t)va_arg(argPtr, void*));
+						break;
+					case 's':
+					{
+						if (spec.len != LEN_NONE)
+							return false;
+						const char* str = va_arg(argPtr, const char*);
+						if (str == NULL)
+							str = "(null)";
+						/* length, then the bytes with their NUL, truncated to
+						 the precision and to what is left of the record. with
+						 a precision @str need not be NUL terminated */
+						int prec = spec.prec == -2 ? star[spec.stars - 1] : spec.prec;
+						size_t n = prec >= 0 ? strnlen(str, (size_t)prec) : strlen(str);
+						size_t room = w.end - w.p;
+						if (room < 2 * RECORD_ALIGN)
+							return false;
+						size_t max = ((room - RECORD_ALIGN) & ~(size_t)(RECORD_ALIGN - 1)) - 1;
+						if (n > max)
+							n = max;
+						ok = w.put_u64(n) && w.put_str(str, n);
+						break;
+					}
+					default:
+						/* %n, wide chars and anything unknown */
+						return false;
+					}
+					if (!ok)
+						return false;
+				}
+				return true;
+			}
+
+			/* snprintf one conversion with its star arguments */
+			template<class T>
+			int format_one(char* out, size_t size, const char* spec, int stars, const int* star, T v)
+			{
+				if (stars == 0) return snprintf(out, size, spec, v);
+				if (stars == 1) return snprintf(out, size, spec, star[0], v);
+				return snprintf(out, size, spec, star[0], star[1], v);
+			}
+
+			/* render the record back into text */
+			void decode_record(const async_record_t* rec, char* out, size_t size)
+			{
+				const char* f = (const char*)rec + sizeof(async_record_t);
+				const char* p = f + ((strlen(f) + 1 + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1));
+				const char* lit = f;
+				size_t used = 0;
+				conv_spec_t spec;
+				char fmt[64];
+
+				while (next_spec(f, spec))
+				{
+					/* the literal text before the conversion, with %% */
+					for (; lit < spec.start && used + 1 < size; lit++)
+					{
+						out[used++] = *lit;
+						if (*lit == '%')
+							lit++;
+					}
+					lit = f;
+
+					int star[2] = { 0, 0 };
+					for (int i = 0; i < spec.stars; i++)
+					{
+						uint64 v;
+						memcpy(&v, p, sizeof(v));
+						p += sizeof(v);
+						star[i] = (int)(int64)v;
+					}
+
+					/* the conversion with the length modifier replaced by
+					 the type we stored */
+					size_t head = spec.length - spec.start;
+					if (head > sizeof(fmt) - 5)
+						head = sizeof(fmt) - 5;
+					memcpy(fmt, spec.start, head);
+					char* tailp = fmt + head;
+					int n = 0;
+					size_t room = used < size ? size - used : 0;
+					switch (spec.conv)
+					{
+					case 'd':
+					case 'i':
+					case 'o':
+					case 'u':
+					case 'x':
+					case 'X':
+					{
+						uint64 v;
+						memcpy(&v, p, sizeof(v));
+						p += sizeof(v);
+						*tailp++ = 'l';
+						*tailp++ = 'l';
+						*tailp++ = spec.conv;
+						*tailp = '\0';
+						if (spec.conv == 'd' || spec.conv == 'i')
+							n = format_one(out + used, room, fmt, spec.stars, star, (long long)(int64)v);
+						else
+							n = format_one(out + used, room, fmt, spec.stars, star, (unsigned long long)v);
+						break;
+					}
+					case 'c':
+					{
+						uint64 v;
+						memcpy(&v, p, sizeof(v));
+						p += sizeof(v);
+						*tailp++ = 'c';
+						*tailp = '\0';
+						n = format_one(out + used, room, fmt, spec.stars, star, (int)v);
+						break;
+					}
+					case 'p':
+					{
+						uint64 v;
+						memcpy(&v, p, sizeof(v));
+						p += sizeof(v);
+						*tailp++ = 'p';
+						*tailp = '\0';
+						n = format_one(out + used, room, fmt, spec.stars, star, (void*)(uintptr_t)v);
+						break;
+					}
+					case 's':
+					{
+						uint64 len;
+						memcpy(&len, p, sizeof(len));
+						p += sizeof(len);
+						*tailp++ = 's';
+						*tailp = '\0';
+						n = format_one(out + used, room, fmt, spec.stars, star, p);
+						p += (len + 1 + RECORD_ALIGN - 1) & ~(uint64)(RECORD_ALIGN - 1);
+						break;
+					}
+					default:
+						if (spec.len == LEN_LONG_DOUBLE)
+						{
+							long double v;
+							memcpy(&v, p, sizeof(v));
+							p += (sizeof(v) + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+							*tailp++ = 'L';
+							*tailp++ = spec.conv;
+							*tailp = '\0';
+							n = format_one(out + used, room, fmt, spec.stars, star, v);
+						}
+						else
+						{
+							double v;
+							memcpy(&v, p, sizeof(v));
+							p += sizeof(v);
+							*tailp++ = spec.conv;
+							*tailp = '\0';
+							n = format_one(out + used, room, fmt, spec.stars, star, v);
+						}
+						break;
+					}
+					if (n > 0)
+						used += (size_t)n < room ? (size_t)n : (room > 0 ? room - 1 : 0);
+				}
+				for (; *lit != '\0' && used + 1 < size; lit++)
+				{
+					out[used++] = *lit;
+					if (*lit == '%' && lit[1] == '%')
+						lit++;
+				}
+				out[used < size ? used : size - 1] = '\0';
+			}
+
+			void emit_text(int cpn_priority, int msg_priority, const char* format, ...)
+			{
+				va_list argPtr;
+				va_start(argPtr, format);
+				log_msg_helper(cpn_priority, msg_priority).message_aux(format, argPtr);
+				va_end(argPtr);
+			}
+
+			/* format and write every record queued so far, the caller holds
+			 s_drain_mutex */
+			uint drain_rings()
+			{
+				char text[LOG_BUFSIZ * 2];
+				uint count = 0;
+				for (async_ring_t* ring = s_rings.load(std::memory_order_acquire); ring != NULL; ring = ring->next)
+				{
+					uint64 tail = ring->tail.load(std::memory_order_relaxed);
+					uint64 head = ring->head.load(std::memory_order_acquire);
+					while (tail != head)
+					{
+						const async_record_t* rec = (const async_record_t*)
+							(ring->buf + (tail & (ring->capacity - 1)));
+						uint32 size = rec->size;
+						if (!(rec->flags & RECORD_PAD))
+						{
+							decode_record(rec, text, sizeof(text));
+							emit_text(rec->cpn_priority, rec->msg_priority, "%s", text);
+							count++;
+						}
+						tail += size;
+						/* hand the space back record by record, a blocked
+						 producer can go on */
+						ring->tail.store(tail, std::memory_order_release);
+					}
+				}
+				s_written.fetch_add(count, std::memory_order_relaxed);
+				uint64 dropped = s_dropped.load(std::memory_order_relaxed);
+				if (dropped != s_reported_drops)
+				{
+					emit_text(0, LOG_MSG_WARNING, "async_log_t dropped %llu messages\n",
+						(unsigned long long)(dropped - s_reported_drops));
+					s_reported_drops = dropped;
+				}
+				return count;
+			}
+
+			void log_thread_main()
+			{
+				t_is_log_thread = true;
+				while (!s_stopping.load(std::memory_order_acquire))
+				{
+					uint count;
+					{
+						std::lock_guard<std::mutex> lock(s_drain_mutex);
+						count = drain_rings();
+					}
+					if (count == 0)
+					{
+						std::unique_lock<std::mutex> lock(s_wake_mutex);
+						s_wake.wait_for(lock, std::chrono::milliseconds(2));
+					}
+				}
+			}
+
+#if !defined( _WIN32 ) && !defined( PLAYSTATION3 )
+			const int s_crash_signals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+
+			/* buffered write(2) to stderr, all the crash handler writes with */
+			struct raw_writer_t
+			{
+				char buf[512];
+				size_t used;
+				raw_writer_t() : used(0) {}
+				void flush()
+				{
+					const char* p = buf;
+					while (used > 0)
+					{
+						ssize_t n = write(STDERR_FILENO, p, used);
+						if (n <= 0)
+							break;
+						p += n;
+						used -= (size_t)n;
+					}
+					used = 0;
+				}
+				void put(const char* str, size_t n)
+				{
+					for (size_t i = 0; i < n; i++)
+					{
+						if (used == sizeof(buf))
+							flush();
+						buf[used++] = str[i];
+					}
+				}
+				void put_uint(uint64 v, uint base, bool upper)
+				{
+					const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+					char text[24];
+					size_t n = 0;
+					do
+					{
+						text[n++] = digits[v % base];
+						v /= base;
+					} while (v != 0);
+					while (n > 0)
+						put(&text[--n], 1);
+				}
+			};
+
+			/* decode_record() without snprintf for the crash handler. strings
+			 and integers are rendered, floats are written as their conversion,
+			 width and precision are ignored. stops at whatever does not fit
+			 the record, it may have been overwritten under us */
+			void write_record_raw(const async_record_t* rec, raw_writer_t& out)
+			{
+				const char* end = (const char*)rec + rec->size;
+				const char* f = (const char*)rec + sizeof(async_record_t);
+				size_t flen = strnlen(f, end - f);
+				if (f + flen == end)
+					return;
+				const char* p = f + ((flen + 1 + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1));
+				const char* lit = f;
+				conv_spec_t spec;
+				while (next_spec(f, spec))
+				{
+					for (; lit < spec.start; lit++)
+					{
+						out.put(lit, 1);
+						if (*lit == '%')
+							lit++;
+					}
+					lit = f;
+
+					p += spec.stars * sizeof(uint64);
+					size_t arg = spec.conv == 's' || spec.len != LEN_LONG_DOUBLE ? sizeof(uint64) :
+						(sizeof(long double) + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+					if (p + arg > end)
+						return;
+					uint64 v;
+					memcpy(&v, p, sizeof(v));
+					p += arg;
+					switch (spec.conv)
+					{
+					case 'd':
+					case 'i':
+						if ((int64)v < 0)
+						{
+							out.put("-", 1);
+							v = 0 - v;
+						}
+						out.put_uint(v, 10, false);
+						break;
+					case 'u': out.put_uint(v, 10, false); break;
+					case 'o': out.put_uint(v, 8, false); break;
+					case 'x': out.put_uint(v, 16, false); break;
+					case 'X': out.put_uint(v, 16, true); break;
+					case 'p':
+						out.put("0x", 2);
+						out.put_uint(v, 16, false);
+						break;
+					case 'c':
+					{
+						char c = (char)v;
+						out.put(&c, 1);
+						break;
+					}
+					case 's':
+						if (v >= (uint64)(end - p))
+							return;
+						out.put(p, (size_t)v);
+						p += (v + 1 + RECORD_ALIGN - 1) & ~(uint64)(RECORD_ALIGN - 1);
+						break;
+					default:
+						out.put(spec.start, f - spec.start);
+						break;
+					}
+				}
+				for (; *lit != '\0'; lit++)
+				{
+					out.put(lit, 1);
+					if (*lit == '%' && lit[1] == '%')
+						lit++;
+				}
+			}
+
+			void crash_flush_handler(int signo)
+			{
+				/* only write(2) in here, no locks: the log thread may hold
+				 s_drain_mutex or be the thread that crashed. records it was
+				 draining when interrupted may come out twice */
+				raw_writer_t out;
+				bool any = false;
+				for (async_ring_t* ring = s_rings.load(std::memory_order_acquire); ring != NULL; ring = ring->next)
+				{
+					uint64 tail = ring->tail.load(std::memory_order_acquire);
+					uint64 head = ring->head.load(std::memory_order_acquire);
+					while (tail != head)
+					{
+						const async_record_t* rec = (const async_record_t*)
+							(ring->buf + (tail & (ring->capacity - 1)));
+						uint32 size = rec->size;
+						if (size < sizeof(async_record_t) || size > head - tail || size % RECORD_ALIGN != 0)
+							break;
+						if (!(rec->flags & RECORD_PAD))
+						{
+							if (!any)
+							{
+								const char title[] = "async_log_t: messages queued at the crash\n";
+								out.put(title, sizeof(title) - 1);
+								any = true;
+							}
+							write_record_raw(rec, out);
+						}
+						tail += size;
+					}
+				}
+				out.flush();
+				/* SA_RESETHAND put the default action back */
+				raise(signo);
+			}
+#endif
+		}
+
+		bool async_log_t::start(uint ring_bytes, overflow_policy_t policy)
+		{
+			std::lock_guard<std::mutex> lock(s_drain_mutex);
+			if (s_started.load(std::memory_order_relaxed))
+				return false;
+			uint64 bytes = 4096;
+			while (bytes < ring_bytes)
+				bytes <<= 1;
+			s_ring_bytes = bytes;
+			/* the rings of exited threads are empty after the last stop(),
+			 take them over and give them the new size */
+			for (async_ring_t* ring = s_rings.load(std::memory_order_acquire); ring != NULL; ring = ring->next)
+			{
+				bool owned = false;
+				if (ring->capacity == bytes || ring->owned.load(std::memory_order_relaxed) ||
+					!ring->owned.compare_exchange_strong(owned, true, std::memory_order_acquire))
+					continue;
+				if (ring->head.load(std::memory_order_relaxed) == ring->tail.load(std::memory_order_relaxed))
+				{
+					free(ring->buf);
+					ring->head.store(0, std::memory_order_relaxed);
+					ring->tail.store(0, std::memory_order_relaxed);
+					ring->capacity = bytes;
+					ring->buf = (char*)malloc(ring->capacity);
+					memset(ring->buf, 0, ring->capacity);
+				}
+				ring->owned.store(false, std::memory_order_release);
+			}
+			s_policy.store(policy, std::memory_order_relaxed);
+			s_dropped.store(0, std::memory_order_relaxed);
+			s_written.store(0, std::memory_order_relaxed);
+			s_reported_drops = 0;
+			s_stopping.store(false, std::memory_order_relaxed);
+			s_log_thread = new std::thread(log_thread_main);
+			s_started.store(true, std::memory_order_release);
+
+			static bool registered = (atexit(async_log_t::stop), true);
+			(void)registered;
+			return true;
+		}
+
+		void async_log_t::stop()
+		{
+			if (!s_started.load(std::memory_order_acquire))
+				return;
+			/* new messages go synchronous from here. a producer that saw
+			 s_started before the store may still be writing its record,
+			 wait for it, then for the log thread, and finally drain what
+			 is left */
+			s_started.store(false, std::memory_order_seq_cst);
+			for (async_ring_t* ring = s_rings.load(std::memory_order_seq_cst); ring != NULL; ring = ring->next)
+			{
+				while (ring->pushing.load(std::memory_order_seq_cst))
+					std::this_thread::yield();
+			}
+			s_stopping.store(true, std::memory_order_release);
+			s_wake.notify_one();
+			if (s_log_thread != NULL)
+			{
+				s_log_thread->join();
+				delete s_log_thread;
+				s_log_thread = NULL;
+			}
+			flush();
+		}
+
+		bool async_log_t::started()
+		{
+			return s_started.load(std::memory_order_acquire);
+		}
+
+		void async_log_t::set_overflow_policy(overflow_policy_t policy)
+		{
+			s_policy.store(policy, std::memory_order_relaxed);
+		}
+
+		void async_log_t::flush()
+		{
+			/* the log thread only gets here from a callback, while draining */
+			if (t_is_log_thread || s_rings.load(std::memory_order_acquire) == NULL)
+				return;
+			std::lock_guard<std::mutex> lock(s_drain_mutex);
+			drain_rings();
+		}
+
+		bool async_log_t::install_crash_flush()
+		{
+#if !defined( _WIN32 ) && !defined( PLAYSTATION3 )
+			for (size_t i = 0; i < sizeof(s_crash_signals) / sizeof(s_crash_signals[0]); i++)
+			{
+				struct sigaction sa;
+				memset(&sa, 0, sizeof(sa));
+				sa.sa_handler = crash_flush_handler;
+				sigemptyset(&sa.sa_mask);
+				sa.sa_flags = SA_RESETHAND;
+				if (sigaction(s_crash_signals[i], &sa, NULL) != 0)
+					return false;
+			}
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		uint64 async_log_t::dropped()
+		{
+			return s_dropped.load(std::memory_order_relaxed);
+		}
+
+		uint64 async_log_t::written()
+		{
+			return s_written.load(std::memory_order_relaxed);
+		}
+
+		bool async_log_t::push(int cpn_priority, int msg_priority, const char * format,
+			va_list argPtr)
+		{
+			if (!s_started.load(std::memory_order_relaxed) || msg_priority == LOG_MSG_CRITICAL ||
+				t_is_log_thread)
+				return false;
+
+			/* mark the ring before looking at s_started again, stop()
+			 clears s_started and then waits for the marks to go */
+			async_ring_t* ring = get_thread_ring();
+			async_push_scope_t scope(ring);
+			if (!s_started.load(std::memory_order_seq_cst))
+				return false;
+
+			/* build the record on the stack, it is copied into the ring in
+			 one go once its size is known */
+			char scratch[LOG_BUFSIZ];
+			async_record_t* rec = (async_record_t*)scratch;
+			rec->cpn_priority = (int16)cpn_priority;
+			rec->msg_priority = (uint8)msg_priority;
+			rec->flags = 0;
+			record_writer_t w;
+			w.p = scratch + sizeof(async_record_t);
+			w.end = scratch + sizeof(scratch);
+			va_list args;
+			geco_va_copy(args, argPtr);
+			bool ok = encode_args(w, format, args);
+			va_end(args);
+			if (!ok)
+				return false;
+			uint32 size = (uint32)(w.p - scratch);
+			size = (size + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+			rec->size = size;
+
+			if (size > ring->capacity / 2)
+				return false;
+			uint64 head = ring->head.load(std::memory_order_relaxed);
+			uint64 pos, contiguous;
+			for (;;)
+			{
+				uint64 tail = ring->tail.load(std::memory_order_acquire);
+				pos = head & (ring->capacity - 1);
+				contiguous = ring->capacity - pos;
+				uint64 need = contiguous < size ? contiguous + size : size;
+				if (ring->capacity - (head - tail) >= need)
+					break;
+				/* stop() is waiting for us, log it synchronously */
+				if (!s_started.load(std::memory_order_relaxed))
+					return false;
+				if (s_policy.load(std::memory_order_relaxed) == OVERFLOW_DROP)
+				{
+					s_dropped.fetch_add(1, std::memory_order_relaxed);
+					return true;
+				}
+				s_wake.notify_one();
+				std::this_thread::yield();
+			}
+			if (contiguous < size)
+			{
+				/* pad to the end of the buffer and start over at 0 */
+				async_record_t* pad = (async_record_t*)(ring->buf + pos);
+				pad->size = (uint32)contiguous;
+				pad->flags = RECORD_PAD;
+				head += contiguous;
+				pos = 0;
+			}
+			memcpy(ring->buf + pos, scratch, size);
+			ring->head.store(head + size, std::memory_order_release);
+			return true;
 		}
 	}
 }
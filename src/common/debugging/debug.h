@@ -366,6 +366,9 @@ struct log_msg_helper
 	//criticalMessageHelper
 	void critical_msg_aux(bool isDevAssertion, const char * format,
 			va_list argPtr);
+	/// syslog, callbacks and console output of an accepted message, what
+	/// message() does synchronously and the async_log_t thread does later
+	void message_aux(const char * format, va_list argPtr);
 
 	static void fini()
 	{
@@ -376,6 +379,65 @@ struct log_msg_helper
 	}
 };
 
+//-------------------------------------------------------
+//	Section: async_log_t
+//-------------------------------------------------------
+
+/**
+ *  @brief
+ *  asynchronous back end of log_msg_helper::message(). while started, the
+ *  calling thread only walks the format string and copies it and the raw
+ *  arguments (strings by value) into a lock-free ring of its own. a
+ *  background thread formats the records and feeds them to the debug
+ *  callbacks and the console as message() would, except that the callbacks
+ *  run on the log thread and get the formatted text as a "%s" format and
+ *  its one argument.
+ *
+ *  CRITICAL messages, messages logged by the log thread itself and formats
+ *  with %n, %ls or %lc are still handled synchronously. critical_msg_aux()
+ *  flushes the rings first so a crash report follows what led to it.
+ *
+ *  async_log_t::start(64 * 1024, async_log_t::OVERFLOW_DROP);
+ *  async_log_t::install_crash_flush();
+ */
+struct async_log_t
+{
+	enum overflow_policy_t
+	{
+		OVERFLOW_DROP, /* count the message in dropped() and go on */
+		OVERFLOW_BLOCK /* wait for the log thread to make room */
+	};
+
+	/// start the log thread. @ring_bytes is the ring size of each logging
+	/// thread, rounded up to a power of 2. a thread that logged since an
+	/// earlier start() keeps the ring size it got then. stop() is registered
+	/// with atexit.
+	static bool start(uint ring_bytes = 64 * 1024,
+			overflow_policy_t policy = OVERFLOW_DROP);
+	/// drain every ring and join the log thread, logging is synchronous again
+	static void stop();
+	static bool started();
+	static void set_overflow_policy(overflow_policy_t policy);
+
+	/// format and write everything queued so far, from the calling thread
+	static void flush();
+	/// on SIGSEGV, SIGBUS, SIGFPE, SIGILL and SIGABRT write what is still
+	/// queued straight to stderr, then re-raise with the default action. the
+	/// handler only calls write(2), so strings and integers are rendered but
+	/// floats are written as their conversion and width and precision are
+	/// ignored. no-op on windows.
+	static bool install_crash_flush();
+
+	/// messages lost to OVERFLOW_DROP since start()
+	static uint64 dropped();
+	/// messages written by the log thread or flush() since start()
+	static uint64 written();
+
+	/// @return false if the message must be logged synchronously
+	static bool push(int cpn_priority, int msg_priority, const char * format,
+			va_list argPtr);
+};
+
 /* This class is used to query if the current thread is the main thread.*/
 struct main_thread_tracker_t
 {
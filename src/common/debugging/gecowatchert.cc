@@ -70,10 +70,45 @@ bool watcher_value_query_t::add_watcher_path(const void *base, const char *path,
 	return true;
 }
 
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  - - - - - - - - - - - -
+// 　　　　　　　　　　　　Section: watcher_batch_query_t impls
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  - - - - - - - - - - - -
+uint watcher_batch_query_t::compile()
+{
+	geco_watcher_base_t& root = root_ != NULL ? *root_ : geco_watcher_base_t::get_root_watcher();
+	uint resolved = 0;
+	handles_.resize(paths_.size());
+	for (uint i = 0; i < paths_.size(); i++)
+	{
+		handle_t& handle = handles_[i];
+		handle.base = NULL;
+		handle.watcher = root.resolve(NULL, paths_[i].c_str(), handle.base);
+		if (handle.watcher != NULL) resolved++;
+	}
+	version_ = geco_watcher_base_t::tree_version();
+	compiled_ = true;
+	return resolved;
+}
+void watcher_batch_query_t::snapshot(geco_bit_stream_t& result)
+{
+	if (!compiled_ || version_ != geco_watcher_base_t::tree_version()) this->compile();
+
+	result.Write((uint)handles_.size());
+	for (auto iter = handles_.begin(); iter != handles_.end(); ++iter)
+	{
+		if (iter->watcher == NULL || !iter->watcher->write_to_stream(iter->base, result))
+		{
+			result.Write((ushort)WVT_UNKNOWN);
+			result.Write((ushort)WT_INVALID);
+		}
+	}
+}
+
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  - - - - - - - - - - - -
 // 　　　　　　　　　　　                       geco_watcher_t impls
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  - - - - - - - - - - - -
 static geco_watcher_base_t* root_watcher_gptr = NULL;
+uint geco_watcher_base_t::tree_version_ = 0;
 geco_watcher_base_t & geco_watcher_base_t::get_root_watcher()
 {
     if (root_watcher_gptr == NULL)
@@ -82,12 +117,13 @@ geco_watcher_base_t & geco_watcher_base_t::get_root_watcher()
     }
     return *root_watcher_gptr;
 }
-void destroy_root_watcher()
+void geco_watcher_base_t::destroy_root_watcher()
 {
     if (root_watcher_gptr != NULL)
     {
         delete root_watcher_gptr;
         root_watcher_gptr = NULL;
+        tree_version_++;
     }
 }
 void geco_watcher_base_t::partition_path(const std::string path, std::string & name,
@@ -109,6 +145,180 @@ void geco_watcher_base_t::partition_path(const std::string path, std::string & n
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  - - - - - - - - - - - -
 // 　　　　　　　　　　　　 Section: geco_watcher_director_t
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  - - - - - - - - - - - -
+/// whole paths looked up through a director, direct mapped on the path hash
+struct geco_watcher_director_t::path_cache_t
+{
+    static const uint SLOTS = 1024;
+    struct entry_t
+    {
+        entry_t() : valid(false)
+        {
+        }
+        bool valid;
+        uint hash;
+        /// tree_version() when this entry was resolved
+        uint version;
+        std::string path;
+        watcher_directory_t* child;
+        uintptr offset;
+        /// position of the tail in path, -1 for no tail
+        int tail;
+    };
+    entry_t entries[SLOTS];
+};
+
+const watcher_label_t* watcher_intern_label(const char * name, uint len)
+{
+    // function statics, labels are interned while static watchers register
+    static std::vector<watcher_label_t*> slots(256, (watcher_label_t*)NULL);
+    static uint count = 0;
+
+    uint hash = 2166136261u;
+    for (uint i = 0; i < len; i++)
+        hash = (hash ^ (uchar) name[i]) * 16777619u;
+
+    uint mask = slots.size() - 1;
+    uint i = hash & mask;
+    for (; slots[i] != NULL; i = (i + 1) & mask)
+    {
+        watcher_label_t* label = slots[i];
+        if (label->hash == hash && label->len == len && memcmp(label->name, name, len) == 0)
+            return label;
+    }
+
+    char* copy = new char[len + 1];
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+    watcher_label_t* label = new watcher_label_t;
+    label->name = copy;
+    label->len = len;
+    label->hash = hash;
+    slots[i] = label;
+
+    if (++count * 2 > slots.size())
+    {
+        std::vector<watcher_label_t*> old(slots.size() * 2, (watcher_label_t*)NULL);
+        old.swap(slots);
+        mask = slots.size() - 1;
+        for (auto iter = old.begin(); iter != old.end(); ++iter)
+        {
+            if (*iter == NULL) continue;
+            uint j = (*iter)->hash & mask;
+            while (slots[j] != NULL) j = (j + 1) & mask;
+            slots[j] = *iter;
+        }
+    }
+    return label;
+}
+
+geco_watcher_director_t::geco_watcher_director_t() :
+        path_cache_(NULL)
+{
+}
+geco_watcher_director_t::~geco_watcher_director_t()
+{
+    delete path_cache_;
+}
+void geco_watcher_director_t::rebuild_index()
+{
+    uint size = 8;
+    while (size < container_.size() * 2) size <<= 1;
+    index_.assign(size, 0);
+    for (uint pos = 0; pos < container_.size(); pos++)
+    {
+        uint i = container_[pos].key->hash & (size - 1);
+        while (index_[i] != 0) i = (i + 1) & (size - 1);
+        index_[i] = pos + 1;
+    }
+}
+watcher_directory_t* geco_watcher_director_t::find_child(const char * name, uint len,
+        uint hash) const
+{
+    if (index_.empty()) return NULL;
+    uint mask = index_.size() - 1;
+    for (uint i = hash & mask;; i = (i + 1) & mask)
+    {
+        uint pos = index_[i];
+        if (pos == 0) return NULL;
+        const watcher_directory_t& child = container_[pos - 1];
+        if (child.key->hash == hash && child.key->len == len
+                && memcmp(child.key->name, name, len) == 0)
+            return (watcher_directory_t*) &child;
+    }
+}
+watcher_directory_t* geco_watcher_director_t::descend(const char * path, uintptr & offset,
+        const char *& tail) const
+{
+    const geco_watcher_director_t* dir = this;
+    watcher_directory_t* found = NULL;
+    const char* identifier = path;
+    offset = 0;
+    tail = NULL;
+    while (true)
+    {
+        uint hash;
+        uint len = watcher_path_segment(identifier, hash);
+        watcher_directory_t* pChild = len == 0 ? NULL : dir->find_child(identifier, len, hash);
+        if (pChild == NULL)
+        {
+            // the last directory found gets the rest, eg. "__doc__"
+            tail = identifier;
+            break;
+        }
+        found = pChild;
+        offset += (uintptr) pChild->base;
+        if (identifier[len] == '\0')
+        {
+            tail = NULL;
+            break;
+        }
+        identifier += len + 1;
+        if (!pChild->is_director)
+        {
+            tail = identifier;
+            break;
+        }
+        dir = (const geco_watcher_director_t*) pChild->watcher;
+    }
+    return found;
+}
+watcher_directory_t* geco_watcher_director_t::find_path(const char * path, const void *& base,
+        const char *& tail)
+{
+    if (path == NULL) return NULL;
+    uint hash;
+    uint len = watcher_path_segment(path, hash);
+    if (path[len] == '\0')
+    {
+        // a single identifier, one probe is as cheap as the cache
+        tail = NULL;
+        watcher_directory_t* pChild = len == 0 ? NULL : this->find_child(path, len, hash);
+        if (pChild != NULL) base = (const void*) (((uintptr) base) + ((uintptr) pChild->base));
+        return pChild;
+    }
+
+    const char* end = path + len;
+    for (; *end != '\0'; ++end)
+        hash = (hash ^ (uchar) *end) * 16777619u;
+    uint pathlen = end - path;
+
+    if (path_cache_ == NULL) path_cache_ = new path_cache_t;
+    path_cache_t::entry_t& entry = path_cache_->entries[hash & (path_cache_t::SLOTS - 1)];
+    if (!entry.valid || entry.version != tree_version_ || entry.hash != hash
+            || entry.path.size() != pathlen || memcmp(entry.path.data(), path, pathlen) != 0)
+    {
+        const char* found_tail;
+        entry.child = this->descend(path, entry.offset, found_tail);
+        entry.tail = found_tail == NULL ? -1 : int(found_tail - path);
+        entry.path.assign(path, pathlen);
+        entry.hash = hash;
+        entry.version = tree_version_;
+        entry.valid = true;
+    }
+    tail = entry.tail < 0 ? NULL : path + entry.tail;
+    if (entry.child != NULL) base = (const void*) (((uintptr) base) + entry.offset);
+    return entry.child;
+}
 bool geco_watcher_director_t::add_watcher(const char * path, geco_watcher_base_t& pChild,
         void * withBase)
 {
@@ -127,9 +337,13 @@ bool geco_watcher_director_t::add_watcher(const char * path, geco_watcher_base_t
             newdir.watcher = &pChild;
             newdir.base = withBase;
             newdir.label = path;
+            newdir.key = watcher_intern_label(path, newdir.label.size());
+            newdir.is_director = dynamic_cast<geco_watcher_director_t*>(&pChild) != NULL;
             auto iter = container_.begin();
             while (iter != container_.end() && (iter->label < newdir.label)) ++iter;
             container_.insert(iter, newdir);
+            this->rebuild_index();
+            tree_version_++;
             was_added = true;
             //VERBOSE_MSG("append watcher %s, container size %d!\n\n", newdir.label.c_str(), (int)container_.size());
         }
@@ -150,9 +364,13 @@ bool geco_watcher_director_t::add_watcher(const char * path, geco_watcher_base_t
             newdir.watcher = newwatcher;
             newdir.base = NULL;
             newdir.label = std::string(path, cmp_len);
+            newdir.key = watcher_intern_label(path, cmp_len);
+            newdir.is_director = true;
             auto iter = container_.begin();
             while (iter != container_.end() && (iter->label < newdir.label)) ++iter;
             pFound = &(*(container_.insert(iter, newdir)));
+            this->rebuild_index();
+            tree_version_++;
             //VERBOSE_MSG(" create new dir (%s),container size %d\n", newdir.label.c_str(), (int)container_.size());
         }
         // recusice call add_watcher, this will create new watcher dir if needed
@@ -167,39 +385,28 @@ bool geco_watcher_director_t::add_watcher(const char * path, geco_watcher_base_t
 bool geco_watcher_director_t::remove_watcher(const char * path)
 {
     if (path == NULL) return false;
-    char* pseparator = strchr((char*) path, WATCHER_PATH_SEPARATOR);
-    uint cmp_len = (pseparator == NULL) ? strlen(path) : (pseparator - path);
-    if (cmp_len > 0)
+    uint hash;
+    uint cmp_len = watcher_path_segment(path, hash);
+    watcher_directory_t* pChild = cmp_len == 0 ? NULL : this->find_child(path, cmp_len, hash);
+    if (pChild == NULL) return false;
+    if (path[cmp_len] != '\0')
     {
-        auto iter = container_.begin();
-        while (iter != container_.end())
-        {
-            if (cmp_len == (*iter).label.length()
-                    && strncmp(path, (*iter).label.c_str(), cmp_len) == 0)
-            {
-                if (pseparator == NULL)
-                {
-                    container_.erase(iter);
-                    // VERBOSE_MSG(" delete watcher (%s) sucesseds\n",(*iter).label.c_str());
-                    return true;
-                }
-                else
-                {
-                    return iter->watcher->remove_watcher(get_path_tail(path));
-                }
-            }
-            ++iter;
-        }
+        return pChild->watcher->remove_watcher(path + cmp_len + 1);
     }
-    return false;
+    container_.erase(container_.begin() + (pChild - &container_[0]));
+    this->rebuild_index();
+    tree_version_++;
+    // VERBOSE_MSG(" delete watcher (%s) sucesseds\n",path);
+    return true;
 }
 int geco_watcher_director_t::set_from_string(void * base, const char * path, const char * valueStr)
 {
-    watcher_directory_t* pChild = this->find_child(path);
+    const void * addedBase = base;
+    const char * tail;
+    watcher_directory_t* pChild = this->find_path(path, addedBase, tail);
     if (pChild != NULL)
     {
-        void * addedBase = (void*) (((uintptr) base) + ((uintptr) pChild->base));
-        return pChild->watcher->set_from_string(addedBase, get_path_tail(path), valueStr);
+        return pChild->watcher->set_from_string((void*) addedBase, tail, valueStr);
     }
     else
     {
@@ -209,11 +416,12 @@ int geco_watcher_director_t::set_from_string(void * base, const char * path, con
 int geco_watcher_director_t::set_from_stream(void * base, const char * path,
         watcher_value_query_t& pathRequest)
 {
-    watcher_directory_t* pChild = this->find_child(path);
+    const void * addedBase = base;
+    const char * tail;
+    watcher_directory_t* pChild = this->find_path(path, addedBase, tail);
     if (pChild != NULL)
     {
-        void * addedBase = (void*) (((uintptr) base) + ((uintptr) pChild->base));
-        return pChild->watcher->set_from_stream(addedBase, get_path_tail(path), pathRequest);
+        return pChild->watcher->set_from_stream((void*) addedBase, tail, pathRequest);
     }
     else
     {
@@ -232,12 +440,12 @@ int geco_watcher_director_t::get_as_string(const void * base, const char * path,
     }
     else
     {
-        watcher_directory_t* pChild = this->find_child(path);
+        const void * addedBase = base;
+        const char * tail;
+        watcher_directory_t* pChild = this->find_path(path, addedBase, tail);
         if (pChild != NULL)
         {
-            void * addedBase = (void*) (((uintptr) base) + ((uintptr) pChild->base));
-            return pChild->watcher->get_as_string(addedBase, get_path_tail(path), result, desc,
-                    mode);
+            return pChild->watcher->get_as_string(addedBase, tail, result, desc, mode);
         }
         else
         {
@@ -279,11 +487,12 @@ int geco_watcher_director_t::get_as_stream(const void * base, const char * path,
     }
     else
     {
-        watcher_directory_t* pChild = this->find_child(path);
+        const void * addedBase = base;
+        const char * tail;
+        watcher_directory_t* pChild = this->find_path(path, addedBase, tail);
         if (pChild != NULL)
         {
-            void * addedBase = (void*) (((uintptr) base) + ((uintptr) pChild->base));
-            return pChild->watcher->get_as_stream(addedBase, get_path_tail(path), pathRequest);
+            return pChild->watcher->get_as_stream(addedBase, tail, pathRequest);
         }
         else
         {
@@ -313,16 +522,30 @@ bool geco_watcher_director_t::visit_children(const void * base, const char *path
     }
     else
     {
-        watcher_directory_t* pChild = this->find_child(path);
+        const void * addedBase = base;
+        const char * tail;
+        watcher_directory_t* pChild = this->find_path(path, addedBase, tail);
         if (pChild != NULL)
         {
-            const void * addedBase = (const void*) (((const uintptr) base)
-                    + ((const uintptr) pChild->base));
-            handled = pChild->watcher->visit_children(addedBase, get_path_tail(path), pathRequest);
+            handled = pChild->watcher->visit_children(addedBase, tail, pathRequest);
         }
     }
     return handled;
 }
+geco_watcher_base_t* geco_watcher_director_t::resolve(const void * base, const char * path,
+        const void *& resolved_base)
+{
+    if (is_empty_path(path))
+    {
+        resolved_base = base;
+        return this;
+    }
+    const void * addedBase = base;
+    const char * tail;
+    watcher_directory_t* pChild = this->find_path(path, addedBase, tail);
+    if (pChild == NULL) return NULL;
+    return pChild->watcher->resolve(addedBase, tail, resolved_base);
+}
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  - - - - - - - - - - - -
 // 　　　　　　　　　　　　　　　　　　　　　　　　　Section: Helper functions
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -  - - - - - - - - - - - -
@@ -258,6 +258,78 @@ struct watcher_value_query_t
 	}
 };
 
+/**
+ * watcher_batch_query_t reads a fixed set of watcher paths in one go, eg. the
+ * paths a monitoring tool scrapes every second.
+ * watcher_value_query_t walks the directory tree and calls back once per path
+ * and per request, this class walks the tree once in compile() and keeps the
+ * resolved watcher and base of every path. snapshot() then only runs the
+ * getters and encodes all values into one stream.
+ *
+ * stream layout of snapshot():
+ *  [count : uint]
+ *  count times [type : WatcherValueType][mode : WatcherMode][value]
+ *  in the order the paths were added. a path that does not resolve to a value
+ *  watcher is written as [WVT_UNKNOWN][WT_INVALID] without value.
+ *
+ * the handles are resolved again by the next snapshot() whenever a watcher
+ * was added or removed since, see geco_watcher_base_t::tree_version().
+ */
+struct watcher_batch_query_t
+{
+	struct handle_t
+	{
+		geco_watcher_base_t* watcher;
+		const void* base;
+	};
+
+	/// @param root the directory paths are relative to, NULL for the root watcher
+	explicit watcher_batch_query_t(geco_watcher_base_t* root = NULL) :
+		root_(root), version_(0), compiled_(false)
+	{
+	}
+	/// @return index of @path in the snapshot
+	uint add_path(const char* path)
+	{
+		paths_.push_back(path);
+		compiled_ = false;
+		return paths_.size() - 1;
+	}
+	void clear()
+	{
+		paths_.clear();
+		handles_.clear();
+		compiled_ = false;
+	}
+	/// @brief resolve every path against the current tree
+	/// @return number of paths that resolved to a watcher
+	uint compile();
+	/// @brief write the values of all paths to @result, see the layout above
+	void snapshot(geco_bit_stream_t& result);
+
+	uint size() const
+	{
+		return paths_.size();
+	}
+	const std::string& get_path(uint index) const
+	{
+		return paths_[index];
+	}
+	/// valid after compile() or snapshot()
+	bool resolved(uint index) const
+	{
+		return index < handles_.size() && handles_[index].watcher != NULL;
+	}
+
+private:
+	geco_watcher_base_t* root_;
+	std::vector<std::string> paths_;
+	std::vector<handle_t> handles_;
+	/// tree_version() when handles_ were resolved
+	uint version_;
+	bool compiled_;
+};
+
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 // Section Starts: string and watcher value : protocol v1
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -575,6 +647,34 @@ public:
 		return true;
 	}
 
+	/**
+	 *  @brief This method finds the watcher associated with the input path
+	 *  without reading it, so that the lookup can be cached by
+	 *  watcher_batch_query_t. The path is relative to this watcher.
+	 *  @param base     This is a pointer used by a number of Watchers. It is
+	 *                  used as an offset into a struct or container.
+	 *  @param path     The path string used to find the desired watcher.
+	 *  @param[out] resolved_base  The base to pass to the returned watcher.
+	 *  @return The watcher or NULL if the path is wrong. Watchers whose
+	 *  children depend on the watched value (sequences) are not resolved.
+	 */
+	virtual geco_watcher_base_t* resolve(const void * base, const char * path,
+		const void *& resolved_base)
+	{
+		if (!is_empty_path(path)) return NULL;
+		resolved_base = base;
+		return this;
+	}
+	/**
+	 *  @brief This method writes [type][mode][value] of this watcher to @result,
+	 *  the same encoding get_as_stream() uses, without notifying anybody.
+	 *  @return True if a value was written, false for watchers without value.
+	 */
+	virtual bool write_to_stream(const void * base, geco_bit_stream_t & result)
+	{
+		return false;
+	}
+
 	virtual void walk_all_files(std::string& path, std::string& buf, int& num, bool print)
 	{
 		num++;
@@ -601,6 +701,18 @@ public:
 	 *  @example  "section1/section/hello" would be split  into "hello" and "section1/section2/".
 	 */
 	static void partition_path(const std::string path, std::string & name, std::string & dir);
+	/**
+	 *  This method returns a counter bumped whenever a watcher is added to or
+	 *  removed from a directory watcher. Cached lookups made at another
+	 *  version may point to freed watchers and must be resolved again.
+	 */
+	static uint tree_version()
+	{
+		return tree_version_;
+	}
+
+protected:
+	static uint tree_version_;
 
 protected:
 	/**
@@ -634,11 +746,49 @@ inline const char * get_path_tail(const char * path)
 	return pSeparator + 1;
 }
 
+/**
+ *  An interned directory label. Every label string is stored once and shared
+ *  by all directories that have a child of that name, eg. the "count" of
+ *  every profile, and its hash is computed once when it is interned.
+ *  Labels are never freed.
+ */
+struct watcher_label_t
+{
+	const char* name;
+	uint len;
+	uint hash;
+};
+/// @return the unique label of the @len chars at @name, created on first use
+const watcher_label_t* watcher_intern_label(const char * name, uint len);
+
+/**
+ *  used to scan the first identifier of a path in one pass.
+ *  @param path     The path to scan, not NULL.
+ *  @param[out] hash  FNV-1a hash of the identifier, the same as the hash of
+ *                  the interned label of that name.
+ *  @return length of the identifier, up to the first separator.
+ */
+inline uint watcher_path_segment(const char * path, uint & hash)
+{
+	uint h = 2166136261u;
+	const char* p = path;
+	for (; *p != '\0' && *p != WATCHER_PATH_SEPARATOR; ++p)
+		h = (h ^ (uchar)*p) * 16777619u;
+	hash = h;
+	return (uint)(p - path);
+}
+
 /**
  *  This class implements a Watcher that can contain other Watchers.
  *  It is used by the watcher module to implement the tree of watchers.
  *  To find a watcher associated with a given path,
  *   you traverse this tree in a way similar to traversing a directory structure.
+ *
+ *  Children are kept sorted by label for visit_children() and indexed by an
+ *  open addressing hash on their interned labels, so finding one child is a
+ *  probe instead of a scan. Whole paths are resolved iteratively through the
+ *  sub directories and the result is cached per path until the tree changes,
+ *  so a repeated lookup of the same path is one hash and one compare.
  *  @see WatcherModule
  *  @ingroup WatcherModule
  */
@@ -647,14 +797,30 @@ struct watcher_directory_t
 	geco_watcher_base_t* watcher;
 	void * base;
 	std::string label;
+	const watcher_label_t* key;
+	/// watcher is a geco_watcher_director_t, paths are resolved through it
+	bool is_director;
 };
 class geco_watcher_director_t : public geco_watcher_base_t
 {
 private:
 	typedef std::vector<watcher_directory_t> Container;
 	Container container_;
+	/// open addressing index over container_, a slot holds position + 1
+	/// and 0 marks an empty slot. rebuilt whenever container_ changes.
+	std::vector<uint> index_;
+	struct path_cache_t;
+	/// created on the first lookup of a path with more than one identifier
+	path_cache_t* path_cache_;
+
+	void rebuild_index();
+	watcher_directory_t* descend(const char * path, uintptr & offset,
+		const char *& tail) const;
 
 public:
+	geco_watcher_director_t();
+	virtual ~geco_watcher_director_t();
+
 	/**
 	 *  @brief
 	 *  This method finds the immediate child of this directory matching the first identifier in the path string.
@@ -667,30 +833,23 @@ public:
 	watcher_directory_t* find_child(const char * path) const
 	{
 		if (path == NULL) return NULL;
-		char* pseparator = strchr((char*)path, WATCHER_PATH_SEPARATOR);
-		uint cmp_len = (pseparator == NULL) ? strlen(path) : (pseparator - path);
-
-		//    char* label = new char[cmp_len + 1];
-		//    label[cmp_len] = '\0';
-		//    memcpy(label, path, cmp_len);
-		//    VERBOSE_MSG("search for  child label %s\n", label);
-
-		watcher_directory_t* ptr = NULL;
-		if (cmp_len != 0)
-		{
-			auto iter = container_.begin();
-			while (iter != container_.end() && ptr == NULL)
-			{
-				if (cmp_len == (*iter).label.length()
-					&& strncmp(path, (*iter).label.c_str(), cmp_len) == 0)
-				{
-					ptr = (watcher_directory_t*)(&(*iter));
-				}
-				++iter;
-			}
-		}
-		return ptr;
+		uint hash;
+		uint len = watcher_path_segment(path, hash);
+		return len == 0 ? NULL : this->find_child(path, len, hash);
 	}
+	/// find the child labelled with the @len chars at @name, @hash is their
+	/// watcher_path_segment() hash
+	watcher_directory_t* find_child(const char * name, uint len, uint hash) const;
+	/**
+	 *  @brief
+	 *  This method finds the deepest watcher on @path that is not a plain
+	 *  directory, eg. "a/b/value" gives the child "value" of directory "a/b"
+	 *  and "a/b/value/x" gives the same child with the tail "x".
+	 *  @param[in,out] base   offset by the bases of every directory passed
+	 *  @param[out] tail  The rest of the path to pass to the found watcher.
+	 *  @return The found child, NULL if the first identifier is not a child.
+	 */
+	watcher_directory_t* find_path(const char * path, const void *& base, const char *& tail);
 	virtual bool add_watcher(const char * path, geco_watcher_base_t& pChild, void * withBase =
 		NULL);
 	virtual bool remove_watcher(const char * path);
@@ -703,16 +862,19 @@ public:
 		watcher_value_query_t & pathRequest);
 	virtual bool visit_children(const void * base, const char *path,
 		watcher_value_query_t& pathRequest);
+	virtual geco_watcher_base_t* resolve(const void * base, const char * path,
+		const void *& resolved_base);
 
 	virtual void walk_all_files(std::string& path, std::string& buf, int& num, bool print)
 	{
-		std::string pathold = path;
+		size_t oldlen = path.size();
 		auto iter = container_.begin();
 		while (iter != container_.end())
 		{
-			path += (*iter).label + "/";
+			path.append(iter->key->name, iter->key->len);
+			path += WATCHER_PATH_SEPARATOR;
 			iter->watcher->walk_all_files(path, buf, num, print);
-			path = pathold;
+			path.resize(oldlen);
 			++iter;
 		}
 	}
@@ -845,6 +1007,12 @@ public:
 			return false;
 		}
 	}
+	virtual bool write_to_stream(const void * base, geco_bit_stream_t & result)
+	{
+		const TYPE & useValue = *(const TYPE*)(((const uintptr)&rValue_) + ((const uintptr)base));
+		write_watcher_value_to_stream(result, useValue, access_);
+		return true;
+	}
 };
 
 /**
@@ -985,6 +1153,12 @@ public:
 			return WatcherPathIsWrong;
 		}
 	}
+	virtual bool write_to_stream(const void * base, geco_bit_stream_t & result)
+	{
+		WatcherMode mode = (setFunction_ != NULL) ? WT_READ_WRITE : WT_READ_ONLY;
+		write_watcher_value_to_stream(result, (*getFunction_)(), mode);
+		return true;
+	}
 };
 
 /**
@@ -1159,6 +1333,14 @@ public:
 			return WatcherPathIsWrong;
 		}
 	}
+	virtual bool write_to_stream(const void * base, geco_bit_stream_t & result)
+	{
+		if (getMethod_ == (GetMethodType)NULL) return false;
+		OBJECT_TYPE & useObject = *(OBJECT_TYPE*)(((uintptr)pObject_) + ((uintptr)base));
+		WatcherMode mode = (setMethod_ != NULL) ? WT_READ_WRITE : WT_READ_ONLY;
+		write_watcher_value_to_stream(result, (useObject.*getMethod_)(), mode);
+		return true;
+	}
 };
 
 /**
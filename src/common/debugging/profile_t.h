@@ -29,6 +29,7 @@
 
 #include "timestamp.h"
 #include "debug.h"
+#include "concurrent_profile_t.h"
 
 // �ɴ˿ɵõ�ϵͳprofileʱ��
 extern uint64 runningTime();
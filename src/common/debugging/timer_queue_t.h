@@ -25,8 +25,12 @@
 #include <algorithm>
 #include <vector>
 #include <functional>
+#include <new>
+#include <type_traits>
+#include <string.h>
 
 #include "timestamp.h"
+#include "../ultils/ultils.h"
 
 // -----------------------------------------------------------------------------
 // Section: TimeQueueT DELC
@@ -152,15 +156,500 @@ class TimeQueueBase;
 class TimeQueueBase
 {
 public:
-	virtual void onCancel() = 0;
+	virtual ~TimeQueueBase() {}
+	virtual void onCancel(TimeQueueNode * pNode) = 0;
+};
+
+
+// -----------------------------------------------------------------------------
+// Section: TimeQueueT backends
+// -----------------------------------------------------------------------------
+
+/**
+*	A backend orders the nodes of a TimeQueueT. It is a class template over the
+*	time stamp and node types that provides:
+*
+*	Hook			embedded in every node, the backend's per node bookkeeping
+*	push(pNode)		insert
+*	top()			the node with the earliest time(), the queue is not empty
+*	pop()			remove top()
+*	remove(pNode)	remove a queued node before it is due
+*	isQueued(pNode)	O(1), read from the hook
+*	popAny()		remove and return some node, used to clear the queue
+*	contains(pNode)	slow scan, for TimeQueueT::legal()
+*/
+
+/**
+*	This class is a 4-ary min heap. Entries keep a copy of the node's time next
+*	to the node pointer so sifting never touches the nodes themselves, and each
+*	node remembers its index in the heap so it can be removed in O(log n).
+*	Four children per level halve the depth of a binary heap, and the four
+*	children of an entry share a cache line.
+*/
+template <class TIME_STAMP, class NODE>
+class TimeQueueHeap4
+{
+public:
+	typedef TIME_STAMP TimeStamp;
+
+	struct Hook
+	{
+		Hook() : index_(INVALID_INDEX) {}
+		uint32 index_;
+	};
+
+	bool empty() const { return heap_.empty(); }
+	uint32 size() const { return uint32(heap_.size()); }
+
+	NODE * top() const { return heap_.front().pNode_; }
+
+	void push(NODE * pNode)
+	{
+		heap_.push_back(Entry(pNode));
+		this->siftUp(uint32(heap_.size() - 1));
+	}
+
+	void pop() { this->removeAt(0); }
+
+	void remove(NODE * pNode) { this->removeAt(pNode->queueHook_.index_); }
+
+	bool isQueued(const NODE * pNode) const
+	{
+		return pNode->queueHook_.index_ != INVALID_INDEX;
+	}
+
+	NODE * popAny()
+	{
+		NODE * pNode = heap_.back().pNode_;
+		heap_.pop_back();
+		pNode->queueHook_.index_ = INVALID_INDEX;
+		return pNode;
+	}
+
+	bool contains(const NODE * pNode) const
+	{
+		for (size_t i = 0; i < heap_.size(); ++i)
+		{
+			if (heap_[i].pNode_ == pNode)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static const uint32 INVALID_INDEX = 0xFFFFFFFF;
+
+private:
+	struct Entry
+	{
+		explicit Entry(NODE * pNode) : time_(pNode->time()), pNode_(pNode) {}
+		TimeStamp time_;
+		NODE * pNode_;
+	};
+
+	void place(uint32 index, const Entry & entry)
+	{
+		heap_[index] = entry;
+		entry.pNode_->queueHook_.index_ = index;
+	}
+
+	void siftUp(uint32 index)
+	{
+		Entry entry = heap_[index];
+		while (index > 0)
+		{
+			uint32 parent = (index - 1) >> 2;
+			if (!(entry.time_ < heap_[parent].time_))
+			{
+				break;
+			}
+			this->place(index, heap_[parent]);
+			index = parent;
+		}
+		this->place(index, entry);
+	}
+
+	void siftDown(uint32 index)
+	{
+		const uint32 count = uint32(heap_.size());
+		Entry entry = heap_[index];
+		for (;;)
+		{
+			uint32 child = (index << 2) + 1;
+			if (child >= count)
+			{
+				break;
+			}
+			uint32 last = std::min(child + 4, count);
+			uint32 best = child;
+			for (++child; child < last; ++child)
+			{
+				if (heap_[child].time_ < heap_[best].time_)
+				{
+					best = child;
+				}
+			}
+			if (!(heap_[best].time_ < entry.time_))
+			{
+				break;
+			}
+			this->place(index, heap_[best]);
+			index = best;
+		}
+		this->place(index, entry);
+	}
+
+	void removeAt(uint32 index)
+	{
+		heap_[index].pNode_->queueHook_.index_ = INVALID_INDEX;
+		Entry last = heap_.back();
+		heap_.pop_back();
+		if (index == heap_.size())
+		{
+			return;
+		}
+		// the moved entry may belong above or below the hole
+		this->place(index, last);
+		if (index > 0 && last.time_ < heap_[(index - 1) >> 2].time_)
+		{
+			this->siftUp(index);
+		}
+		else
+		{
+			this->siftDown(index);
+		}
+	}
+
+	std::vector<Entry> heap_;
+};
+
+
+/**
+*	This class is a calendar queue with one tick per bucket, for timers in
+*	game ticks (TimeQueue). It covers a window of 2^BUCKET_BITS ticks starting
+*	at the earliest timer. Every node in a bucket is due on the same tick, so
+*	buckets are plain FIFO lists and push, pop and remove are O(1); an
+*	occupancy bitmap finds the next non-empty bucket with ctz64(). Timers
+*	beyond the window wait in a TimeQueueHeap4 and are moved into the buckets
+*	once the window reaches them.
+*
+*	A timer due before the window moves it back to start at that timer, the
+*	ticks that then fall off its end go to the overflow heap. Do not use it
+*	with high resolution timestamps such as gettimestamp(), where nearly
+*	every timer would go through the overflow heap.
+*/
+template <class TIME_STAMP, class NODE, int BUCKET_BITS>
+class TimeQueueCalendarT
+{
+public:
+	typedef TIME_STAMP TimeStamp;
+
+	struct Hook
+	{
+		Hook() :
+			pPrev_(NULL),
+			pNext_(NULL),
+			index_(TimeQueueHeap4<TIME_STAMP, NODE>::INVALID_INDEX),
+			inBucket_(false)
+		{}
+		NODE * pPrev_;
+		NODE * pNext_;
+		/// bucket index, or the overflow heap index when not in a bucket
+		uint32 index_;
+		bool inBucket_;
+	};
+
+	TimeQueueCalendarT() :
+		size_(0),
+		base_(0),
+		pTop_(NULL)
+	{
+		memset(buckets_, 0, sizeof(buckets_));
+		memset(occupied_, 0, sizeof(occupied_));
+	}
+
+	bool empty() const { return size_ == 0; }
+	uint32 size() const { return size_; }
+
+	NODE * top() const { return pTop_; }
+
+	void push(NODE * pNode)
+	{
+		const TimeStamp time = pNode->time();
+
+		if (size_++ == 0)
+		{
+			base_ = time;
+		}
+		else if (time < base_)
+		{
+			this->rebase(time);
+		}
+
+		if (time < base_ + TimeStamp(BUCKET_COUNT))
+		{
+			this->link(pNode, time);
+		}
+		else
+		{
+			overflow_.push(pNode);
+		}
+
+		if (pTop_ == NULL || time < pTop_->time())
+		{
+			pTop_ = pNode;
+		}
+	}
+
+	void pop() { this->remove(pTop_); }
+
+	void remove(NODE * pNode)
+	{
+		if (pNode->queueHook_.inBucket_)
+		{
+			this->unlink(pNode);
+		}
+		else
+		{
+			overflow_.remove(pNode);
+		}
+
+		--size_;
+
+		if (pNode == pTop_)
+		{
+			this->findTop();
+		}
+	}
+
+	bool isQueued(const NODE * pNode) const
+	{
+		return pNode->queueHook_.inBucket_ || overflow_.isQueued(pNode);
+	}
+
+	NODE * popAny()
+	{
+		NODE * pNode = pTop_;
+		this->remove(pNode);
+		return pNode;
+	}
+
+	bool contains(const NODE * pNode) const
+	{
+		for (int i = 0; i < BUCKET_COUNT; ++i)
+		{
+			for (NODE * pIter = buckets_[i].pHead_; pIter != NULL;
+				pIter = pIter->queueHook_.pNext_)
+			{
+				if (pIter == pNode)
+				{
+					return true;
+				}
+			}
+		}
+		return overflow_.contains(pNode);
+	}
+
+private:
+	static const int BUCKET_COUNT = 1 << BUCKET_BITS;
+	static const int WORD_COUNT = (BUCKET_COUNT + 63) / 64;
+	static const uint32 BUCKET_MASK = BUCKET_COUNT - 1;
+
+	struct Bucket
+	{
+		NODE * pHead_;
+		NODE * pTail_;
+	};
+
+	void link(NODE * pNode, TimeStamp time)
+	{
+		const uint32 index = uint32(time) & BUCKET_MASK;
+		Bucket & bucket = buckets_[index];
+		Hook & hook = pNode->queueHook_;
+		hook.pPrev_ = bucket.pTail_;
+		hook.pNext_ = NULL;
+		hook.index_ = index;
+		hook.inBucket_ = true;
+		(bucket.pTail_ != NULL ? bucket.pTail_->queueHook_.pNext_ : bucket.pHead_) = pNode;
+		bucket.pTail_ = pNode;
+		occupied_[index >> 6] |= uint64(1) << (index & 63);
+	}
+
+	void unlink(NODE * pNode)
+	{
+		Hook & hook = pNode->queueHook_;
+		Bucket & bucket = buckets_[hook.index_];
+		(hook.pPrev_ != NULL ? hook.pPrev_->queueHook_.pNext_ : bucket.pHead_) = hook.pNext_;
+		(hook.pNext_ != NULL ? hook.pNext_->queueHook_.pPrev_ : bucket.pTail_) = hook.pPrev_;
+		if (bucket.pHead_ == NULL)
+		{
+			occupied_[hook.index_ >> 6] &= ~(uint64(1) << (hook.index_ & 63));
+		}
+		hook.pPrev_ = hook.pNext_ = NULL;
+		hook.index_ = TimeQueueHeap4<TIME_STAMP, NODE>::INVALID_INDEX;
+		hook.inBucket_ = false;
+	}
+
+	/**
+	*	Move the window back to start at @time. The buckets of the ticks that
+	*	no longer fit in it are emptied into the overflow heap, so the buckets
+	*	still hold one tick each and base_ stays the earliest time.
+	*/
+	void rebase(TimeStamp time)
+	{
+		const TimeStamp end = base_ + TimeStamp(BUCKET_COUNT);
+		TimeStamp tick = time + TimeStamp(BUCKET_COUNT);
+		if (tick < base_)
+		{
+			tick = base_;
+		}
+		for (; tick < end; ++tick)
+		{
+			Bucket & bucket = buckets_[uint32(tick) & BUCKET_MASK];
+			while (bucket.pHead_ != NULL)
+			{
+				NODE * pNode = bucket.pHead_;
+				this->unlink(pNode);
+				overflow_.push(pNode);
+			}
+		}
+		base_ = time;
+	}
+
+	/**
+	*	Find the first occupied bucket at or after base_, wrapping once. The
+	*	buckets only hold times inside the window so this is the earliest
+	*	node. If they are empty the window jumps to the overflow heap's top.
+	*	Either way the window then starts at the new top and overflow nodes
+	*	that now fall inside it move into their buckets.
+	*/
+	void findTop()
+	{
+		pTop_ = NULL;
+		if (size_ == 0)
+		{
+			return;
+		}
+
+		const uint32 start = uint32(base_) & BUCKET_MASK;
+		for (int i = 0; i <= WORD_COUNT; ++i)
+		{
+			uint32 word = ((start >> 6) + i) % WORD_COUNT;
+			uint64 bits = occupied_[word];
+			if (i == 0)
+			{
+				bits &= ~uint64(0) << (start & 63);
+			}
+			else if (i == WORD_COUNT)
+			{
+				bits &= ~(~uint64(0) << (start & 63));
+			}
+			if (bits != 0)
+			{
+				uint32 index = (word << 6) + geco::ultils::ctz64(bits);
+				pTop_ = buckets_[index].pHead_;
+				base_ += (index - start) & BUCKET_MASK;
+				break;
+			}
+		}
+
+		if (pTop_ == NULL)
+		{
+			pTop_ = overflow_.top();
+			base_ = pTop_->time();
+		}
+
+		while (!overflow_.empty() &&
+			overflow_.top()->time() < base_ + TimeStamp(BUCKET_COUNT))
+		{
+			NODE * pNode = overflow_.top();
+			overflow_.pop();
+			this->link(pNode, pNode->time());
+		}
+
+		// moved from the overflow heap, now the head of its bucket
+		pTop_ = buckets_[uint32(base_) & BUCKET_MASK].pHead_;
+	}
+
+	Bucket buckets_[BUCKET_COUNT];
+	uint64 occupied_[WORD_COUNT];
+	TimeQueueHeap4<TIME_STAMP, NODE> overflow_;
+	uint32 size_;
+	/// first tick of the window, never later than the earliest node
+	TimeStamp base_;
+	NODE * pTop_;
+};
+
+template <class TIME_STAMP, class NODE>
+using TimeQueueCalendar = TimeQueueCalendarT<TIME_STAMP, NODE, 10>;
+
+
+/**
+*	This class hands out the nodes of one TimeQueueT from chunks of
+*	NODES_PER_CHUNK, so adding a timer does not hit the heap once the queue
+*	has grown to its working size. Chunks are released with the pool.
+*/
+template <class NODE, int NODES_PER_CHUNK = 256>
+class TimeQueueNodePool
+{
+public:
+	TimeQueueNodePool() : pFree_(NULL) {}
+	~TimeQueueNodePool()
+	{
+		for (size_t i = 0; i < chunks_.size(); ++i)
+		{
+			::operator delete(chunks_[i]);
+		}
+	}
+
+	void * allocate()
+	{
+		if (pFree_ == NULL)
+		{
+			Slot * pChunk = static_cast<Slot *>(
+				::operator new(sizeof(Slot) * NODES_PER_CHUNK));
+			chunks_.push_back(pChunk);
+			for (int i = NODES_PER_CHUNK - 1; i >= 0; --i)
+			{
+				pChunk[i].pNext_ = pFree_;
+				pFree_ = pChunk + i;
+			}
+		}
+		Slot * pSlot = pFree_;
+		pFree_ = pSlot->pNext_;
+		return pSlot;
+	}
+
+	void deallocate(void * p)
+	{
+		Slot * pSlot = static_cast<Slot *>(p);
+		pSlot->pNext_ = pFree_;
+		pFree_ = pSlot;
+	}
+
+private:
+	union Slot
+	{
+		Slot * pNext_;
+		typename std::aligned_storage<sizeof(NODE), alignof(NODE)>::type node_;
+	};
+
+	Slot * pFree_;
+	std::vector<Slot *> chunks_;
 };
 
 /**
 * 	This class implements a time queue, measured in game ticks. The logic is
 * 	basically stolen from Mercury, but it is intended to be used as a low
 * 	resolution timer.  Also, timestamps should be synchronised between servers.
+*
+*	QUEUE is the ordering backend, TimeQueueHeap4 or TimeQueueCalendar.
+*	Cancelled timers are removed from the backend and returned to the node
+*	pool immediately.
 */
-template< class TIME_STAMP >
+template< class TIME_STAMP,
+	template <class, class> class QUEUE = TimeQueueHeap4 >
 class TimeQueueT : public TimeQueueBase
 {
 public:
@@ -202,13 +691,14 @@ public:
 	TIME_STAMP & timerIntervalTime(TimerID handle);
 
 private:
-	void purgeCancelledNodes();
-	void onCancel();
+	void onCancel(TimeQueueNode * pNode);
 
 	/// This structure represents one event in the time queue.
 	class Node : public TimeQueueNode
 	{
 	public:
+		typedef TIME_STAMP TimeStamp;
+
 		Node(TimeQueueBase & owner, TimeStamp startTime, TimeStamp interval,
 			TimerHandler * pHandler, void * pUser);
 
@@ -220,6 +710,9 @@ private:
 
 		void triggerTimer();
 
+		/// Owned by the QUEUE backend.
+		typename QUEUE< TIME_STAMP, Node >::Hook queueHook_;
+
 	private:
 		TimeStamp			time_;
 		TimeStamp			interval_;
@@ -228,81 +721,25 @@ private:
 		Node & operator=(const Node &);
 	};
 
-	/// Comparison object for the priority queue.
-	class Comparator
+	Node * newNode(TimeStamp startTime, TimeStamp interval,
+		TimerHandler * pHandler, void * pUser)
 	{
-	public:
-		bool operator()(const Node* a, const Node* b)
-		{
-			return a->time() > b->time();
-		}
-	};
+		return new (nodePool_.allocate())
+			Node(*this, startTime, interval, pHandler, pUser);
+	}
 
-	/**
-	*	This class implements a priority queue. std::priority_queue is not used
-	*	so that access to the underlying container can be gotten.
-	*/
-	class PriorityQueue
+	void deleteNode(Node * pNode)
 	{
-	public:
-		typedef std::vector< Node * > Container;
-
-		typedef typename Container::value_type value_type;
-		typedef typename Container::size_type size_type;
-
-		bool empty() const { return container_.empty(); }
-		size_type size() const { return container_.size(); }
-
-		const value_type & top() const { return container_.front(); }
-
-		void push(const value_type & x)
-		{
-			container_.push_back(x);
-			std::push_heap(container_.begin(), container_.end(),
-				Comparator());
-		}
-
-		void pop()
-		{
-			std::pop_heap(container_.begin(), container_.end(), Comparator());
-			container_.pop_back();
-		}
-
-		/**
-		*	Note: This leaves the queue in a bad state.
-		*/
-		Node * unsafePopBack()
-		{
-			Node * pNode = container_.back();
-			container_.pop_back();
-			return pNode;
-		}
-
-		/**
-		*	This method returns the underlying container. If this container is
-		*	modified, heapify should be called to return the PriorityQueue to
-		*	be a valid priority queue.
-		*/
-		Container & container() { return container_; }
-
-		/**
-		*	This method enforces the underlying container to be in a valid heap
-		*	ordering.
-		*/
-		void heapify()
-		{
-			std::make_heap(container_.begin(), container_.end(),
-				Comparator());
-		}
+		pNode->~Node();
+		nodePool_.deallocate(pNode);
+	}
 
-	private:
-		Container container_;
-	};
+	typedef QUEUE< TIME_STAMP, Node > Queue;
 
-	PriorityQueue	timeQueue_;
+	TimeQueueNodePool< Node >	nodePool_;
+	Queue			timeQueue_;
 	Node * 			pProcessingNode_;
 	TimeStamp 		lastProcessTime_;
-	int				numCancelled_;
 
 	// Cannot be copied.
 	TimeQueueT(const TimeQueueT &);
@@ -311,6 +748,8 @@ private:
 
 typedef TimeQueueT< uint32 > TimeQueue;
 typedef TimeQueueT< uint64 > TimeQueue64;
+/// For tick driven timers, see TimeQueueCalendarT.
+typedef TimeQueueT< uint32, TimeQueueCalendar > TickTimeQueue;
 
 
 // -----------------------------------------------------------------------------
@@ -320,12 +759,12 @@ typedef TimeQueueT< uint64 > TimeQueue64;
 /**
 *	This is the constructor.
 */
-template< class TIME_STAMP >
-TimeQueueT< TIME_STAMP >::TimeQueueT() :
+template< class TIME_STAMP, template <class, class> class QUEUE >
+TimeQueueT< TIME_STAMP, QUEUE >::TimeQueueT() :
+	nodePool_(),
 	timeQueue_(),
 	pProcessingNode_(NULL),
-	lastProcessTime_(0),
-	numCancelled_(0)
+	lastProcessTime_(0)
 {
 }
 
@@ -333,8 +772,8 @@ TimeQueueT< TIME_STAMP >::TimeQueueT() :
 * 	This is the destructor. It walks the queue and cancels events,
 *	then deletes them. If the cancellation of events
 */
-template <class TIME_STAMP>
-TimeQueueT< TIME_STAMP >::~TimeQueueT()
+template <class TIME_STAMP, template <class, class> class QUEUE>
+TimeQueueT< TIME_STAMP, QUEUE >::~TimeQueueT()
 {
 	this->clear();
 }
@@ -343,19 +782,19 @@ TimeQueueT< TIME_STAMP >::~TimeQueueT()
 /**
 *	This method cancels all events in this queue.
 */
-template <class TIME_STAMP>
-void TimeQueueT< TIME_STAMP >::clear(bool shouldCallCancel)
+template <class TIME_STAMP, template <class, class> class QUEUE>
+void TimeQueueT< TIME_STAMP, QUEUE >::clear(bool shouldCallCancel)
 {
 	// Make sure we don't loop forever
 	int maxLoopCount = timeQueue_.size();
 
 	while (!timeQueue_.empty())
 	{
-		Node * pNode = timeQueue_.unsafePopBack();
+		// Unqueued first, so onCancel() leaves the node to us
+		Node * pNode = timeQueue_.popAny();
 
 		if (!pNode->isCancelled() && shouldCallCancel)
 		{
-			--numCancelled_; // Since it's removed from the queue
 			pNode->cancel();
 
 			if (--maxLoopCount == 0)
@@ -363,18 +802,9 @@ void TimeQueueT< TIME_STAMP >::clear(bool shouldCallCancel)
 				shouldCallCancel = false;
 			}
 		}
-		else if (pNode->isCancelled())
-		{
-			--numCancelled_;
-		}
 
-		delete pNode;
+		this->deleteNode(pNode);
 	}
-
-	numCancelled_ = 0;
-
-	// Clear the queue
-	timeQueue_ = PriorityQueue();
 }
 
 
@@ -389,11 +819,11 @@ void TimeQueueT< TIME_STAMP >::clear(bool shouldCallCancel)
 *	@param pUser		User data to be passed with the event.
 *	@return				A handle to the new event.
 */
-template <class TIME_STAMP>
-TimerID TimeQueueT< TIME_STAMP >::add(TimeStamp startTime,
+template <class TIME_STAMP, template <class, class> class QUEUE>
+TimerID TimeQueueT< TIME_STAMP, QUEUE >::add(TimeStamp startTime,
 	TimeStamp interval, TimerHandler * pHandler, void * pUser)
 {
-	Node * pNode = new Node(*this, startTime, interval, pHandler, pUser);
+	Node * pNode = this->newNode(startTime, interval, pHandler, pUser);
 	timeQueue_.push(pNode);
 
 	return TimerID(pNode);
@@ -401,67 +831,20 @@ TimerID TimeQueueT< TIME_STAMP >::add(TimeStamp startTime,
 
 
 /**
-*	This method is called when a timer has been cancelled.
+*	This method is called when a timer has been cancelled. A queued node is
+*	removed and freed right away. The node being processed and nodes already
+*	taken off the queue by clear() are freed by their caller.
 */
-template <class TIME_STAMP>
-void TimeQueueT< TIME_STAMP >::onCancel()
+template <class TIME_STAMP, template <class, class> class QUEUE>
+void TimeQueueT< TIME_STAMP, QUEUE >::onCancel(TimeQueueNode * pCancelled)
 {
-	++numCancelled_;
+	Node * pNode = static_cast<Node *>(pCancelled);
 
-	// If there are too many cancelled timers in the queue (more than half),
-	// these are flushed from the queue immediately.
-
-	if (numCancelled_ * 2 > int(timeQueue_.size()))
-	{
-		this->purgeCancelledNodes();
-	}
-}
-
-
-/**
-*	This class is used by purgeCancelledNodes to partition the timers and
-*	separate those that have been cancelled.
-*/
-template <class NODE>
-class IsNotCancelled
-{
-public:
-	bool operator()(const NODE * pNode)
-	{
-		return !pNode->isCancelled();
-	}
-};
-
-
-/**
-*	This method removes all cancelled timers from the priority queue. Generally,
-*	cancelled timers wait until they have reached the top of the queue before
-*	being deleted.
-*/
-template <class TIME_STAMP>
-void TimeQueueT< TIME_STAMP >::purgeCancelledNodes()
-{
-	typename PriorityQueue::Container & container = timeQueue_.container();
-
-	typename PriorityQueue::Container::iterator newEnd =
-		std::partition(container.begin(), container.end(),
-			IsNotCancelled< Node >());
-
-	for (typename PriorityQueue::Container::iterator iter = newEnd;
-		iter != container.end();
-		++iter)
+	if (pNode != pProcessingNode_ && timeQueue_.isQueued(pNode))
 	{
-		delete *iter;
+		timeQueue_.remove(pNode);
+		this->deleteNode(pNode);
 	}
-
-	const int numPurged = (container.end() - newEnd);
-	numCancelled_ -= numPurged;
-	// numCancelled_ will be 1 when we're in the middle of processing a
-	// once-off timer.
-	GECO_ASSERT((numCancelled_ == 0) || (numCancelled_ == 1));
-
-	container.erase(newEnd, container.end());
-	timeQueue_.heapify();
 }
 
 
@@ -474,23 +857,18 @@ void TimeQueueT< TIME_STAMP >::purgeCancelledNodes()
 *
 *	@return The number of timers that fired.
 */
-template <class TIME_STAMP>
-int TimeQueueT< TIME_STAMP >::process(TimeStamp now)
+template <class TIME_STAMP, template <class, class> class QUEUE>
+int TimeQueueT< TIME_STAMP, QUEUE >::process(TimeStamp now)
 {
 	int numFired = 0;
 
-	while ((!timeQueue_.empty()) && (
-		timeQueue_.top()->time() <= now ||
-		timeQueue_.top()->isCancelled()))
+	while ((!timeQueue_.empty()) && (timeQueue_.top()->time() <= now))
 	{
 		Node * pNode = pProcessingNode_ = timeQueue_.top();
 		timeQueue_.pop();
 
-		if (!pNode->isCancelled())
-		{
-			++numFired;
-			pNode->triggerTimer();
-		}
+		++numFired;
+		pNode->triggerTimer();
 
 		if (!pNode->isCancelled())
 		{
@@ -498,10 +876,7 @@ int TimeQueueT< TIME_STAMP >::process(TimeStamp now)
 		}
 		else
 		{
-			delete pNode;
-
-			GECO_ASSERT(numCancelled_ > 0);
-			--numCancelled_;
+			this->deleteNode(pNode);
 		}
 	}
 
@@ -515,11 +890,9 @@ int TimeQueueT< TIME_STAMP >::process(TimeStamp now)
 /**
 *	This method determines whether or not the given handle is legal.
 */
-template <class TIME_STAMP>
-bool TimeQueueT< TIME_STAMP >::legal(TimerID handle) const
+template <class TIME_STAMP, template <class, class> class QUEUE>
+bool TimeQueueT< TIME_STAMP, QUEUE >::legal(TimerID handle) const
 {
-	typedef Node * const * NodeIter;
-
 	Node * pNode = static_cast<Node*>(handle.pNode());
 
 	if (pNode == NULL)
@@ -532,25 +905,14 @@ bool TimeQueueT< TIME_STAMP >::legal(TimerID handle) const
 		return true;
 	}
 
-	NodeIter begin = &timeQueue_.top();
-	NodeIter end = begin + timeQueue_.size();
-
-	for (NodeIter it = begin; it != end; it++)
-	{
-		if (*it == pNode)
-		{
-			return true;
-		}
-	}
-
-	return false;
+	return timeQueue_.contains(pNode);
 }
 
 /**
 *	This method returns the time until the next timer goes off.
 */
-template <class TIME_STAMP>
-TIME_STAMP TimeQueueT< TIME_STAMP >::nextExp(TimeStamp now) const
+template <class TIME_STAMP, template <class, class> class QUEUE>
+TIME_STAMP TimeQueueT< TIME_STAMP, QUEUE >::nextExp(TimeStamp now) const
 {
 	if (timeQueue_.empty() ||
 		now > timeQueue_.top()->time())
@@ -566,8 +928,8 @@ TIME_STAMP TimeQueueT< TIME_STAMP >::nextExp(TimeStamp now) const
 *	This method returns information associated with the timer with the input
 *	handler.
 */
-template <class TIME_STAMP>
-bool TimeQueueT< TIME_STAMP >::getTimerInfo(TimerID handle,
+template <class TIME_STAMP, template <class, class> class QUEUE>
+bool TimeQueueT< TIME_STAMP, QUEUE >::getTimerInfo(TimerID handle,
 	TimeStamp &			time,
 	TimeStamp &			interval,
 	void * &			pUser) const
@@ -591,9 +953,9 @@ bool TimeQueueT< TIME_STAMP >::getTimerInfo(TimerID handle,
 *	This method returns the time that the given timer handle will be delivered,
 *	in timestamps.
 */
-template <class TIME_STAMP>
+template <class TIME_STAMP, template <class, class> class QUEUE>
 TIME_STAMP
-TimeQueueT< TIME_STAMP >::timerDeliveryTime(TimerID handle) const
+TimeQueueT< TIME_STAMP, QUEUE >::timerDeliveryTime(TimerID handle) const
 {
 	Node * pNode = static_cast<Node *>(handle.pNode());
 	return pNode->deliveryTime();
@@ -604,9 +966,9 @@ TimeQueueT< TIME_STAMP >::timerDeliveryTime(TimerID handle) const
 *	This method returns the time between deliveries of the given timer handle,
 *	in timestamps.
 */
-template <class TIME_STAMP>
+template <class TIME_STAMP, template <class, class> class QUEUE>
 TIME_STAMP
-TimeQueueT< TIME_STAMP >::timerIntervalTime(TimerID handle) const
+TimeQueueT< TIME_STAMP, QUEUE >::timerIntervalTime(TimerID handle) const
 {
 	Node * pNode = static_cast<Node *>(handle.pNode());
 	return pNode->interval();
@@ -617,8 +979,8 @@ TimeQueueT< TIME_STAMP >::timerIntervalTime(TimerID handle) const
 *	This method returns the time between deliveries of the given timer handle,
 *	in timestamps. The value returned may be modified.
 */
-template <class TIME_STAMP>
-TIME_STAMP & TimeQueueT< TIME_STAMP >::timerIntervalTime(TimerID handle)
+template <class TIME_STAMP, template <class, class> class QUEUE>
+TIME_STAMP & TimeQueueT< TIME_STAMP, QUEUE >::timerIntervalTime(TimerID handle)
 {
 	Node * pNode = static_cast<Node *>(handle.pNode());
 	return pNode->intervalRef();
@@ -664,7 +1026,8 @@ void TimeQueueNode::cancel()
 		pHandler_ = NULL;
 	}
 
-	owner_.onCancel();
+	// May free this node, nothing may touch it afterwards.
+	owner_.onCancel(this);
 }
 
 
@@ -675,8 +1038,8 @@ void TimeQueueNode::cancel()
 /**
 *	Constructor
 */
-template <class TIME_STAMP>
-TimeQueueT< TIME_STAMP >::Node::Node(TimeQueueBase & owner,
+template <class TIME_STAMP, template <class, class> class QUEUE>
+TimeQueueT< TIME_STAMP, QUEUE >::Node::Node(TimeQueueBase & owner,
 	TimeStamp startTime, TimeStamp interval,
 	TimerHandler * _pHandler, void * _pUser) :
 	TimeQueueNode(owner, _pHandler, _pUser),
@@ -689,8 +1052,8 @@ TimeQueueT< TIME_STAMP >::Node::Node(TimeQueueBase & owner,
 /**
 *	This method cancels the time queue node.
 */
-template <class TIME_STAMP>
-TIME_STAMP TimeQueueT< TIME_STAMP >::Node::deliveryTime() const
+template <class TIME_STAMP, template <class, class> class QUEUE>
+TIME_STAMP TimeQueueT< TIME_STAMP, QUEUE >::Node::deliveryTime() const
 {
 	return this->isExecuting() ? (time_ + interval_) : time_;
 }
@@ -700,8 +1063,8 @@ TIME_STAMP TimeQueueT< TIME_STAMP >::Node::deliveryTime() const
 *	This method triggers the timer assoicated with this node. It also updates
 *	the state for repeating timers.
 */
-template <class TIME_STAMP>
-void TimeQueueT< TIME_STAMP >::Node::triggerTimer()
+template <class TIME_STAMP, template <class, class> class QUEUE>
+void TimeQueueT< TIME_STAMP, QUEUE >::Node::triggerTimer()
 {
 	if (!this->isCancelled())
 	{
@@ -20,6 +20,10 @@
 
 #include "timestamp.h"
 #include "../ultils/affinity.h"
+#include <atomic>
+#if defined(_WIN32)
+#include <intrin.h>
+#endif
 
 #if defined(PLAYSTATION3)
 static uint64 calc_stamps_pe_sec()
@@ -102,51 +106,313 @@ static uint64 calc_stamps_pe_sec()
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
-static uint64 calc_stamps_pe_sec()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+std::atomic<int> g_clock_source(CLOCK_SOURCE_NONE);
+
+static uint64 raw_ns()
 {
-	struct timeval tvBefore, tvSleep =
-	{ 0, 500000 }, tvAfter;
-	uint64 stampBefore, stampAfter;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return uint64(ts.tv_sec) * 1000000000ULL + uint64(ts.tv_nsec);
+}
+/* read the TSC and CLOCK_MONOTONIC_RAW as close together as we can: the
+ clock read is bracketed by two rdtsc and the narrowest of a few tries wins */
+static void sample_tsc(uint64& tsc, uint64& ns)
+{
+	uint64 best = ~uint64(0);
+	for (int i = 0; i < 5; i++)
+	{
+		uint64 before = geco_rdtsc();
+		uint64 now = raw_ns();
+		uint64 after = geco_rdtsc();
+		if (after - before < best)
+		{
+			best = after - before;
+			tsc = before + (after - before) / 2;
+			ns = now;
+		}
+	}
+}
+/* the kernel checks the TSC of every core against each other and drops it
+ as clocksource if they drift, so trust its choice when we can read it */
+static bool kernel_trusts_tsc()
+{
+	FILE* fp = fopen("/sys/devices/system/clocksource/clocksource0/current_clocksource", "r");
+	if (fp == NULL)
+		return true;
+	char name[32] = { 0 };
+	bool ret = fgets(name, sizeof(name), fp) != NULL && strncmp(name, "tsc", 3) == 0;
+	fclose(fp);
+	return ret;
+}
 
-	// Prime it (just in cache)
-	gettimeofday(&tvBefore, NULL);
-	gettimeofday(&tvBefore, NULL);
-	/* If we do these in the same order, then as long as the offset of
-	 the time returned by gettimeofday is consistent, we should be ok. */
-	gettimeofday(&tvBefore, NULL);
-	stampBefore = gettimestamp();
-	select(0, NULL, NULL, NULL, &tvSleep);
+int geco_clock_select()
+{
+	int source = g_clock_source.load(std::memory_order_acquire);
+	if (source != CLOCK_SOURCE_NONE)
+		return source;
+	const char* env = getenv("GECO_CLOCK_SOURCE");
+	if (env != NULL && strcmp(env, "tsc") == 0)
+		source = CLOCK_SOURCE_TSC;
+	else if (env != NULL && strcmp(env, "os") == 0)
+		source = CLOCK_SOURCE_OS;
+	else
+		source = geco_clock_t::invariant_tsc() && kernel_trusts_tsc() ?
+			CLOCK_SOURCE_TSC : CLOCK_SOURCE_OS;
+	/* first one wins, every thread must agree on the source */
+	int expected = CLOCK_SOURCE_NONE;
+	if (!g_clock_source.compare_exchange_strong(expected, source))
+		source = expected;
+	return source;
+}
+#endif
 
-	// And again
-	gettimeofday(&tvAfter, NULL);
-	gettimeofday(&tvAfter, NULL);
-	gettimeofday(&tvAfter, NULL);
-	stampAfter = gettimestamp();
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// 　　　　　　　　　　　　 Section: geco_clock_t
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+const uint geco_clock_t::SHIFT;
+const uint64 geco_clock_t::RESYNC_INTERVAL_NS;
+const uint geco_clock_t::MAX_SLEW_PPM;
 
-	uint64 microDelta = (tvAfter.tv_usec + 1000000 - tvBefore.tv_usec) % 1000000;
-	uint64 stampDelta = stampAfter - stampBefore;
-	return (stampDelta * 1000000ULL) / microDelta;
-	// the multiply above won't overflow until we get over 4THz processors :)
+static inline uint64 mul_shift(uint64 value, uint64 mult)
+{
+#if defined(__SIZEOF_INT128__)
+	return uint64((unsigned __int128)value * mult >> geco_clock_t::SHIFT);
+#elif defined(_M_X64)
+	uint64 hi;
+	uint64 lo = _umul128(value, mult, &hi);
+	return __shiftright128(lo, hi, geco_clock_t::SHIFT);
+#else
+	return uint64(double(value) * double(mult) / double(1ULL << geco_clock_t::SHIFT));
+#endif
+}
+/* ns per stamp in SHIFT fixed point */
+static inline uint64 make_mult(uint64 ns, uint64 stamps)
+{
+	return uint64(double(ns) * double(1ULL << geco_clock_t::SHIFT) / double(stamps));
+}
+/* stamps in RESYNC_INTERVAL_NS at @mult */
+static inline uint64 resync_interval(uint64 mult)
+{
+	return uint64(double(geco_clock_t::RESYNC_INTERVAL_NS)
+		* double(1ULL << geco_clock_t::SHIFT) / double(mult));
+}
+
+namespace
+{
+/* conversion parameters, written under a sequence lock by the re-sync and
+ read lock-free: ns = base_ns + ((stamp - base_stamp) * mult >> SHIFT) */
+struct clock_state_t
+{
+	std::atomic<uint32> seq;
+	std::atomic<uint64> base_stamp;
+	std::atomic<uint64> base_ns;
+	std::atomic<uint64> mult;
+	/* first calibration point, the rate is measured from here */
+	uint64 calib_stamp;
+	uint64 calib_ns;
+	std::atomic<uint64> next_sync;
+	std::atomic<int64> last_drift;
+	std::atomic<uint64> resyncs;
+	std::atomic_flag syncing;
+	bool tsc;
+
+	clock_state_t();
+
+	void load(uint64& stamp, uint64& ns, uint64& m) const
+	{
+		uint32 before, after;
+		do
+		{
+			before = seq.load(std::memory_order_acquire);
+			stamp = base_stamp.load(std::memory_order_relaxed);
+			ns = base_ns.load(std::memory_order_relaxed);
+			m = mult.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			after = seq.load(std::memory_order_relaxed);
+		} while ((before & 1) || before != after);
+	}
+	void store(uint64 stamp, uint64 ns, uint64 m)
+	{
+		uint32 s = seq.load(std::memory_order_relaxed);
+		seq.store(s + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		base_stamp.store(stamp, std::memory_order_relaxed);
+		base_ns.store(ns, std::memory_order_relaxed);
+		mult.store(m, std::memory_order_relaxed);
+		seq.store(s + 2, std::memory_order_release);
+	}
+	uint64 to_ns(uint64 stamp) const
+	{
+		uint64 base, ns, m;
+		this->load(base, ns, m);
+		/* a core whose TSC lags the re-syncing one by a few cycles must
+		 not wrap around */
+		return stamp > base ? ns + mul_shift(stamp - base, m) : ns;
+	}
+	void maybe_resync(uint64 stamp)
+	{
+		if (tsc && stamp >= next_sync.load(std::memory_order_relaxed))
+			this->resync();
+	}
+	bool resync();
+};
+
+clock_state_t::clock_state_t() :
+	seq(0), base_stamp(0), base_ns(0), mult(0), calib_stamp(0), calib_ns(0),
+	next_sync(~uint64(0)), last_drift(0), resyncs(0), tsc(false)
+{
+	syncing.clear();
+#if defined(__unix__) || defined(__linux__)
+	if (geco_clock_select() == CLOCK_SOURCE_TSC)
+	{
+		tsc = true;
+		uint64 stamp0, ns0, stamp1, ns1;
+		sample_tsc(stamp0, ns0);
+		struct timespec pause = { 0, 20000000 };
+		nanosleep(&pause, NULL);
+		sample_tsc(stamp1, ns1);
+		calib_stamp = stamp0;
+		calib_ns = ns0;
+		uint64 m = make_mult(ns1 - ns0, stamp1 - stamp0);
+		this->store(stamp1, ns1, m);
+		next_sync.store(stamp1 + resync_interval(m), std::memory_order_relaxed);
+	}
+	else
+	{
+		this->store(0, 0, 1ULL << geco_clock_t::SHIFT);
+	}
+#else
+	this->store(0, 0, make_mult(1000000000ULL, calc_stamps_pe_sec()));
+#endif
+}
+
+bool clock_state_t::resync()
+{
+#if defined(__unix__) || defined(__linux__)
+	if (!tsc || syncing.test_and_set(std::memory_order_acquire))
+		return false;
+	uint64 stamp, raw;
+	sample_tsc(stamp, raw);
+	uint64 base, ns, m;
+	this->load(base, ns, m);
+	uint64 now = stamp > base ? ns + mul_shift(stamp - base, m) : ns;
+	int64 drift = int64(raw - now);
+
+	/* the rate over the whole run, then a correction that closes the
+	 offset by the next re-sync */
+	uint64 rate = make_mult(raw - calib_ns, stamp - calib_stamp);
+	uint64 interval = resync_interval(rate);
+	double slew = double(drift) * double(1ULL << geco_clock_t::SHIFT) / double(interval);
+	double cap = double(rate) * geco_clock_t::MAX_SLEW_PPM / 1000000.0;
+	if (slew > cap) slew = cap;
+	if (slew < -cap) slew = -cap;
+
+	/* re-base at the current reading so the clock stays continuous */
+	this->store(stamp, now, uint64(double(rate) + slew));
+	next_sync.store(stamp + interval, std::memory_order_relaxed);
+	last_drift.store(drift, std::memory_order_relaxed);
+	resyncs.fetch_add(1, std::memory_order_relaxed);
+	syncing.clear(std::memory_order_release);
+	return true;
+#else
+	return false;
+#endif
+}
+
+clock_state_t& clock_state()
+{
+	static clock_state_t state;
+	return state;
+}
 }
+
+clock_source_t geco_clock_t::source()
+{
+#if defined(__unix__) || defined(__linux__)
+	return clock_source_t(geco_clock_select());
+#elif defined(_WIN32) && defined(GECO_USE_RDTSC)
+	return CLOCK_SOURCE_TSC;
+#else
+	return CLOCK_SOURCE_OS;
+#endif
+}
+
+bool geco_clock_t::invariant_tsc()
+{
+#if defined(__i386__) || defined(__x86_64__)
+	uint32 eax, ebx, ecx, edx;
+	if (__get_cpuid_max(0x80000000, NULL) < 0x80000007)
+		return false;
+	__cpuid(0x80000007, eax, ebx, ecx, edx);
+	return (edx & (1 << 8)) != 0;
+#elif defined(_WIN32) && (defined(_M_X64) || defined(_M_IX86))
+	int regs[4];
+	__cpuid(regs, 0x80000000);
+	if (uint32(regs[0]) < 0x80000007)
+		return false;
+	__cpuid(regs, 0x80000007);
+	return (regs[3] & (1 << 8)) != 0;
+#else
+	return false;
 #endif
+}
+
+uint64 geco_clock_t::stamps2ns(uint64 stamps)
+{
+	clock_state_t& state = clock_state();
+	if (state.tsc)
+		state.maybe_resync(geco_rdtsc());
+	return mul_shift(stamps, state.mult.load(std::memory_order_relaxed));
+}
+
+uint64 geco_clock_t::now_ns()
+{
+	clock_state_t& state = clock_state();
+	uint64 stamp = gettimestamp();
+	state.maybe_resync(stamp);
+	return state.to_ns(stamp);
+}
+
+bool geco_clock_t::resync()
+{
+	return clock_state().resync();
+}
+
+uint64 geco_clock_t::mult()
+{
+	return clock_state().mult.load(std::memory_order_relaxed);
+}
+
+int64 geco_clock_t::last_drift_ns()
+{
+	return clock_state().last_drift.load(std::memory_order_relaxed);
+}
+
+uint64 geco_clock_t::resync_count()
+{
+	return clock_state().resyncs.load(std::memory_order_relaxed);
+}
 
 uint64 stamps_per_sec()
 {
-	static uint64 stampsPerSecondCache = calc_stamps_pe_sec();
-	return stampsPerSecondCache;
+	return uint64(stamps_per_sec_double() + 0.5);
 }
 double stamps_per_sec_double()
 {
-	static double stampsPerSecondCacheD = double(stamps_per_sec());
-	return stampsPerSecondCacheD;
+	return 1000000000.0 * double(1ULL << geco_clock_t::SHIFT) / double(geco_clock_t::mult());
 }
 double stamps2sec(uint64 stamps)
 {
-	static double val = stamps_per_sec_double();
-	return stamps / val;
+	return double(geco_clock_t::stamps2ns(stamps)) / 1000000000.0;
 }
 time_stamp_t time_stamp_t::fromSecs(double seconds)
 {
 	return uint64(seconds * stamps_per_sec_double());
 }
-
@@ -39,11 +39,22 @@
 
 //#define GECO_USE_RDTSC
 
+/// where gettimestamp() reads its stamps from, chosen once per process
+enum clock_source_t
+{
+	CLOCK_SOURCE_NONE = 0, /* not chosen yet */
+	CLOCK_SOURCE_TSC = 1, /* invariant time stamp counter */
+	CLOCK_SOURCE_OS = 2 /* clock_gettime(CLOCK_MONOTONIC) ns, or QueryPerformanceCounter */
+};
+
 #if defined(__unix__) || defined(__linux__)
+#include <time.h>
+#include <atomic>
+
 /**　This function returns the processor's (real-time) clock cycle counter.
  *　Read Time-Stamp Counterloads current value of processor's timestamp counter into EDX:EAX
  */
-inline uint64 gettimestamp()
+inline uint64 geco_rdtsc()
 {
 	uint32 rethi, retlo;
 	__asm__ __volatile__(
@@ -53,6 +64,33 @@ inline uint64 gettimestamp()
 	);
 	return uint64(rethi) << 32 | retlo;
 }
+/// CLOCK_MONOTONIC in ns, served by the vDSO without entering the kernel
+inline uint64 geco_monotonic_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return uint64(ts.tv_sec) * 1000000000ULL + uint64(ts.tv_nsec);
+}
+
+/// a clock_source_t, CLOCK_SOURCE_NONE until the first gettimestamp()
+extern GECOAPI std::atomic<int> g_clock_source;
+/// choose the clock source, see geco_clock_t::source()
+int GECOAPI geco_clock_select();
+
+/**
+ * rdtsc when the TSC is invariant and the kernel keeps it in sync across
+ * cores, clock_gettime(CLOCK_MONOTONIC) in ns otherwise. the source never
+ * changes once chosen, so stamps of one process are always comparable.
+ */
+inline uint64 gettimestamp()
+{
+	int source = g_clock_source.load(std::memory_order_relaxed);
+	if (source == CLOCK_SOURCE_TSC)
+		return geco_rdtsc();
+	if (source == CLOCK_SOURCE_NONE)
+		source = geco_clock_select();
+	return source == CLOCK_SOURCE_TSC ? geco_rdtsc() : geco_monotonic_ns();
+}
 #elif defined(_WIN32)
 #ifdef GECO_USE_RDTSC
 #pragma warning (push)
@@ -111,17 +149,61 @@ inline uint64 gettimestamp()
 #endif
 
 /**
- *	This function tells you how many there are in a second. It caches its reply
- *	after being called for the first time, however that call may take some time.
+ *	This function tells you how many there are in a second. The first call
+ *	calibrates the clock and may take some time, later calls return the rate
+ *	refined by geco_clock_t::resync().
  */
 uint64 GECOAPI stamps_per_sec();
 /**
  *	This function tells you how many there are in a second as a double precision
- *	floating point value. It caches its reply after being called for the first
- *	time, however that call may take some time.
+ *	floating point value, see stamps_per_sec().
  */
 double GECOAPI stamps_per_sec_double();
 double GECOAPI stamps2sec(uint64 stamps);
+
+/**
+ *	This class converts stamps to nanoseconds with a fixed point multiply
+ *	and shift, ns = (stamps * mult) >> SHIFT, no division and no floating
+ *	point.
+ *
+ *	with the TSC source, mult is first calibrated against CLOCK_MONOTONIC_RAW
+ *	and then re-synced every RESYNC_INTERVAL_NS: the rate is re-measured over
+ *	the whole run and the offset to CLOCK_MONOTONIC_RAW is slewed away over
+ *	the next interval, never stepped, so now_ns() never goes backwards.
+ *	a re-sync is due-checked by now_ns() and stamps2ns().
+ *
+ *	with the OS source stamps already are ns and mult is 1 << SHIFT.
+ */
+struct GECOAPI geco_clock_t
+{
+		static const uint SHIFT = 32;
+		static const uint64 RESYNC_INTERVAL_NS = 1000000000ULL;
+		/// slew applied per re-sync is capped at this many parts per million
+		static const uint MAX_SLEW_PPM = 500;
+
+		/// the source of gettimestamp(), chosen on first use: the TSC if
+		/// invariant_tsc() and the kernel clocksource is "tsc", the OS clock
+		/// otherwise. GECO_CLOCK_SOURCE=tsc|os in the environment overrides.
+		static clock_source_t source();
+		/// CPUID.80000007H:EDX[8], the TSC ticks at a constant rate in every
+		/// P-, C- and T-state
+		static bool invariant_tsc();
+
+		/// a duration in stamps to ns
+		static uint64 stamps2ns(uint64 stamps);
+		/// monotonic ns, in step with CLOCK_MONOTONIC_RAW for the TSC source
+		static uint64 now_ns();
+		/// re-measure now instead of waiting for the interval
+		/// @return false if another thread is re-syncing or the source is
+		/// not the TSC
+		static bool resync();
+
+		static uint64 mult();
+		/// CLOCK_MONOTONIC_RAW minus now_ns() at the last re-sync
+		static int64 last_drift_ns();
+		static uint64 resync_count();
+};
+
 /** This class stores a value in stamps but has access functions in seconds.*/
 struct GECOAPI time_stamp_t
 {
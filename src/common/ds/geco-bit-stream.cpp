@@ -8,9 +8,206 @@
 #include "geco-bit-stream.h"
 #include "../ds/array.h"
 #include "../ultils/geco-malloc.h"
+#include "../debugging/gecowatchert.h"
 #include <list>
 #include <algorithm>
-GECO_STATIC_FACTORY_DEFIS(geco_bit_stream_t, geco_bit_stream_t);
+#include <atomic>
+#include <mutex>
+
+/// per-thread free list behind geco_bit_stream_t::get_instance().
+/// only the owner thread touches @free_, the counters are atomics so that
+/// watcher queries from other threads can sum them without locking the owner.
+class geco_bit_stream_pool_t
+{
+private:
+	std::vector<geco_bit_stream_t*> free_;
+	std::atomic<uint64> hits_;
+	std::atomic<uint64> misses_;
+	std::atomic<uint64> free_instances_;
+	std::atomic<uint64> retained_heap_bytes_;
+
+	/// all live pools, and the counters of the pools whose thread exited
+	static std::mutex& registry_mutex()
+	{
+		static std::mutex mutex;
+		return mutex;
+	}
+	static std::vector<geco_bit_stream_pool_t*>& registry()
+	{
+		static std::vector<geco_bit_stream_pool_t*> pools;
+		return pools;
+	}
+	static geco_bit_stream_pool_stats_t& retired_stats()
+	{
+		static geco_bit_stream_pool_stats_t stats = { 0, 0, 0, 0 };
+		return stats;
+	}
+
+	/// relaxed increments by the owner thread, plain load + store, no lock prefix
+	INLINE static void add(std::atomic<uint64>& counter, int64 delta)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + delta,
+			std::memory_order_relaxed);
+	}
+
+public:
+	geco_bit_stream_pool_t() : hits_(0), misses_(0), free_instances_(0),
+		retained_heap_bytes_(0)
+	{
+		free_.reserve(GECO_STREAM_POOL_MAX_FREE_INSTANCES);
+		std::lock_guard<std::mutex> lock(registry_mutex());
+		registry().push_back(this);
+	}
+	~geco_bit_stream_pool_t()
+	{
+		for (auto stream : free_)
+			delete stream;
+		std::lock_guard<std::mutex> lock(registry_mutex());
+		retired_stats().hits += hits_.load(std::memory_order_relaxed);
+		retired_stats().misses += misses_.load(std::memory_order_relaxed);
+		auto& pools = registry();
+		pools.erase(std::remove(pools.begin(), pools.end(), this), pools.end());
+	}
+
+	static geco_bit_stream_pool_t& thread_pool()
+	{
+		static thread_local geco_bit_stream_pool_t pool;
+		return pool;
+	}
+
+	INLINE geco_bit_stream_t* get()
+	{
+		if (free_.empty())
+		{
+			add(misses_, 1);
+			return new geco_bit_stream_t;
+		}
+		geco_bit_stream_t* stream = free_.back();
+		free_.pop_back();
+		add(free_instances_, -1);
+		add(hits_, 1);
+		if (stream->uchar_data_ != stream->statck_buffer_)
+			add(retained_heap_bytes_, -(int64)BITS_TO_BYTES(stream->allocated_bits_size_));
+		/// same state as the default ctor except that the buffer is not
+		/// zeroed, writes never depend on the old bytes
+		stream->writable_bit_pos_ = stream->readable_bit_pos_ = 0;
+		stream->is_read_only_ = false;
+		stream->enabble_compression = true;
+		return stream;
+	}
+
+	INLINE void reclaim(geco_bit_stream_t* stream)
+	{
+		if (free_.size() >= GECO_STREAM_POOL_MAX_FREE_INSTANCES)
+		{
+			delete stream;
+			return;
+		}
+		if (stream->uchar_data_ != stream->statck_buffer_)
+		{
+			byte_size_t bytes = BITS_TO_BYTES(stream->allocated_bits_size_);
+			if (stream->can_free_ &&
+				bytes <= GECO_STREAM_POOL_MAX_RETAINED_BUFFER_BYTES &&
+				retained_heap_bytes_.load(std::memory_order_relaxed) + bytes <=
+				GECO_STREAM_POOL_MAX_RETAINED_BYTES)
+			{
+				add(retained_heap_bytes_, bytes);
+			}
+			else
+			{
+				/// too big to keep or not ours (user buffer), fall back to
+				/// the inline buffer
+				if (stream->can_free_)
+					free(stream->uchar_data_);
+				stream->uchar_data_ = stream->statck_buffer_;
+				stream->allocated_bits_size_ = GECO_STREAM_STACK_ALLOC_BITS;
+				stream->can_free_ = false;
+			}
+		}
+		free_.push_back(stream);
+		add(free_instances_, 1);
+	}
+
+	static void get_stats(geco_bit_stream_pool_stats_t& stats)
+	{
+		std::lock_guard<std::mutex> lock(registry_mutex());
+		stats = retired_stats();
+		for (auto pool : registry())
+		{
+			stats.hits += pool->hits_.load(std::memory_order_relaxed);
+			stats.misses += pool->misses_.load(std::memory_order_relaxed);
+			stats.free_instances += pool->free_instances_.load(std::memory_order_relaxed);
+			stats.retained_heap_bytes += pool->retained_heap_bytes_.load(std::memory_order_relaxed);
+		}
+	}
+};
+
+#if ENABLE_WATCHERS
+// The watcher getters hand back a reference, so each one reads the pool into
+// its own local stats and returns a per-thread copy of the field it wants;
+// concurrent watcher reads then share nothing.
+static uint64& pool_hits()
+{
+	geco_bit_stream_pool_stats_t stats;
+	geco_bit_stream_pool_t::get_stats(stats);
+	static thread_local uint64 value;
+	value = stats.hits;
+	return value;
+}
+static uint64& pool_misses()
+{
+	geco_bit_stream_pool_stats_t stats;
+	geco_bit_stream_pool_t::get_stats(stats);
+	static thread_local uint64 value;
+	value = stats.misses;
+	return value;
+}
+static uint64& pool_free_instances()
+{
+	geco_bit_stream_pool_stats_t stats;
+	geco_bit_stream_pool_t::get_stats(stats);
+	static thread_local uint64 value;
+	value = stats.free_instances;
+	return value;
+}
+static uint64& pool_retained_heap_bytes()
+{
+	geco_bit_stream_pool_stats_t stats;
+	geco_bit_stream_pool_t::get_stats(stats);
+	static thread_local uint64 value;
+	value = stats.retained_heap_bytes;
+	return value;
+}
+static bool add_pool_watchers()
+{
+	GECO_WATCH("Memory/BitStreamPool/hits", CAST_FUNC_R(uint64, pool_hits),
+		"get_instance() served from a per-thread free list");
+	GECO_WATCH("Memory/BitStreamPool/misses", CAST_FUNC_R(uint64, pool_misses),
+		"get_instance() that had to new a stream");
+	GECO_WATCH("Memory/BitStreamPool/freeInstances", CAST_FUNC_R(uint64, pool_free_instances),
+		"streams sitting in the per-thread free lists");
+	GECO_WATCH("Memory/BitStreamPool/retainedHeapBytes", CAST_FUNC_R(uint64, pool_retained_heap_bytes),
+		"heap buffers kept alive by the free streams");
+	return true;
+}
+#endif
+
+geco_bit_stream_t* geco_bit_stream_t::get_instance(void)
+{
+#if ENABLE_WATCHERS
+	static bool watchers_added = add_pool_watchers();
+	(void)watchers_added;
+#endif
+	return geco_bit_stream_pool_t::thread_pool().get();
+}
+void geco_bit_stream_t::reclaim_instance(geco_bit_stream_t* i)
+{
+	geco_bit_stream_pool_t::thread_pool().reclaim(i);
+}
+void geco_bit_stream_t::get_pool_stats(geco_bit_stream_pool_stats_t& stats)
+{
+	geco_bit_stream_pool_t::get_stats(stats);
+}
 
 const unsigned int englishCharacterFrequencies[256] = { 0, 0, 0, 0, 0, 0, 0, 0,
 		0, 0, 722, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -193,6 +390,86 @@ void HuffmanEncodingTree::GenerateFromFrequencyTable(
 	}
 	std::sort(encodingTableSorted.begin(), encodingTableSorted.end(),
 		cmp_char_encoding_bitslen);
+
+	GenerateDecodeTable();
+}
+
+void HuffmanEncodingTree::GenerateDecodeTable(void) {
+	// Walk every HUFFMAN_DECODE_TABLE_BITS bits pattern from the root and
+	// record the complete codes it contains, a partial code at the end is
+	// left for the next lookup
+	for (uint window = 0; window < (1u << HUFFMAN_DECODE_TABLE_BITS); window++) {
+		HuffmanEncodingTreeNode *node = root;
+		uint symbols = 0, count = 0, used = 0;
+		for (uint bit = 0; bit < HUFFMAN_DECODE_TABLE_BITS; bit++) {
+			if ((window >> (HUFFMAN_DECODE_TABLE_BITS - 1 - bit)) & 1)
+				node = node->right;
+			else
+				node = node->left;
+			if (node->left == 0 && node->right == 0) {
+				symbols |= (uint)node->value << (count << 3);
+				used = bit + 1;
+				node = root;
+				if (++count == HUFFMAN_DECODE_TABLE_SYMBOLS)
+					break;
+			}
+		}
+		decodeTable[window] = symbols | (count << 24) | (used << 26);
+	}
+}
+
+template<class EMIT>
+unsigned HuffmanEncodingTree::DecodeBits(const unsigned char *data,
+	bit_size_t startBit, bit_size_t sizeInBits, EMIT& emit) const {
+	const unsigned char *src = data + (startBit >> 3);
+	const unsigned char *end = data + BITS_TO_BYTES(startBit + sizeInBits);
+	/// next bits left aligned, bits past @end read as zero
+	uint64 bits = 0;
+	int avail = 0;
+	unsigned decoded = 0;
+
+#define HUFFMAN_REFILL_BITS() \
+	while (avail <= 56 && src < end) { \
+		bits |= (uint64)*src++ << (56 - avail); \
+		avail += 8; \
+	}
+
+	HUFFMAN_REFILL_BITS();
+	bits <<= startBit & 7;
+	avail -= startBit & 7;
+
+	while (sizeInBits > 0) {
+		HUFFMAN_REFILL_BITS();
+		uint entry = decodeTable[bits >> (64 - HUFFMAN_DECODE_TABLE_BITS)];
+		uint used = entry >> 26;
+		if (used != 0 && used <= sizeInBits) {
+			uint count = (entry >> 24) & 3;
+			for (uint i = 0; i < count; i++)
+				emit((unsigned char)(entry >> (i << 3)), decoded++);
+			bits <<= used;
+			avail -= used;
+			sizeInBits -= used;
+			continue;
+		}
+
+		// The code is longer than the table or cut by the end of the input,
+		// walk the tree for this one symbol
+		HuffmanEncodingTreeNode *node = root;
+		while (sizeInBits > 0) {
+			if (avail <= 0)
+				HUFFMAN_REFILL_BITS();
+			node = (bits >> 63) ? node->right : node->left;
+			bits <<= 1;
+			avail--;
+			sizeInBits--;
+			if (node->left == 0 && node->right == 0) {
+				emit(node->value, decoded++);
+				break;
+			}
+		}
+	}
+#undef HUFFMAN_REFILL_BITS
+	return decoded;
 }
 
 // Pass an array of bytes to array and a preallocated JackieBits to receive the output
@@ -222,7 +499,36 @@ void HuffmanEncodingTree::EncodeArray(unsigned char *input, size_t sizeInBytes,
 
 	}
 }
+namespace {
+struct huffman_array_emitter_t {
+	unsigned char *output;
+	size_t maxCharsToWrite;
+	INLINE void operator()(unsigned char value, unsigned index) {
+		if (index < maxCharsToWrite)
+			output[index] = value;
+	}
+};
+struct huffman_stream_emitter_t {
+	geco_bit_stream_t *output;
+	INLINE void operator()(unsigned char value, unsigned /*index*/) {
+		// Use WriteBits instead of Write(char) because we want to avoid TYPE_CHECKING
+		output->WriteBits(&value, 8, true);
+	}
+};
+}
+
 unsigned HuffmanEncodingTree::DecodeArray(geco_bit_stream_t * input,
+	bit_size_t sizeInBits, size_t maxCharsToWrite, unsigned char *output) {
+	assert(input->get_payloads() >= sizeInBits);
+	if (sizeInBits == 0)
+		return 0;
+	huffman_array_emitter_t emit = { output, maxCharsToWrite };
+	bit_size_t startBit = input->readable_bit_pos();
+	unsigned decoded = DecodeBits(input->uchar_data(), startBit, sizeInBits, emit);
+	input->readable_bit_pos(startBit + sizeInBits);
+	return decoded;
+}
+unsigned HuffmanEncodingTree::DecodeArrayByTreeWalk(geco_bit_stream_t * input,
 	bit_size_t sizeInBits, size_t maxCharsToWrite, unsigned char *output) {
 	HuffmanEncodingTreeNode * currentNode;
 	unsigned outputWriteIndex;
@@ -252,26 +558,10 @@ unsigned HuffmanEncodingTree::DecodeArray(geco_bit_stream_t * input,
 // Pass an array of encoded bytes to array and a preallocated JackieBits to receive the output
 void HuffmanEncodingTree::DecodeArray(unsigned char *input,
 	bit_size_t sizeInBits, geco_bit_stream_t * output) {
-	HuffmanEncodingTreeNode * currentNode;
 	if (sizeInBits <= 0)
 		return;
-	geco_bit_stream_t bitStream(input, BITS_TO_BYTES(sizeInBits), false);
-	currentNode = root;
-
-	// For each bit, go left if it is a 0 and right if it is a 1.  When we reach a leaf, that gives us the desired value and we restart from the root
-	for (unsigned counter = 0; counter < sizeInBits; counter++) {
-		if (bitStream.ReadBit() == false)   // left!
-			currentNode = currentNode->left;
-		else
-			currentNode = currentNode->right;
-
-		if (currentNode->left == 0 && currentNode->right == 0)   // Leaf
-		{
-			// Use WriteBits instead of Write(char) because we want to avoid TYPE_CHECKING
-			output->WriteBits(&(currentNode->value), 8, true);
-			currentNode = root;
-		}
-	}
+	huffman_stream_emitter_t emit = { output };
+	DecodeBits(input, 0, sizeInBits, emit);
 }
 
 geco_string_compressor_t* geco_string_compressor_t::instance = 0;
@@ -639,6 +929,23 @@ void geco_bit_stream_t::ReadBits(uchar *dest, bit_size_t bits2Read,
 		return;
 	}
 
+	/// word-at-a-time path for sub-word unaligned reads:
+	/// load all the bytes that cover the bits with one unaligned load,
+	/// shift out the consumed bits and scatter the result into @dest.
+	/// the bytes read (including any bits past @bits2Read in the last
+	/// covering byte when not @alignRight) are same to the byte loop below
+	if (startReadPosBits != 0 && bits2Read <= GECO_STREAM_WORD_MAX_BITS) {
+		uint64 word = load_word(readPosByte,
+			BITS_TO_BYTES(startReadPosBits + bits2Read)) << startReadPosBits;
+		const byte_size_t bytes2Write = BITS_TO_BYTES(bits2Read);
+		for (byte_size_t i = 0; i < bytes2Write; i++)
+			dest[i] = (uchar)(word >> (56 - (i << 3)));
+		if (alignRight && (bits2Read & 7) != 0)
+			dest[bytes2Write - 1] >>= (8 - (bits2Read & 7));
+		readable_bit_pos_ += bits2Read;
+		return;
+	}
+
 	/// if @mReadPosBits is aligned  do memcpy_fast for efficiency
 	if (startReadPosBits == 0) {
 		memcpy_fast(dest, &uchar_data_[readPosByte], BITS_TO_BYTES(bits2Read));
@@ -766,7 +1073,8 @@ void geco_bit_stream_t::WriteBits(const uchar* src, bit_size_t bits2Write,
 	//if( mReadOnly ) return false;
 	//if( bits2Write == 0 ) return false;
 
-	AppendBitsCouldRealloc(bits2Write);
+	if (writable_bit_pos_ + bits2Write > allocated_bits_size_)
+		AppendBitsCouldRealloc(bits2Write);
 
 	/// get offset that overlaps one byte boudary, &7 is same to %8, but faster
 	/// @startWritePosBits could be zero
@@ -779,6 +1087,31 @@ void geco_bit_stream_t::WriteBits(const uchar* src, bit_size_t bits2Write,
 		return;
 	}
 
+	/// word-at-a-time path for sub-word writes:
+	/// gather @src into the top of a big-endian word, splice it after the
+	/// bits already in the current byte and store only the covering bytes.
+	/// the bytes stored are same to the byte loop below, which ors into the
+	/// current byte and assigns all following ones
+	if (bits2Write <= GECO_STREAM_WORD_MAX_BITS) {
+		const byte_size_t srcBytes = BITS_TO_BYTES(bits2Write);
+		uint64 word = 0;
+		for (byte_size_t i = 0; i + 1 < srcBytes; i++)
+			word |= (uint64)src[i] << (56 - (i << 3));
+		uchar lastByte = src[srcBytes - 1];
+		if ((bits2Write & 7) != 0 && rightAligned)
+			lastByte <<= 8 - (bits2Write & 7);
+		word |= (uint64)lastByte << (56 - ((srcBytes - 1) << 3));
+
+		uchar* dest = uchar_data_ + (writable_bit_pos_ >> 3);
+		if (startWritePosBits != 0)
+			word = ((uint64)dest[0] << 56) | (word >> startWritePosBits);
+		const byte_size_t destBytes = BITS_TO_BYTES(startWritePosBits + bits2Write);
+		for (byte_size_t i = 0; i < destBytes; i++)
+			dest[i] = (uchar)(word >> (56 - (i << 3)));
+		writable_bit_pos_ += bits2Write;
+		return;
+	}
+
 	uchar dataByte;
 	//const uchar* inputPtr = src;
 
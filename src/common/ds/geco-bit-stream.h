@@ -58,6 +58,13 @@
 #define GECO_STREAM_STACK_ALLOC_BYTES 1512
 #define GECO_STREAM_STACK_ALLOC_BITS (BYTES_TO_BITS(GECO_STREAM_STACK_ALLOC_BYTES))
 
+/// max number of free streams each thread keeps for geco_bit_stream_t::get_instance()
+#define GECO_STREAM_POOL_MAX_FREE_INSTANCES 64
+/// a reclaimed stream keeps its grown heap buffer only if it is not larger than this
+#define GECO_STREAM_POOL_MAX_RETAINED_BUFFER_BYTES (64*1024)
+/// max heap bytes all free streams of one thread can keep
+#define GECO_STREAM_POOL_MAX_RETAINED_BYTES (1024*1024)
+
 // another imple of singleton using static methods instead of inhertance
 #define GECO_STATIC_FACTORY_DELC(TYPE)\
 static TYPE* get_instance(void);\
@@ -159,6 +166,46 @@ INLINE uint GECO_UNPACK3(const char *pData)
 #define GECO_NTOHF_ASSIGN( dest, x ) GECO_HTONF_ASSIGN( dest, x )
 #define GECO_NTOH3_ASSIGN( pDest, pData ) GECO_HTON3_ASSIGN( pDest, pData )
 
+/// The largest run of bits WriteBits()/ReadBits() splice through one 64-bit
+/// word. 56 bits plus a 7-bit start offset still fits in a single word.
+#define GECO_STREAM_WORD_MAX_BITS 56
+
+/// load/store 8 bytes at any address as a big-endian (wire order) word.
+/// the first byte in memory always lands in the top 8 bits of the word,
+/// which is the bit order geco_bit_stream_t writes in.
+INLINE uint64 GECO_LOAD_BE64(const uchar* pSrc)
+{
+	uint64 v;
+	memcpy(&v, pSrc, sizeof(v));
+#if defined(_MSC_VER)
+	return _byteswap_uint64(v);
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+	return __builtin_bswap64(v);
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__)
+	return v;
+#else
+	const uchar* p = pSrc;
+	return ((uint64)p[0] << 56) | ((uint64)p[1] << 48) | ((uint64)p[2] << 40) |
+		((uint64)p[3] << 32) | ((uint64)p[4] << 24) | ((uint64)p[5] << 16) |
+		((uint64)p[6] << 8) | (uint64)p[7];
+#endif
+}
+INLINE void GECO_STORE_BE64(uchar* pDest, uint64 v)
+{
+#if defined(_MSC_VER)
+	v = _byteswap_uint64(v);
+	memcpy(pDest, &v, sizeof(v));
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+	v = __builtin_bswap64(v);
+	memcpy(pDest, &v, sizeof(v));
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__)
+	memcpy(pDest, &v, sizeof(v));
+#else
+	for (int i = 0; i < 8; i++)
+		pDest[i] = (uchar)(v >> (56 - (i << 3)));
+#endif
+}
+
 typedef uint32 bit_size_t;
 typedef uint32 byte_size_t;
 
@@ -171,6 +218,22 @@ union MultiType
 
 class uint24_t;
 class geco_bit_stream_t;
+class geco_bit_accumulator_t;
+class geco_bit_stream_pool_t;
+
+/// counters of the per-thread pools behind geco_bit_stream_t::get_instance(),
+/// summed over all threads that ever used the pool
+struct geco_bit_stream_pool_stats_t
+{
+	/// get_instance() served from a free list
+	uint64 hits;
+	/// get_instance() had to new a stream
+	uint64 misses;
+	/// streams sitting in free lists
+	uint64 free_instances;
+	/// heap buffers kept alive by the free streams
+	uint64 retained_heap_bytes;
+};
 
 /// JackieStringCompressor
 
@@ -187,6 +250,11 @@ struct CharacterEncoding {
 	unsigned char* encoding;
 	unsigned short bitLength;
 };
+/// bits looked up per step by the table driven huffman decoder
+#define HUFFMAN_DECODE_TABLE_BITS 11
+/// max symbols one table entry can emit
+#define HUFFMAN_DECODE_TABLE_SYMBOLS 3
+
 /// This generates special cases of the huffman encoding tree using 8 bit keys
 /// with the additional condition that unused combinations of 8 bits are treated as a frequency of 1
 class GECOAPI HuffmanEncodingTree {
@@ -203,11 +271,19 @@ public:
 		geco_bit_stream_t * output);
 
 	/// \brief Decodes an array encoded by EncodeArray().
+	/// looks up HUFFMAN_DECODE_TABLE_BITS bits per step and emits up to
+	/// HUFFMAN_DECODE_TABLE_SYMBOLS symbols per lookup, only codes longer
+	/// than the table walk the tree. output is same to DecodeArrayByTreeWalk().
 	unsigned DecodeArray(geco_bit_stream_t * input, bit_size_t sizeInBits,
 		size_t maxCharsToWrite, unsigned char *output);
 	void DecodeArray(unsigned char *input, bit_size_t sizeInBits,
 		geco_bit_stream_t * output);
 
+	/// \brief reference decoder walking the tree one bit per step,
+	/// kept for tests and benchmarks.
+	unsigned DecodeArrayByTreeWalk(geco_bit_stream_t * input, bit_size_t sizeInBits,
+		size_t maxCharsToWrite, unsigned char *output);
+
 	/// \brief Given a frequency table of 256 elements, all with a frequency of 1 or more, generate the tree.
 	void GenerateFromFrequencyTable(const unsigned int frequencyTable[256] = 0);
 
@@ -219,6 +295,16 @@ private:
 	HuffmanEncodingTreeNode *root;
 	CharacterEncoding encodingTable[256];
 	std::vector<CharacterEncoding*> encodingTableSorted;
+	/// indexed by the next HUFFMAN_DECODE_TABLE_BITS bits starting at the root:
+	/// bits 0-23 decoded symbols in order, bits 24-25 symbols count,
+	/// bits 26-29 bits used by those symbols, 0 if the first code is
+	/// longer than the table.
+	uint decodeTable[1 << HUFFMAN_DECODE_TABLE_BITS];
+
+	void GenerateDecodeTable(void);
+	template<class EMIT>
+	unsigned DecodeBits(const unsigned char *data, bit_size_t startBit,
+		bit_size_t sizeInBits, EMIT& emit) const;
 };
 
 class GECOAPI geco_string_compressor_t {
@@ -314,6 +400,8 @@ public:
 //! (8+7)>>3 = 15/8 = 1 ( also is the number of written bytes)
 //!
 class geco_bit_stream_t {
+	friend class geco_bit_accumulator_t;
+	friend class geco_bit_stream_pool_t;
 private:
 	bit_size_t allocated_bits_size_;
 	bit_size_t writable_bit_pos_;
@@ -334,8 +422,28 @@ private:
 		ushort m_acZShort;
 	};
 
+	/// @brief load the @bytes2Load bytes starting at @bytePos as the top of
+	/// a big-endian word, the rest of the word is zero.
+	/// does one unaligned 8-byte load when the buffer is long enough,
+	/// otherwise gathers byte by byte so we never read past the allocation.
+	INLINE uint64 load_word(byte_size_t bytePos, uint bytes2Load) const {
+		assert(bytes2Load > 0 && bytes2Load <= 8);
+		if (bytePos + 8 <= BITS_TO_BYTES(allocated_bits_size_))
+			return GECO_LOAD_BE64(uchar_data_ + bytePos)
+			& (~(uint64)0 << ((8 - bytes2Load) << 3));
+		uint64 word = 0;
+		for (uint i = 0; i < bytes2Load; i++)
+			word |= (uint64)uchar_data_[bytePos + i] << (56 - (i << 3));
+		return word;
+	}
+
 public:
+	/// get_instance() pops a stream from the free list of the calling thread
+	/// and only news one when the list is empty. reclaim_instance() pushes it
+	/// back, keeping a grown heap buffer within the retained byte caps above.
+	/// a stream can be reclaimed on a different thread than it was got.
 	GECO_STATIC_FACTORY_DELC(geco_bit_stream_t);
+	static void get_pool_stats(geco_bit_stream_pool_stats_t& stats);
 
 	/// @Param [in] [ bit_size_t initialBytesAllocate]:
 	/// the number of bytes to pre-allocate.
@@ -1135,7 +1243,9 @@ public:
 		//data[mWritingPosBits >> 3] = ((data[mWritingPosBits >> 3] >> shit) << shit);
 		//mWritingPosBits++;
 
-		AppendBitsCouldRealloc(1);
+		/// only call out of line when the buffer really has to grow
+		if (writable_bit_pos_ >= allocated_bits_size_)
+			AppendBitsCouldRealloc(1);
 		/// New bytes need to be zeroed
 		if ((writable_bit_pos_ & 7) == 0)
 			uchar_data_[writable_bit_pos_ >> 3] = 0;
@@ -1148,7 +1258,8 @@ public:
 	/// @author mengdi[Jackie]
 	inline void WriteBitOne(void) {
 		assert(is_read_only_ == false);
-		AppendBitsCouldRealloc(1);
+		if (writable_bit_pos_ >= allocated_bits_size_)
+			AppendBitsCouldRealloc(1);
 
 		// Write bit 1
 		bit_size_t shift = writable_bit_pos_ & 7;
@@ -1978,9 +2089,9 @@ public:
 		AppendBitsCouldRealloc(24);
 #ifndef DO_NOT_SWAP_ENDIAN
 		if (DoEndianSwap()) {
-			uchar_data_[(writable_bit_pos_ >> 3) + 0] = inByteArray[3];
-			uchar_data_[(writable_bit_pos_ >> 3) + 1] = inByteArray[2];
-			uchar_data_[(writable_bit_pos_ >> 3) + 2] = inByteArray[1];
+			uchar_data_[(writable_bit_pos_ >> 3) + 0] = inByteArray[2];
+			uchar_data_[(writable_bit_pos_ >> 3) + 1] = inByteArray[1];
+			uchar_data_[(writable_bit_pos_ >> 3) + 2] = inByteArray[0];
 		}
 		else
 #endif
@@ -1999,9 +2110,9 @@ public:
 		//if (mReadPosBits + 4 * 8 > mWritePosBits) return;
 #ifndef DO_NOT_SWAP_ENDIAN
 		if (DoEndianSwap()) {
-			inOutByteArray[0] = uchar_data_[(readable_bit_pos_ >> 3) + 3];
-			inOutByteArray[1] = uchar_data_[(readable_bit_pos_ >> 3) + 2];
-			inOutByteArray[2] = uchar_data_[(readable_bit_pos_ >> 3) + 1];
+			inOutByteArray[0] = uchar_data_[(readable_bit_pos_ >> 3) + 2];
+			inOutByteArray[1] = uchar_data_[(readable_bit_pos_ >> 3) + 1];
+			inOutByteArray[2] = uchar_data_[(readable_bit_pos_ >> 3) + 0];
 		}
 		else
 #endif
@@ -2206,6 +2317,142 @@ public:
 	bool is_compression_mode() { return enabble_compression; }
 };
 
+/// @brief 64-bit accumulator mode over a geco_bit_stream_t.
+/// @details
+/// writes are buffered in a register and flushed into the stream
+/// one whole 64-bit word at a time, reads are done with unaligned 64-bit
+/// loads straight from the stream buffer. fields written through it
+/// produce the same bytes as the equivalent geco_bit_stream_t calls:
+/// write_bits(v, n) == WriteBits(&u8, n) for n <= 8,
+/// write(integral) == Write(integral) and write(bool) == Write(bool).
+/// @notice
+/// 1. pending bits only reach the stream when the accumulator is destroyed,
+/// so do not touch the written side of the stream while one is alive.
+/// 2. reads are not buffered and can be mixed freely with stream reads.
+/// usage:
+/// {
+///     geco_bit_accumulator_t acc(stream);
+///     acc.write(true);
+///     acc.write_bits(yaw, 5);
+/// } // pending bits written to stream here
+class geco_bit_accumulator_t
+{
+private:
+	geco_bit_stream_t& stream_;
+	/// pending bits left aligned (MSB is the next bit on the wire)
+	uint64 acc_;
+	/// number of valid bits in @acc_, always < 64 between calls
+	uint pending_bits_;
+
+	/// move the partial byte at the stream write pos into the register so
+	/// that the stream write pos is always byte aligned while we buffer
+	INLINE void absorb_partial_byte() {
+		pending_bits_ = stream_.writable_bit_pos_ & 7;
+		stream_.writable_bit_pos_ -= pending_bits_;
+		acc_ = pending_bits_ ?
+			(uint64)stream_.uchar_data_[stream_.writable_bit_pos_ >> 3] << 56 : 0;
+	}
+	INLINE void flush_word(uint64 word) {
+		if (stream_.writable_bit_pos_ + 64 > stream_.allocated_bits_size_)
+			stream_.AppendBitsCouldRealloc(64);
+		GECO_STORE_BE64(stream_.uchar_data_ + (stream_.writable_bit_pos_ >> 3), word);
+		stream_.writable_bit_pos_ += 64;
+	}
+
+public:
+	explicit geco_bit_accumulator_t(geco_bit_stream_t& stream) :
+		stream_(stream), acc_(0), pending_bits_(0) {
+		assert(stream_.is_read_only_ == false);
+		absorb_partial_byte();
+	}
+	/// push all pending bits including the last partial byte into the stream
+	~geco_bit_accumulator_t() {
+		if (pending_bits_ == 0)
+			return;
+		if (stream_.writable_bit_pos_ + pending_bits_ > stream_.allocated_bits_size_)
+			stream_.AppendBitsCouldRealloc(pending_bits_);
+		uchar* dest = stream_.uchar_data_ + (stream_.writable_bit_pos_ >> 3);
+		for (uint i = 0; i < BITS_TO_BYTES(pending_bits_); i++)
+			dest[i] = (uchar)(acc_ >> (56 - (i << 3)));
+		stream_.writable_bit_pos_ += pending_bits_;
+	}
+
+	/// @brief write the low @bits2Write bits of @value, MSB first.
+	/// @param [in] value user data, right aligned
+	/// @param [in] bits2Write 1 - 64
+	INLINE void write_bits(uint64 value, uint bits2Write) {
+		assert(bits2Write > 0 && bits2Write <= 64);
+		value &= ~(uint64)0 >> (64 - bits2Write);
+		const uint freeBits = 64 - pending_bits_;
+		if (bits2Write < freeBits) {
+			acc_ |= value << (freeBits - bits2Write);
+			pending_bits_ += bits2Write;
+			return;
+		}
+		/// fill up the register, flush it and keep the rest
+		const uint restBits = bits2Write - freeBits;
+		flush_word(acc_ | (value >> restBits));
+		acc_ = restBits ? value << (64 - restBits) : 0;
+		pending_bits_ = restBits;
+	}
+	INLINE void write(bool src) {
+		if (pending_bits_ == 63) {
+			flush_word(acc_ | (uint64)src);
+			acc_ = 0;
+			pending_bits_ = 0;
+			return;
+		}
+		acc_ |= (uint64)src << (63 - pending_bits_);
+		pending_bits_++;
+	}
+	/// @brief same wire format as geco_bit_stream_t::Write(IntegralType)
+	template<class IntegralType>
+	INLINE void write(const IntegralType& src) {
+		GECO_STATIC_ASSERT(sizeof(IntegralType) <= 8, integral_type_too_large);
+		uint64 v = 0;
+		memcpy(&v, &src, sizeof(IntegralType));
+		if (!geco_bit_stream_t::IsBigEndian())
+			write_bits(v, BYTES_TO_BITS(sizeof(IntegralType)));
+		else
+			write_bits(v >> ((8 - sizeof(IntegralType)) << 3), BYTES_TO_BITS(sizeof(IntegralType)));
+	}
+	/// @brief same wire format as geco_bit_stream_t::WriteBits()
+	void write_bits(const uchar* src, bit_size_t bits2Write, bool rightAligned = true) {
+		for (; bits2Write >= 8; bits2Write -= 8)
+			write_bits(*src++, 8);
+		if (bits2Write > 0)
+			write_bits(rightAligned ? *src : (*src >> (8 - bits2Write)), bits2Write);
+	}
+
+	/// @brief read @bits2Read bits into the low bits of the result, MSB first.
+	/// @param [in] bits2Read 1 - 57
+	INLINE uint64 read_bits(uint bits2Read) {
+		assert(bits2Read > 0 && bits2Read <= 57);
+		assert(stream_.get_payloads() >= bits2Read);
+		const uint startBits = stream_.readable_bit_pos_ & 7;
+		uint64 word = stream_.load_word(stream_.readable_bit_pos_ >> 3,
+			BITS_TO_BYTES(startBits + bits2Read));
+		stream_.readable_bit_pos_ += bits2Read;
+		return (word << startBits) >> (64 - bits2Read);
+	}
+	INLINE void read(bool& dest) {
+		dest = read_bits(1) != 0;
+	}
+	/// @brief same wire format as geco_bit_stream_t::Read(IntegralType)
+	template<class IntegralType>
+	INLINE void read(IntegralType& dest) {
+		GECO_STATIC_ASSERT(sizeof(IntegralType) <= 8, integral_type_too_large);
+		uint64 v;
+		if (sizeof(IntegralType) == 8)
+			v = (read_bits(32) << 32) | read_bits(32);
+		else
+			v = read_bits(BYTES_TO_BITS(sizeof(IntegralType)));
+		if (geco_bit_stream_t::IsBigEndian())
+			v <<= (8 - sizeof(IntegralType)) << 3;
+		memcpy(&dest, &v, sizeof(IntegralType));
+	}
+};
+
 INLINE geco_bit_stream_t& operator<<(geco_bit_stream_t& kOS, const std::string& kData)
 {
 	kOS.Write(kData);
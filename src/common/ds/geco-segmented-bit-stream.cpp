@@ -0,0 +1,263 @@
+/*
+ * Geco Gaming Company
+ * All Rights Reserved.
+ * Copyright (c)  2016 GECOEngine.
+ *
+ * GECOEngine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GECOEngine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with KBEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+ /*
+  * geco-segmented-bit-stream.cpp
+  */
+
+#include "geco-segmented-bit-stream.h"
+
+geco_stream_segment_pool_t::geco_stream_segment_pool_t(uint max_free_size) :
+	free_list_(NULL), free_size_(0), max_free_size_(max_free_size),
+	allocated_size_(0)
+{
+}
+
+geco_stream_segment_pool_t::~geco_stream_segment_pool_t()
+{
+	while (free_list_ != NULL)
+	{
+		geco_stream_segment_t* next = free_list_->next;
+		geco_free_ext(free_list_, FILE_AND_LINE);
+		free_list_ = next;
+	}
+	free_size_ = 0;
+}
+
+void geco_stream_segment_pool_t::reclaim_segments(geco_stream_segment_t* head)
+{
+	while (head != NULL)
+	{
+		geco_stream_segment_t* next = head->next;
+		reclaim_segment(head);
+		head = next;
+	}
+}
+
+geco_stream_segment_pool_t& geco_stream_segment_pool_t::thread_pool()
+{
+	static thread_local geco_stream_segment_pool_t pool;
+	return pool;
+}
+
+geco_segmented_bit_stream_t::geco_segmented_bit_stream_t(
+	geco_stream_segment_pool_t& pool) :
+	pool_(pool), head_(NULL), write_seg_(NULL), write_seg_pos_(0),
+	read_seg_(NULL), read_seg_pos_(0), writable_bit_pos_(0),
+	readable_bit_pos_(0), segments_size_(0)
+{
+}
+
+geco_segmented_bit_stream_t::~geco_segmented_bit_stream_t()
+{
+	pool_.reclaim_segments(head_);
+}
+
+void geco_segmented_bit_stream_t::reset()
+{
+	pool_.reclaim_segments(head_);
+	head_ = write_seg_ = read_seg_ = NULL;
+	write_seg_pos_ = read_seg_pos_ = 0;
+	writable_bit_pos_ = readable_bit_pos_ = 0;
+	segments_size_ = 0;
+}
+
+void geco_segmented_bit_stream_t::write_aligned_bytes(const uchar* src,
+	byte_size_t size)
+{
+	assert((writable_bit_pos_ & 7) == 0);
+	while (size > 0)
+	{
+		uchar* dest = write_byte();
+		byte_size_t room = BITS_TO_BYTES(write_seg_pos_ +
+			GECO_STREAM_SEGMENT_BITS - writable_bit_pos_);
+		if (room > size) room = size;
+		memcpy_fast(dest, src, room);
+		src += room;
+		size -= room;
+		writable_bit_pos_ += BYTES_TO_BITS(room);
+	}
+}
+
+void geco_segmented_bit_stream_t::ReadAlignedBytes(uchar* dest,
+	byte_size_t size)
+{
+	assert((readable_bit_pos_ & 7) == 0);
+	assert(get_payloads() >= BYTES_TO_BITS(size));
+	while (size > 0)
+	{
+		if (readable_bit_pos_ - read_seg_pos_ >= GECO_STREAM_SEGMENT_BITS)
+		{
+			read_seg_ = read_seg_->next;
+			read_seg_pos_ += GECO_STREAM_SEGMENT_BITS;
+		}
+		byte_size_t offset = (readable_bit_pos_ - read_seg_pos_) >> 3;
+		byte_size_t room = GECO_STREAM_SEGMENT_BYTES - offset;
+		if (room > size) room = size;
+		memcpy_fast(dest, read_seg_->data + offset, room);
+		dest += room;
+		size -= room;
+		readable_bit_pos_ += BYTES_TO_BITS(room);
+	}
+}
+
+void geco_segmented_bit_stream_t::WriteBits(const uchar* src,
+	bit_size_t bits2Write, bool rightAligned /*= true*/)
+{
+	assert(bits2Write > 0);
+
+	/// whole bytes at a byte boundary go segment by segment with memcpy
+	if ((writable_bit_pos_ & 7) == 0 && (bits2Write & 7) == 0)
+	{
+		write_aligned_bytes(src, bits2Write >> 3);
+		return;
+	}
+
+	/// all bits land in the current segment, splice them with a raw
+	/// pointer like geco_bit_stream_t::WriteBits() does
+	const bit_size_t segOffset = writable_bit_pos_ - write_seg_pos_;
+	if (write_seg_ != NULL && segOffset + bits2Write <= GECO_STREAM_SEGMENT_BITS)
+	{
+		uchar* dest = write_seg_->data + (segOffset >> 3);
+		const uint startBits = writable_bit_pos_ & 7;
+		const uint lastBits = bits2Write & 7;
+		writable_bit_pos_ += bits2Write;
+		if (startBits == 0)
+		{
+			memcpy_fast(dest, src, bits2Write >> 3);
+			if (lastBits > 0)
+			{
+				uchar dataByte = src[bits2Write >> 3];
+				if (rightAligned)
+					dataByte <<= 8 - lastBits;
+				dest[bits2Write >> 3] = dataByte & (uchar)(0xFF00 >> lastBits);
+			}
+			return;
+		}
+		for (; bits2Write >= 8; bits2Write -= 8)
+		{
+			*dest++ |= *src >> startBits;
+			*dest = (uchar)(*src++ << (8 - startBits));
+		}
+		if (lastBits > 0)
+		{
+			uchar dataByte = *src;
+			if (rightAligned)
+				dataByte <<= 8 - lastBits;
+			dataByte &= (uchar)(0xFF00 >> lastBits);
+			*dest |= dataByte >> startBits;
+			if (lastBits > 8 - startBits)
+				dest[1] = (uchar)(dataByte << (8 - startBits));
+		}
+		return;
+	}
+
+	for (; bits2Write >= 8; bits2Write -= 8)
+		write_byte_bits(*src++, 8);
+
+	/// the partial last byte, same to geco_bit_stream_t::WriteBits()
+	if (bits2Write > 0)
+	{
+		uchar dataByte = *src;
+		if (rightAligned)
+			dataByte <<= 8 - bits2Write;
+		write_byte_bits(dataByte, bits2Write);
+	}
+}
+
+void geco_segmented_bit_stream_t::ReadBits(uchar* dest, bit_size_t bits2Read,
+	bool alignRight /*= true*/)
+{
+	assert(bits2Read > 0);
+	assert(get_payloads() >= bits2Read);
+
+	if ((readable_bit_pos_ & 7) == 0 && (bits2Read & 7) == 0)
+	{
+		ReadAlignedBytes(dest, bits2Read >> 3);
+		return;
+	}
+
+	if (readable_bit_pos_ - read_seg_pos_ >= GECO_STREAM_SEGMENT_BITS)
+	{
+		read_seg_ = read_seg_->next;
+		read_seg_pos_ += GECO_STREAM_SEGMENT_BITS;
+	}
+	const bit_size_t segOffset = readable_bit_pos_ - read_seg_pos_;
+	if (segOffset + bits2Read <= GECO_STREAM_SEGMENT_BITS)
+	{
+		const uchar* src = read_seg_->data + (segOffset >> 3);
+		const uint startBits = readable_bit_pos_ & 7;
+		const uint lastBits = bits2Read & 7;
+		readable_bit_pos_ += bits2Read;
+		for (; bits2Read >= 8; bits2Read -= 8, src++)
+			*dest++ = startBits == 0 ? *src :
+			(uchar)((src[0] << startBits) | (src[1] >> (8 - startBits)));
+		if (lastBits > 0)
+		{
+			uchar dataByte = (uchar)(src[0] << startBits);
+			if (lastBits > 8 - startBits)
+				dataByte |= src[1] >> (8 - startBits);
+			dataByte &= (uchar)(0xFF00 >> lastBits);
+			*dest = alignRight ? (uchar)(dataByte >> (8 - lastBits)) : dataByte;
+		}
+		return;
+	}
+
+	for (; bits2Read >= 8; bits2Read -= 8)
+		*dest++ = read_byte_bits(8);
+
+	if (bits2Read > 0)
+	{
+		uchar dataByte = read_byte_bits(bits2Read);
+		if (alignRight)
+			dataByte >>= 8 - bits2Read;
+		*dest = dataByte;
+	}
+}
+
+uint geco_segmented_bit_stream_t::get_iovecs(geco_iovec_t* vecs,
+	uint max_vecs) const
+{
+	byte_size_t bytes = get_written_bytes();
+	uint size = 0;
+	for (const geco_stream_segment_t* seg = head_;
+		seg != NULL && bytes > 0 && size < max_vecs; seg = seg->next)
+	{
+		byte_size_t len = bytes < GECO_STREAM_SEGMENT_BYTES ?
+			bytes : GECO_STREAM_SEGMENT_BYTES;
+		GECO_IOVEC_SET(vecs[size], seg->data, len);
+		bytes -= len;
+		size++;
+	}
+	return size;
+}
+
+void geco_segmented_bit_stream_t::flatten_to(geco_bit_stream_t& out) const
+{
+	bit_size_t bits = writable_bit_pos_;
+	for (const geco_stream_segment_t* seg = head_;
+		seg != NULL && bits > 0; seg = seg->next)
+	{
+		bit_size_t len = bits < GECO_STREAM_SEGMENT_BITS ?
+			bits : GECO_STREAM_SEGMENT_BITS;
+		out.WriteBits(seg->data, len, false);
+		bits -= len;
+	}
+}
@@ -0,0 +1,313 @@
+/*
+ * Geco Gaming Company
+ * All Rights Reserved.
+ * Copyright (c)  2016 GECOEngine.
+ *
+ * GECOEngine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GECOEngine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with KBEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+ /*
+  * geco-segmented-bit-stream.h
+  *
+  * bit stream that grows by chaining fixed-size segments taken from a
+  * free-list pool instead of realloc-ing one contiguous buffer.
+  * the written segments can be handed to sendmsg()/writev() as an iovec
+  * array without flattening. the wire layout is same to geco_bit_stream_t
+  * (MSB first, left aligned), so a flattened segmented stream can be read
+  * by geco_bit_stream_t and vice versa.
+  */
+
+#ifndef SRC_COMMON_DS_GECO_SEGMENTED_BIT_STREAM_H_
+#define SRC_COMMON_DS_GECO_SEGMENTED_BIT_STREAM_H_
+
+#include "geco-bit-stream.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+typedef WSABUF geco_iovec_t;
+#define GECO_IOVEC_SET(vec, base, size) \
+	((vec).buf = (char*)(base), (vec).len = (ULONG)(size))
+#define GECO_IOVEC_BASE(vec) ((vec).buf)
+#define GECO_IOVEC_LEN(vec) ((size_t)(vec).len)
+#else
+#include <sys/uio.h>
+typedef struct iovec geco_iovec_t;
+#define GECO_IOVEC_SET(vec, base, size) \
+	((vec).iov_base = (void*)(base), (vec).iov_len = (size_t)(size))
+#define GECO_IOVEC_BASE(vec) ((vec).iov_base)
+#define GECO_IOVEC_LEN(vec) ((vec).iov_len)
+#endif
+
+/// payload bytes of one segment, 1024 keeps the segment header + payload
+/// in one small-object friendly block
+#ifndef GECO_STREAM_SEGMENT_BYTES
+#define GECO_STREAM_SEGMENT_BYTES 1024
+#endif
+#define GECO_STREAM_SEGMENT_BITS (BYTES_TO_BITS(GECO_STREAM_SEGMENT_BYTES))
+/// how many free segments a pool keeps before giving memory back
+#define GECO_STREAM_SEGMENT_POOL_MAX 256
+
+struct geco_stream_segment_t
+{
+	geco_stream_segment_t* next;
+	uchar data[GECO_STREAM_SEGMENT_BYTES];
+};
+
+/// free-list of segments. not thread safe, use one pool per thread,
+/// thread_pool() gives the calling thread its own pool.
+class GECOAPI geco_stream_segment_pool_t
+{
+private:
+	geco_stream_segment_t* free_list_;
+	uint free_size_;
+	uint max_free_size_;
+	uint allocated_size_;
+
+public:
+	explicit geco_stream_segment_pool_t(
+		uint max_free_size = GECO_STREAM_SEGMENT_POOL_MAX);
+	~geco_stream_segment_pool_t();
+
+	INLINE geco_stream_segment_t* get_segment()
+	{
+		geco_stream_segment_t* seg = free_list_;
+		if (seg != NULL)
+		{
+			free_list_ = seg->next;
+			free_size_--;
+		}
+		else
+		{
+			seg = (geco_stream_segment_t*)geco_malloc_ext(
+				sizeof(geco_stream_segment_t), FILE_AND_LINE);
+			allocated_size_++;
+		}
+		seg->next = NULL;
+		return seg;
+	}
+	INLINE void reclaim_segment(geco_stream_segment_t* seg)
+	{
+		if (free_size_ >= max_free_size_)
+		{
+			geco_free_ext(seg, FILE_AND_LINE);
+			allocated_size_--;
+			return;
+		}
+		seg->next = free_list_;
+		free_list_ = seg;
+		free_size_++;
+	}
+	/// give back a whole chain linked by @next
+	void reclaim_segments(geco_stream_segment_t* head);
+
+	/// segments sitting in the free list
+	uint free_segments() const { return free_size_; }
+	/// segments owned by this pool, both free and in use
+	uint allocated_segments() const { return allocated_size_; }
+
+	/// the pool of the calling thread
+	static geco_stream_segment_pool_t& thread_pool();
+};
+
+/// @brief
+/// bit stream built from a chain of pooled fixed-size segments.
+/// 1. growing never copies written data, a new segment is chained instead
+/// 2. get_iovecs() exports the written bytes for sendmsg()/writev()
+/// 3. reads and writes that cross a segment boundary are transparent
+/// 4. reset() and the dtor give the segments back to the pool
+class GECOAPI geco_segmented_bit_stream_t
+{
+private:
+	geco_stream_segment_pool_t& pool_;
+	geco_stream_segment_t* head_;
+	/// always the last segment of the chain
+	geco_stream_segment_t* write_seg_;
+	/// bit position of the first bit in @write_seg_
+	bit_size_t write_seg_pos_;
+	geco_stream_segment_t* read_seg_;
+	bit_size_t read_seg_pos_;
+	bit_size_t writable_bit_pos_;
+	bit_size_t readable_bit_pos_;
+	uint segments_size_;
+
+	/// non-copyable, segments are owned by one stream
+	geco_segmented_bit_stream_t(const geco_segmented_bit_stream_t&);
+	geco_segmented_bit_stream_t& operator=(const geco_segmented_bit_stream_t&);
+
+	INLINE void append_segment()
+	{
+		geco_stream_segment_t* seg = pool_.get_segment();
+		if (write_seg_ == NULL)
+		{
+			head_ = read_seg_ = seg;
+			write_seg_pos_ = read_seg_pos_ = 0;
+		}
+		else
+		{
+			write_seg_->next = seg;
+			write_seg_pos_ += GECO_STREAM_SEGMENT_BITS;
+		}
+		write_seg_ = seg;
+		segments_size_++;
+	}
+	/// the byte holding @writable_bit_pos_, chains a segment if needed
+	INLINE uchar* write_byte()
+	{
+		if (write_seg_ == NULL ||
+			writable_bit_pos_ - write_seg_pos_ >= GECO_STREAM_SEGMENT_BITS)
+			append_segment();
+		return write_seg_->data + ((writable_bit_pos_ - write_seg_pos_) >> 3);
+	}
+	/// the byte holding @pos, @pos must be >= @readable_bit_pos_
+	INLINE uchar read_byte(bit_size_t pos)
+	{
+		if (pos - read_seg_pos_ >= GECO_STREAM_SEGMENT_BITS)
+		{
+			read_seg_ = read_seg_->next;
+			read_seg_pos_ += GECO_STREAM_SEGMENT_BITS;
+		}
+		return read_seg_->data[(pos - read_seg_pos_) >> 3];
+	}
+	/// write the top @bits2Write bits of @leftAligned, 1 - 8 bits
+	INLINE void write_byte_bits(uchar leftAligned, uint bits2Write)
+	{
+		leftAligned &= (uchar)(0xFF00 >> bits2Write);
+		const uint startBits = writable_bit_pos_ & 7;
+		uchar* dest = write_byte();
+		if (startBits == 0)
+		{
+			*dest = leftAligned;
+			writable_bit_pos_ += bits2Write;
+			return;
+		}
+		*dest |= leftAligned >> startBits;
+		const uint freeBits = 8 - startBits;
+		if (bits2Write > freeBits)
+		{
+			writable_bit_pos_ += freeBits;
+			*write_byte() = (uchar)(leftAligned << freeBits);
+			writable_bit_pos_ += bits2Write - freeBits;
+			return;
+		}
+		writable_bit_pos_ += bits2Write;
+	}
+	/// read @bits2Read bits (1 - 8) into the top bits of the result
+	INLINE uchar read_byte_bits(uint bits2Read)
+	{
+		const uint startBits = readable_bit_pos_ & 7;
+		uchar out = (uchar)(read_byte(readable_bit_pos_) << startBits);
+		if (startBits != 0 && bits2Read > 8 - startBits)
+			out |= read_byte(readable_bit_pos_ + 8 - startBits) >> (8 - startBits);
+		readable_bit_pos_ += bits2Read;
+		return out & (uchar)(0xFF00 >> bits2Read);
+	}
+
+public:
+	explicit geco_segmented_bit_stream_t(
+		geco_stream_segment_pool_t& pool = geco_stream_segment_pool_t::thread_pool());
+	~geco_segmented_bit_stream_t();
+
+	/// give all segments back to the pool and rewind both positions
+	void reset();
+
+	bit_size_t get_written_bits() const { return writable_bit_pos_; }
+	byte_size_t get_written_bytes() const { return BITS_TO_BYTES(writable_bit_pos_); }
+	bit_size_t get_payloads() const { return writable_bit_pos_ - readable_bit_pos_; }
+	bit_size_t get_read_bits() const { return readable_bit_pos_; }
+	uint get_segments_size() const { return segments_size_; }
+	const geco_stream_segment_t* get_segments() const { return head_; }
+
+	/// @brief same to geco_bit_stream_t::WriteBits()
+	/// @param [in] src user data
+	/// @param [in] bits2Write number of bits to write
+	/// @param [in] rightAligned
+	/// if true, the partial last byte of @src is taken from its low bits.
+	/// use false to write the data of another stream.
+	void WriteBits(const uchar* src, bit_size_t bits2Write,
+		bool rightAligned = true);
+	/// @brief same to geco_bit_stream_t::ReadBits()
+	void ReadBits(uchar* dest, bit_size_t bits2Read, bool alignRight = true);
+
+	/// memcpy segment by segment, @writable_bit_pos_ must be byte aligned
+	void write_aligned_bytes(const uchar* src, byte_size_t size);
+	/// memcpy segment by segment, @readable_bit_pos_ must be byte aligned
+	void ReadAlignedBytes(uchar* dest, byte_size_t size);
+
+	INLINE void Write(bool src)
+	{
+		write_byte_bits(src ? 0x80 : 0, 1);
+	}
+	INLINE void Read(bool& dest)
+	{
+		assert(get_payloads() >= 1);
+		dest = (read_byte_bits(1) & 0x80) != 0;
+	}
+	/// same wire as geco_bit_stream_t::Write(const IntergralType&)
+	template<class IntergralType>
+	void Write(const IntergralType& src)
+	{
+		if (sizeof(IntergralType) == 1)
+		{
+			write_byte_bits(*(const uchar*)&src, 8);
+			return;
+		}
+#ifndef DO_NOT_SWAP_ENDIAN
+		if (geco_bit_stream_t::DoEndianSwap())
+		{
+			uchar output[sizeof(IntergralType)];
+			geco_bit_stream_t::ReverseBytes((uchar*)&src, output,
+				sizeof(IntergralType));
+			WriteBits(output, BYTES_TO_BITS(sizeof(IntergralType)));
+		}
+		else
+#endif
+			WriteBits((const uchar*)&src, BYTES_TO_BITS(sizeof(IntergralType)));
+	}
+	/// same wire as geco_bit_stream_t::Read(IntegralType&)
+	template<class IntegralType>
+	void Read(IntegralType& dest)
+	{
+		assert(get_payloads() >= BYTES_TO_BITS(sizeof(IntegralType)));
+		if (sizeof(IntegralType) == 1)
+		{
+			*(uchar*)&dest = read_byte_bits(8);
+			return;
+		}
+#ifndef DO_NOT_SWAP_ENDIAN
+		if (geco_bit_stream_t::DoEndianSwap())
+		{
+			uchar output[sizeof(IntegralType)];
+			ReadBits(output, BYTES_TO_BITS(sizeof(IntegralType)));
+			geco_bit_stream_t::ReverseBytes(output, (uchar*)&dest,
+				sizeof(IntegralType));
+		}
+		else
+#endif
+			ReadBits((uchar*)&dest, BYTES_TO_BITS(sizeof(IntegralType)));
+	}
+
+	/// @brief fill @vecs with the written bytes, one entry per segment,
+	/// the partial last byte is included.
+	/// @return number of entries filled, at most @max_vecs.
+	/// the iovecs point into the segments and stay valid until the stream
+	/// is reset or destroyed.
+	uint get_iovecs(geco_iovec_t* vecs, uint max_vecs) const;
+
+	/// append all written bits to a contiguous stream,
+	/// mainly for code paths that still need one buffer.
+	void flatten_to(geco_bit_stream_t& out) const;
+};
+
+#endif /* SRC_COMMON_DS_GECO_SEGMENTED_BIT_STREAM_H_ */
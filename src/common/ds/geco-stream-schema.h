@@ -0,0 +1,234 @@
+/*
+ * Geco Gaming Company
+ * All Rights Reserved.
+ * Copyright (c)  2016 GECOEngine.
+ *
+ * GECOEngine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GECOEngine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with KBEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+ /*
+  * geco-stream-schema.h
+  *
+  * compile-time field lists for geco_bit_stream_t serializers.
+  * declare the fields of a type once and get the compressed and
+  * uncompressed encoders/decoders generated from the same list:
+  *
+  * typedef geco_schema_t<GecoYawPitch,
+  *     GECO_SCHEMA_FIELD(GecoYawPitch, m_uiYaw),
+  *     GECO_SCHEMA_FIELD(GecoYawPitch, m_uiPitch)> GecoYawPitchSchema;
+  * GECO_SCHEMA_STREAM_OPERATORS(GecoYawPitch, GecoYawPitchSchema)
+  *
+  * is_compression_mode() is tested once per message, not once per field.
+  * when every field has a fixed uncompressed size, the schema knows the
+  * message size at compile time (fixed_bits/fixed_bytes) and grows the
+  * stream once before writing.
+  */
+
+#ifndef SRC_COMMON_DS_GECO_STREAM_SCHEMA_H_
+#define SRC_COMMON_DS_GECO_STREAM_SCHEMA_H_
+
+#include <type_traits>
+#include "geco-bit-stream.h"
+
+/// forwards to the stream's own Write/WriteMini/Read/ReadMini overloads, so
+/// a field encodes exactly as a hand written operator calling them would.
+/// @FIXED_BITS uncompressed bits of the field, 0 if it depends on the value
+template<class F, bit_size_t FIXED_BITS>
+struct geco_schema_stream_codec_t
+{
+	static const bit_size_t fixed_bits = FIXED_BITS;
+	static const bool byte_aligned = false;
+
+	static INLINE void write(geco_bit_stream_t& os, const F& v) { os.Write(v); }
+	static INLINE void write_mini(geco_bit_stream_t& os, const F& v) { os.WriteMini(v); }
+	static INLINE void read(geco_bit_stream_t& is, F& v) { is.Read(v); }
+	static INLINE void read_mini(geco_bit_stream_t& is, F& v) { is.ReadMini(v); }
+};
+
+/// default codec of a field type. bool is one bit, other arithmetic types
+/// are sizeof() bytes, anything else is treated as variable sized.
+template<class F>
+struct geco_schema_codec_t : geco_schema_stream_codec_t<F,
+	std::is_same<F, bool>::value ? 1 :
+	std::is_arithmetic<F>::value ? BYTES_TO_BITS(sizeof(F)) : 0>
+{
+};
+
+/// @CODEC's uncompressed encoding in both modes, for fields whose wire
+/// format must not depend on is_compression_mode()
+template<class F, class CODEC = geco_schema_codec_t<F> >
+struct geco_schema_uncompressed_codec_t
+{
+	static const bit_size_t fixed_bits = CODEC::fixed_bits;
+	static const bool byte_aligned = CODEC::byte_aligned;
+
+	static INLINE void write(geco_bit_stream_t& os, const F& v) { CODEC::write(os, v); }
+	static INLINE void write_mini(geco_bit_stream_t& os, const F& v) { CODEC::write(os, v); }
+	static INLINE void read(geco_bit_stream_t& is, F& v) { CODEC::read(is, v); }
+	static INLINE void read_mini(geco_bit_stream_t& is, F& v) { CODEC::read(is, v); }
+};
+
+/// fixed char buffers go as huffman compressed strings in both modes and
+/// never decode more than N - 1 chars into the buffer
+template<size_t N>
+struct geco_schema_codec_t<char[N]>
+{
+	static const bit_size_t fixed_bits = 0;
+	static const bool byte_aligned = false;
+
+	static INLINE void write(geco_bit_stream_t& os, const char(&v)[N])
+	{
+		geco_string_compressor_t::Instance()->EncodeString(v, N, &os, 0);
+	}
+	static INLINE void write_mini(geco_bit_stream_t& os, const char(&v)[N]) { write(os, v); }
+	static INLINE void read(geco_bit_stream_t& is, char(&v)[N])
+	{
+		if (!geco_string_compressor_t::Instance()->DecodeString(v, N, &is, 0))
+			v[0] = 0;
+	}
+	static INLINE void read_mini(geco_bit_stream_t& is, char(&v)[N]) { read(is, v); }
+};
+
+/// 3 raw bytes via Write/ReadThreeAlignedBytes() in both modes,
+/// the stream is byte aligned first
+struct geco_schema_three_bytes_codec_t
+{
+	static const bit_size_t fixed_bits = 24;
+	static const bool byte_aligned = true;
+
+	static INLINE void write(geco_bit_stream_t& os, const uchar(&v)[3])
+	{
+		os.WriteThreeAlignedBytes(reinterpret_cast<const char*>(v));
+	}
+	static INLINE void write_mini(geco_bit_stream_t& os, const uchar(&v)[3]) { write(os, v); }
+	static INLINE void read(geco_bit_stream_t& is, uchar(&v)[3])
+	{
+		is.ReadThreeAlignedBytes(reinterpret_cast<char*>(v));
+	}
+	static INLINE void read_mini(geco_bit_stream_t& is, uchar(&v)[3]) { read(is, v); }
+};
+
+/// one field of a schema, the member is bound at compile time
+template<class T, class F, F T::*MEMBER, class CODEC = geco_schema_codec_t<F> >
+struct geco_schema_field_t
+{
+	typedef CODEC codec;
+	static INLINE void write(geco_bit_stream_t& os, const T& v) { CODEC::write(os, v.*MEMBER); }
+	static INLINE void write_mini(geco_bit_stream_t& os, const T& v) { CODEC::write_mini(os, v.*MEMBER); }
+	static INLINE void read(geco_bit_stream_t& is, T& v) { CODEC::read(is, v.*MEMBER); }
+	static INLINE void read_mini(geco_bit_stream_t& is, T& v) { CODEC::read_mini(is, v.*MEMBER); }
+};
+
+#define GECO_SCHEMA_FIELD(TYPE, MEMBER) \
+geco_schema_field_t<TYPE, decltype(TYPE::MEMBER), &TYPE::MEMBER>
+#define GECO_SCHEMA_FIELD_CODEC(TYPE, MEMBER, CODEC) \
+geco_schema_field_t<TYPE, decltype(TYPE::MEMBER), &TYPE::MEMBER, CODEC>
+
+/// [Internal] folds the uncompressed sizes of a field list starting at bit @POS.
+/// byte aligned fields round @POS up first, which is exact as long as the
+/// message itself starts byte aligned.
+template<bit_size_t POS, class... FIELDS>
+struct geco_schema_size_t
+{
+	static const bool is_fixed = true;
+	static const bit_size_t bits = POS;
+};
+template<bit_size_t POS, class FIELD, class... FIELDS>
+struct geco_schema_size_t<POS, FIELD, FIELDS...>
+{
+private:
+	typedef typename FIELD::codec codec;
+	static const bit_size_t start = codec::byte_aligned ? (POS + 7) & ~7u : POS;
+	typedef geco_schema_size_t<start + codec::fixed_bits, FIELDS...> rest;
+public:
+	static const bool is_fixed = codec::fixed_bits != 0 && rest::is_fixed;
+	static const bit_size_t bits = is_fixed ? rest::bits : 0;
+};
+
+/// @brief
+/// encoders and decoders of @T generated from one field list.
+/// fields are written in declaration order with the codec's
+/// write() in uncompressed mode and write_mini() in compressed mode.
+template<class T, class... FIELDS>
+struct geco_schema_t
+{
+	typedef geco_schema_size_t<0, FIELDS...> size_type;
+	/// true if every field has a fixed uncompressed size
+	static const bool is_fixed_size = size_type::is_fixed;
+	/// exact uncompressed size when the message starts byte aligned, 0 if variable
+	static const bit_size_t fixed_bits = size_type::bits;
+	static const byte_size_t fixed_bytes = BITS_TO_BYTES(fixed_bits);
+
+	static INLINE void write_uncompressed(geco_bit_stream_t& os, const T& v)
+	{
+		/// grow once up front, +7 covers a non-aligned start
+		if (is_fixed_size)
+			os.AppendBitsCouldRealloc(fixed_bits + 7);
+		int expand[] = { 0, (FIELDS::write(os, v), 0)... };
+		(void)expand;
+	}
+	static INLINE void write_compressed(geco_bit_stream_t& os, const T& v)
+	{
+		int expand[] = { 0, (FIELDS::write_mini(os, v), 0)... };
+		(void)expand;
+	}
+	static INLINE void read_uncompressed(geco_bit_stream_t& is, T& v)
+	{
+		int expand[] = { 0, (FIELDS::read(is, v), 0)... };
+		(void)expand;
+	}
+	static INLINE void read_compressed(geco_bit_stream_t& is, T& v)
+	{
+		int expand[] = { 0, (FIELDS::read_mini(is, v), 0)... };
+		(void)expand;
+	}
+
+	static INLINE void write(geco_bit_stream_t& os, const T& v)
+	{
+		if (os.is_compression_mode())
+			write_compressed(os, v);
+		else
+			write_uncompressed(os, v);
+	}
+	static INLINE void read(geco_bit_stream_t& is, T& v)
+	{
+		if (is.is_compression_mode())
+			read_compressed(is, v);
+		else
+			read_uncompressed(is, v);
+	}
+};
+
+template<class T, class... FIELDS>
+const bool geco_schema_t<T, FIELDS...>::is_fixed_size;
+template<class T, class... FIELDS>
+const bit_size_t geco_schema_t<T, FIELDS...>::fixed_bits;
+template<class T, class... FIELDS>
+const byte_size_t geco_schema_t<T, FIELDS...>::fixed_bytes;
+
+/// defines operator<< and operator>> of @TYPE with @SCHEMA
+#define GECO_SCHEMA_STREAM_OPERATORS(TYPE, SCHEMA) \
+INLINE geco_bit_stream_t& operator >>(geco_bit_stream_t& is, TYPE& v) \
+{ \
+	SCHEMA::read(is, v); \
+	return is; \
+} \
+INLINE geco_bit_stream_t& operator <<(geco_bit_stream_t& os, const TYPE& v) \
+{ \
+	SCHEMA::write(os, v); \
+	return os; \
+}
+
+#endif /* SRC_COMMON_DS_GECO_STREAM_SCHEMA_H_ */
@@ -0,0 +1,481 @@
+/*
+ * Geco Gaming Company
+ * All Rights Reserved.
+ * Copyright (c)  2016 GECOEngine.
+ *
+ * GECOEngine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GECOEngine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with KBEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+ /*
+  * mpmc-queue.h
+  *
+  * bounded multi-producer queues for cross-thread job hand-off, the
+  * many-writers counterpart of spsc_queue_t:
+  *
+  * mpsc_queue_t<job_t, 4096, futex_wait_strategy_t> jobs;
+  * // DB worker, log forwarders, timers
+  * jobs.push(job);
+  * // logic thread, sleeps in the kernel while there is nothing to do
+  * uint n = jobs.pop_n(batch, 64);
+  *
+  * cells carry sequence numbers (Dmitry Vyukov's bounded queue), so a push
+  * or pop is one CAS on the shared index plus one release store on the
+  * cell, no lock and no per-element allocation.
+  */
+
+#ifndef SRC_COMMON_DS_MPMC_QUEUE_H_
+#define SRC_COMMON_DS_MPMC_QUEUE_H_
+
+#include <stdlib.h>
+#include <limits.h>
+#include <atomic>
+#include <new>
+#include <thread>
+#include <utility>
+#include <type_traits>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#endif
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#define GECO_CPU_RELAX() _mm_pause()
+#else
+#define GECO_CPU_RELAX() ((void)0)
+#endif
+
+namespace geco
+{
+namespace ds
+{
+/// how many times the yield and futex strategies poll before giving up
+/// the cpu, long enough to ride out a producer that is mid-push
+#define GECO_QUEUE_WAIT_SPINS 128
+
+/// @brief
+/// wait strategies tell a blocking push()/pop() what to do while the queue
+/// is full/empty. each one has:
+/// wait_until(try_fn) - call try_fn() until it returns true
+/// notify() - called after every successful op of the other side
+///
+/// busy polls with a pause instruction. lowest latency, burns a core,
+/// only for threads pinned to their own cpu.
+struct spin_wait_strategy_t
+{
+	template<class TRY>
+	void wait_until(TRY&& try_fn)
+	{
+		while (!try_fn())
+			GECO_CPU_RELAX();
+	}
+	void notify()
+	{
+	}
+};
+
+/// polls for a while and then yields the time slice between tries
+struct yield_wait_strategy_t
+{
+	template<class TRY>
+	void wait_until(TRY&& try_fn)
+	{
+		for (unsigned int spins = 0; !try_fn(); spins++)
+		{
+			if (spins < GECO_QUEUE_WAIT_SPINS)
+				GECO_CPU_RELAX();
+			else
+				std::this_thread::yield();
+		}
+	}
+	void notify()
+	{
+	}
+};
+
+/// polls for a while and then parks the thread in the kernel on an event
+/// counter (futex on linux, WaitOnAddress on windows) until the other side
+/// notifies. notify() costs one fence and one load while nobody sleeps.
+class futex_wait_strategy_t
+{
+public:
+	futex_wait_strategy_t() :
+			m_nEpoch(0), m_nWaiters(0)
+	{
+	}
+
+	template<class TRY>
+	void wait_until(TRY&& try_fn)
+	{
+		for (unsigned int spins = 0; spins < GECO_QUEUE_WAIT_SPINS; spins++)
+		{
+			if (try_fn())
+				return;
+			GECO_CPU_RELAX();
+		}
+		for (;;)
+		{
+			/// sample the epoch -before- announcing ourselves and retrying,
+			/// a notify() in between bumps it and the park returns at once
+			const unsigned int key = m_nEpoch.load(std::memory_order_acquire);
+			m_nWaiters.fetch_add(1, std::memory_order_seq_cst);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (try_fn())
+			{
+				m_nWaiters.fetch_sub(1, std::memory_order_relaxed);
+				return;
+			}
+			park(key);
+			m_nWaiters.fetch_sub(1, std::memory_order_relaxed);
+			if (try_fn())
+				return;
+		}
+	}
+	void notify()
+	{
+		/// pairs with the fence in wait_until(), either the waiter sees
+		/// our op in its retry or we see it in m_nWaiters
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (m_nWaiters.load(std::memory_order_relaxed) == 0)
+			return;
+		m_nEpoch.fetch_add(1, std::memory_order_release);
+		wake_all();
+	}
+
+private:
+	void park(unsigned int key)
+	{
+#if defined(__linux__)
+		syscall(SYS_futex, &m_nEpoch, FUTEX_WAIT_PRIVATE, key, NULL, NULL, 0);
+#elif defined(_WIN32)
+		WaitOnAddress(&m_nEpoch, &key, sizeof(key), INFINITE);
+#else
+		if (m_nEpoch.load(std::memory_order_acquire) == key)
+			std::this_thread::yield();
+#endif
+	}
+	void wake_all()
+	{
+#if defined(__linux__)
+		syscall(SYS_futex, &m_nEpoch, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL,
+				0);
+#elif defined(_WIN32)
+		WakeByAddressAll(&m_nEpoch);
+#endif
+	}
+
+	static_assert(sizeof(std::atomic<unsigned int>) == sizeof(unsigned int),
+			"futex word must be a plain 32 bits int");
+
+	std::atomic<unsigned int> m_nEpoch;
+	std::atomic<unsigned int> m_nWaiters;
+};
+
+/// @brief
+/// bounded queue of sequence-numbered cells, the capacity is @nSize rounded
+/// up to the next power of 2. cell i is free for the producer that claims
+/// position pos when its sequence == pos and holds an element for the
+/// consumer at pos when its sequence == pos + 1.
+/// @MULTI_CONSUMER false lets the single consumer advance its index with a
+/// plain store instead of a CAS, use the mpsc_queue_t/mpmc_queue_t aliases.
+template<typename elementType, unsigned int nSize, class WAIT,
+		bool MULTI_CONSUMER>
+class sequenced_queue_t
+{
+private:
+	struct Cell
+	{
+		std::atomic<unsigned int> seq;
+		typename std::aligned_storage<sizeof(elementType),
+				std::alignment_of<elementType>::value>::type storage;
+
+		elementType* ele()
+		{
+			return reinterpret_cast<elementType*>(&storage);
+		}
+	};
+
+public:
+	sequenced_queue_t() :
+			m_pCells(0), m_nSize(RoundUpPower2(nSize < 2 ? 2 : nSize)), m_nMask(
+					m_nSize - 1), m_nIn(0), m_nOut(0)
+	{
+		m_pCells = (Cell*) malloc(m_nSize * sizeof(Cell));
+		for (unsigned int i = 0; i < m_nSize; i++)
+			new (&m_pCells[i].seq) std::atomic<unsigned int>(i);
+	}
+	~sequenced_queue_t()
+	{
+		if (0 != m_pCells)
+		{
+			while (try_consume([](elementType&)
+			{}))
+				;
+			free(m_pCells);
+			m_pCells = 0;
+		}
+	}
+
+	/// a snapshot, exact only when no other thread is pushing or popping
+	unsigned int Size() const
+	{
+		return m_nIn.load(std::memory_order_acquire)
+				- m_nOut.load(std::memory_order_acquire);
+	}
+	bool IsEmpty() const
+	{
+		return Size() == 0;
+	}
+	unsigned int Capacity() const
+	{
+		return m_nSize;
+	}
+
+	/// construct an element in place, safe from any number of threads
+	/// @return false if the queue is full
+	template<class ... Args>
+	bool try_emplace(Args&&... args)
+	{
+		unsigned int pos = m_nIn.load(std::memory_order_relaxed);
+		Cell* cell;
+		for (;;)
+		{
+			cell = &m_pCells[pos & m_nMask];
+			const int diff = (int) (cell->seq.load(std::memory_order_acquire)
+					- pos);
+			if (diff == 0)
+			{
+				if (m_nIn.compare_exchange_weak(pos, pos + 1,
+						std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+				return false;
+			else
+				pos = m_nIn.load(std::memory_order_relaxed);
+		}
+		new (cell->ele()) elementType(std::forward<Args>(args)...);
+		cell->seq.store(pos + 1, std::memory_order_release);
+		m_NotEmpty.notify();
+		return true;
+	}
+	bool try_push(const elementType& ele)
+	{
+		return try_emplace(ele);
+	}
+	bool try_push(elementType&& ele)
+	{
+		return try_emplace(std::move(ele));
+	}
+	/// claim up to @count consecutive free cells with one CAS and copy
+	/// @eles into them. the batch stays in order but other producers'
+	/// elements may come before or after it.
+	/// @return number of elements pushed, 0 - @count
+	unsigned int try_push_n(const elementType* eles, unsigned int count)
+	{
+		if (count == 0)
+			return 0;
+		unsigned int pos = m_nIn.load(std::memory_order_relaxed);
+		unsigned int n;
+		for (;;)
+		{
+			for (n = 0; n < count; n++)
+			{
+				if (m_pCells[(pos + n) & m_nMask].seq.load(
+						std::memory_order_acquire) != pos + n)
+					break;
+			}
+			if (n == 0)
+			{
+				const int diff =
+						(int) (m_pCells[pos & m_nMask].seq.load(
+								std::memory_order_acquire) - pos);
+				if (diff < 0)
+					return 0;
+				pos = m_nIn.load(std::memory_order_relaxed);
+				continue;
+			}
+			if (m_nIn.compare_exchange_weak(pos, pos + n,
+					std::memory_order_relaxed))
+				break;
+		}
+		for (unsigned int i = 0; i < n; i++)
+		{
+			Cell* cell = &m_pCells[(pos + i) & m_nMask];
+			new (cell->ele()) elementType(eles[i]);
+			cell->seq.store(pos + i + 1, std::memory_order_release);
+		}
+		m_NotEmpty.notify();
+		return n;
+	}
+
+	/// call @fn(elementType&) on the oldest element in place, then free it
+	template<class FUNC>
+	bool try_consume(FUNC&& fn)
+	{
+		unsigned int pos = m_nOut.load(std::memory_order_relaxed);
+		Cell* cell;
+		for (;;)
+		{
+			cell = &m_pCells[pos & m_nMask];
+			const int diff = (int) (cell->seq.load(std::memory_order_acquire)
+					- (pos + 1));
+			if (diff == 0)
+			{
+				if (claim_out(pos, 1))
+					break;
+			}
+			else if (diff < 0)
+				return false;
+			else
+				pos = m_nOut.load(std::memory_order_relaxed);
+		}
+		fn(*cell->ele());
+		cell->ele()->~elementType();
+		cell->seq.store(pos + m_nSize, std::memory_order_release);
+		m_NotFull.notify();
+		return true;
+	}
+	bool try_pop(elementType& ele)
+	{
+		return try_consume([&ele](elementType& head)
+		{	ele = std::move(head);});
+	}
+	/// move out up to @count consecutive elements claimed with one CAS
+	/// @return number of elements popped, 0 - @count
+	unsigned int try_pop_n(elementType* eles, unsigned int count)
+	{
+		if (count == 0)
+			return 0;
+		unsigned int pos = m_nOut.load(std::memory_order_relaxed);
+		unsigned int n;
+		for (;;)
+		{
+			for (n = 0; n < count; n++)
+			{
+				if (m_pCells[(pos + n) & m_nMask].seq.load(
+						std::memory_order_acquire) != pos + n + 1)
+					break;
+			}
+			if (n == 0)
+			{
+				const int diff = (int) (m_pCells[pos & m_nMask].seq.load(
+						std::memory_order_acquire) - (pos + 1));
+				if (diff < 0)
+					return 0;
+				pos = m_nOut.load(std::memory_order_relaxed);
+				continue;
+			}
+			if (claim_out(pos, n))
+				break;
+		}
+		for (unsigned int i = 0; i < n; i++)
+		{
+			Cell* cell = &m_pCells[(pos + i) & m_nMask];
+			eles[i] = std::move(*cell->ele());
+			cell->ele()->~elementType();
+			cell->seq.store(pos + i + m_nSize, std::memory_order_release);
+		}
+		m_NotFull.notify();
+		return n;
+	}
+
+	/// block with the wait strategy until there is room
+	void push(const elementType& ele)
+	{
+		m_NotFull.wait_until([this, &ele]()
+		{	return try_emplace(ele);});
+	}
+	/// block with the wait strategy until an element arrives
+	void pop(elementType& ele)
+	{
+		m_NotEmpty.wait_until([this, &ele]()
+		{	return try_pop(ele);});
+	}
+	/// block until at least one element arrives, then take up to @count
+	unsigned int pop_n(elementType* eles, unsigned int count)
+	{
+		unsigned int n = 0;
+		m_NotEmpty.wait_until([this, eles, count, &n]()
+		{	return (n = try_pop_n(eles, count)) != 0;});
+		return n;
+	}
+
+private:
+	/// advance the consumer index from @pos by @n, @pos is reloaded on failure
+	bool claim_out(unsigned int& pos, unsigned int n)
+	{
+		if (MULTI_CONSUMER)
+			return m_nOut.compare_exchange_weak(pos, pos + n,
+					std::memory_order_relaxed);
+		m_nOut.store(pos + n, std::memory_order_relaxed);
+		return true;
+	}
+
+	static unsigned int RoundUpPower2(unsigned int val)
+	{
+		val--;
+		val |= val >> 1;
+		val |= val >> 2;
+		val |= val >> 4;
+		val |= val >> 8;
+		val |= val >> 16;
+		return val + 1;
+	}
+
+	sequenced_queue_t(const sequenced_queue_t&);
+	sequenced_queue_t& operator=(const sequenced_queue_t&);
+
+	static const unsigned int cacheline_size = 64;
+	typedef char cacheline_pad_t[cacheline_size];
+
+private:
+	cacheline_pad_t pad0_;
+	/// read-only after construction
+	Cell* m_pCells;
+	const unsigned int m_nSize;
+	const unsigned int m_nMask;
+	cacheline_pad_t pad1_;
+	/// next position producers claim
+	std::atomic<unsigned int> m_nIn;
+	cacheline_pad_t pad2_;
+	/// next position consumers claim
+	std::atomic<unsigned int> m_nOut;
+	cacheline_pad_t pad3_;
+	/// consumers wait on it while empty, producers notify it
+	WAIT m_NotEmpty;
+	cacheline_pad_t pad4_;
+	/// producers wait on it while full, consumers notify it
+	WAIT m_NotFull;
+	cacheline_pad_t pad5_;
+};
+
+/// many producers, exactly one consumer thread
+template<typename elementType, unsigned int nSize = 1024,
+		class WAIT = yield_wait_strategy_t>
+using mpsc_queue_t = sequenced_queue_t<elementType, nSize, WAIT, false>;
+
+/// any number of producer and consumer threads
+template<typename elementType, unsigned int nSize = 1024,
+		class WAIT = yield_wait_strategy_t>
+using mpmc_queue_t = sequenced_queue_t<elementType, nSize, WAIT, true>;
+}
+}
+#endif /* SRC_COMMON_DS_MPMC_QUEUE_H_ */
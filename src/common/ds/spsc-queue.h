@@ -1,10 +1,28 @@
 #ifndef __COMMON_DS_SCSP_QUEUE_H
 #define __COMMON_DS_SCSP_QUEUE_H
 
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include <utility>
+#include <type_traits>
+
 namespace geco
 {
 namespace ds
 {
+/// @brief
+/// bounded lock-free single-producer single-consumer ring.
+/// 1. head and tail are free running counters, each on its own cache line,
+///    published with release stores and sampled with acquire loads
+/// 2. each side keeps a cached copy of the opposite index and only reloads
+///    it (one cross-core cache miss) when the ring looks full or empty
+/// 3. elements are constructed in place and moved, never memcpy-ed
+/// 4. the capacity is @nSize rounded up to the next power of 2
+///
+/// push_back()/try_push*()/try_emplace() may only be called by the producer
+/// thread, pop_front()/try_pop*()/front()/pop()/try_consume()/operator[]
+/// only by the consumer thread.
 template<typename elementType, unsigned int nSize = 128>
 class spsc_queue_t
 {
@@ -19,105 +37,172 @@ public:
 	};
 
 	spsc_queue_t() :
-			m_pBuffer(0), m_nSize(nSize), m_ElementSize(sizeof(elementType)), m_nIn(
-					0), m_nOut(0)
+			m_pBuffer(0), m_nSize(RoundUpPower2(nSize < 2 ? 2 : nSize)), m_nMask(
+					m_nSize - 1), m_nIn(0), m_nOutCached(0), m_nOut(0), m_nInCached(
+					0)
 	{
-		//round up to the next power of 2
-		if (!IsPower2(nSize * m_ElementSize))
-		{
-			m_nSize = RoundUpPower2(nSize * m_ElementSize);
-		}
-		m_pBuffer = (char*) malloc(m_nSize);
-		m_nIn = m_nOut = 0;
+		m_pBuffer = (elementType*) malloc(m_nSize * sizeof(elementType));
 	}
-	virtual ~spsc_queue_t()
+	~spsc_queue_t()
 	{
 		if (0 != m_pBuffer)
 		{
+			Clear();
 			free(m_pBuffer);
 			m_pBuffer = 0;
 		}
 	}
 
+	/// consumer side, destroys all queued elements
 	void Clear(void)
 	{
-		m_nIn = m_nOut = 0;
+		while (pop())
+			;
 	}
+	/// exact on either side, a snapshot when called from a third thread
 	unsigned int Size() const
 	{
-		return (m_nIn - m_nOut) / m_ElementSize;
+		return m_nIn.load(std::memory_order_acquire)
+				- m_nOut.load(std::memory_order_acquire);
 	}
-	bool IsEmpty()
+	bool IsEmpty() const
 	{
-		Size() == 0;
+		return Size() == 0;
 	}
-	/// These two functions will do whil-loop internally
-	/// until the needed element is returned
-	/// will walways return true;
-	void push_back(const elementType& buffer)
+	unsigned int Capacity() const
 	{
-		unsigned int m_len = 0;
-		while (m_len < m_ElementSize)
-		{
-			m_len = m_ElementSize - m_len;
-			unsigned int l = m_nSize - m_nIn + m_nOut;
-			m_len = m_len < l ? m_len : l;
-
-			/// Ensure that we sample the m_nOut index -before- we start putting bytes into the UnlockQueue.
-#ifdef _WIN32
-			MemoryBarrier();
-#else
-			__sync_synchronize();
-#endif
-
-			/// first put the data starting from fifo->in to buffer end
-			l = m_nSize - (m_nIn & (m_nSize - 1));
-			l = m_len < l ? m_len : l;
-
-			memcpy(m_pBuffer + (m_nIn & (m_nSize - 1)), &buffer, l);
-			/// then put the rest (if any) at the beginning of the buffer
-			memcpy(m_pBuffer, &buffer + l, m_len - l);
+		return m_nSize;
+	}
 
-			/// Ensure that we push_back the bytes to the kfifo -before- we update the fifo->in index.
-#ifdef _WIN32
-			MemoryBarrier();
-#else
-			__sync_synchronize();
-#endif
-			m_nIn += m_len;
+	/// construct an element in place at the tail
+	/// @return false if the ring is full
+	template<class ... Args>
+	bool try_emplace(Args&&... args)
+	{
+		const unsigned int in = m_nIn.load(std::memory_order_relaxed);
+		if (in - m_nOutCached == m_nSize)
+		{
+			m_nOutCached = m_nOut.load(std::memory_order_acquire);
+			if (in - m_nOutCached == m_nSize)
+				return false;
 		}
+		new (m_pBuffer + (in & m_nMask)) elementType(
+				std::forward<Args>(args)...);
+		m_nIn.store(in + 1, std::memory_order_release);
+		return true;
+	}
+	bool try_push(const elementType& ele)
+	{
+		return try_emplace(ele);
 	}
-	void pop_front(elementType& buffer)
+	bool try_push(elementType&& ele)
 	{
-		unsigned int m_len = 0;
-		while (m_len < m_ElementSize)
+		return try_emplace(std::move(ele));
+	}
+	/// copy as many of @eles as fit and publish them with one release store
+	/// @return number of elements pushed, 0 - @count
+	unsigned int try_push_n(const elementType* eles, unsigned int count)
+	{
+		const unsigned int in = m_nIn.load(std::memory_order_relaxed);
+		unsigned int room = m_nSize - (in - m_nOutCached);
+		if (room < count)
 		{
-			m_len = m_ElementSize - m_len;
-			unsigned int l = m_nIn - m_nOut;
-			m_len = m_len < l ? m_len : l;
-
-			/// Ensure that we sample the fifo->in index -before- westart removing bytes from the kfifo.
-#ifdef _WIN32
-			MemoryBarrier();
-#else
-			__sync_synchronize();
-#endif
-			/// first get the data from fifo->out until the end of the buffer
-			l = m_nSize - (m_nOut & (m_nSize - 1));
-			l = m_len < l ? m_len : l;
-
-			memcpy(&buffer, m_pBuffer + (m_nOut & (m_nSize - 1)), l);
-			/// then get the rest (if any) from the beginning of the buffer
-			memcpy(&buffer + l, m_pBuffer, m_len - l);
+			m_nOutCached = m_nOut.load(std::memory_order_acquire);
+			room = m_nSize - (in - m_nOutCached);
+		}
+		if (count > room)
+			count = room;
+		for (unsigned int i = 0; i < count; i++)
+			new (m_pBuffer + ((in + i) & m_nMask)) elementType(eles[i]);
+		if (count > 0)
+			m_nIn.store(in + count, std::memory_order_release);
+		return count;
+	}
 
-			/// Ensure that we remove the bytes from the kfifo -before- we update the fifo->out index.
-#ifdef _WIN32
-			MemoryBarrier();
-#else
-			__sync_synchronize();
-#endif
-			m_nOut += m_len;
+	/// the element at the head, constructed in place and still owned by
+	/// the ring, NULL if empty. call pop() when done with it.
+	elementType* front()
+	{
+		const unsigned int out = m_nOut.load(std::memory_order_relaxed);
+		if (out == m_nInCached)
+		{
+			m_nInCached = m_nIn.load(std::memory_order_acquire);
+			if (out == m_nInCached)
+				return 0;
 		}
+		return m_pBuffer + (out & m_nMask);
+	}
+	/// destroy the head element and hand its slot back to the producer
+	/// @return false if the ring is empty
+	bool pop()
+	{
+		elementType* ele = front();
+		if (ele == 0)
+			return false;
+		ele->~elementType();
+		m_nOut.store(m_nOut.load(std::memory_order_relaxed) + 1,
+				std::memory_order_release);
+		return true;
+	}
+	/// call @fn(elementType&) on the head element in place, then pop it
+	template<class FUNC>
+	bool try_consume(FUNC&& fn)
+	{
+		elementType* ele = front();
+		if (ele == 0)
+			return false;
+		fn(*ele);
+		ele->~elementType();
+		m_nOut.store(m_nOut.load(std::memory_order_relaxed) + 1,
+				std::memory_order_release);
+		return true;
+	}
+	bool try_pop(elementType& ele)
+	{
+		elementType* head = front();
+		if (head == 0)
+			return false;
+		ele = std::move(*head);
+		head->~elementType();
+		m_nOut.store(m_nOut.load(std::memory_order_relaxed) + 1,
+				std::memory_order_release);
+		return true;
+	}
+	/// move up to @count elements out and release their slots with one store
+	/// @return number of elements popped, 0 - @count
+	unsigned int try_pop_n(elementType* eles, unsigned int count)
+	{
+		const unsigned int out = m_nOut.load(std::memory_order_relaxed);
+		unsigned int avail = m_nInCached - out;
+		if (avail < count)
+		{
+			m_nInCached = m_nIn.load(std::memory_order_acquire);
+			avail = m_nInCached - out;
+		}
+		if (count > avail)
+			count = avail;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			elementType* ele = m_pBuffer + ((out + i) & m_nMask);
+			eles[i] = std::move(*ele);
+			ele->~elementType();
+		}
+		if (count > 0)
+			m_nOut.store(out + count, std::memory_order_release);
+		return count;
+	}
+
+	/// These two functions will do whil-loop internally
+	/// until the needed element is pushed or popped
+	void push_back(const elementType& ele)
+	{
+		while (!try_emplace(ele))
+			;
+	}
+	void pop_front(elementType& ele)
+	{
+		while (!try_pop(ele))
+			;
 	}
 
 	/// @Notice
@@ -125,39 +210,43 @@ public:
 	/// Caller need check @position is bwtween 0 and Size() before call it
 	elementType& operator[](unsigned int position) const
 	{
-		return *((elementType*) (m_pBuffer + (m_nOut & (m_nSize - 1))
-				+ position * m_ElementSize));
+		return m_pBuffer[(m_nOut.load(std::memory_order_relaxed) + position)
+				& m_nMask];
 	}
 
 private:
-	bool IsPower2(unsigned long n)
-	{
-		return (n != 0 && ((n & (n - 1)) == 0));
-	}
-	;
-	unsigned long RoundUpPower2(unsigned long val)
+	static unsigned int RoundUpPower2(unsigned int val)
 	{
-		if ((val & (val - 1)) == 0)
-			return val;
-		unsigned long maxulong = (unsigned long) ((unsigned long) ~0);
-		unsigned long andv = ~(maxulong & (maxulong >> 1));
-		while ((andv & val) == 0)
-			andv >>= 1;
-		return andv << 1;
+		val--;
+		val |= val >> 1;
+		val |= val >> 2;
+		val |= val >> 4;
+		val |= val >> 8;
+		val |= val >> 16;
+		return val + 1;
 	}
 
+	spsc_queue_t(const spsc_queue_t&);
+	spsc_queue_t& operator=(const spsc_queue_t&);
+
+	static const unsigned int cacheline_size = 64;
+	typedef char cacheline_pad_t[cacheline_size];
+
 private:
-	uint64_t padding1[16];
-	unsigned int m_nIn; /* data is added at offset (in % size) */
-	uint64_t padding2[16]; // 128 byte
-	unsigned int m_nOut; /* data is extracted from off. (out % size) */
-	uint64_t padding3[16];
-	char *m_pBuffer; /* the buffer holding the data */
-	uint64_t padding4[16];
-	unsigned int m_nSize; /* the size of the allocated buffer */
-	uint64_t padding5[16];
-	unsigned int m_ElementSize;
-	uint64_t padding6[16];
+	cacheline_pad_t pad0_;
+	/// read-only after construction, shared by both sides
+	elementType* m_pBuffer;
+	const unsigned int m_nSize;
+	const unsigned int m_nMask;
+	cacheline_pad_t pad1_;
+	/// producer line: next slot to write + last seen m_nOut
+	std::atomic<unsigned int> m_nIn;
+	unsigned int m_nOutCached;
+	cacheline_pad_t pad2_;
+	/// consumer line: next slot to read + last seen m_nIn
+	std::atomic<unsigned int> m_nOut;
+	unsigned int m_nInCached;
+	cacheline_pad_t pad3_;
 };
 }
 }
@@ -0,0 +1,246 @@
+/*
+ * Geco Gaming Company
+ * All Rights Reserved.
+ * Copyright (c)  2016 GECOEngine.
+ *
+ * GECOEngine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GECOEngine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with KBEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "geco-ds-iwheel-timer.h"
+#include <assert.h>
+
+namespace geco
+{
+    namespace ultils
+    {
+        const int iwtimers_t::WHEEL_BITS;
+        const int iwtimers_t::WHEEL_COUNT;
+        const int iwtimers_t::WHEEL_SLOTS;
+        const int iwtimers_t::SLOT_MASK;
+        const int iwtimers_t::EXPIRED_SLOT;
+        const timeout_t iwtimers_t::TIMEOUT_LIMIT;
+
+        static inline uint64_t rotl64(uint64_t v, int c)
+        {
+            c &= 63;
+            return c ? (v << c) | (v >> (64 - c)) : v;
+        }
+        static inline uint64_t rotr64(uint64_t v, int c)
+        {
+            c &= 63;
+            return c ? (v >> c) | (v << (64 - c)) : v;
+        }
+
+        bool iwtimer_t::pending_expired() const
+        {
+            return pprev != NULL && slot == iwtimers_t::EXPIRED_SLOT;
+        }
+        void iwtimer_t::stop()
+        {
+            if (owner != NULL)
+                owner->stop_timer(this);
+        }
+
+        iwtimers_t::iwtimers_t(timeout_t hz) :
+                expired(NULL), expired_tail(&expired), curtime(0), hertz(
+                        hz ? hz : 1000)
+        {
+            memset(wheel, 0, sizeof(wheel));
+            memset(pending, 0, sizeof(pending));
+        }
+
+        void iwtimers_t::reset()
+        {
+            for (int wheel_idx = 0; wheel_idx < WHEEL_COUNT; wheel_idx++)
+            {
+                wheel_t slots = pending[wheel_idx];
+                while (slots)
+                {
+                    int slot_idx = ctz64(slots);
+                    slots &= slots - 1;
+                    while (wheel[wheel_idx][slot_idx] != NULL)
+                        unlink(wheel[wheel_idx][slot_idx]);
+                }
+            }
+            while (expired != NULL)
+                unlink(expired);
+        }
+
+        void iwtimers_t::add_timer(iwtimer_t* to, timeout_t timeout)
+        {
+            if (to->flags & iwtimer_t::REPEAT)
+                to->interval = timeout > 0 ? timeout : 1;
+            sche_timer(to,
+                    (to->flags & iwtimer_t::ABS) ? timeout : curtime + timeout);
+        }
+
+        void iwtimers_t::stop_timer(iwtimer_t* to)
+        {
+            if (to->pprev != NULL)
+            {
+                assert(to->owner == this);
+                unlink(to);
+            }
+        }
+
+        void iwtimers_t::sche_timer(iwtimer_t* to, timeout_t abs_expires)
+        {
+            if (to->pprev != NULL)
+                to->owner->stop_timer(to);
+
+            to->expires = abs_expires;
+            if (abs_expires > curtime)
+            {
+                int wheel_idx = get_wheel_idx(abs_expires - curtime);
+                int slot_idx = get_slot_idx(wheel_idx, abs_expires);
+                link(&wheel[wheel_idx][slot_idx], to,
+                        (wheel_idx << WHEEL_BITS) | slot_idx);
+                pending[wheel_idx] |= wheel_t(1) << slot_idx;
+            }
+            else
+            {
+                push_expired(to);
+            }
+        }
+
+        void iwtimers_t::readd_timer(iwtimer_t* to)
+        {
+            timeout_t abs_expires = to->expires + to->interval;
+            if (abs_expires <= curtime)
+            {
+                /* missed firings are dropped, fire at the next multiple of
+                 * the interval after the last expiration instead */
+                timeout_t r = (curtime - abs_expires) % to->interval;
+                abs_expires = curtime + (to->interval - r);
+            }
+            sche_timer(to, abs_expires);
+        }
+
+        timeout_t iwtimers_t::get_interval() const
+        {
+            timeout_t timeout = ~timeout_t(0);
+            timeout_t relmask = 0;
+            for (int wheel_idx = 0; wheel_idx < WHEEL_COUNT; wheel_idx++)
+            {
+                if (pending[wheel_idx])
+                {
+                    /* distance in slots from the current slot to the first
+                     * populated one, found with one rotate and one ctz64 */
+                    int slot_idx = SLOT_MASK
+                            & (curtime >> (wheel_idx * WHEEL_BITS));
+                    timeout_t _timeout = timeout_t(
+                            ctz64(rotr64(pending[wheel_idx], slot_idx))
+                                    + !!wheel_idx)
+                            << (wheel_idx * WHEEL_BITS);
+                    _timeout -= relmask & curtime;
+                    if (_timeout < timeout)
+                        timeout = _timeout;
+                }
+                relmask <<= WHEEL_BITS;
+                relmask |= SLOT_MASK;
+            }
+            return timeout;
+        }
+
+        void iwtimers_t::update(timeout_t abstime)
+        {
+            timeout_t elapsed = abstime - curtime;
+            iwtimer_t* todo = NULL;
+
+            for (int wheel_idx = 0; wheel_idx < WHEEL_COUNT; wheel_idx++)
+            {
+                const int shift = wheel_idx * WHEEL_BITS;
+                wheel_t due;
+                if ((elapsed >> shift) > SLOT_MASK)
+                {
+                    /* a full turn of this wheel has passed */
+                    due = ~wheel_t(0);
+                }
+                else
+                {
+                    /* every slot from the old slot up to and including the
+                     * new one */
+                    int _elapsed = SLOT_MASK & (elapsed >> shift);
+                    int oslot = SLOT_MASK & (curtime >> shift);
+                    int nslot = SLOT_MASK & (abstime >> shift);
+                    wheel_t span = (wheel_t(1) << _elapsed) - 1;
+                    due = rotl64(span, oslot);
+                    due |= rotr64(rotl64(span, nslot), _elapsed);
+                    due |= wheel_t(1) << nslot;
+                }
+
+                /* detach the due slots onto the todo chain in one splice
+                 * per slot, they are rescheduled below once curtime moved */
+                wheel_t slots = due & pending[wheel_idx];
+                pending[wheel_idx] &= ~slots;
+                while (slots)
+                {
+                    int slot_idx = ctz64(slots);
+                    slots &= slots - 1;
+                    iwtimer_t* head = wheel[wheel_idx][slot_idx];
+                    wheel[wheel_idx][slot_idx] = NULL;
+                    iwtimer_t* tail = head;
+                    while (tail->next != NULL)
+                        tail = tail->next;
+                    tail->next = todo;
+                    todo = head;
+                }
+
+                if (!(due & 1))
+                    break;
+                /* we wrapped, so the next wheel ticks at least once */
+                if (elapsed < (timeout_t(WHEEL_SLOTS) << shift))
+                    elapsed = timeout_t(WHEEL_SLOTS) << shift;
+            }
+
+            curtime = abstime;
+
+            /* due timers land on the expired queue, timers of a higher wheel
+             * whose slot came due drop to a lower wheel */
+            while (todo != NULL)
+            {
+                iwtimer_t* to = todo;
+                todo = to->next;
+                to->pprev = NULL;
+                to->owner = NULL;
+                sche_timer(to, to->expires);
+            }
+        }
+
+        iwtimer_t* iwtimers_t::get_expired_timer()
+        {
+            iwtimer_t* to = expired;
+            if (to == NULL)
+                return NULL;
+            unlink(to);
+            if ((to->flags & iwtimer_t::REPEAT) && to->interval > 0)
+                readd_timer(to);
+            return to;
+        }
+
+        uint iwtimers_t::expire(timeout_t abstime)
+        {
+            update(abstime);
+            uint fired = 0;
+            iwtimer_t* to;
+            while ((to = get_expired_timer()) != NULL)
+            {
+                to->fire();
+                fired++;
+            }
+            return fired;
+        }
+    }
+}
@@ -0,0 +1,310 @@
+/*
+ * Geco Gaming Company
+ * All Rights Reserved.
+ * Copyright (c)  2016 GECOEngine.
+ *
+ * GECOEngine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GECOEngine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with KBEngine.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * geco-ds-iwheel-timer.h
+ *
+ * allocation free variant of wtimers_t (geco-ds-wheel-timer.h).
+ *
+ * same wheel geometry, 4 wheels of 64 slots, each wheel has a 64 bits
+ * occupancy bitmap and ctz64() finds the next populated slot. the difference
+ * is that nothing is allocated after construction:
+ * 1. timers are linked into the slots through their own next/pprev fields,
+ *    so scheduling, cancelling and cascading are pointer swaps
+ * 2. callbacks are stored inside the timer in GECO_IWTIMER_CB_SIZE bytes,
+ *    a lambda capturing a few pointers fits, std::function is not needed
+ * 3. timers in higher wheels are cascaded down to lower wheels when their
+ *    slot comes due, so every timer fires on the exact tick it expires
+ *
+ * iwtimers_t timers;
+ * iwtimer_t t;
+ * t.set_callback([&](iwtimer_t* self) { ... });
+ * timers.add_timer(&t, 100);    // fire in 100 ticks
+ * timers.expire(now);           // advance the clock and fire due timers
+ */
+
+#ifndef SRC_COMMON_DS_IWHEELTIMERMGRT_H_
+#define SRC_COMMON_DS_IWHEELTIMERMGRT_H_
+
+#include <stdint.h>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include "ultils.h"
+
+/// bytes of inline callback storage in each timer
+#ifndef GECO_IWTIMER_CB_SIZE
+#define GECO_IWTIMER_CB_SIZE 32
+#endif
+
+typedef uint64_t timeout_t;
+
+namespace geco
+{
+    namespace ultils
+    {
+        struct iwtimers_t;
+
+        /// @brief
+        /// intrusive timer node. owned by the caller and linked into at most
+        /// one iwtimers_t at a time, it unlinks itself when destroyed.
+        struct iwtimer_t
+        {
+            public:
+                enum
+                {
+                    REPEAT = 0x01, /* re-arm with @interval after firing */
+                    ABS = 0x02 /* add_timer() values are absolute */
+                };
+
+                iwtimer_t(int wt_flags = 0) :
+                        next(NULL), pprev(NULL), expires(0), interval(0), owner(
+                        NULL), slot(0), flags(wt_flags), invoke(NULL)
+                {
+                }
+                ~iwtimer_t()
+                {
+                    stop();
+                }
+
+                /// store @fn(iwtimer_t*) inline. @fn must fit in
+                /// GECO_IWTIMER_CB_SIZE bytes and be trivially destructible,
+                /// i.e. a function pointer or a lambda capturing pointers/PODs.
+                template<class FUNC>
+                void set_callback(FUNC fn)
+                {
+                    typedef typename std::decay<FUNC>::type fn_t;
+                    static_assert(sizeof(fn_t) <= GECO_IWTIMER_CB_SIZE,
+                            "callback too large for iwtimer_t, raise GECO_IWTIMER_CB_SIZE");
+                    static_assert(alignof(fn_t) <= alignof(cb_storage_t),
+                            "callback over-aligned for iwtimer_t");
+                    static_assert(std::is_trivially_destructible<fn_t>::value,
+                            "iwtimer_t callbacks must be trivially destructible");
+                    new (&storage) fn_t(std::move(fn));
+                    invoke = &invoke_thunk<fn_t>;
+                }
+                /// same as the C style timeout_setcb() of wtimer_t
+                void set_callback(void (*fn)(iwtimer_t*, void*), void* arg)
+                {
+                    set_callback([fn, arg](iwtimer_t* self)
+                    {   fn(self, arg);});
+                }
+                void fire()
+                {
+                    if (invoke != NULL)
+                        invoke(this);
+                }
+
+                /// true if on a wheel or the expired queue
+                bool pending() const
+                {
+                    return pprev != NULL;
+                }
+                bool pending_expired() const;
+                bool pending_wheel() const
+                {
+                    return pending() && !pending_expired();
+                }
+                timeout_t get_expires() const
+                {
+                    return expires;
+                }
+                timeout_t get_interval() const
+                {
+                    return interval;
+                }
+                /// remove from whichever collection holds it, no-op if none
+                void stop();
+
+            private:
+                friend struct iwtimers_t;
+
+                template<class fn_t>
+                static void invoke_thunk(iwtimer_t* self)
+                {
+                    (*reinterpret_cast<fn_t*>(&self->storage))(self);
+                }
+
+                iwtimer_t(const iwtimer_t&);
+                iwtimer_t& operator=(const iwtimer_t&);
+
+                typedef std::aligned_storage<GECO_IWTIMER_CB_SIZE,
+                        alignof(void*)>::type cb_storage_t;
+
+                /// slot list links, pprev points at the previous node's @next
+                /// or at the slot head, NULL when not pending
+                iwtimer_t* next;
+                iwtimer_t** pprev;
+                timeout_t expires; /* abs expiration time */
+                timeout_t interval; /* period if REPEAT */
+                iwtimers_t* owner;
+                unsigned short slot; /* wheel * WHEEL_LEN + slot, or the expired slot */
+                unsigned short flags;
+                void (*invoke)(iwtimer_t*);
+                cb_storage_t storage;
+        };
+
+        /// @brief
+        /// hierarchical timing wheel over intrusive iwtimer_t nodes.
+        /// same algorithm as wtimers_t, see geco-ds-wheel-timer.h for the
+        /// wheel/slot math, plus cascading of higher wheels on update().
+        /// not thread safe.
+        struct iwtimers_t
+        {
+            public:
+                static const int WHEEL_BITS = 6;
+                static const int WHEEL_COUNT = 4;
+                static const int WHEEL_SLOTS = 1 << WHEEL_BITS;
+                static const int SLOT_MASK = WHEEL_SLOTS - 1;
+                static const int EXPIRED_SLOT = WHEEL_COUNT * WHEEL_SLOTS;
+                /// relative timeouts above this are parked on the top wheel
+                /// and cascaded again until they come due
+                static const timeout_t TIMEOUT_LIMIT = (timeout_t(1)
+                        << (WHEEL_BITS * WHEEL_COUNT)) - 1;
+
+                iwtimers_t(timeout_t hz = 1000);
+                /// unlinks every timer still pending, does not free them
+                ~iwtimers_t()
+                {
+                    reset();
+                }
+
+                void reset();
+
+                timeout_t get_hz() const
+                {
+                    return hertz;
+                }
+                timeout_t get_curtime() const
+                {
+                    return curtime;
+                }
+
+                /// @brief arm @to to fire after @timeout ticks, or at @timeout if
+                /// it has the ABS flag. re-arms if already pending.
+                void add_timer(iwtimer_t* to, timeout_t timeout);
+                void stop_timer(iwtimer_t* to);
+
+                /// @brief advance the clock to @abstime, due timers move to the
+                /// expired queue, timers of higher wheels cascade down
+                void update(timeout_t abstime);
+                void step(timeout_t elapsedtime)
+                {
+                    update(curtime + elapsedtime);
+                }
+                /// @return next expired timer (loop until NULL), repeating
+                /// timers are re-armed before they are returned
+                iwtimer_t* get_expired_timer();
+                /// @brief update(@abstime) then fire every expired timer
+                /// @return number of callbacks fired
+                uint expire(timeout_t abstime);
+
+                bool has_expired_timer() const
+                {
+                    return expired != NULL;
+                }
+                bool has_expiring_timer() const
+                {
+                    wheel_t any = 0;
+                    for (int wheel = 0; wheel < WHEEL_COUNT; wheel++)
+                        any |= pending[wheel];
+                    return any != 0;
+                }
+
+                /// @return ticks the caller can sleep before the next update(),
+                /// 0 if timers already expired. never later than the earliest
+                /// timer, may be earlier when only higher wheels are populated.
+                timeout_t timeout() const
+                {
+                    return expired != NULL ? 0 : get_interval();
+                }
+
+            private:
+                friend struct iwtimer_t;
+                typedef uint64_t wheel_t;
+
+                iwtimers_t(const iwtimers_t&);
+                iwtimers_t& operator=(const iwtimers_t&);
+
+                timeout_t get_interval() const;
+                void sche_timer(iwtimer_t* to, timeout_t abs_expires);
+                void readd_timer(iwtimer_t* to);
+
+                void link(iwtimer_t** head, iwtimer_t* to, int slot_index)
+                {
+                    to->next = *head;
+                    if (to->next != NULL)
+                        to->next->pprev = &to->next;
+                    *head = to;
+                    to->pprev = head;
+                    to->slot = (unsigned short) slot_index;
+                    to->owner = this;
+                }
+                void unlink(iwtimer_t* to)
+                {
+                    if (to->slot == EXPIRED_SLOT && expired_tail == &to->next)
+                        expired_tail = to->pprev;
+                    *to->pprev = to->next;
+                    if (to->next != NULL)
+                        to->next->pprev = to->pprev;
+                    if (to->slot != EXPIRED_SLOT
+                            && (&wheel[0][0])[to->slot] == NULL)
+                        pending[to->slot >> WHEEL_BITS] &= ~(wheel_t(1)
+                                << (to->slot & SLOT_MASK));
+                    to->next = NULL;
+                    to->pprev = NULL;
+                    to->owner = NULL;
+                }
+                /// append to the expired queue, get_expired_timer() pops the head
+                void push_expired(iwtimer_t* to)
+                {
+                    to->next = NULL;
+                    to->pprev = expired_tail;
+                    *expired_tail = to;
+                    expired_tail = &to->next;
+                    to->slot = EXPIRED_SLOT;
+                    to->owner = this;
+                }
+
+                static int get_wheel_idx(timeout_t rem)
+                {
+                    if (rem > TIMEOUT_LIMIT)
+                        rem = TIMEOUT_LIMIT;
+                    return (63 - clz64(rem)) / WHEEL_BITS;
+                }
+                static int get_slot_idx(int wheel, timeout_t expires)
+                {
+                    return SLOT_MASK
+                            & ((expires >> (wheel * WHEEL_BITS)) - !!wheel);
+                }
+
+                /// slot heads, one pointer each so the whole wheel set is 2KB
+                iwtimer_t* wheel[WHEEL_COUNT][WHEEL_SLOTS];
+                /// bit n set <=> wheel[w][n] is not empty
+                wheel_t pending[WHEEL_COUNT];
+                iwtimer_t* expired;
+                iwtimer_t** expired_tail;
+                timeout_t curtime;
+                timeout_t hertz;
+        };
+    }
+}
+
+#endif /* SRC_COMMON_DS_IWHEELTIMERMGRT_H_ */
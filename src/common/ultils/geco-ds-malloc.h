@@ -29,6 +29,7 @@
 #include <cstring>
 #include <cassert>
 #include <cstdio>
+#include <mutex>
 #include "geco-ds-config.h"
 
 #ifndef __RESTRICT
@@ -599,13 +600,13 @@ public:
 			return malloc_allocator::allocate(size);
 		}
 
-		/*find an avaiable free list*/
-		my_free_list = free_list + freelist_index(size);
-
 #if defined(GECO_USE_STL_THREADS) && !defined(GECO_NO_THREADS)
 		GECO_ALLOC_LOCK;
 #endif
 
+		/*find an avaiable free list*/
+		my_free_list = free_list + freelist_index(size);
+
 		void* __RESTRICT result = (void*)(*my_free_list);
 		if (result == 0)
 		{
@@ -634,11 +635,11 @@ public:
 			malloc_allocator::deallocate(pointer, size);
 			return;
 		}
-		my_free_list = free_list + freelist_index(size);
-		tmp_unit = (Unit*)pointer;
 #if defined(GECO_USE_STL_THREADS) && !defined(GECO_NO_THREADS)
 		GECO_ALLOC_LOCK;
 #endif
+		my_free_list = free_list + freelist_index(size);
+		tmp_unit = (Unit*)pointer;
 		tmp_unit->_M_free_list_link = *my_free_list;
 		*my_free_list = tmp_unit;
 #if defined(GECO_USE_STL_THREADS) && !defined(GECO_NO_THREADS)
@@ -646,6 +647,55 @@ public:
 #endif
 	}
 
+	/**
+	* hands up to @count units of @size to a thread cache in one go.
+	* the units are chained by _M_free_list_link and 0 terminated.
+	* must be locked if threads enabled
+	* @return the number of units in @head, 1 - @count */
+	int allocate_units_batch(size_t size, Unit*& head, int count)
+	{
+		Unit* GECO_VOLATILE* list = free_list + freelist_index(size);
+		Unit* first = *list;
+		if (first == 0)
+		{
+			// carve the units straight from the pool, no need to build
+			// a free list here that the cache would take apart again
+			size_t aligned_uint_size = round_up(size);
+			int units_size = count;
+			char* units = alloc_units(aligned_uint_size, units_size);
+			for (int i = 0; i < units_size - 1; i++)
+			{
+				((Unit*)(units + i * aligned_uint_size))->_M_free_list_link =
+					(Unit*)(units + (i + 1) * aligned_uint_size);
+			}
+			((Unit*)(units + (units_size - 1) * aligned_uint_size))->_M_free_list_link = 0;
+			head = (Unit*)units;
+			return units_size;
+		}
+
+		int units_size = 1;
+		Unit* last = first;
+		while (units_size < count && last->_M_free_list_link != 0)
+		{
+			last = last->_M_free_list_link;
+			units_size++;
+		}
+		*list = last->_M_free_list_link;
+		last->_M_free_list_link = 0;
+		head = first;
+		return units_size;
+	}
+
+	/**
+	* takes back a chain of units of @size from a thread cache in one go.
+	* must be locked if threads enabled */
+	void deallocate_units_batch(size_t size, Unit* head, Unit* tail)
+	{
+		Unit* GECO_VOLATILE* list = free_list + freelist_index(size);
+		tail->_M_free_list_link = *list;
+		*list = head;
+	}
+
 	void* reallocate(void* unit_pointer, size_t old_unit_size, size_t new_unit_size)
 	{
 		// 如果old_size和new_size均大于__MAX_BYTES, 则直接调用realloc()
@@ -700,7 +750,186 @@ public:
 	}
 };
 
-typedef default_alloc<GECO_ALLOC_USES_THREAD, 0> multi_clients_alloc;
+//! bytes a thread cache moves from/to the central pool per transfer,
+//! the number of units is clamped to [2, GECO_TCACHE_MAX_BATCH]
+#ifndef GECO_TCACHE_BATCH_BYTES
+#define GECO_TCACHE_BATCH_BYTES (16 * 1024)
+#endif
+#define GECO_TCACHE_MAX_BATCH 64
+
+//! Thread caching front end of default_alloc.
+//! Every thread keeps its own free list per size class (the same
+//! NFREELISTS classes of default_alloc) and allocates/deallocates from it
+//! without any lock. Only when a list runs empty, or grows past two
+//! batches, a whole batch of units moves from/to one central default_alloc
+//! under a mutex, so the lock is taken once per batch, not once per call.
+//!
+//! 1. all members are static, instances are interchangeable and it also
+//!    works with simple_alloc<T, thread_cached_alloc<inst> >
+//! 2. a unit allocated on one thread may be freed on another one, it just
+//!    joins the free list of the freeing thread
+//! 3. a cache gives all its units back to the central pool when its
+//!    thread exits, frees after that go to the central pool directly
+template <int inst>
+class thread_cached_alloc
+{
+PRIVATE:
+	struct central_t
+	{
+		std::mutex lock;
+		default_alloc<false, inst> pool;
+	};
+	//! POD so that it is zero initialized and never destructed,
+	//! still usable from other thread_local dtors
+	struct cache_t
+	{
+		Unit* free_list[NFREELISTS];
+		int size[NFREELISTS];
+		//! the reaper of this thread is created
+		bool armed;
+		bool dead;
+	};
+	struct cache_reaper_t
+	{
+		~cache_reaper_t()
+		{
+			for (size_t i = 0; i < NFREELISTS; i++)
+				release(i, tcache_.size[i]);
+			tcache_.dead = true;
+		}
+	};
+	static thread_local cache_t tcache_;
+
+	//! never destroyed, units can still be freed by other static dtors
+	//! when the program exits
+	static central_t& central()
+	{
+		static central_t* central_ = new central_t;
+		return *central_;
+	}
+	static size_t freelist_index(size_t size)
+	{
+		return (((size)+(size_t)ALIGN - 1) / (size_t)ALIGN - 1);
+	}
+	static int batch_units(size_t index)
+	{
+		int units = (int)(GECO_TCACHE_BATCH_BYTES / ((index + 1) * ALIGN));
+		if (units < 2) return 2;
+		if (units > GECO_TCACHE_MAX_BATCH) return GECO_TCACHE_MAX_BATCH;
+		return units;
+	}
+	//! make sure the cache is flushed when this thread exits, on the first
+	//! call of a thread whether it allocates or only frees
+	static void ensure_reaper()
+	{
+		static thread_local cache_reaper_t reaper;
+		(void)reaper;
+		tcache_.armed = true;
+	}
+	static void* refill(size_t index)
+	{
+		Unit* head;
+		int units_size;
+		{
+			central_t& c = central();
+			std::lock_guard<std::mutex> guard(c.lock);
+			units_size = c.pool.allocate_units_batch((index + 1) * ALIGN, head,
+				tcache_.dead ? 1 : batch_units(index));
+		}
+		tcache_.free_list[index] = head->_M_free_list_link;
+		tcache_.size[index] = units_size - 1;
+		return head;
+	}
+	//! give the first @count units of list @index back to the central pool
+	static void release(size_t index, int count)
+	{
+		if (count <= 0) return;
+		Unit* head = tcache_.free_list[index];
+		Unit* tail = head;
+		for (int i = 1; i < count; i++)
+			tail = tail->_M_free_list_link;
+		tcache_.free_list[index] = tail->_M_free_list_link;
+		tcache_.size[index] -= count;
+
+		central_t& c = central();
+		std::lock_guard<std::mutex> guard(c.lock);
+		c.pool.deallocate_units_batch((index + 1) * ALIGN, head, tail);
+	}
+
+public:
+	static void* allocate(size_t size)
+	{
+		if (size == 0) return NULL;
+		if (size > MAX_BYTES) return malloc_allocator::allocate(size);
+
+		if (!tcache_.armed) ensure_reaper();
+		size_t index = freelist_index(size);
+		Unit* result = tcache_.free_list[index];
+		if (result == 0) return refill(index);
+		tcache_.free_list[index] = result->_M_free_list_link;
+		tcache_.size[index]--;
+		return result;
+	}
+
+	static void deallocate(void* pointer, size_t size)
+	{
+		if (pointer == NULL) return;
+		if (size > MAX_BYTES)
+		{
+			malloc_allocator::deallocate(pointer, size);
+			return;
+		}
+
+		if (!tcache_.armed) ensure_reaper();
+		size_t index = freelist_index(size);
+		Unit* unit = (Unit*)pointer;
+		unit->_M_free_list_link = tcache_.free_list[index];
+		tcache_.free_list[index] = unit;
+		int units_size = ++tcache_.size[index];
+		if (tcache_.dead)
+			release(index, units_size);
+		else if (units_size > 2 * batch_units(index))
+			release(index, batch_units(index));
+	}
+
+	static void* reallocate(void* unit_pointer, size_t old_unit_size, size_t new_unit_size)
+	{
+		if (old_unit_size > MAX_BYTES && new_unit_size > MAX_BYTES)
+		{
+			return (malloc_allocator::reallocate(unit_pointer, old_unit_size, new_unit_size));
+		}
+		if (freelist_index(old_unit_size) == freelist_index(new_unit_size))
+		{
+			return unit_pointer;
+		}
+		void* result = allocate(new_unit_size);
+		size_t cpyszie = new_unit_size > old_unit_size ? old_unit_size : new_unit_size;
+		memcpy(result, unit_pointer, cpyszie);
+		deallocate(unit_pointer, old_unit_size);
+		return (result);
+	}
+
+	//! units cached by the calling thread in the free list of @size
+	static int cached_units(size_t size)
+	{
+		return tcache_.size[freelist_index(size)];
+	}
+
+	bool operator==(const thread_cached_alloc&)
+	{
+		return true;
+	}
+
+	bool operator!=(const thread_cached_alloc&)
+	{
+		return false;
+	}
+};
+
+template <int inst>
+thread_local typename thread_cached_alloc<inst>::cache_t thread_cached_alloc<inst>::tcache_;
+
+typedef thread_cached_alloc<0> multi_clients_alloc;
 typedef default_alloc<false, 0> single_client_alloc;
 #endif
 
@@ -719,7 +948,6 @@ struct allocator
 {
 	typedef multi_clients_alloc Alloc;
 	typedef single_client_alloc SAlloc;
-	SAlloc salloc;
 
 	typedef size_t size_type;
 	typedef ptrdiff_t difference_type;
@@ -759,13 +987,13 @@ struct allocator
 	pointer allocate(size_type alloc_size, const void* = 0)
 	{
 		return alloc_size == 0 ?
-			NULL : (pointer)(salloc.allocate(alloc_size * sizeof(value_type)));
+			NULL : (pointer)(Alloc::allocate(alloc_size * sizeof(value_type)));
 	}
 
 	//! __p is not permitted to be a null pointer.
 	void deallocate(pointer ptr, size_type alloc_size)
 	{
-		salloc.deallocate(ptr, alloc_size * sizeof(value_type));
+		Alloc::deallocate(ptr, alloc_size * sizeof(value_type));
 	}
 
 	size_type max_size() const GECO_NOTHROW
@@ -970,6 +1198,16 @@ struct alloc_adaptor_1<_Tp, default_alloc<__threads, __inst> >
 	typedef alloc_adaptor_0<_Tp, default_alloc<__threads, __inst> >
 		allocator_type;
 };
+// 3) for thread_cached_alloc
+template <class _Tp, int __inst>
+struct alloc_adaptor_1<_Tp, thread_cached_alloc<__inst> >
+{
+	static const bool _S_instanceless = true;
+	typedef simple_alloc<_Tp, thread_cached_alloc<__inst> >
+		simple_alloc_type;
+	typedef alloc_adaptor_0<_Tp, thread_cached_alloc<__inst> >
+		allocator_type;
+};
 template <class _Tp, class _Alloc>
 struct alloc_adaptor_1<_Tp, debug_alloc<_Alloc> >
 {
@@ -0,0 +1,413 @@
+/*
+* Geco Gaming Company
+* All Rights Reserved.
+* Copyright (c)  2016 GECOEngine.
+*
+* GECOEngine is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* GECOEngine is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with KBEngine.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include <string.h>
+#include <signal.h>
+#include <string>
+#ifdef _WIN32
+#include <io.h>
+#define geco_write_fd _write
+#else
+#include <unistd.h>
+#define geco_write_fd write
+#endif
+
+#include "geco-malloc-tracker.h"
+#include "../debugging/gecowatchert.h"
+
+std::atomic<bool> geco_alloc_tracker_t::enabled_(false);
+
+/// zero initialized, so usable before any static ctor runs
+static geco_alloc_site_t s_sites[GECO_ALLOC_MAX_SITES];
+static std::atomic<uint64> s_untracked_allocs(0);
+
+static inline uint64 site_key(const char* file, uint line)
+{
+	/// never 0, 0 marks a free slot
+	uint64 key = ((uint64)(uintptr)file * 0x9E3779B97F4A7C15ULL) ^
+		((uint64)line * 0xC2B2AE3D27D4EB4FULL);
+	key ^= key >> 29;
+	return key | 1;
+}
+
+static geco_alloc_site_t* find_or_insert_site(const char* file, uint line,
+	uint& id)
+{
+	const uint64 key = site_key(file, line);
+	const uint shard = (uint)(key >> 60) & (GECO_ALLOC_SITE_SHARDS - 1);
+	geco_alloc_site_t* sites = s_sites + shard * GECO_ALLOC_SITES_PER_SHARD;
+	uint slot = (uint)(key >> 8) & (GECO_ALLOC_SITES_PER_SHARD - 1);
+	for (uint probes = 0; probes < GECO_ALLOC_SITES_PER_SHARD; probes++)
+	{
+		geco_alloc_site_t& site = sites[slot];
+		uint64 seen = site.key.load(std::memory_order_acquire);
+		if (seen == 0)
+		{
+			if (site.key.compare_exchange_strong(seen, key,
+				std::memory_order_acq_rel))
+			{
+				site.file = file;
+				site.line = line;
+				site.ready.store(true, std::memory_order_release);
+				id = shard * GECO_ALLOC_SITES_PER_SHARD + slot + 1;
+				return &site;
+			}
+			/// lost the race, @seen is the winner's key
+		}
+		if (seen == key)
+		{
+			id = shard * GECO_ALLOC_SITES_PER_SHARD + slot + 1;
+			return &site;
+		}
+		slot = (slot + 1) & (GECO_ALLOC_SITES_PER_SHARD - 1);
+	}
+	return NULL;
+}
+
+void geco_alloc_tracker_t::enable(bool on)
+{
+	enabled_.store(on, std::memory_order_relaxed);
+	if (on)
+		update_watchers();
+}
+
+uint geco_alloc_tracker_t::on_alloc(size_t size, const char* file, uint line)
+{
+	if (!enabled_.load(std::memory_order_relaxed) || file == NULL)
+		return 0;
+	uint id;
+	geco_alloc_site_t* site = find_or_insert_site(file, line, id);
+	if (site == NULL)
+	{
+		s_untracked_allocs.fetch_add(1, std::memory_order_relaxed);
+		return 0;
+	}
+	site->allocs.fetch_add(1, std::memory_order_relaxed);
+	site->live_count.fetch_add(1, std::memory_order_relaxed);
+	uint64 live = site->live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+	uint64 peak = site->peak_bytes.load(std::memory_order_relaxed);
+	while (live > peak && !site->peak_bytes.compare_exchange_weak(peak, live,
+		std::memory_order_relaxed))
+		;
+	return id;
+}
+
+void geco_alloc_tracker_t::on_free(uint id, size_t size)
+{
+	geco_alloc_site_t* site = geco_alloc_tracker_t::site(id);
+	if (site == NULL)
+		return;
+	site->frees.fetch_add(1, std::memory_order_relaxed);
+	site->live_count.fetch_sub(1, std::memory_order_relaxed);
+	site->live_bytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+geco_alloc_site_t* geco_alloc_tracker_t::site(uint id)
+{
+	if (id == 0 || id > GECO_ALLOC_MAX_SITES)
+		return NULL;
+	return &s_sites[id - 1];
+}
+
+void geco_alloc_tracker_t::get_stats(geco_alloc_stats_t& stats)
+{
+	memset(&stats, 0, sizeof(stats));
+	for (uint i = 0; i < GECO_ALLOC_MAX_SITES; i++)
+	{
+		const geco_alloc_site_t& site = s_sites[i];
+		if (!site.ready.load(std::memory_order_acquire))
+			continue;
+		stats.sites++;
+		stats.live_bytes += site.live_bytes.load(std::memory_order_relaxed);
+		stats.live_count += site.live_count.load(std::memory_order_relaxed);
+		stats.allocs += site.allocs.load(std::memory_order_relaxed);
+		stats.frees += site.frees.load(std::memory_order_relaxed);
+	}
+	stats.untracked_allocs = s_untracked_allocs.load(std::memory_order_relaxed);
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// 　　　　　　　　　　　　 Section: async-signal-safe report
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+namespace
+{
+/// fixed line buffer, snprintf() is not async-signal-safe
+struct report_line_t
+{
+	char buf[512];
+	uint len;
+
+	report_line_t() : len(0) {}
+	void str(const char* s)
+	{
+		while (*s != 0 && len < sizeof(buf) - 1)
+			buf[len++] = *s++;
+	}
+	void num(uint64 v, uint width = 0)
+	{
+		char digits[24];
+		uint n = 0;
+		do
+		{
+			digits[n++] = (char)('0' + v % 10);
+			v /= 10;
+		} while (v != 0);
+		while (width > n && len < sizeof(buf) - 1)
+		{
+			buf[len++] = ' ';
+			width--;
+		}
+		while (n > 0 && len < sizeof(buf) - 1)
+			buf[len++] = digits[--n];
+	}
+	void flush(int fd)
+	{
+		buf[len++] = '\n';
+		while (len > 0)
+		{
+			int written = (int)geco_write_fd(fd, buf, len);
+			if (written <= 0)
+				break;
+			memmove(buf, buf + written, len - written);
+			len -= written;
+		}
+		len = 0;
+	}
+};
+}
+
+void geco_alloc_tracker_t::dump(int fd, uint max_sites)
+{
+	geco_alloc_stats_t stats;
+	get_stats(stats);
+	report_line_t line;
+	line.str("geco alloc tracker: live ");
+	line.num(stats.live_bytes);
+	line.str(" bytes in ");
+	line.num(stats.live_count);
+	line.str(" blocks, ");
+	line.num(stats.allocs);
+	line.str(" allocs, ");
+	line.num(stats.frees);
+	line.str(" frees, ");
+	line.num(stats.sites);
+	line.str(" sites, ");
+	line.num(stats.untracked_allocs);
+	line.str(" untracked allocs");
+	line.flush(fd);
+	line.str("  live bytes   live blocks          peak        allocs         frees  site");
+	line.flush(fd);
+
+	/// selection of the biggest sites, ordered by (live bytes, slot),
+	/// no room to sort in a signal handler
+	uint64 last_bytes = ~(uint64)0;
+	uint last_slot = GECO_ALLOC_MAX_SITES;
+	for (uint n = 0; n < max_sites; n++)
+	{
+		uint best = GECO_ALLOC_MAX_SITES;
+		uint64 best_bytes = 0;
+		for (uint i = 0; i < GECO_ALLOC_MAX_SITES; i++)
+		{
+			if (!s_sites[i].ready.load(std::memory_order_acquire))
+				continue;
+			uint64 bytes = s_sites[i].live_bytes.load(std::memory_order_relaxed);
+			bool below_last = bytes < last_bytes ||
+				(bytes == last_bytes && i > last_slot);
+			if (below_last && (best == GECO_ALLOC_MAX_SITES || bytes > best_bytes))
+			{
+				best = i;
+				best_bytes = bytes;
+			}
+		}
+		if (best == GECO_ALLOC_MAX_SITES)
+			break;
+		last_bytes = best_bytes;
+		last_slot = best;
+
+		const geco_alloc_site_t& site = s_sites[best];
+		line.num(best_bytes, 12);
+		line.num(site.live_count.load(std::memory_order_relaxed), 14);
+		line.num(site.peak_bytes.load(std::memory_order_relaxed), 14);
+		line.num(site.allocs.load(std::memory_order_relaxed), 14);
+		line.num(site.frees.load(std::memory_order_relaxed), 14);
+		line.str("  ");
+		line.str(site.file);
+		line.str(":");
+		line.num(site.line);
+		line.flush(fd);
+	}
+}
+
+#ifndef _WIN32
+static int s_dump_fd = 2;
+static uint s_dump_max_sites = 32;
+static void on_dump_signal(int)
+{
+	geco_alloc_tracker_t::dump(s_dump_fd, s_dump_max_sites);
+}
+#endif
+
+bool geco_alloc_tracker_t::install_dump_signal(int signo, int fd, uint max_sites)
+{
+#ifdef _WIN32
+	return false;
+#else
+	s_dump_fd = fd;
+	s_dump_max_sites = max_sites;
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = on_dump_signal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	return sigaction(signo, &action, NULL) == 0;
+#endif
+}
+
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// 　　　　　　　　　　　　 Section: watchers
+//- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+#if ENABLE_WATCHERS
+namespace
+{
+/// read-only view of one site for method watchers,
+/// the atomics are copied into @value_ on read
+struct alloc_site_watch_t
+{
+	geco_alloc_site_t* site_;
+	uint64 value_;
+
+	uint64& live_bytes() { return value_ = site_->live_bytes.load(std::memory_order_relaxed); }
+	uint64& live_count() { return value_ = site_->live_count.load(std::memory_order_relaxed); }
+	uint64& peak_bytes() { return value_ = site_->peak_bytes.load(std::memory_order_relaxed); }
+	uint64& allocs() { return value_ = site_->allocs.load(std::memory_order_relaxed); }
+	uint64& frees() { return value_ = site_->frees.load(std::memory_order_relaxed); }
+};
+
+/// slots that already have watchers, claimed with a compare-exchange since
+/// enable() and the siteCount watcher can both be adding them
+std::atomic<bool> s_watched[GECO_ALLOC_MAX_SITES];
+
+uint64& watch_live_bytes()
+{
+	geco_alloc_stats_t stats;
+	geco_alloc_tracker_t::get_stats(stats);
+	static thread_local uint64 value;
+	return value = stats.live_bytes;
+}
+uint64& watch_live_count()
+{
+	geco_alloc_stats_t stats;
+	geco_alloc_tracker_t::get_stats(stats);
+	static thread_local uint64 value;
+	return value = stats.live_count;
+}
+uint64& watch_allocs()
+{
+	geco_alloc_stats_t stats;
+	geco_alloc_tracker_t::get_stats(stats);
+	static thread_local uint64 value;
+	return value = stats.allocs;
+}
+uint64& watch_frees()
+{
+	geco_alloc_stats_t stats;
+	geco_alloc_tracker_t::get_stats(stats);
+	static thread_local uint64 value;
+	return value = stats.frees;
+}
+uint64& watch_site_count()
+{
+	geco_alloc_tracker_t::update_watchers();
+	geco_alloc_stats_t stats;
+	geco_alloc_tracker_t::get_stats(stats);
+	static thread_local uint64 value;
+	return value = stats.sites;
+}
+bool s_enabled_watch;
+bool& watch_enabled()
+{
+	return s_enabled_watch = geco_alloc_tracker_t::enabled();
+}
+void set_enabled(bool& on)
+{
+	geco_alloc_tracker_t::enable(on);
+}
+
+bool add_tracker_watchers()
+{
+	GECO_WATCH("Memory/Allocations/enabled", CAST_FUNC_RW(bool, watch_enabled, set_enabled),
+		"record geco_malloc_ext() call sites");
+	GECO_WATCH("Memory/Allocations/liveBytes", CAST_FUNC_R(uint64, watch_live_bytes),
+		"bytes allocated by tracked sites and not freed yet");
+	GECO_WATCH("Memory/Allocations/liveCount", CAST_FUNC_R(uint64, watch_live_count),
+		"blocks allocated by tracked sites and not freed yet");
+	GECO_WATCH("Memory/Allocations/allocs", CAST_FUNC_R(uint64, watch_allocs),
+		"allocations recorded");
+	GECO_WATCH("Memory/Allocations/frees", CAST_FUNC_R(uint64, watch_frees),
+		"frees recorded");
+	GECO_WATCH("Memory/Allocations/siteCount", CAST_FUNC_R(uint64, watch_site_count),
+		"call sites seen, reading it adds the new ones under sites/");
+	return true;
+}
+}
+#endif
+
+void geco_alloc_tracker_t::update_watchers()
+{
+#if ENABLE_WATCHERS
+	static bool added = add_tracker_watchers();
+	(void)added;
+	for (uint i = 0; i < GECO_ALLOC_MAX_SITES; i++)
+	{
+		geco_alloc_site_t& site = s_sites[i];
+		if (s_watched[i].load(std::memory_order_relaxed) ||
+			!site.ready.load(std::memory_order_acquire))
+			continue;
+		bool watched = false;
+		if (!s_watched[i].compare_exchange_strong(watched, true))
+			continue;
+
+		/// "sites/<file name>:<line>/", the directory part of the file
+		/// would split the watcher path
+		const char* name = strrchr(site.file, '/');
+		const char* bslash = strrchr(site.file, '\\');
+		if (bslash != NULL && (name == NULL || bslash > name))
+			name = bslash;
+		name = name == NULL ? site.file : name + 1;
+		char line[16];
+		snprintf(line, sizeof(line), ":%u/", site.line);
+		std::string dir = std::string("Memory/Allocations/sites/") + name + line;
+
+		alloc_site_watch_t* watch = new alloc_site_watch_t;
+		watch->site_ = &site;
+		watch->value_ = 0;
+		GECO_WATCH((dir + "liveBytes").c_str(), *watch,
+			CAST_METHOD_R(uint64, alloc_site_watch_t, live_bytes));
+		GECO_WATCH((dir + "liveCount").c_str(), *watch,
+			CAST_METHOD_R(uint64, alloc_site_watch_t, live_count));
+		GECO_WATCH((dir + "peakBytes").c_str(), *watch,
+			CAST_METHOD_R(uint64, alloc_site_watch_t, peak_bytes));
+		GECO_WATCH((dir + "allocs").c_str(), *watch,
+			CAST_METHOD_R(uint64, alloc_site_watch_t, allocs));
+		GECO_WATCH((dir + "frees").c_str(), *watch,
+			CAST_METHOD_R(uint64, alloc_site_watch_t, frees));
+	}
+#endif
+}
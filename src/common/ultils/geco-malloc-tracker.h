@@ -0,0 +1,121 @@
+/*
+* Geco Gaming Company
+* All Rights Reserved.
+* Copyright (c)  2016 GECOEngine.
+*
+* GECOEngine is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* GECOEngine is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public License
+* along with KBEngine.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+/*
+* geco-malloc-tracker.h
+*
+* per call site allocation statistics of geco_malloc_ext()/geco_free_ext().
+* every block remembers the site (file, line) that allocated it, so frees
+* are charged back to the allocating site no matter where they happen.
+*
+* geco_alloc_tracker_t::enable(true);                // start recording
+* geco_alloc_tracker_t::install_dump_signal(SIGUSR2); // kill -USR2 <pid>
+* geco_alloc_tracker_t::dump(fd, 20);                // top 20 by live bytes
+*
+* watchers live under "Memory/Allocations", one sub directory per site
+* under "Memory/Allocations/sites" named "<file>:<line>".
+*/
+
+#ifndef __INCLUDE_GECO_MALLOC_TRACKER_H
+#define __INCLUDE_GECO_MALLOC_TRACKER_H
+
+#include <stddef.h>
+#include <atomic>
+#include "../geco-plateform.h"
+
+/// site slots per shard, sites that hash into a full shard are not tracked
+#define GECO_ALLOC_SITES_PER_SHARD 256
+#define GECO_ALLOC_SITE_SHARDS 16
+#define GECO_ALLOC_MAX_SITES (GECO_ALLOC_SITES_PER_SHARD * GECO_ALLOC_SITE_SHARDS)
+
+/// one call site, a cache line of its own so that hot sites on different
+/// threads do not share lines
+struct alignas(64) geco_alloc_site_t
+{
+	/// 0 while the slot is free, set once with a CAS
+	std::atomic<uint64> key;
+	/// valid once @ready is true
+	const char* file;
+	uint line;
+	std::atomic<bool> ready;
+	/// bytes and blocks allocated here and not freed yet
+	std::atomic<uint64> live_bytes;
+	std::atomic<uint64> live_count;
+	/// high-water mark of @live_bytes
+	std::atomic<uint64> peak_bytes;
+	/// total allocations and frees, their difference churns memory
+	std::atomic<uint64> allocs;
+	std::atomic<uint64> frees;
+};
+
+/// totals over all sites
+struct geco_alloc_stats_t
+{
+	uint64 live_bytes;
+	uint64 live_count;
+	uint64 allocs;
+	uint64 frees;
+	uint sites;
+	/// allocations not recorded because their shard was full
+	uint64 untracked_allocs;
+};
+
+/// @brief
+/// lock-free table of call sites split into GECO_ALLOC_SITE_SHARDS shards
+/// by the hash of (file, line). a site is inserted with one CAS and never
+/// removed, counters are relaxed atomics, so recording never blocks and
+/// the table can be read from a signal handler.
+class GECOAPI geco_alloc_tracker_t
+{
+public:
+	/// start or stop recording. blocks allocated while stopped are never
+	/// charged to a site, so toggling at any time is safe.
+	static void enable(bool on);
+	static bool enabled()
+	{
+		return enabled_.load(std::memory_order_relaxed);
+	}
+
+	/// @return the site id of (@file, @line) to be kept with the block,
+	/// 0 if not recording or the shard is full
+	static uint on_alloc(size_t size, const char* file, uint line);
+	/// charge a free to @site, the id on_alloc() returned for the block
+	static void on_free(uint site, size_t size);
+
+	/// the site of @site id, NULL for 0
+	static geco_alloc_site_t* site(uint site);
+	static void get_stats(geco_alloc_stats_t& stats);
+
+	/// write the top @max_sites sites by live bytes to @fd. only uses
+	/// write(), no allocation and no lock, so it is async-signal-safe.
+	static void dump(int fd, uint max_sites);
+	/// dump(@fd, @max_sites) whenever @signo arrives, no-op on windows
+	static bool install_dump_signal(int signo, int fd = 2, uint max_sites = 32);
+
+	/// register the watchers of the sites seen since the last call under
+	/// "Memory/Allocations/sites". called on enable() and whenever
+	/// "Memory/Allocations/siteCount" is read.
+	static void update_watchers();
+
+private:
+	static std::atomic<bool> enabled_;
+};
+
+#endif
@@ -22,6 +22,7 @@
 
 #include "geco-malloc.h"
 #include "geco-ds-malloc.h"
+#include "geco-malloc-tracker.h"
 
 static void* _DefaultMalloc(size_t size)
 {
@@ -42,26 +43,46 @@ GecoMalloc geco_malloc = _DefaultMalloc;
 GecoRealloc geco_realloc = _DefaultRealloc;
 GecoFree geco_free = _DefaultFree;
 
-static geco::ds::single_client_alloc galloc;
+static geco::ds::multi_clients_alloc galloc;
+
+/// kept in front of every block of geco_malloc_ext(), 8 bytes so that the
+/// client pointer keeps the 8 bytes alignment of the pool units
+struct geco_block_header_t
+{
+    /// block size including this header
+    unsigned int size;
+    /// geco_alloc_tracker_t site id, 0 if not tracked
+    unsigned int site;
+};
+
 static void* _DefaultMalloc_Ex(size_t size, const char *file, unsigned int line)
 {
-    char* buf = (char*)galloc.allocate(size + sizeof(int));
-    *(int*)buf = size + sizeof(int);
-    return (buf + sizeof(int));
+    size_t total = size + sizeof(geco_block_header_t);
+    geco_block_header_t* header = (geco_block_header_t*)galloc.allocate(total);
+    header->size = (unsigned int)total;
+    header->site = geco_alloc_tracker_t::on_alloc(size, file, line);
+    return header + 1;
 }
 static void* _DefaultRealloc_Ex(void *p, size_t newsize, const char *file,
     unsigned int line)
 {
-    int oldsize = ((int*)((char*)p - sizeof(int)))[0];
-    char* buf = (char*)galloc.reallocate(p, oldsize, newsize + sizeof(int));
-    ((int*)buf)[0] = newsize;
-    return buf + sizeof(int);
+    if (p == NULL) return _DefaultMalloc_Ex(newsize, file, line);
+    geco_block_header_t* header = (geco_block_header_t*)p - 1;
+    geco_alloc_tracker_t::on_free(header->site,
+        header->size - sizeof(geco_block_header_t));
+    size_t total = newsize + sizeof(geco_block_header_t);
+    header = (geco_block_header_t*)galloc.reallocate(header, header->size, total);
+    header->size = (unsigned int)total;
+    header->site = geco_alloc_tracker_t::on_alloc(newsize, file, line);
+    return header + 1;
 }
 static void _DefaultFree_Ex(void *p, const char *file, unsigned int line)
 {
-    char* ptr = (char*)p - sizeof(int);
-    int size = *(int*)ptr;
-    galloc.deallocate(ptr, size);
+    if (p == NULL) return;
+    geco_block_header_t* header = (geco_block_header_t*)p - 1;
+    geco_alloc_tracker_t::on_free(header->site,
+        header->size - sizeof(geco_block_header_t));
+    galloc.deallocate(header, header->size);
 }
 /*function with ext for debug*/
 GecoMallocExt geco_malloc_ext = _DefaultMalloc_Ex;
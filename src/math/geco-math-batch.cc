@@ -0,0 +1,429 @@
+//{future source message}
+#include "geco-math-batch.h"
+#include "geco-math-direction.h"
+
+#include <cstring>
+
+#if GECO_BATCH_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+//----------------------------------------------------------------------------
+// scalar kernels, also used for the tails of the simd ones
+//----------------------------------------------------------------------------
+static void DistanceSqr3fScalar(float* fpOutDistSqr, const float* fpX,
+	const float* fpY, const float* fpZ, uint uiCount, const float* fpPoint3)
+{
+	for (uint i = 0; i < uiCount; i++)
+	{
+		float fDx = fpX[i] - fpPoint3[0];
+		float fDy = fpY[i] - fpPoint3[1];
+		float fDz = fpZ[i] - fpPoint3[2];
+		fpOutDistSqr[i] = fDx * fDx + fDy * fDy + fDz * fDz;
+	}
+}
+//----------------------------------------------------------------------------
+static void Normalize3fScalar(float* fpX, float* fpY, float* fpZ, uint uiCount)
+{
+	for (uint i = 0; i < uiCount; i++)
+	{
+		float fLengthSqr = fpX[i] * fpX[i] + fpY[i] * fpY[i] + fpZ[i] * fpZ[i];
+		if (fLengthSqr > 0.0f)
+		{
+			float fInvLength = 1.0f / sqrtf(fLengthSqr);
+			fpX[i] *= fInvLength;
+			fpY[i] *= fInvLength;
+			fpZ[i] *= fInvLength;
+		}
+	}
+}
+//----------------------------------------------------------------------------
+static void TransformCoordM4fScalar(float* fpOutX, float* fpOutY, float* fpOutZ,
+	const float* fpX, const float* fpY, const float* fpZ, uint uiCount,
+	const float* fpMat4x4)
+{
+	for (uint i = 0; i < uiCount; i++)
+	{
+		float fX = fpX[i], fY = fpY[i], fZ = fpZ[i];
+		float fInvw = 1.0f / (fX * fpMat4x4[3] + fY * fpMat4x4[7] +
+			fZ * fpMat4x4[11] + fpMat4x4[15]);
+		fpOutX[i] = fInvw * (fX * fpMat4x4[0] + fY * fpMat4x4[4] +
+			fZ * fpMat4x4[8] + fpMat4x4[12]);
+		fpOutY[i] = fInvw * (fX * fpMat4x4[1] + fY * fpMat4x4[5] +
+			fZ * fpMat4x4[9] + fpMat4x4[13]);
+		fpOutZ[i] = fInvw * (fX * fpMat4x4[2] + fY * fpMat4x4[6] +
+			fZ * fpMat4x4[10] + fpMat4x4[14]);
+	}
+}
+//----------------------------------------------------------------------------
+static void PackYawPitchScalar(uchar* upOutYaw, uchar* upOutPitch,
+	const float* fpYaw, const float* fpPitch, uint uiCount)
+{
+	for (uint i = 0; i < uiCount; i++)
+	{
+		upOutYaw[i] = AngleToInt8(fpYaw[i]);
+		upOutPitch[i] = HalfAngleToInt8(fpPitch[i]);
+	}
+}
+
+#if GECO_BATCH_X86
+//----------------------------------------------------------------------------
+// SSE2 kernels, 4 lanes
+//----------------------------------------------------------------------------
+GECO_TARGET_SSE2
+static void DistanceSqr3fSSE2(float* fpOutDistSqr, const float* fpX,
+	const float* fpY, const float* fpZ, uint uiCount, const float* fpPoint3)
+{
+	__m128 kPx = _mm_set1_ps(fpPoint3[0]);
+	__m128 kPy = _mm_set1_ps(fpPoint3[1]);
+	__m128 kPz = _mm_set1_ps(fpPoint3[2]);
+	uint i = 0;
+	for (; i + 4 <= uiCount; i += 4)
+	{
+		__m128 kDx = _mm_sub_ps(_mm_loadu_ps(fpX + i), kPx);
+		__m128 kDy = _mm_sub_ps(_mm_loadu_ps(fpY + i), kPy);
+		__m128 kDz = _mm_sub_ps(_mm_loadu_ps(fpZ + i), kPz);
+		__m128 kSum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(kDx, kDx),
+			_mm_mul_ps(kDy, kDy)), _mm_mul_ps(kDz, kDz));
+		_mm_storeu_ps(fpOutDistSqr + i, kSum);
+	}
+	DistanceSqr3fScalar(fpOutDistSqr + i, fpX + i, fpY + i, fpZ + i, uiCount - i, fpPoint3);
+}
+//----------------------------------------------------------------------------
+GECO_TARGET_SSE2
+static void Normalize3fSSE2(float* fpX, float* fpY, float* fpZ, uint uiCount)
+{
+	__m128 kZero = _mm_setzero_ps();
+	__m128 kOne = _mm_set1_ps(1.0f);
+	uint i = 0;
+	for (; i + 4 <= uiCount; i += 4)
+	{
+		__m128 kX = _mm_loadu_ps(fpX + i);
+		__m128 kY = _mm_loadu_ps(fpY + i);
+		__m128 kZ = _mm_loadu_ps(fpZ + i);
+		__m128 kLengthSqr = _mm_add_ps(_mm_add_ps(_mm_mul_ps(kX, kX),
+			_mm_mul_ps(kY, kY)), _mm_mul_ps(kZ, kZ));
+		// zero length lanes are scaled by one
+		__m128 kNonZero = _mm_cmpgt_ps(kLengthSqr, kZero);
+		__m128 kInvLength = _mm_div_ps(kOne, _mm_sqrt_ps(kLengthSqr));
+		kInvLength = _mm_or_ps(_mm_and_ps(kNonZero, kInvLength),
+			_mm_andnot_ps(kNonZero, kOne));
+		_mm_storeu_ps(fpX + i, _mm_mul_ps(kX, kInvLength));
+		_mm_storeu_ps(fpY + i, _mm_mul_ps(kY, kInvLength));
+		_mm_storeu_ps(fpZ + i, _mm_mul_ps(kZ, kInvLength));
+	}
+	Normalize3fScalar(fpX + i, fpY + i, fpZ + i, uiCount - i);
+}
+//----------------------------------------------------------------------------
+GECO_TARGET_SSE2
+static void TransformCoordM4fSSE2(float* fpOutX, float* fpOutY, float* fpOutZ,
+	const float* fpX, const float* fpY, const float* fpZ, uint uiCount,
+	const float* fpMat4x4)
+{
+	__m128 akM[16];
+	for (int j = 0; j < 16; j++)
+		akM[j] = _mm_set1_ps(fpMat4x4[j]);
+	__m128 kOne = _mm_set1_ps(1.0f);
+	uint i = 0;
+	for (; i + 4 <= uiCount; i += 4)
+	{
+		__m128 kX = _mm_loadu_ps(fpX + i);
+		__m128 kY = _mm_loadu_ps(fpY + i);
+		__m128 kZ = _mm_loadu_ps(fpZ + i);
+		__m128 akOut[4];
+		for (int c = 0; c < 4; c++)
+		{
+			akOut[c] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(kX, akM[c]),
+				_mm_mul_ps(kY, akM[4 + c])), _mm_mul_ps(kZ, akM[8 + c])), akM[12 + c]);
+		}
+		__m128 kInvw = _mm_div_ps(kOne, akOut[3]);
+		_mm_storeu_ps(fpOutX + i, _mm_mul_ps(kInvw, akOut[0]));
+		_mm_storeu_ps(fpOutY + i, _mm_mul_ps(kInvw, akOut[1]));
+		_mm_storeu_ps(fpOutZ + i, _mm_mul_ps(kInvw, akOut[2]));
+	}
+	TransformCoordM4fScalar(fpOutX + i, fpOutY + i, fpOutZ + i, fpX + i, fpY + i,
+		fpZ + i, uiCount - i, fpMat4x4);
+}
+//----------------------------------------------------------------------------
+/// floorf() of 4 lanes as int32, SSE2 has no round instruction
+GECO_TARGET_SSE2
+static inline __m128i FloorToIntSSE2(__m128 kValue)
+{
+	__m128i kTrunc = _mm_cvttps_epi32(kValue);
+	// truncation rounded a negative lane up, the compare mask is -1 there
+	__m128 kGreater = _mm_cmpgt_ps(_mm_cvtepi32_ps(kTrunc), kValue);
+	return _mm_add_epi32(kTrunc, _mm_castps_si128(kGreater));
+}
+/// low byte of each int32 lane into 4 bytes at @upOut, as the (uchar) cast
+GECO_TARGET_SSE2
+static inline void StoreLowBytesSSE2(uchar* upOut, __m128i kValue)
+{
+	kValue = _mm_and_si128(kValue, _mm_set1_epi32(0xff));
+	kValue = _mm_packs_epi32(kValue, kValue);
+	kValue = _mm_packus_epi16(kValue, kValue);
+	int iBytes = _mm_cvtsi128_si32(kValue);
+	memcpy(upOut, &iBytes, 4);
+}
+GECO_TARGET_SSE2
+static void PackYawPitchSSE2(uchar* upOutYaw, uchar* upOutPitch,
+	const float* fpYaw, const float* fpPitch, uint uiCount)
+{
+	__m128 kPi = _mm_set1_ps(GECO_MATH_PI_F);
+	__m128 kHalf = _mm_set1_ps(0.5f);
+	__m128 k128 = _mm_set1_ps(128.f);
+	__m128 k254 = _mm_set1_ps(254.f);
+	__m128 kMin = _mm_set1_ps(-128.f);
+	__m128 kMax = _mm_set1_ps(127.f);
+	uint i = 0;
+	for (; i + 4 <= uiCount; i += 4)
+	{
+		// same operation order as AngleToInt8() and HalfAngleToInt8()
+		__m128 kYaw = _mm_add_ps(_mm_div_ps(_mm_mul_ps(_mm_loadu_ps(fpYaw + i), k128), kPi), kHalf);
+		StoreLowBytesSSE2(upOutYaw + i, FloorToIntSSE2(kYaw));
+
+		// clamping before the floor gives the same as clamping after it
+		__m128 kPitch = _mm_add_ps(_mm_div_ps(_mm_mul_ps(_mm_loadu_ps(fpPitch + i), k254), kPi), kHalf);
+		kPitch = _mm_min_ps(_mm_max_ps(kPitch, kMin), kMax);
+		StoreLowBytesSSE2(upOutPitch + i, FloorToIntSSE2(kPitch));
+	}
+	PackYawPitchScalar(upOutYaw + i, upOutPitch + i, fpYaw + i, fpPitch + i, uiCount - i);
+}
+
+//----------------------------------------------------------------------------
+// AVX2 kernels, 8 lanes
+//----------------------------------------------------------------------------
+GECO_TARGET_AVX2
+static void DistanceSqr3fAVX2(float* fpOutDistSqr, const float* fpX,
+	const float* fpY, const float* fpZ, uint uiCount, const float* fpPoint3)
+{
+	__m256 kPx = _mm256_set1_ps(fpPoint3[0]);
+	__m256 kPy = _mm256_set1_ps(fpPoint3[1]);
+	__m256 kPz = _mm256_set1_ps(fpPoint3[2]);
+	uint i = 0;
+	for (; i + 8 <= uiCount; i += 8)
+	{
+		__m256 kDx = _mm256_sub_ps(_mm256_loadu_ps(fpX + i), kPx);
+		__m256 kDy = _mm256_sub_ps(_mm256_loadu_ps(fpY + i), kPy);
+		__m256 kDz = _mm256_sub_ps(_mm256_loadu_ps(fpZ + i), kPz);
+		__m256 kSum = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(kDx, kDx),
+			_mm256_mul_ps(kDy, kDy)), _mm256_mul_ps(kDz, kDz));
+		_mm256_storeu_ps(fpOutDistSqr + i, kSum);
+	}
+	DistanceSqr3fSSE2(fpOutDistSqr + i, fpX + i, fpY + i, fpZ + i, uiCount - i, fpPoint3);
+}
+//----------------------------------------------------------------------------
+GECO_TARGET_AVX2
+static void Normalize3fAVX2(float* fpX, float* fpY, float* fpZ, uint uiCount)
+{
+	__m256 kZero = _mm256_setzero_ps();
+	__m256 kOne = _mm256_set1_ps(1.0f);
+	uint i = 0;
+	for (; i + 8 <= uiCount; i += 8)
+	{
+		__m256 kX = _mm256_loadu_ps(fpX + i);
+		__m256 kY = _mm256_loadu_ps(fpY + i);
+		__m256 kZ = _mm256_loadu_ps(fpZ + i);
+		__m256 kLengthSqr = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(kX, kX),
+			_mm256_mul_ps(kY, kY)), _mm256_mul_ps(kZ, kZ));
+		__m256 kNonZero = _mm256_cmp_ps(kLengthSqr, kZero, _CMP_GT_OQ);
+		__m256 kInvLength = _mm256_div_ps(kOne, _mm256_sqrt_ps(kLengthSqr));
+		kInvLength = _mm256_blendv_ps(kOne, kInvLength, kNonZero);
+		_mm256_storeu_ps(fpX + i, _mm256_mul_ps(kX, kInvLength));
+		_mm256_storeu_ps(fpY + i, _mm256_mul_ps(kY, kInvLength));
+		_mm256_storeu_ps(fpZ + i, _mm256_mul_ps(kZ, kInvLength));
+	}
+	Normalize3fSSE2(fpX + i, fpY + i, fpZ + i, uiCount - i);
+}
+//----------------------------------------------------------------------------
+GECO_TARGET_AVX2
+static void TransformCoordM4fAVX2(float* fpOutX, float* fpOutY, float* fpOutZ,
+	const float* fpX, const float* fpY, const float* fpZ, uint uiCount,
+	const float* fpMat4x4)
+{
+	__m256 akM[16];
+	for (int j = 0; j < 16; j++)
+		akM[j] = _mm256_set1_ps(fpMat4x4[j]);
+	__m256 kOne = _mm256_set1_ps(1.0f);
+	uint i = 0;
+	for (; i + 8 <= uiCount; i += 8)
+	{
+		__m256 kX = _mm256_loadu_ps(fpX + i);
+		__m256 kY = _mm256_loadu_ps(fpY + i);
+		__m256 kZ = _mm256_loadu_ps(fpZ + i);
+		__m256 akOut[4];
+		for (int c = 0; c < 4; c++)
+		{
+			akOut[c] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+				_mm256_mul_ps(kX, akM[c]), _mm256_mul_ps(kY, akM[4 + c])),
+				_mm256_mul_ps(kZ, akM[8 + c])), akM[12 + c]);
+		}
+		__m256 kInvw = _mm256_div_ps(kOne, akOut[3]);
+		_mm256_storeu_ps(fpOutX + i, _mm256_mul_ps(kInvw, akOut[0]));
+		_mm256_storeu_ps(fpOutY + i, _mm256_mul_ps(kInvw, akOut[1]));
+		_mm256_storeu_ps(fpOutZ + i, _mm256_mul_ps(kInvw, akOut[2]));
+	}
+	TransformCoordM4fSSE2(fpOutX + i, fpOutY + i, fpOutZ + i, fpX + i, fpY + i,
+		fpZ + i, uiCount - i, fpMat4x4);
+}
+//----------------------------------------------------------------------------
+/// low byte of each int32 lane into 8 bytes at @upOut
+GECO_TARGET_AVX2
+static inline void StoreLowBytesAVX2(uchar* upOut, __m256i kValue)
+{
+	kValue = _mm256_and_si256(kValue, _mm256_set1_epi32(0xff));
+	__m128i kWords = _mm_packs_epi32(_mm256_castsi256_si128(kValue),
+		_mm256_extracti128_si256(kValue, 1));
+	_mm_storel_epi64((__m128i*)upOut, _mm_packus_epi16(kWords, kWords));
+}
+GECO_TARGET_AVX2
+static void PackYawPitchAVX2(uchar* upOutYaw, uchar* upOutPitch,
+	const float* fpYaw, const float* fpPitch, uint uiCount)
+{
+	__m256 kPi = _mm256_set1_ps(GECO_MATH_PI_F);
+	__m256 kHalf = _mm256_set1_ps(0.5f);
+	__m256 k128 = _mm256_set1_ps(128.f);
+	__m256 k254 = _mm256_set1_ps(254.f);
+	__m256 kMin = _mm256_set1_ps(-128.f);
+	__m256 kMax = _mm256_set1_ps(127.f);
+	uint i = 0;
+	for (; i + 8 <= uiCount; i += 8)
+	{
+		__m256 kYaw = _mm256_add_ps(_mm256_div_ps(_mm256_mul_ps(
+			_mm256_loadu_ps(fpYaw + i), k128), kPi), kHalf);
+		StoreLowBytesAVX2(upOutYaw + i, _mm256_cvttps_epi32(_mm256_floor_ps(kYaw)));
+
+		__m256 kPitch = _mm256_add_ps(_mm256_div_ps(_mm256_mul_ps(
+			_mm256_loadu_ps(fpPitch + i), k254), kPi), kHalf);
+		kPitch = _mm256_min_ps(_mm256_max_ps(kPitch, kMin), kMax);
+		StoreLowBytesAVX2(upOutPitch + i, _mm256_cvttps_epi32(_mm256_floor_ps(kPitch)));
+	}
+	PackYawPitchSSE2(upOutYaw + i, upOutPitch + i, fpYaw + i, fpPitch + i, uiCount - i);
+}
+#endif
+
+//----------------------------------------------------------------------------
+// runtime dispatch
+//----------------------------------------------------------------------------
+struct GecoBatchKernels
+{
+	GecoBatchIsa m_eIsa;
+	void(*m_pfnDistanceSqr3f)(float*, const float*, const float*, const float*,
+		uint, const float*);
+	void(*m_pfnNormalize3f)(float*, float*, float*, uint);
+	void(*m_pfnTransformCoordM4f)(float*, float*, float*, const float*,
+		const float*, const float*, uint, const float*);
+	void(*m_pfnPackYawPitch)(uchar*, uchar*, const float*, const float*, uint);
+};
+//----------------------------------------------------------------------------
+static GecoBatchIsa DetectIsa()
+{
+#if GECO_BATCH_X86 && defined(__GNUC__)
+	__builtin_cpu_init();
+	// checks the os saves the ymm registers as well
+	if (__builtin_cpu_supports("avx2")) return GECO_BATCH_AVX2;
+	if (__builtin_cpu_supports("sse2")) return GECO_BATCH_SSE2;
+	return GECO_BATCH_SCALAR;
+#elif GECO_BATCH_X86 && defined(_MSC_VER)
+	int aiRegs[4];
+	__cpuid(aiRegs, 0);
+	int iMaxLeaf = aiRegs[0];
+	__cpuid(aiRegs, 1);
+	bool bSSE2 = (aiRegs[3] & (1 << 26)) != 0;
+	bool bOSXSave = (aiRegs[2] & (1 << 27)) != 0;
+	bool bAVX = (aiRegs[2] & (1 << 28)) != 0;
+	if (bOSXSave && bAVX && iMaxLeaf >= 7 && (_xgetbv(0) & 6) == 6)
+	{
+		__cpuidex(aiRegs, 7, 0);
+		if (aiRegs[1] & (1 << 5)) return GECO_BATCH_AVX2;
+	}
+	return bSSE2 ? GECO_BATCH_SSE2 : GECO_BATCH_SCALAR;
+#else
+	return GECO_BATCH_SCALAR;
+#endif
+}
+//----------------------------------------------------------------------------
+static void SelectKernels(GecoBatchKernels& kKernels, GecoBatchIsa eIsa)
+{
+	kKernels.m_eIsa = GECO_BATCH_SCALAR;
+	kKernels.m_pfnDistanceSqr3f = DistanceSqr3fScalar;
+	kKernels.m_pfnNormalize3f = Normalize3fScalar;
+	kKernels.m_pfnTransformCoordM4f = TransformCoordM4fScalar;
+	kKernels.m_pfnPackYawPitch = PackYawPitchScalar;
+#if GECO_BATCH_X86
+	if (eIsa >= GECO_BATCH_SSE2)
+	{
+		kKernels.m_eIsa = GECO_BATCH_SSE2;
+		kKernels.m_pfnDistanceSqr3f = DistanceSqr3fSSE2;
+		kKernels.m_pfnNormalize3f = Normalize3fSSE2;
+		kKernels.m_pfnTransformCoordM4f = TransformCoordM4fSSE2;
+		kKernels.m_pfnPackYawPitch = PackYawPitchSSE2;
+	}
+	if (eIsa >= GECO_BATCH_AVX2)
+	{
+		kKernels.m_eIsa = GECO_BATCH_AVX2;
+		kKernels.m_pfnDistanceSqr3f = DistanceSqr3fAVX2;
+		kKernels.m_pfnNormalize3f = Normalize3fAVX2;
+		kKernels.m_pfnTransformCoordM4f = TransformCoordM4fAVX2;
+		kKernels.m_pfnPackYawPitch = PackYawPitchAVX2;
+	}
+#endif
+}
+//----------------------------------------------------------------------------
+static GecoBatchKernels& Kernels()
+{
+	static GecoBatchKernels s_kKernels = []()
+	{
+		GecoBatchKernels kKernels;
+		SelectKernels(kKernels, GecoBatchSupportedIsa());
+		return kKernels;
+	}();
+	return s_kKernels;
+}
+//----------------------------------------------------------------------------
+GecoBatchIsa GecoBatchSupportedIsa()
+{
+	static GecoBatchIsa s_eIsa = DetectIsa();
+	return s_eIsa;
+}
+//----------------------------------------------------------------------------
+GecoBatchIsa GecoBatchGetIsa()
+{
+	return Kernels().m_eIsa;
+}
+//----------------------------------------------------------------------------
+GecoBatchIsa GecoBatchSetIsa(GecoBatchIsa eIsa)
+{
+	if (eIsa > GecoBatchSupportedIsa()) eIsa = GecoBatchSupportedIsa();
+	SelectKernels(Kernels(), eIsa);
+	return eIsa;
+}
+//----------------------------------------------------------------------------
+void GecoBatchDistanceSqr3f(float* fpOutDistSqr, const float* fpX,
+	const float* fpY, const float* fpZ, uint uiCount, const float* fpPoint3)
+{
+	Kernels().m_pfnDistanceSqr3f(fpOutDistSqr, fpX, fpY, fpZ, uiCount, fpPoint3);
+}
+//----------------------------------------------------------------------------
+void GecoBatchNormalize3f(float* fpX, float* fpY, float* fpZ, uint uiCount)
+{
+	Kernels().m_pfnNormalize3f(fpX, fpY, fpZ, uiCount);
+}
+//----------------------------------------------------------------------------
+void GecoBatchTransformCoordM4f(float* fpOutX, float* fpOutY, float* fpOutZ,
+	const float* fpX, const float* fpY, const float* fpZ, uint uiCount,
+	const float* fpMat4x4)
+{
+	Kernels().m_pfnTransformCoordM4f(fpOutX, fpOutY, fpOutZ, fpX, fpY, fpZ,
+		uiCount, fpMat4x4);
+}
+//----------------------------------------------------------------------------
+void GecoBatchPackYawPitch(uchar* upOutYaw, uchar* upOutPitch,
+	const float* fpYaw, const float* fpPitch, uint uiCount)
+{
+	Kernels().m_pfnPackYawPitch(upOutYaw, upOutPitch, fpYaw, fpPitch, uiCount);
+}
+//----------------------------------------------------------------------------
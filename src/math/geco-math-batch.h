@@ -0,0 +1,81 @@
+//{future header message}
+/**
+*	geco-math-batch.h
+*
+*	structure-of-arrays counterparts of the scalar routines in
+*	geco-math-power.h. the scalar family works on one vector per call and
+*	asserts every pointer, these kernels take N x, y and z in separate arrays
+*	so that a whole entity array is processed per tick, 4 lanes at a time with
+*	SSE2 and 8 with AVX2.
+*
+*	the instruction set is picked once at runtime from cpuid, see
+*	GecoBatchGetIsa(). every kernel gives the same results as its scalar
+*	routine, lanes are not fused with FMA.
+*
+*	float afX[N], afY[N], afZ[N], afDistSqr[N];
+*	GecoBatchDistanceSqr3f(afDistSqr, afX, afY, afZ, N, afCenter);
+*
+*	arrays do not need any alignment, 32 bytes is best for AVX2. outputs may
+*	alias the inputs of the same lane.
+*/
+#ifndef __GecoMathBatch_H__
+#define __GecoMathBatch_H__
+
+#include "geco-math-power.h"
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#define GECO_BATCH_X86 1
+#else
+#define GECO_BATCH_X86 0
+#endif
+
+/// gcc and clang only emit the wider instructions in functions marked for
+/// them, msvc emits any intrinsic anywhere. other batch kernels, such as the
+/// GecoPackedXY ones, mark theirs with these too.
+#if GECO_BATCH_X86 && defined(__GNUC__)
+#define GECO_TARGET_SSE2 __attribute__((target("sse2")))
+#define GECO_TARGET_AVX2 __attribute__((target("avx2")))
+#define GECO_TARGET_SSE42 __attribute__((target("sse4.2")))
+#else
+#define GECO_TARGET_SSE2
+#define GECO_TARGET_AVX2
+#define GECO_TARGET_SSE42
+#endif
+
+/// instruction sets of the batch kernels, ordered by width
+enum GecoBatchIsa
+{
+	GECO_BATCH_SCALAR = 0,
+	GECO_BATCH_SSE2 = 1,
+	GECO_BATCH_AVX2 = 2
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+	/// best instruction set of this cpu, detected on the first call
+	GecoBatchIsa GECOAPI GecoBatchSupportedIsa();
+	/// instruction set the kernels currently use
+	GecoBatchIsa GECOAPI GecoBatchGetIsa();
+	/// use @eIsa, clamped to GecoBatchSupportedIsa(). for tests and benchmarks
+	GecoBatchIsa GECOAPI GecoBatchSetIsa(GecoBatchIsa eIsa);
+
+	/// fpOutDistSqr[i] = |(fpX[i], fpY[i], fpZ[i]) - fpPoint3|^2
+	void GECOAPI GecoBatchDistanceSqr3f(float* fpOutDistSqr, const float* fpX,
+		const float* fpY, const float* fpZ, uint uiCount, const float* fpPoint3);
+	/// normalize uiCount vectors in place like GecoNormalize3f, zero length
+	/// vectors are left zero instead of becoming NaN
+	void GECOAPI GecoBatchNormalize3f(float* fpX, float* fpY, float* fpZ, uint uiCount);
+	/// GecoVector3TransformCoordM4f of uiCount points
+	void GECOAPI GecoBatchTransformCoordM4f(float* fpOutX, float* fpOutY, float* fpOutZ,
+		const float* fpX, const float* fpY, const float* fpZ, uint uiCount,
+		const float* fpMat4x4);
+	/// AngleToInt8(fpYaw[i]) and HalfAngleToInt8(fpPitch[i]) of uiCount
+	/// orientations, the packing of GecoYawPitch
+	void GECOAPI GecoBatchPackYawPitch(uchar* upOutYaw, uchar* upOutPitch,
+		const float* fpYaw, const float* fpPitch, uint uiCount);
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif /* __GecoMathBatch_H__ */
@@ -0,0 +1,369 @@
+#include "bundle.h"
+#include "packet-filter.h"
+
+#include <assert.h>
+
+const int GecoNetPacketPool::BLOCK_PACKETS;
+const int GecoNetBundle::REQUEST_HEADER_SIZE;
+
+// -----------------------------------------------------------------------------
+// Section: GecoNetPacketPool
+// -----------------------------------------------------------------------------
+GecoNetPacketPool::GecoNetPacketPool() :
+        pFree_(NULL), numAllocated_(0), numFree_(0)
+{
+}
+
+GecoNetPacketPool::~GecoNetPacketPool()
+{
+    if (numFree_ != numAllocated_)
+        network_logger()->warn("GecoNetPacketPool::~GecoNetPacketPool(): {} packets still in use",
+            numAllocated_ - numFree_);
+    for (size_t i = 0; i < blocks_.size(); i++)
+        delete[] blocks_[i];
+}
+
+GecoNetPacket * GecoNetPacketPool::allocate()
+{
+    if (pFree_ == NULL)
+    {
+        GecoNetPacket * pBlock = new GecoNetPacket[BLOCK_PACKETS];
+        blocks_.push_back(pBlock);
+        for (int i = 0; i < BLOCK_PACKETS; i++)
+            pBlock[i].m_spNext = i + 1 < BLOCK_PACKETS ? &pBlock[i + 1] : NULL;
+        pFree_ = pBlock;
+        numAllocated_ += BLOCK_PACKETS;
+        numFree_ += BLOCK_PACKETS;
+    }
+    GecoNetPacket * pPacket = pFree_;
+    pFree_ = pPacket->m_spNext;
+    numFree_--;
+
+    pPacket->m_spNext = NULL;
+    pPacket->m_iMsgEndOffset = sizeof(GecoNetPacket::Flags);
+    pPacket->m_iFooterSize = 0;
+    pPacket->m_iExtraFilterSize = 0;
+    pPacket->m_uiFirstRequestOffset = 0;
+    pPacket->m_puiLastRequestOffset = NULL;
+    memset(pPacket->m_acData, 0, sizeof(GecoNetPacket::Flags));
+    return pPacket;
+}
+
+void GecoNetPacketPool::release(GecoNetPacket * pChain)
+{
+    if (pChain == NULL)
+        return;
+    GecoNetPacket * pLast = pChain;
+    numFree_++;
+    while (pLast->m_spNext)
+    {
+        pLast = pLast->m_spNext;
+        numFree_++;
+    }
+    pLast->m_spNext = pFree_;
+    pFree_ = pChain;
+}
+
+// -----------------------------------------------------------------------------
+// Section: GecoNetBundle
+// -----------------------------------------------------------------------------
+GecoNetBundle::GecoNetBundle(GecoNetPacketPool & pool, int extraFilterSize) :
+        pool_(pool),
+        extraFilterSize_(extraFilterSize),
+        pFirst_(NULL),
+        pCurrent_(NULL),
+        numPackets_(0),
+        numMessages_(0),
+        pCurrentIE_(NULL),
+        pCurrentHeader_(NULL),
+        messageLength_(0),
+        pMessagePacket_(NULL),
+        messageStart_(0),
+        messageFooterSize_(0),
+        messageFirstRequest_(0),
+        pMessageLastRequest_(NULL),
+        finalised_(false)
+{
+    this->newPacket();
+}
+
+GecoNetBundle::~GecoNetBundle()
+{
+    pool_.release(pFirst_);
+}
+
+void GecoNetBundle::newPacket()
+{
+    GecoNetPacket * pPacket = pool_.allocate();
+    pPacket->m_iExtraFilterSize = extraFilterSize_;
+    if (pCurrent_)
+        pCurrent_->m_spNext = pPacket;
+    else
+        pFirst_ = pPacket;
+    pCurrent_ = pPacket;
+    numPackets_++;
+}
+
+char * GecoNetBundle::startHeader(const GecoNetInterfaceElement & ie, int headerSize, int footerSize)
+{
+    assert(!finalised_);
+    this->endMessage();
+
+    // keep fixed length messages whole when an empty packet would
+    int need = headerSize + ie.NominalBodySize();
+    if (pCurrent_->m_iFooterSize < footerSize)
+        need += footerSize - pCurrent_->m_iFooterSize;
+    if (pCurrent_->m_iMsgEndOffset + need > this->capacity() &&
+        pCurrent_->m_iMsgEndOffset > int(sizeof(GecoNetPacket::Flags)))
+        this->newPacket();
+
+    pMessagePacket_ = pCurrent_;
+    messageStart_ = pCurrent_->m_iMsgEndOffset;
+    messageFooterSize_ = pCurrent_->m_iFooterSize;
+    messageFirstRequest_ = pCurrent_->m_uiFirstRequestOffset;
+    pMessageLastRequest_ = pCurrent_->m_puiLastRequestOffset;
+    if (pCurrent_->m_iFooterSize < footerSize)
+        pCurrent_->m_iFooterSize = footerSize;
+
+    char * pHeader = pCurrent_->Back();
+    pCurrent_->m_iMsgEndOffset += headerSize;
+    *(GecoNetMessageID*) pHeader = ie.GetID();
+    pCurrentIE_ = &ie;
+    pCurrentHeader_ = pHeader;
+    messageLength_ = 0;
+    numMessages_++;
+    return pHeader;
+}
+
+void GecoNetBundle::startMessage(const GecoNetInterfaceElement & ie)
+{
+    this->startHeader(ie, ie.HeaderSize(), 0);
+}
+
+void GecoNetBundle::startRequest(const GecoNetInterfaceElement & ie, GecoNetReplyID replyID)
+{
+    char * pHeader = this->startHeader(ie, ie.HeaderSize() + REQUEST_HEADER_SIZE, sizeof(GecoNetPacket::Offset));
+    char * pRequest = pHeader + ie.HeaderSize();
+    uint32 netReplyID = GECO_HTONL(uint32(replyID));
+    memcpy(pRequest, &netReplyID, sizeof(netReplyID));
+    GecoNetPacket::Offset * pNext = (GecoNetPacket::Offset*) (pRequest + sizeof(netReplyID));
+    memset(pNext, 0, sizeof(GecoNetPacket::Offset));
+
+    // link the previous request of this packet to this one
+    GecoNetPacket::Offset offset = GecoNetPacket::Offset(pHeader - pCurrent_->m_acData);
+    if (pCurrent_->m_uiFirstRequestOffset == 0)
+    {
+        pCurrent_->m_uiFirstRequestOffset = offset;
+    }
+    else
+    {
+        GecoNetPacket::Offset netOffset = GECO_HTONS(offset);
+        memcpy(pCurrent_->m_puiLastRequestOffset, &netOffset, sizeof(netOffset));
+    }
+    pCurrent_->m_puiLastRequestOffset = pNext;
+}
+
+void * GecoNetBundle::reserveInNewPacket(int nBytes)
+{
+    if (nBytes > this->maxReserve())
+    {
+        network_logger()->critical("GecoNetBundle::reserve(): {} bytes do not fit in a packet, use addBlob()",
+            nBytes);
+        return NULL;
+    }
+    this->newPacket();
+    char * pData = pCurrent_->Back();
+    pCurrent_->m_iMsgEndOffset += nBytes;
+    messageLength_ += nBytes;
+    return pData;
+}
+
+void GecoNetBundle::addBlob(const void * pData, int length)
+{
+    const char * pSrc = (const char*) pData;
+    while (length > 0)
+    {
+        int room = this->capacity() - pCurrent_->m_iMsgEndOffset;
+        if (room <= 0)
+        {
+            this->newPacket();
+            continue;
+        }
+        int n = length < room ? length : room;
+        memcpy(pCurrent_->Back(), pSrc, n);
+        pCurrent_->m_iMsgEndOffset += n;
+        messageLength_ += n;
+        pSrc += n;
+        length -= n;
+    }
+}
+
+void GecoNetBundle::endMessage()
+{
+    if (pCurrentIE_ == NULL)
+        return;
+    if (pCurrentIE_->CanHandleLength(messageLength_))
+    {
+        pCurrentIE_->CompressLength(pCurrentHeader_, messageLength_, *this);
+    }
+    else
+    {
+        network_logger()->critical("GecoNetBundle::endMessage(): {} bytes of {} do not fit its {} byte length, "
+            "the message is dropped", messageLength_, pCurrentIE_->c_str(), pCurrentIE_->LengthParam());
+        this->dropMessage();
+    }
+    pCurrentIE_ = NULL;
+    pCurrentHeader_ = NULL;
+}
+
+/// takes the current message out again, with the packets its body started
+void GecoNetBundle::dropMessage()
+{
+    for (GecoNetPacket * pPacket = pMessagePacket_->Next(); pPacket; pPacket = pPacket->Next())
+        numPackets_--;
+    pool_.release(pMessagePacket_->m_spNext);
+    pMessagePacket_->m_spNext = NULL;
+    pCurrent_ = pMessagePacket_;
+    pCurrent_->m_iMsgEndOffset = messageStart_;
+    pCurrent_->m_iFooterSize = messageFooterSize_;
+    pCurrent_->m_uiFirstRequestOffset = messageFirstRequest_;
+    pCurrent_->m_puiLastRequestOffset = pMessageLastRequest_;
+    // a request was linked from the one before it
+    if (pMessageLastRequest_ != NULL)
+        memset(pMessageLastRequest_, 0, sizeof(GecoNetPacket::Offset));
+    numMessages_--;
+}
+
+void GecoNetBundle::finalise()
+{
+    if (finalised_)
+        return;
+    this->endMessage();
+    for (GecoNetPacket * pPacket = pFirst_; pPacket; pPacket = pPacket->Next())
+    {
+        GecoNetPacket::Flags flags = 0;
+        if (pPacket->m_uiFirstRequestOffset)
+        {
+            GecoNetPacket::Offset netOffset = GECO_HTONS(pPacket->m_uiFirstRequestOffset);
+            memcpy(pPacket->Back(), &netOffset, sizeof(netOffset));
+            pPacket->m_iMsgEndOffset += sizeof(netOffset);
+            flags |= GecoNetPacket::FLAG_HAS_REQUESTS;
+        }
+        flags = GECO_HTONS(flags);
+        memcpy(pPacket->m_acData, &flags, sizeof(flags));
+    }
+    finalised_ = true;
+}
+
+void GecoNetBundle::clear()
+{
+    pool_.release(pFirst_);
+    pFirst_ = pCurrent_ = NULL;
+    numPackets_ = 0;
+    numMessages_ = 0;
+    pCurrentIE_ = NULL;
+    pCurrentHeader_ = NULL;
+    messageLength_ = 0;
+    pMessagePacket_ = NULL;
+    finalised_ = false;
+    this->newPacket();
+}
+
+int GecoNetBundle::size() const
+{
+    int total = 0;
+    for (const GecoNetPacket * pPacket = pFirst_; pPacket; pPacket = pPacket->Next())
+        total += pPacket->m_iMsgEndOffset;
+    return total;
+}
+
+// -----------------------------------------------------------------------------
+// Section: GecoNetBundleArena
+// -----------------------------------------------------------------------------
+GecoNetBundleArena::GecoNetBundleArena(GecoNetPacketPool & pool, int extraFilterSize) :
+        pool_(pool), extraFilterSize_(extraFilterSize), numBundles_(0)
+{
+}
+
+GecoNetBundleArena::~GecoNetBundleArena()
+{
+    for (size_t i = 0; i < bundles_.size(); i++)
+        delete bundles_[i];
+}
+
+GecoNetBundle & GecoNetBundleArena::bundle(const GecoNetAddress & addr, GecoNetPacketFilter * pFilter)
+{
+    Index::iterator iter = index_.find(addr);
+    if (iter != index_.end())
+        return *bundles_[iter->second];
+
+    if (pFilter && pFilter->maxSpareSize() > extraFilterSize_)
+        network_logger()->error("GecoNetBundleArena::bundle(): the filter needs {} spare bytes, "
+            "the arena leaves {}, full packets will not be sent", pFilter->maxSpareSize(), extraFilterSize_);
+    if (numBundles_ == (int) bundles_.size())
+    {
+        bundles_.push_back(new GecoNetBundle(pool_, extraFilterSize_));
+        addrs_.push_back(addr);
+        filters_.push_back(pFilter);
+    }
+    else
+    {
+        addrs_[numBundles_] = addr;
+        filters_[numBundles_] = pFilter;
+    }
+    index_[addr] = numBundles_;
+    return *bundles_[numBundles_++];
+}
+
+int GecoNetBundleArena::send(GecoNetEndpoint & endpoint)
+{
+    GecoNetPacket * packets[GecoNetEndpoint::MMSG_BATCH];
+    GecoNetAddress addrs[GecoNetEndpoint::MMSG_BATCH];
+    int count = 0;
+    int numSent = 0;
+    for (int i = 0; i <= numBundles_; i++)
+    {
+        // the last round flushes the partial batch
+        GecoNetPacket * pPacket = NULL;
+        if (i < numBundles_ && bundles_[i]->numMessages())
+        {
+            bundles_[i]->finalise();
+            pPacket = bundles_[i]->pFirstPacket();
+        }
+        for (;;)
+        {
+            if (count == GecoNetEndpoint::MMSG_BATCH || (count && i == numBundles_ && !pPacket))
+            {
+                int sent = endpoint.SendMany(packets, addrs, count);
+                if (sent < count)
+                    network_logger()->error("GecoNetBundleArena::send(): sent {} of {} packets: {}",
+                        sent < 0 ? 0 : sent, count, strerror(errno));
+                numSent += sent < 0 ? 0 : sent;
+                count = 0;
+            }
+            if (!pPacket)
+                break;
+            if (filters_[i] && !filters_[i]->send(pPacket))
+            {
+                network_logger()->error("GecoNetBundleArena::send(): filter refused a packet of {} bytes",
+                    pPacket->m_iMsgEndOffset);
+                pPacket = pPacket->Next();
+                continue;
+            }
+            packets[count] = pPacket;
+            addrs[count] = addrs_[i];
+            count++;
+            pPacket = pPacket->Next();
+        }
+    }
+    this->clear();
+    return numSent;
+}
+
+void GecoNetBundleArena::clear()
+{
+    for (int i = 0; i < numBundles_; i++)
+        bundles_[i]->clear();
+    index_.clear();
+    numBundles_ = 0;
+}
@@ -0,0 +1,231 @@
+//{future header message}
+#ifndef __GecoNetBundle_H__
+#define __GecoNetBundle_H__
+
+#include "end-point.h"
+#include "common/ds/eastl/EASTL/hash_map.h"
+
+class GecoNetPacketFilter;
+
+#include <string.h>
+
+/**
+ *	This class recycles packets. Packets are allocated in blocks that are
+ *	only freed with the pool, released packets go on a free list chained
+ *	through GecoNetPacket::m_spNext, so a tick's packets are reused by the
+ *	next tick without touching the heap.
+ *
+ *	@ingroup network
+ */
+class GECOAPI GecoNetPacketPool
+{
+    public:
+        static const int BLOCK_PACKETS = 32;
+
+        GecoNetPacketPool();
+        ~GecoNetPacketPool();
+
+        /// an empty packet, its flags zeroed and m_iMsgEndOffset past them
+        GecoNetPacket * allocate();
+        /// releases @pChain and every packet chained after it
+        void release(GecoNetPacket * pChain);
+
+        int numAllocated() const
+        {
+            return numAllocated_;
+        }
+        int numFree() const
+        {
+            return numFree_;
+        }
+
+    private:
+        GecoNetPacketPool(const GecoNetPacketPool &);
+        GecoNetPacketPool & operator=(const GecoNetPacketPool &);
+
+        std::vector<GecoNetPacket*> blocks_;
+        GecoNetPacket * pFree_;
+        int numAllocated_;
+        int numFree_;
+};
+
+/**
+ *	This class builds the datagrams of one destination. Messages are appended
+ *	back to back into packets from a GecoNetPacketPool, a packet is only
+ *	started when the current one is full, so small messages share datagrams.
+ *
+ *	A message is a GecoNetInterfaceElement header, the id and for variable
+ *	length messages the length written by CompressLength() when the message
+ *	ends, then its body. Requests add a reply id and the offset of the next
+ *	request in the packet: the packet's m_uiFirstRequestOffset starts the
+ *	chain, m_puiLastRequestOffset points at the link the next request fills
+ *	in, and finalise() appends the first offset as the packet footer.
+ *
+ *	Headers never span packets, bodies may and are read back with
+ *	BundleDataPos.
+ *
+ *	@ingroup network
+ */
+class GECOAPI GecoNetBundle
+{
+    public:
+        /// reply id and next request offset following a request's header
+        static const int REQUEST_HEADER_SIZE = sizeof(GecoNetReplyID) + sizeof(GecoNetPacket::Offset);
+
+        /// @extraFilterSize bytes at the end of every packet are left to filters
+        explicit GecoNetBundle(GecoNetPacketPool & pool, int extraFilterSize = 0);
+        ~GecoNetBundle();
+
+        /// @name Building
+        //@{
+        void startMessage(const GecoNetInterfaceElement & ie);
+        void startRequest(const GecoNetInterfaceElement & ie, GecoNetReplyID replyID);
+        /**
+         *	This method returns @nBytes of contiguous body space of the current
+         *	message, in a new packet when the current one is too full. NULL
+         *	when @nBytes do not fit in an empty packet, use addBlob() for those.
+         */
+        void * reserve(int nBytes)
+        {
+            if (pCurrent_->m_iMsgEndOffset + nBytes > this->capacity())
+                return this->reserveInNewPacket(nBytes);
+            char * pData = pCurrent_->Back();
+            pCurrent_->m_iMsgEndOffset += nBytes;
+            messageLength_ += nBytes;
+            return pData;
+        }
+        /// appends @length bytes, spread over as many packets as needed
+        void addBlob(const void * pData, int length);
+        /// values too big for a packet are spread over packets like a blob
+        template<class TYPE>
+        GecoNetBundle & operator<<(const TYPE & value)
+        {
+            if (int(sizeof(TYPE)) > this->maxReserve())
+                this->addBlob(&value, sizeof(TYPE));
+            else
+                memcpy(this->reserve(sizeof(TYPE)), &value, sizeof(TYPE));
+            return *this;
+        }
+        /**
+         *	This method ends the last message and writes the packet flags and
+         *	footers. A message is dropped, with a critical log, when it ends
+         *	with more bytes than its length field holds.
+         */
+        void finalise();
+        /// releases the packets to the pool, the bundle is empty again
+        void clear();
+        //@}
+
+        /// @name Accessors
+        //@{
+        GecoNetPacket * pFirstPacket() const
+        {
+            return pFirst_;
+        }
+        int numPackets() const
+        {
+            return numPackets_;
+        }
+        int numMessages() const
+        {
+            return numMessages_;
+        }
+        /// bytes in all packets
+        int size() const;
+        bool isFinalised() const
+        {
+            return finalised_;
+        }
+        //@}
+
+    private:
+        int capacity() const
+        {
+            return PACKET_MAX_SIZE - pCurrent_->m_iFooterSize - pCurrent_->m_iExtraFilterSize;
+        }
+        /// the most reserve() can return, the body space of an empty packet
+        int maxReserve() const
+        {
+            return PACKET_MAX_SIZE - int(sizeof(GecoNetPacket::Flags)) - extraFilterSize_;
+        }
+        char * startHeader(const GecoNetInterfaceElement & ie, int headerSize, int footerSize);
+        void * reserveInNewPacket(int nBytes);
+        void endMessage();
+        void dropMessage();
+        void newPacket();
+
+        GecoNetBundle(const GecoNetBundle &);
+        GecoNetBundle & operator=(const GecoNetBundle &);
+
+        GecoNetPacketPool & pool_;
+        int extraFilterSize_;
+
+        GecoNetPacket * pFirst_;
+        GecoNetPacket * pCurrent_;
+        int numPackets_;
+        int numMessages_;
+
+        /// the message being built, its length is compressed when it ends
+        const GecoNetInterfaceElement * pCurrentIE_;
+        char * pCurrentHeader_;
+        int messageLength_;
+        /// the packet state before the current message, for dropMessage()
+        GecoNetPacket * pMessagePacket_;
+        int messageStart_;
+        int messageFooterSize_;
+        GecoNetPacket::Offset messageFirstRequest_;
+        GecoNetPacket::Offset * pMessageLastRequest_;
+        bool finalised_;
+};
+
+/**
+ *	This class coalesces a tick's messages per destination. Every address
+ *	gets one bundle, send() finalises them all, runs their packets through
+ *	the destination's filter, sends them with GecoNetEndpoint::SendMany() and
+ *	recycles the packets and bundles for the next tick.
+ *
+ *	@ingroup network
+ */
+class GECOAPI GecoNetBundleArena
+{
+    public:
+        /// @extraFilterSize must cover the maxSpareSize() of the filters used
+        explicit GecoNetBundleArena(GecoNetPacketPool & pool, int extraFilterSize = 0);
+        ~GecoNetBundleArena();
+
+        /**
+         *	This method returns the bundle of @addr for this tick. @pFilter, when
+         *	given with the first call of the tick, transforms its packets.
+         */
+        GecoNetBundle & bundle(const GecoNetAddress & addr, GecoNetPacketFilter * pFilter = NULL);
+        /**
+         *	This method sends every bundle, then clears the arena.
+         *
+         *	@return the number of packets sent.
+         */
+        int send(GecoNetEndpoint & endpoint);
+        /// drops this tick's bundles unsent
+        void clear();
+
+        int numBundles() const
+        {
+            return numBundles_;
+        }
+
+    private:
+        typedef eastl::hash_map<GecoNetAddress, int, geco_net_addr_hash_functor, geco_net_addr_cmp_functor> Index;
+
+        GecoNetBundleArena(const GecoNetBundleArena &);
+        GecoNetBundleArena & operator=(const GecoNetBundleArena &);
+
+        GecoNetPacketPool & pool_;
+        int extraFilterSize_;
+        Index index_;
+        /// kept across ticks, the first numBundles_ are in use
+        std::vector<GecoNetBundle*> bundles_;
+        std::vector<GecoNetAddress> addrs_;
+        std::vector<GecoNetPacketFilter*> filters_;
+        int numBundles_;
+};
+
+#endif // __GecoNetBundle_H__
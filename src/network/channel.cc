@@ -0,0 +1,341 @@
+#include "channel.h"
+#include "common/debugging/timestamp.h"
+
+const int GecoNetChannel::WINDOW_SIZE;
+const int GecoNetChannel::DATA_HEADER_SIZE;
+const int GecoNetChannel::ACK_HEADER_SIZE;
+const int GecoNetChannel::MAX_PAYLOAD;
+const int GecoNetChannel::FAST_RETRANSMIT_DUP_ACKS;
+const int64 GecoNetChannel::DEFAULT_INITIAL_RTO;
+const int64 GecoNetChannel::DEFAULT_MIN_RTO;
+const int64 GecoNetChannel::DEFAULT_MAX_RTO;
+
+/// byte offsets of the header fields, all in network order
+static const int SEQ_OFFSET = 2;
+static const int DATA_ACK_OFFSET = 6;
+static const int ONLY_ACK_OFFSET = 2;
+
+/// sequence numbers wrap, compare them by their distance
+static INLINE int32 seq_diff(uint32 a, uint32 b)
+{
+    return int32(a - b);
+}
+
+static INLINE void put16(char * p, ushort v)
+{
+    v = htons(v);
+    memcpy(p, &v, sizeof(v));
+}
+static INLINE void put32(char * p, uint32 v)
+{
+    v = htonl(v);
+    memcpy(p, &v, sizeof(v));
+}
+static INLINE ushort get16(const char * p)
+{
+    ushort v;
+    memcpy(&v, p, sizeof(v));
+    return ntohs(v);
+}
+static INLINE uint32 get32(const char * p)
+{
+    uint32 v;
+    memcpy(&v, p, sizeof(v));
+    return ntohl(v);
+}
+
+GecoNetChannel::GecoNetChannel(GecoNetChannelTransport * pTransport, GecoNetChannelReceiver * pReceiver) :
+        pTransport_(pTransport),
+        pReceiver_(pReceiver),
+        pSendRing_(new GecoNetPacket[WINDOW_SIZE]),
+        sendBase_(0),
+        sendNext_(0),
+        pRecvRing_(new GecoNetPacket[WINDOW_SIZE]),
+        recvNext_(0),
+        ackOwed_(false),
+        srtt_(-1),
+        rttvar_(0),
+        rto_(0),
+        minRto_(0),
+        maxRto_(0),
+        fastRetransmit_(true),
+        numPacketsSent_(0),
+        numPacketsResent_(0),
+        numFastRetransmits_(0),
+        numTimeouts_(0),
+        numAcksSent_(0)
+{
+    memset(unacked_, 0, sizeof(unacked_));
+    memset(received_, 0, sizeof(received_));
+    this->setRtoBounds(DEFAULT_INITIAL_RTO, DEFAULT_MIN_RTO, DEFAULT_MAX_RTO);
+}
+
+GecoNetChannel::~GecoNetChannel()
+{
+    delete[] pSendRing_;
+    delete[] pRecvRing_;
+}
+
+void GecoNetChannel::setRtoBounds(int64 initialMicros, int64 minMicros, int64 maxMicros)
+{
+    minRto_ = this->micros2stamps(minMicros);
+    maxRto_ = this->micros2stamps(maxMicros);
+    rto_ = this->micros2stamps(initialMicros);
+    if (srtt_ >= 0)
+        this->sampleRtt(srtt_);
+}
+
+int64 GecoNetChannel::micros2stamps(int64 micros) const
+{
+    return int64(micros * stamps_per_sec_double() / 1000000.0);
+}
+
+double GecoNetChannel::srttMicros() const
+{
+    return srtt_ < 0 ? -1.0 : srtt_ * 1000000.0 / stamps_per_sec_double();
+}
+
+double GecoNetChannel::rtoMicros() const
+{
+    return rto_ * 1000000.0 / stamps_per_sec_double();
+}
+
+GecoNetReason GecoNetChannel::send(const char * data, int length, uint64 now)
+{
+    if (length < 0 || length > MAX_PAYLOAD)
+    {
+        network_logger()->error("GecoNetChannel::send(): message of {} bytes exceeds {}", length, MAX_PAYLOAD);
+        return GECO_NET_REASON_GENERAL_NETWORK;
+    }
+    if (this->windowFull())
+        return GECO_NET_REASON_WINDOW_OVERFLOW;
+
+    uint32 seq = sendNext_++;
+    int slot = seq % WINDOW_SIZE;
+    GecoNetPacket & packet = pSendRing_[slot];
+    put16(packet.m_acData, GecoNetPacket::FLAG_ON_CHANNEL | GecoNetPacket::FLAG_IS_RELIABLE |
+        GecoNetPacket::FLAG_HAS_SEQUENCE_NUMBER | GecoNetPacket::FLAG_HAS_ACKS);
+    put32(packet.m_acData + SEQ_OFFSET, seq);
+    memcpy(packet.m_acData + DATA_HEADER_SIZE, data, length);
+    packet.m_iMsgEndOffset = DATA_HEADER_SIZE + length;
+    this->writeAcks(packet);
+
+    Unacked & unacked = unacked_[slot];
+    unacked.sentAt_ = now;
+    unacked.acked_ = false;
+    unacked.resent_ = false;
+    unacked.fastResent_ = false;
+
+    numPacketsSent_++;
+    pTransport_->sendPacket(&packet);
+    return GECO_NET_REASON_SUCCESS;
+}
+
+GecoNetReason GecoNetChannel::receive(const GecoNetPacket & packet, uint64 now)
+{
+    if (packet.m_iMsgEndOffset < ACK_HEADER_SIZE)
+        return GECO_NET_REASON_CORRUPTED_PACKET;
+    const char * data = packet.m_acData;
+    ushort flags = get16(data);
+    if (!(flags & GecoNetPacket::FLAG_ON_CHANNEL) || !(flags & GecoNetPacket::FLAG_HAS_ACKS))
+        return GECO_NET_REASON_CORRUPTED_PACKET;
+
+    bool hasSeq = (flags & GecoNetPacket::FLAG_HAS_SEQUENCE_NUMBER) != 0;
+    if (hasSeq && packet.m_iMsgEndOffset < DATA_HEADER_SIZE)
+        return GECO_NET_REASON_CORRUPTED_PACKET;
+
+    const char * acks = data + (hasSeq ? DATA_ACK_OFFSET : ONLY_ACK_OFFSET);
+    uint64 sack = (uint64(get32(acks + 4)) << 32) | get32(acks + 8);
+    this->processAcks(get32(acks), sack, now);
+    if (!hasSeq)
+        return GECO_NET_REASON_SUCCESS;
+
+    uint32 seq = get32(data + SEQ_OFFSET);
+    int32 ahead = seq_diff(seq, recvNext_);
+    if (ahead < 0)
+    {
+        // our ack got lost, tell the peer again
+        this->sendAck();
+        return GECO_NET_REASON_SUCCESS;
+    }
+    if (ahead >= WINDOW_SIZE)
+        return GECO_NET_REASON_WINDOW_OVERFLOW;
+
+    if (ahead > 0)
+    {
+        // out of order: keep it and ack at once, the duplicate ack with its
+        // selective acks is what triggers the peer's fast retransmit
+        int slot = seq % WINDOW_SIZE;
+        if (!received_[slot])
+        {
+            received_[slot] = true;
+            memcpy(pRecvRing_[slot].m_acData, data, packet.m_iMsgEndOffset);
+            pRecvRing_[slot].m_iMsgEndOffset = packet.m_iMsgEndOffset;
+        }
+        this->sendAck();
+        return GECO_NET_REASON_SUCCESS;
+    }
+
+    pReceiver_->handleMessage(data + DATA_HEADER_SIZE, packet.m_iMsgEndOffset - DATA_HEADER_SIZE);
+    recvNext_++;
+    bool filledGap = false;
+    int slot = recvNext_ % WINDOW_SIZE;
+    while (received_[slot])
+    {
+        received_[slot] = false;
+        const GecoNetPacket & buffered = pRecvRing_[slot];
+        pReceiver_->handleMessage(buffered.m_acData + DATA_HEADER_SIZE,
+            buffered.m_iMsgEndOffset - DATA_HEADER_SIZE);
+        recvNext_++;
+        slot = recvNext_ % WINDOW_SIZE;
+        filledGap = true;
+    }
+    // the peer is waiting on a filled gap, anything else can wait for the
+    // next send or tick
+    if (filledGap)
+        this->sendAck();
+    else
+        ackOwed_ = true;
+    return GECO_NET_REASON_SUCCESS;
+}
+
+void GecoNetChannel::processAcks(uint32 ack, uint64 sack, uint64 now)
+{
+    // stale or from the future, the bitmap is relative to it so skip both
+    if (seq_diff(ack, sendBase_) < 0 || seq_diff(ack, sendNext_) > 0)
+        return;
+
+    while (sendBase_ != ack)
+    {
+        Unacked & unacked = unacked_[sendBase_ % WINDOW_SIZE];
+        if (!unacked.acked_ && !unacked.resent_)
+            this->sampleRtt(now - unacked.sentAt_);
+        unacked.acked_ = true;
+        sendBase_++;
+    }
+
+    uint32 highestSacked = ack;
+    for (int i = 0; sack != 0 && i < WINDOW_SIZE; i++, sack >>= 1)
+    {
+        if (!(sack & 1))
+            continue;
+        uint32 seq = ack + 1 + i;
+        if (seq_diff(seq, sendNext_) >= 0)
+            break;
+        Unacked & unacked = unacked_[seq % WINDOW_SIZE];
+        // Karn: a resent packet's round trip is ambiguous
+        if (!unacked.acked_ && !unacked.resent_)
+            this->sampleRtt(now - unacked.sentAt_);
+        unacked.acked_ = true;
+        highestSacked = seq;
+    }
+
+    if (!fastRetransmit_ || highestSacked == ack)
+        return;
+    // a hole with FAST_RETRANSMIT_DUP_ACKS selective acks above it has been
+    // passed by as many duplicate acks: resend it once, the timeout covers a
+    // lost resend
+    int sackedAbove = 0;
+    for (uint32 seq = highestSacked; seq_diff(seq, sendBase_) >= 0; seq--)
+    {
+        Unacked & unacked = unacked_[seq % WINDOW_SIZE];
+        if (unacked.acked_)
+        {
+            sackedAbove++;
+            continue;
+        }
+        if (sackedAbove < FAST_RETRANSMIT_DUP_ACKS || unacked.fastResent_)
+            continue;
+        unacked.fastResent_ = true;
+        numFastRetransmits_++;
+        this->resend(seq, now);
+    }
+}
+
+void GecoNetChannel::sampleRtt(uint64 rtt)
+{
+    int64 r = int64(rtt);
+    if (srtt_ < 0)
+    {
+        srtt_ = r;
+        rttvar_ = r / 2;
+    }
+    else
+    {
+        int64 err = r - srtt_;
+        srtt_ += err / 8;
+        rttvar_ += ((err < 0 ? -err : err) - rttvar_) / 4;
+    }
+    rto_ = srtt_ + 4 * rttvar_;
+    if (rto_ < minRto_)
+        rto_ = minRto_;
+    if (rto_ > maxRto_)
+        rto_ = maxRto_;
+}
+
+void GecoNetChannel::resend(uint32 seq, uint64 now)
+{
+    int slot = seq % WINDOW_SIZE;
+    Unacked & unacked = unacked_[slot];
+    unacked.sentAt_ = now;
+    unacked.resent_ = true;
+    GecoNetPacket & packet = pSendRing_[slot];
+    this->writeAcks(packet);
+    numPacketsResent_++;
+    pTransport_->sendPacket(&packet);
+}
+
+void GecoNetChannel::tick(uint64 now)
+{
+    bool timedOut = false;
+    for (uint32 seq = sendBase_; seq != sendNext_; seq++)
+    {
+        Unacked & unacked = unacked_[seq % WINDOW_SIZE];
+        if (unacked.acked_ || int64(now - unacked.sentAt_) < rto_)
+            continue;
+        // another fast retransmit may recover a lost resend sooner
+        unacked.fastResent_ = false;
+        this->resend(seq, now);
+        timedOut = true;
+    }
+    if (timedOut)
+    {
+        numTimeouts_++;
+        rto_ = rto_ * 2 > maxRto_ ? maxRto_ : rto_ * 2;
+    }
+    if (ackOwed_)
+        this->sendAck();
+}
+
+void GecoNetChannel::sendAck()
+{
+    GecoNetPacket packet;
+    put16(packet.m_acData, GecoNetPacket::FLAG_ON_CHANNEL | GecoNetPacket::FLAG_HAS_ACKS);
+    packet.m_iMsgEndOffset = ACK_HEADER_SIZE;
+    this->writeAcks(packet);
+    numAcksSent_++;
+    pTransport_->sendPacket(&packet);
+}
+
+void GecoNetChannel::writeAcks(GecoNetPacket & packet)
+{
+    bool hasSeq = (get16(packet.m_acData) & GecoNetPacket::FLAG_HAS_SEQUENCE_NUMBER) != 0;
+    char * acks = packet.m_acData + (hasSeq ? DATA_ACK_OFFSET : ONLY_ACK_OFFSET);
+    uint64 sack = this->sackBits();
+    put32(acks, recvNext_);
+    put32(acks + 4, uint32(sack >> 32));
+    put32(acks + 8, uint32(sack));
+    ackOwed_ = false;
+}
+
+uint64 GecoNetChannel::sackBits() const
+{
+    // bit i is recvNext_ + 1 + i, recvNext_ itself is never buffered
+    uint64 sack = 0;
+    for (int i = 0; i < WINDOW_SIZE - 1; i++)
+    {
+        if (received_[(recvNext_ + 1 + i) % WINDOW_SIZE])
+            sack |= uint64(1) << i;
+    }
+    return sack;
+}
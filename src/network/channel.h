@@ -0,0 +1,202 @@
+//{future header message}
+#ifndef __GecoNetChannel_H__
+#define __GecoNetChannel_H__
+
+#include "net-types.h"
+
+/**
+ *	This class puts the packets of a channel on the wire. The packet is only
+ *	valid for the duration of the call, it is resent from the channel's own
+ *	copy.
+ *
+ *	@ingroup network
+ */
+struct GecoNetChannelTransport
+{
+        virtual ~GecoNetChannelTransport()
+        {
+        }
+        virtual void sendPacket(GecoNetPacket * pPacket) = 0;
+};
+
+/**
+ *	This class receives the messages of a channel, exactly once and in the
+ *	order they were sent.
+ *
+ *	@ingroup network
+ */
+struct GecoNetChannelReceiver
+{
+        virtual ~GecoNetChannelReceiver()
+        {
+        }
+        virtual void handleMessage(const char * data, int length) = 0;
+};
+
+/**
+ *	This class is a reliable, ordered channel over unreliable packets.
+ *
+ *	Every packet carries a cumulative ack, the next sequence number expected,
+ *	and a selective ack bitmap of the WINDOW_SIZE packets after it that have
+ *	arrived out of order, so one surviving packet acks everything before it
+ *	and losing an ack costs nothing. The retransmit timeout follows the
+ *	smoothed round trip time (Jacobson/Karels, RFC 6298) instead of a fixed
+ *	resend delay, backing off on each timeout. A hole with three selective
+ *	acks above it, as many duplicate acks, is resent straight away, so a lost
+ *	packet stalls ordered delivery for about one round trip.
+ *
+ *	Times are gettimestamp() stamps, configuration is in microseconds.
+ *
+ *	@ingroup network
+ */
+class GECOAPI GecoNetChannel
+{
+    public:
+        /// the most packets in flight, all covered by one selective ack bitmap
+        static const int WINDOW_SIZE = 64;
+        /// flags, sequence number, cumulative ack and selective ack bitmap
+        static const int DATA_HEADER_SIZE = 18;
+        static const int ACK_HEADER_SIZE = 14;
+        static const int MAX_PAYLOAD = PACKET_MAX_SIZE - DATA_HEADER_SIZE;
+        static const int FAST_RETRANSMIT_DUP_ACKS = 3;
+
+        static const int64 DEFAULT_INITIAL_RTO = 200 * 1000;
+        static const int64 DEFAULT_MIN_RTO = 50 * 1000;
+        static const int64 DEFAULT_MAX_RTO = 5 * 1000 * 1000;
+
+        GecoNetChannel(GecoNetChannelTransport * pTransport, GecoNetChannelReceiver * pReceiver);
+        ~GecoNetChannel();
+
+        /// @name Configuration
+        //@{
+        /**
+         *	This method sets the retransmit timeout used before the first round
+         *	trip sample and the bounds the estimate is clamped to. Equal values
+         *	give the old fixed resend delay.
+         */
+        void setRtoBounds(int64 initialMicros, int64 minMicros, int64 maxMicros);
+        void fastRetransmit(bool enable)
+        {
+            fastRetransmit_ = enable;
+        }
+        //@}
+
+        /// @name Traffic
+        //@{
+        /**
+         *	This method sends a reliable message of at most MAX_PAYLOAD bytes,
+         *	with the acks owed to the peer piggybacked on it.
+         *
+         *	@return GECO_NET_REASON_WINDOW_OVERFLOW when WINDOW_SIZE packets are
+         *	unacked, the message is not sent.
+         */
+        GecoNetReason send(const char * data, int length, uint64 now);
+        /**
+         *	This method processes a packet from the peer: its acks, then its
+         *	message, which is delivered when every message before it has been.
+         */
+        GecoNetReason receive(const GecoNetPacket & packet, uint64 now);
+        /**
+         *	This method resends the packets whose retransmit timeout expired and
+         *	sends the acks that could not be piggybacked. Call it every tick.
+         */
+        void tick(uint64 now);
+        //@}
+
+        /// @name State
+        //@{
+        int numUnacked() const
+        {
+            return int(sendNext_ - sendBase_);
+        }
+        bool windowFull() const
+        {
+            return this->numUnacked() >= WINDOW_SIZE;
+        }
+        /// -1 before the first round trip sample
+        double srttMicros() const;
+        double rtoMicros() const;
+        //@}
+
+        /// @name Statistics
+        //@{
+        uint numPacketsSent() const
+        {
+            return numPacketsSent_;
+        }
+        uint numPacketsResent() const
+        {
+            return numPacketsResent_;
+        }
+        uint numFastRetransmits() const
+        {
+            return numFastRetransmits_;
+        }
+        uint numTimeouts() const
+        {
+            return numTimeouts_;
+        }
+        uint numAcksSent() const
+        {
+            return numAcksSent_;
+        }
+        //@}
+
+    private:
+        struct Unacked
+        {
+                uint64 sentAt_;
+                bool acked_;
+                bool resent_;
+                bool fastResent_;
+        };
+
+        void processAcks(uint32 ack, uint64 sack, uint64 now);
+        void sampleRtt(uint64 rtt);
+        void resend(uint32 seq, uint64 now);
+        void sendAck();
+        void writeAcks(GecoNetPacket & packet);
+        uint64 sackBits() const;
+        int64 micros2stamps(int64 micros) const;
+
+        GecoNetChannel(const GecoNetChannel &);
+        GecoNetChannel & operator=(const GecoNetChannel &);
+
+        GecoNetChannelTransport * pTransport_;
+        GecoNetChannelReceiver * pReceiver_;
+
+        /// @name Sending side
+        //@{
+        /// indexed by sequence number % WINDOW_SIZE
+        GecoNetPacket * pSendRing_;
+        Unacked unacked_[WINDOW_SIZE];
+        uint32 sendBase_;
+        uint32 sendNext_;
+        //@}
+
+        /// @name Receiving side
+        //@{
+        GecoNetPacket * pRecvRing_;
+        bool received_[WINDOW_SIZE];
+        uint32 recvNext_;
+        bool ackOwed_;
+        //@}
+
+        /// @name Round trip estimate, in stamps
+        //@{
+        int64 srtt_;
+        int64 rttvar_;
+        int64 rto_;
+        int64 minRto_;
+        int64 maxRto_;
+        bool fastRetransmit_;
+        //@}
+
+        uint numPacketsSent_;
+        uint numPacketsResent_;
+        uint numFastRetransmits_;
+        uint numTimeouts_;
+        uint numAcksSent_;
+};
+
+#endif // __GecoNetChannel_H__
@@ -0,0 +1,221 @@
+#include "dispatch-table.h"
+#include "bundle.h"
+#include "network-interface.h"
+
+const int GecoNetDispatchTable::NUM_ENTRIES;
+
+// -----------------------------------------------------------------------------
+// Section: GecoNetDispatchTable
+// -----------------------------------------------------------------------------
+GecoNetDispatchTable::GecoNetDispatchTable()
+{
+    this->clear();
+}
+
+void GecoNetDispatchTable::clear()
+{
+    for (int i = 0; i < NUM_ENTRIES; i++)
+    {
+        entries_[i].pFunc_ = NULL;
+        entries_[i].pHandler_ = NULL;
+        entries_[i].pElement_ = NULL;
+        entries_[i].lengthStyle_ = INVALID_MESSAGE;
+        entries_[i].lengthParam_ = 0;
+    }
+    numRegistered_ = 0;
+}
+
+void GecoNetDispatchTable::build(GecoInterfaceMinder & minder)
+{
+    this->clear();
+    for (size_t i = 0; i < minder.elements_.size(); i++)
+    {
+        GecoNetInterfaceElementWithStats & ie = minder.elements_[i];
+        GecoNetDispatchEntry & entry = entries_[ie.GetID()];
+        if (entry.pElement_)
+        {
+            network_logger()->error("GecoNetDispatchTable::build( {} ): {} and {} have the same id {}",
+                minder.name_, entry.pElement_->GetName(), ie.GetName(), ie.GetID());
+            continue;
+        }
+        entry.pFunc_ = minder.messageFunc(i);
+        entry.pHandler_ = ie.GetHandler();
+        entry.pElement_ = &ie;
+        entry.lengthStyle_ = ie.LengthStyle();
+        entry.lengthParam_ = ie.LengthParam();
+        numRegistered_++;
+    }
+}
+
+/// the end of the messages of @pPacket and the offset of its first request
+static void packet_extent(GecoNetPacket * pPacket, int & end, int & nextRequest)
+{
+    GecoNetPacket::Flags flags;
+    memcpy(&flags, pPacket->m_acData, sizeof(flags));
+    flags = GECO_HTONS(flags);
+    end = pPacket->m_iMsgEndOffset;
+    nextRequest = 0;
+    if (flags & GecoNetPacket::FLAG_HAS_REQUESTS)
+    {
+        // the footer is the offset of the first request, each request header
+        // holds the offset of the next
+        end -= sizeof(GecoNetPacket::Offset);
+        GecoNetPacket::Offset netOffset;
+        memcpy(&netOffset, pPacket->m_acData + end, sizeof(netOffset));
+        nextRequest = GECO_HTONS(netOffset);
+    }
+}
+
+int GecoNetDispatchTable::processBundle(const GecoNetAddress & from, GecoNetPacket * pPacket,
+    GecoMessageFilter * pFilter)
+{
+    int numHandled = 0;
+    int end, nextRequest;
+    packet_extent(pPacket, end, nextRequest);
+    int offset = sizeof(GecoNetPacket::Flags);
+    int header = offset;
+    GecoNetMessageID id = 0;
+    bool truncated = false;
+    // one stream over the packet, bracketed to each body in turn
+    geco_bit_stream_t stream((uchar*) pPacket->m_acData, end, false);
+    for (;;)
+    {
+        if (offset >= end)
+        {
+            pPacket = pPacket->Next();
+            if (pPacket == NULL)
+                break;
+            packet_extent(pPacket, end, nextRequest);
+            offset = sizeof(GecoNetPacket::Flags);
+            stream.uchar_data((uchar*) pPacket->m_acData);
+            stream.allocated_bits_size(BYTES_TO_BITS(end));
+            continue;
+        }
+
+        char * pData = pPacket->m_acData;
+        header = offset;
+        id = pData[offset];
+        const GecoNetDispatchEntry & entry = entries_[id];
+        offset += sizeof(GecoNetMessageID);
+
+        int length = entry.lengthParam_;
+        if (entry.lengthStyle_ == VARIABLE_LENGTH_MESSAGE)
+        {
+            if (offset + entry.lengthParam_ > end)
+            {
+                truncated = true;
+                break;
+            }
+            const char * pLen = pData + offset;
+            switch (entry.lengthParam_)
+            {
+                case 1:
+                    length = *(uchar*) pLen;
+                    break;
+                case 2:
+                    length = GECO_HTONS(*(ushort* )pLen);
+                    break;
+                case 3:
+                    length = GECO_UNPACK3(pLen);
+                    break;
+                case 4:
+                    length = GECO_HTONL(*(uint32* )pLen);
+                    break;
+                default:
+                    length = -1;
+                    break;
+            }
+            offset += entry.lengthParam_;
+        }
+        else if (entry.lengthStyle_ != FIXED_LENGTH_MESSAGE)
+        {
+            network_logger()->error("GecoNetDispatchTable::processBundle(): unknown message id {} at offset {}",
+                id, header);
+            return -1;
+        }
+
+        if (header == nextRequest)
+        {
+            // the reply id, then the offset of the next request
+            if (offset + GecoNetBundle::REQUEST_HEADER_SIZE > end)
+            {
+                truncated = true;
+                break;
+            }
+            GecoNetPacket::Offset netOffset;
+            memcpy(&netOffset, pData + offset + sizeof(uint32), sizeof(netOffset));
+            nextRequest = GECO_HTONS(netOffset);
+            offset += GecoNetBundle::REQUEST_HEADER_SIZE;
+        }
+        if (length < 0)
+        {
+            truncated = true;
+            break;
+        }
+
+        bool spilled = offset + length > end;
+        if (!spilled)
+        {
+            stream.readable_bit_pos(BYTES_TO_BITS(offset));
+            stream.writable_bit_pos(BYTES_TO_BITS(offset + length));
+            offset += length;
+        }
+        else
+        {
+            // the body continues in the next packets
+            spill_.assign(pData + offset, pData + end);
+            while ((int) spill_.size() < length)
+            {
+                pPacket = pPacket->Next();
+                if (pPacket == NULL)
+                    break;
+                packet_extent(pPacket, end, nextRequest);
+                offset = sizeof(GecoNetPacket::Flags) + length - (int) spill_.size();
+                if (offset > end)
+                    offset = end;
+                spill_.insert(spill_.end(), pPacket->m_acData + sizeof(GecoNetPacket::Flags),
+                    pPacket->m_acData + offset);
+            }
+            if (pPacket == NULL)
+            {
+                truncated = true;
+                break;
+            }
+            stream.uchar_data((uchar*) &spill_[0]);
+            stream.allocated_bits_size(BYTES_TO_BITS(length));
+            stream.readable_bit_pos(0);
+            stream.writable_bit_pos(BYTES_TO_BITS(length));
+        }
+
+        if ((pFilter == NULL || !pFilter->filterMessage(from, *entry.pElement_, stream)) && entry.pFunc_)
+        {
+            if (g_enable_stats)
+                entry.pElement_->startProfile();
+            entry.pFunc_(entry.pHandler_, from, *entry.pElement_, stream);
+            if (g_enable_stats)
+                entry.pElement_->stopProfile(length);
+            numHandled++;
+        }
+        if (spilled)
+        {
+            stream.uchar_data((uchar*) pPacket->m_acData);
+            stream.allocated_bits_size(BYTES_TO_BITS(end));
+        }
+    }
+
+    if (truncated)
+    {
+        network_logger()->error("GecoNetDispatchTable::processBundle(): message {} at offset {} runs past the "
+            "end of the packets", id, header);
+        return -1;
+    }
+    return numHandled;
+}
+
+// -----------------------------------------------------------------------------
+// Section: GecoInterfaceMinder
+// -----------------------------------------------------------------------------
+void GecoInterfaceMinder::registerWithInterface(GecoNetworkInterface & networkInterface)
+{
+    networkInterface.dispatchTable().build(*this);
+}
@@ -0,0 +1,79 @@
+//{future header message}
+#ifndef __GecoNetDispatchTable_H__
+#define __GecoNetDispatchTable_H__
+
+#include "net-types.h"
+
+#include <vector>
+
+/**
+ *	This is one slot of a GecoNetDispatchTable, everything the receive loop
+ *	needs to find the end of a message and call its handler.
+ */
+struct GecoNetDispatchEntry
+{
+        /// NULL when the message has no handler in this process
+        GecoNetMessageFunc pFunc_;
+        GecoNetInputMessageHandler * pHandler_;
+        /// the element and its stats, NULL for ids of no registered message
+        GecoNetInterfaceElementWithStats * pElement_;
+        /// FIXED_LENGTH_MESSAGE, VARIABLE_LENGTH_MESSAGE or INVALID_MESSAGE
+        uchar lengthStyle_;
+        int lengthParam_;
+};
+
+/**
+ *	This class dispatches the messages of received packets. It is a flat
+ *	array indexed by GecoNetMessageID, built once from a GecoInterfaceMinder
+ *	by GecoInterfaceMinder::registerWithInterface(), so the receive loop
+ *	finds a message's length and handler with one load instead of going
+ *	through the minder's elements. Handlers added to the minder with their
+ *	exact type and a public HandleMessage() are called directly, without a
+ *	virtual call; a GecoMessageFilter, when one is given, is still called
+ *	for every message.
+ *
+ *	@ingroup network
+ */
+class GECOAPI GecoNetDispatchTable
+{
+    public:
+        static const int NUM_ENTRIES = 256;
+
+        GecoNetDispatchTable();
+
+        /// fills the table from @minder, clearing what was registered before
+        void build(GecoInterfaceMinder & minder);
+        void clear();
+
+        const GecoNetDispatchEntry & entry(GecoNetMessageID id) const
+        {
+            return entries_[id];
+        }
+        /// the number of ids of a registered message
+        int numRegistered() const
+        {
+            return numRegistered_;
+        }
+
+        /**
+         *	This method walks the messages of the packets chained from
+         *	@pPacket, as a GecoNetBundle lays them out, and calls their
+         *	handlers with a stream over the message body. A body that
+         *	continues in the next packet is gathered into one buffer first.
+         *	Request headers are skipped. When @pFilter returns true the
+         *	message is not handled.
+         *
+         *	@return the number of messages handled, -1 when the packets hold
+         *	an unknown message or a message that runs past their end, after
+         *	those before it were handled.
+         */
+        int processBundle(const GecoNetAddress & from, GecoNetPacket * pPacket, GecoMessageFilter * pFilter = NULL);
+
+    private:
+        GecoNetDispatchEntry entries_[NUM_ENTRIES];
+        int numRegistered_;
+        /// the bodies that continue across packets
+        std::vector<char> spill_;
+};
+
+#endif // __GecoNetDispatchTable_H__
@@ -78,13 +78,38 @@ class GECOAPI GecoNetEndpoint
         //@{
         int SendTo(void * gramData, int gramSize, GecoNetAddress& networkAddr)
         {
-            return ::sendto(m_kSocket, (char*) gramData, gramSize, 0, &networkAddr.su.sa, sizeof(sockaddr));
+            return ::sendto(m_kSocket, (char*) gramData, gramSize, 0, &networkAddr.su.sa,
+                saddr_len(&networkAddr.su));
         }
         int RecvFrom(void * gramData, int gramSize, GecoNetAddress& networkAddr)
         {
-            socklen_t sinLen = sizeof(sockaddr);
+            socklen_t sinLen = sizeof(sockaddrunion);
             return ::recvfrom(m_kSocket, (char*) gramData, gramSize, 0, &networkAddr.su.sa, &sinLen);
         }
+
+        /// datagrams per recvmmsg()/sendmmsg() call
+        static const int MMSG_BATCH = 64;
+        /**
+         *	This method receives up to count datagrams, one recvmmsg() call for
+         *	every MMSG_BATCH of them on linux. It waits like RecvFrom() for the
+         *	first datagram only, then takes what is already queued.
+         *
+         *	@param packets	packets[i] gets datagram i, its m_iMsgEndOffset is set
+         *					to the datagram size.
+         *	@param addrs	addrs[i] gets the source of datagram i.
+         *
+         *	@return the number received, -1 with errno as RecvFrom() if none was.
+         */
+        int RecvMany(GecoNetPacket* const * packets, GecoNetAddress* addrs, int count);
+        /**
+         *	This method sends packets[i], m_iMsgEndOffset bytes of it, to
+         *	addrs[i] for every i below count, one sendmmsg() call for every
+         *	MMSG_BATCH of them on linux.
+         *
+         *	@return the number sent, less than count when the socket buffer
+         *	filled, -1 with errno as SendTo() if none was.
+         */
+        int SendMany(GecoNetPacket* const * packets, const GecoNetAddress* addrs, int count);
         //@}
 
         /// @name Connecting Socket Methods
@@ -238,11 +263,11 @@ INLINE int GecoNetEndpoint::Bind(u_int16_t networkPort, const char* networkAddr)
 {
     sockaddrunion su;
     str2saddr(&su, networkAddr, networkPort);
-    return ::bind(m_kSocket, (struct sockaddr*) &su, sizeof(sockaddr));
+    return ::bind(m_kSocket, (struct sockaddr*) &su, saddr_len(&su));
 }
 INLINE int GecoNetEndpoint::Bind(GecoNetAddress& bindaddr)
 {
-    return ::bind(m_kSocket, (struct sockaddr*) &bindaddr.su, sizeof(sockaddr));
+    return ::bind(m_kSocket, (struct sockaddr*) &bindaddr.su, saddr_len(&bindaddr.su));
 }
 INLINE int GecoNetEndpoint::JoinMulticastGroup(const GecoNetAddress& networkAddr)
 {
@@ -308,13 +333,13 @@ INLINE int GecoNetEndpoint::Detach()
 }
 INLINE int GecoNetEndpoint::GetLocalAddress(GecoNetAddress* networkAddr) const
 {
-    socklen_t sinLen = sizeof(sockaddr);
+    socklen_t sinLen = sizeof(sockaddrunion);
     int ret = ::getsockname(m_kSocket, (struct sockaddr*) &networkAddr->su.sa, &sinLen);
     return ret;
 }
 INLINE int GecoNetEndpoint::GetRemoteAddress(GecoNetAddress* networkAddr) const
 {
-    socklen_t sinLen = sizeof(sockaddr);
+    socklen_t sinLen = sizeof(sockaddrunion);
     int ret = ::getpeername(m_kSocket, (struct sockaddr*) &networkAddr->su.sa, &sinLen);
     return ret;
 }
@@ -348,12 +373,12 @@ INLINE int GecoNetEndpoint::Listen(int backlog)
 
 INLINE int GecoNetEndpoint::Connect(const GecoNetAddress& saddr)
 {
-    return ::connect(m_kSocket, (sockaddr*) &saddr.su.sa, sizeof(sockaddr));
+    return ::connect(m_kSocket, (sockaddr*) &saddr.su.sa, saddr_len(&saddr.su));
 }
 
 INLINE GecoNetEndpoint * GecoNetEndpoint::Accept(GecoNetAddress& networkAddr)
 {
-    socklen_t sinLen = sizeof(sockaddr);
+    socklen_t sinLen = sizeof(sockaddrunion);
     int ret = (int) ::accept(m_kSocket, &networkAddr.su.sa, &sinLen);
 #if defined( __linux__ ) || defined( PLAYSTATION3 )
     if (ret < 0)
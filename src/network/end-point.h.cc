@@ -9,6 +9,7 @@
 
 GecoNetEndpoint::FrontEndInterfaces GecoNetEndpoint::ms_kFrontEndInterfaces;
 GecoNetAddStringInterfaces GecoNetEndpoint::ms_kGecoNetAddStringInterfaces;
+const int GecoNetEndpoint::MMSG_BATCH;
 
 #ifdef __linux__
 extern "C"
@@ -126,6 +127,94 @@ bool GecoNetEndpoint::GetClosedPort(GecoNetAddress & closedPort)
     return isResultSet;
 }
 
+int GecoNetEndpoint::RecvMany(GecoNetPacket* const * packets, GecoNetAddress* addrs, int count)
+{
+    int received = 0;
+#ifdef __linux__
+    mmsghdr msgs[MMSG_BATCH];
+    iovec iovs[MMSG_BATCH];
+    while (received < count)
+    {
+        int batch = count - received < MMSG_BATCH ? count - received : MMSG_BATCH;
+        for (int i = 0; i < batch; i++)
+        {
+            iovs[i].iov_base = packets[received + i]->m_acData;
+            iovs[i].iov_len = PACKET_MAX_SIZE;
+            msghdr& hdr = msgs[i].msg_hdr;
+            hdr.msg_name = &addrs[received + i].su;
+            hdr.msg_namelen = sizeof(sockaddrunion);
+            hdr.msg_iov = &iovs[i];
+            hdr.msg_iovlen = 1;
+            hdr.msg_control = NULL;
+            hdr.msg_controllen = 0;
+            hdr.msg_flags = 0;
+        }
+        // only the first call may block, MSG_WAITFORONE stops waiting
+        // once it has a datagram
+        int ret = ::recvmmsg(m_kSocket, msgs, batch, received == 0 ? MSG_WAITFORONE : MSG_DONTWAIT, NULL);
+        if (ret <= 0)
+            return received > 0 ? received : ret;
+        for (int i = 0; i < ret; i++)
+            packets[received + i]->m_iMsgEndOffset = msgs[i].msg_len;
+        received += ret;
+        if (ret < batch)
+            break;
+    }
+#else
+    // no batched call, one datagram so that a blocking socket is not waited
+    // on for the others
+    if (count > 0)
+    {
+        int len = this->RecvFrom(packets[0]->m_acData, PACKET_MAX_SIZE, addrs[0]);
+        if (len < 0)
+            return -1;
+        packets[0]->m_iMsgEndOffset = len;
+        received = 1;
+    }
+#endif
+    return received;
+}
+
+int GecoNetEndpoint::SendMany(GecoNetPacket* const * packets, const GecoNetAddress* addrs, int count)
+{
+    int sent = 0;
+#ifdef __linux__
+    mmsghdr msgs[MMSG_BATCH];
+    iovec iovs[MMSG_BATCH];
+    while (sent < count)
+    {
+        int batch = count - sent < MMSG_BATCH ? count - sent : MMSG_BATCH;
+        for (int i = 0; i < batch; i++)
+        {
+            iovs[i].iov_base = packets[sent + i]->m_acData;
+            iovs[i].iov_len = packets[sent + i]->m_iMsgEndOffset;
+            msghdr& hdr = msgs[i].msg_hdr;
+            hdr.msg_name = (void*) &addrs[sent + i].su;
+            hdr.msg_namelen = saddr_len(&addrs[sent + i].su);
+            hdr.msg_iov = &iovs[i];
+            hdr.msg_iovlen = 1;
+            hdr.msg_control = NULL;
+            hdr.msg_controllen = 0;
+            hdr.msg_flags = 0;
+        }
+        int ret = ::sendmmsg(m_kSocket, msgs, batch, 0);
+        if (ret <= 0)
+            return sent > 0 ? sent : ret;
+        sent += ret;
+        if (ret < batch)
+            break;
+    }
+#else
+    for (; sent < count; sent++)
+    {
+        if (this->SendTo(packets[sent]->m_acData, packets[sent]->m_iMsgEndOffset,
+            const_cast<GecoNetAddress&>(addrs[sent])) < 0)
+            return sent > 0 ? sent : -1;
+    }
+#endif
+    return sent;
+}
+
 const GecoNetAddStringInterfaces* GecoNetEndpoint::GetInterfaces()
 {
 #ifdef _WIN32
@@ -28,6 +28,8 @@
 #ifndef __MSG_HANDLER_DEFINES_H__
 #define __MSG_HANDLER_DEFINES_H__   //  Prevent include the folowing macros more than one time
 
+#include "network-interface.h"
+
   /* Helper macros */
 #define GECO_FIXED_MESSAGE( NAME, PARAM, HANDLER )     GECO_MESSAGE( NAME, FIXED_LENGTH_MESSAGE, PARAM, HANDLER)
 #define GECO_VARIABLE_MESSAGE( NAME, PARAM, HANDLER )  GECO_MESSAGE( NAME, VARIABLE_LENGTH_MESSAGE, PARAM, HANDLER)
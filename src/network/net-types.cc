@@ -1,6 +1,13 @@
 #include "net-types.h"
+#include "math/geco-math-batch.h"
 //#include "GecoWatcher.h"
 
+#include <string.h>
+#if GECO_BATCH_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
 bool g_enable_stats = true;
 
 bool saddr_equals(const sockaddrunion *a, const sockaddrunion *b, bool ignore_port)
@@ -433,6 +440,456 @@ GecoWatcher* GecoNetInterfaceElementWithStats::GetWatcher()
     return NULL;
 }
 
+// -----------------------------------------------------------------------------
+// Section: GecoPackedXY and GecoPackedXYZ batches
+// -----------------------------------------------------------------------------
+static_assert(sizeof(GecoPackedXY) == 3, "packed xy records are 3 bytes");
+static_assert(sizeof(GecoPackedXYZ) == 6, "packed xyz records are 6 bytes");
+
+#if GECO_BATCH_X86
+/// byte indices of one GECO_PACK3 record taken from the int32 lane at @b
+#ifdef GECO_LITTLE_ENDIAN
+#define GECO_PACK3_BYTES(b) (b) + 2, (b) + 1, (b)
+#else
+#define GECO_PACK3_BYTES(b) (b), (b) + 1, (b) + 2
+#endif
+
+/// the simd kernels do the bit twiddling of the scalar methods on 4 or 8
+/// lanes, the records are moved with shuffles under AVX2 and one by one
+/// under SSE2. each returns how many records it did, the caller does the tail.
+
+//----------------------------------------------------------------------------
+/// the 24 bit words PackXY builds, see GecoPackedXY::PackXY()
+GECO_TARGET_SSE2
+static inline __m128i PackXYLanesSSE2(__m128 kX, __m128 kY)
+{
+    const __m128 kSign = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+    const __m128 kTwo = _mm_set1_ps(2.f);
+    const __m128i kExpMask = _mm_set1_epi32(0x7c000000);
+    const __m128i kExp = _mm_set1_epi32(0x40000000);
+    const __m128i kRound = _mm_set1_epi32(0x3ffc000);
+    const __m128i kRoundBit = _mm_set1_epi32(0x4000);
+    const __m128i kOnes = _mm_set1_epi32(-1);
+
+    // addValues[v < 0] is 2 with the sign of v
+    __m128i kXu = _mm_castps_si128(_mm_add_ps(kX, _mm_or_ps(kTwo, _mm_and_ps(kX, kSign))));
+    __m128i kYu = _mm_castps_si128(_mm_add_ps(kY, _mm_or_ps(kTwo, _mm_and_ps(kY, kSign))));
+
+    __m128i kXCeil = _mm_or_si128(_mm_xor_si128(_mm_cmpeq_epi32(_mm_and_si128(kXu, kExpMask), kExp), kOnes),
+        _mm_cmpeq_epi32(_mm_and_si128(kXu, kRound), kRound));
+    __m128i kYCeil = _mm_or_si128(_mm_xor_si128(_mm_cmpeq_epi32(_mm_and_si128(kYu, kExpMask), kExp), kOnes),
+        _mm_cmpeq_epi32(_mm_and_si128(kYu, kRound), kRound));
+    __m128i kResult = _mm_or_si128(_mm_and_si128(kXCeil, _mm_set1_epi32(0x7ff000)),
+        _mm_and_si128(kYCeil, _mm_set1_epi32(0x0007ff)));
+
+    kResult = _mm_or_si128(kResult, _mm_add_epi32(_mm_and_si128(_mm_srli_epi32(kXu, 3), _mm_set1_epi32(0x7ff000)),
+        _mm_srli_epi32(_mm_and_si128(kXu, kRoundBit), 2)));
+    kResult = _mm_or_si128(kResult, _mm_add_epi32(_mm_and_si128(_mm_srli_epi32(kYu, 15), _mm_set1_epi32(0x0007ff)),
+        _mm_srli_epi32(_mm_and_si128(kYu, kRoundBit), 14)));
+    kResult = _mm_and_si128(kResult, _mm_set1_epi32(0x7ff7ff));
+    kResult = _mm_or_si128(kResult, _mm_and_si128(_mm_srli_epi32(kXu, 8), _mm_set1_epi32(0x800000)));
+    return _mm_or_si128(kResult, _mm_and_si128(_mm_srli_epi32(kYu, 20), _mm_set1_epi32(0x000800)));
+}
+/// the 16 bit words SetZ builds, see GecoPackedXYZ::SetZ()
+GECO_TARGET_SSE2
+static inline __m128i PackZLanesSSE2(__m128 kZ)
+{
+    const __m128 kSign = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+    __m128i kZu = _mm_castps_si128(_mm_add_ps(kZ, _mm_or_ps(_mm_set1_ps(2.f), _mm_and_ps(kZ, kSign))));
+    return _mm_or_si128(_mm_and_si128(_mm_srli_epi32(kZu, 12), _mm_set1_epi32(0x7fff)),
+        _mm_and_si128(_mm_srli_epi32(kZu, 16), _mm_set1_epi32(0x8000)));
+}
+/// see GecoPackedXY::UnpackXY()
+GECO_TARGET_SSE2
+static inline void UnpackXYLanesSSE2(__m128i kData, __m128& kX, __m128& kY)
+{
+    const __m128i kBase = _mm_set1_epi32(0x40000000);
+    const __m128 kTwo = _mm_set1_ps(2.f);
+    kX = _mm_sub_ps(_mm_castsi128_ps(_mm_or_si128(kBase,
+        _mm_slli_epi32(_mm_and_si128(kData, _mm_set1_epi32(0x7ff000)), 3))), kTwo);
+    kY = _mm_sub_ps(_mm_castsi128_ps(_mm_or_si128(kBase,
+        _mm_slli_epi32(_mm_and_si128(kData, _mm_set1_epi32(0x0007ff)), 15))), kTwo);
+    kX = _mm_or_ps(kX, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(kData, _mm_set1_epi32(0x800000)), 8)));
+    kY = _mm_or_ps(kY, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(kData, _mm_set1_epi32(0x000800)), 20)));
+}
+/// see GecoPackedXYZ::GetZ()
+GECO_TARGET_SSE2
+static inline __m128 UnpackZLanesSSE2(__m128i kZData)
+{
+    __m128 kZ = _mm_sub_ps(_mm_castsi128_ps(_mm_or_si128(_mm_set1_epi32(0x40000000),
+        _mm_slli_epi32(_mm_and_si128(kZData, _mm_set1_epi32(0x7fff)), 12))), _mm_set1_ps(2.f));
+    return _mm_or_ps(kZ, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(kZData, _mm_set1_epi32(0x8000)), 16)));
+}
+/// 2^(exponent field - @bias) of every lane, the error is a power of two
+GECO_TARGET_SSE2
+static inline __m128 ErrorLanesSSE2(__m128i kExponent, int bias)
+{
+    return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(kExponent, _mm_set1_epi32(127 - bias)), 23));
+}
+GECO_TARGET_SSE2
+static inline __m128i LoadXYRecordsSSE2(const GecoPackedXY* pIn, uint uiStride)
+{
+    const uchar* p = (const uchar*) pIn;
+    return _mm_setr_epi32(GECO_UNPACK3((const char*) p), GECO_UNPACK3((const char*) p + uiStride),
+        GECO_UNPACK3((const char*) p + 2 * uiStride), GECO_UNPACK3((const char*) p + 3 * uiStride));
+}
+GECO_TARGET_SSE2
+static inline __m128i LoadZRecordsSSE2(const GecoPackedXYZ* pIn)
+{
+    return _mm_setr_epi32(pIn[0].m_acZShort, pIn[1].m_acZShort, pIn[2].m_acZShort, pIn[3].m_acZShort);
+}
+//----------------------------------------------------------------------------
+GECO_TARGET_SSE2
+static uint PackXYSSE2(GecoPackedXY* pOut, const float* fpX, const float* fpY, uint uiCount)
+{
+    uint auiData[4];
+    uint i = 0;
+    for (; i + 4 <= uiCount; i += 4)
+    {
+        _mm_storeu_si128((__m128i*) auiData, PackXYLanesSSE2(_mm_loadu_ps(fpX + i), _mm_loadu_ps(fpY + i)));
+        for (uint k = 0; k < 4; k++)
+            GECO_PACK3((char*) pOut[i + k].m_acData, auiData[k]);
+    }
+    return i;
+}
+GECO_TARGET_SSE2
+static uint UnpackXYSSE2(float* fpX, float* fpY, const GecoPackedXY* pIn, uint uiCount)
+{
+    uint i = 0;
+    for (; i + 4 <= uiCount; i += 4)
+    {
+        __m128 kX, kY;
+        UnpackXYLanesSSE2(LoadXYRecordsSSE2(pIn + i, sizeof(GecoPackedXY)), kX, kY);
+        _mm_storeu_ps(fpX + i, kX);
+        _mm_storeu_ps(fpY + i, kY);
+    }
+    return i;
+}
+GECO_TARGET_SSE2
+static uint XYErrorSSE2(float* fpXError, float* fpYError, const GecoPackedXY* pIn, uint uiStride,
+    uint uiCount)
+{
+    const __m128i kSeven = _mm_set1_epi32(7);
+    const uchar* p = (const uchar*) pIn;
+    uint i = 0;
+    for (; i + 4 <= uiCount; i += 4)
+    {
+        __m128i kData = LoadXYRecordsSSE2((const GecoPackedXY*) (p + i * uiStride), uiStride);
+        _mm_storeu_ps(fpXError + i, ErrorLanesSSE2(_mm_and_si128(_mm_srli_epi32(kData, 20), kSeven), 8));
+        _mm_storeu_ps(fpYError + i, ErrorLanesSSE2(_mm_and_si128(_mm_srli_epi32(kData, 8), kSeven), 8));
+    }
+    return i;
+}
+GECO_TARGET_SSE2
+static uint PackXYZSSE2(GecoPackedXYZ* pOut, const float* fpX, const float* fpY, const float* fpZ,
+    uint uiCount)
+{
+    uint auiData[4], auiZData[4];
+    uint i = 0;
+    for (; i + 4 <= uiCount; i += 4)
+    {
+        _mm_storeu_si128((__m128i*) auiData, PackXYLanesSSE2(_mm_loadu_ps(fpX + i), _mm_loadu_ps(fpY + i)));
+        _mm_storeu_si128((__m128i*) auiZData, PackZLanesSSE2(_mm_loadu_ps(fpZ + i)));
+        for (uint k = 0; k < 4; k++)
+        {
+            GECO_PACK3((char*) pOut[i + k].m_acData, auiData[k]);
+            pOut[i + k].m_acZShort = (ushort) auiZData[k];
+        }
+    }
+    return i;
+}
+GECO_TARGET_SSE2
+static uint UnpackXYZSSE2(float* fpX, float* fpY, float* fpZ, const GecoPackedXYZ* pIn, uint uiCount)
+{
+    uint i = 0;
+    for (; i + 4 <= uiCount; i += 4)
+    {
+        __m128 kX, kY;
+        UnpackXYLanesSSE2(LoadXYRecordsSSE2(pIn + i, sizeof(GecoPackedXYZ)), kX, kY);
+        _mm_storeu_ps(fpX + i, kX);
+        _mm_storeu_ps(fpY + i, kY);
+        _mm_storeu_ps(fpZ + i, UnpackZLanesSSE2(LoadZRecordsSSE2(pIn + i)));
+    }
+    return i;
+}
+GECO_TARGET_SSE2
+static uint ZErrorSSE2(float* fpZError, const GecoPackedXYZ* pIn, uint uiCount)
+{
+    uint i = 0;
+    for (; i + 4 <= uiCount; i += 4)
+    {
+        __m128i kExponent = _mm_and_si128(_mm_srli_epi32(LoadZRecordsSSE2(pIn + i), 11), _mm_set1_epi32(0xf));
+        _mm_storeu_ps(fpZError + i, ErrorLanesSSE2(kExponent, 10));
+    }
+    return i;
+}
+
+//----------------------------------------------------------------------------
+GECO_TARGET_AVX2
+static inline __m256i PackXYLanesAVX2(__m256 kX, __m256 kY)
+{
+    const __m256 kSign = _mm256_castsi256_ps(_mm256_set1_epi32(0x80000000));
+    const __m256 kTwo = _mm256_set1_ps(2.f);
+    const __m256i kExpMask = _mm256_set1_epi32(0x7c000000);
+    const __m256i kExp = _mm256_set1_epi32(0x40000000);
+    const __m256i kRound = _mm256_set1_epi32(0x3ffc000);
+    const __m256i kRoundBit = _mm256_set1_epi32(0x4000);
+    const __m256i kOnes = _mm256_set1_epi32(-1);
+
+    __m256i kXu = _mm256_castps_si256(_mm256_add_ps(kX, _mm256_or_ps(kTwo, _mm256_and_ps(kX, kSign))));
+    __m256i kYu = _mm256_castps_si256(_mm256_add_ps(kY, _mm256_or_ps(kTwo, _mm256_and_ps(kY, kSign))));
+
+    __m256i kXCeil = _mm256_or_si256(_mm256_xor_si256(_mm256_cmpeq_epi32(_mm256_and_si256(kXu, kExpMask), kExp), kOnes),
+        _mm256_cmpeq_epi32(_mm256_and_si256(kXu, kRound), kRound));
+    __m256i kYCeil = _mm256_or_si256(_mm256_xor_si256(_mm256_cmpeq_epi32(_mm256_and_si256(kYu, kExpMask), kExp), kOnes),
+        _mm256_cmpeq_epi32(_mm256_and_si256(kYu, kRound), kRound));
+    __m256i kResult = _mm256_or_si256(_mm256_and_si256(kXCeil, _mm256_set1_epi32(0x7ff000)),
+        _mm256_and_si256(kYCeil, _mm256_set1_epi32(0x0007ff)));
+
+    kResult = _mm256_or_si256(kResult, _mm256_add_epi32(_mm256_and_si256(_mm256_srli_epi32(kXu, 3), _mm256_set1_epi32(0x7ff000)),
+        _mm256_srli_epi32(_mm256_and_si256(kXu, kRoundBit), 2)));
+    kResult = _mm256_or_si256(kResult, _mm256_add_epi32(_mm256_and_si256(_mm256_srli_epi32(kYu, 15), _mm256_set1_epi32(0x0007ff)),
+        _mm256_srli_epi32(_mm256_and_si256(kYu, kRoundBit), 14)));
+    kResult = _mm256_and_si256(kResult, _mm256_set1_epi32(0x7ff7ff));
+    kResult = _mm256_or_si256(kResult, _mm256_and_si256(_mm256_srli_epi32(kXu, 8), _mm256_set1_epi32(0x800000)));
+    return _mm256_or_si256(kResult, _mm256_and_si256(_mm256_srli_epi32(kYu, 20), _mm256_set1_epi32(0x000800)));
+}
+GECO_TARGET_AVX2
+static inline __m256i PackZLanesAVX2(__m256 kZ)
+{
+    const __m256 kSign = _mm256_castsi256_ps(_mm256_set1_epi32(0x80000000));
+    __m256i kZu = _mm256_castps_si256(_mm256_add_ps(kZ, _mm256_or_ps(_mm256_set1_ps(2.f), _mm256_and_ps(kZ, kSign))));
+    return _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(kZu, 12), _mm256_set1_epi32(0x7fff)),
+        _mm256_and_si256(_mm256_srli_epi32(kZu, 16), _mm256_set1_epi32(0x8000)));
+}
+GECO_TARGET_AVX2
+static inline void UnpackXYLanesAVX2(__m256i kData, __m256& kX, __m256& kY)
+{
+    const __m256i kBase = _mm256_set1_epi32(0x40000000);
+    const __m256 kTwo = _mm256_set1_ps(2.f);
+    kX = _mm256_sub_ps(_mm256_castsi256_ps(_mm256_or_si256(kBase,
+        _mm256_slli_epi32(_mm256_and_si256(kData, _mm256_set1_epi32(0x7ff000)), 3))), kTwo);
+    kY = _mm256_sub_ps(_mm256_castsi256_ps(_mm256_or_si256(kBase,
+        _mm256_slli_epi32(_mm256_and_si256(kData, _mm256_set1_epi32(0x0007ff)), 15))), kTwo);
+    kX = _mm256_or_ps(kX, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(kData, _mm256_set1_epi32(0x800000)), 8)));
+    kY = _mm256_or_ps(kY, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(kData, _mm256_set1_epi32(0x000800)), 20)));
+}
+GECO_TARGET_AVX2
+static inline __m256 UnpackZLanesAVX2(__m256i kZData)
+{
+    __m256 kZ = _mm256_sub_ps(_mm256_castsi256_ps(_mm256_or_si256(_mm256_set1_epi32(0x40000000),
+        _mm256_slli_epi32(_mm256_and_si256(kZData, _mm256_set1_epi32(0x7fff)), 12))), _mm256_set1_ps(2.f));
+    return _mm256_or_ps(kZ, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(kZData, _mm256_set1_epi32(0x8000)), 16)));
+}
+GECO_TARGET_AVX2
+static inline __m256 ErrorLanesAVX2(__m256i kExponent, int bias)
+{
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(kExponent, _mm256_set1_epi32(127 - bias)), 23));
+}
+/// the first 12 bytes of @kValue
+GECO_TARGET_AVX2
+static inline void Store12BytesAVX2(uchar* upOut, __m128i kValue)
+{
+    _mm_storel_epi64((__m128i*) upOut, kValue);
+    int iHigh = _mm_cvtsi128_si32(_mm_srli_si128(kValue, 8));
+    memcpy(upOut + 8, &iHigh, 4);
+}
+//----------------------------------------------------------------------------
+GECO_TARGET_AVX2
+static uint PackXYAVX2(GecoPackedXY* pOut, const float* fpX, const float* fpY, uint uiCount)
+{
+    // 4 records from the 4 int32 of each 128 bit lane
+    const __m256i kShuffle = _mm256_setr_epi8(
+        GECO_PACK3_BYTES(0), GECO_PACK3_BYTES(4), GECO_PACK3_BYTES(8), GECO_PACK3_BYTES(12), -1, -1, -1, -1,
+        GECO_PACK3_BYTES(0), GECO_PACK3_BYTES(4), GECO_PACK3_BYTES(8), GECO_PACK3_BYTES(12), -1, -1, -1, -1);
+    uchar* p = (uchar*) pOut;
+    uint i = 0;
+    for (; i + 8 <= uiCount; i += 8)
+    {
+        __m256i kRecords = _mm256_shuffle_epi8(PackXYLanesAVX2(_mm256_loadu_ps(fpX + i),
+            _mm256_loadu_ps(fpY + i)), kShuffle);
+        Store12BytesAVX2(p + i * 3, _mm256_castsi256_si128(kRecords));
+        Store12BytesAVX2(p + i * 3 + 12, _mm256_extracti128_si256(kRecords, 1));
+    }
+    return i;
+}
+/// 8 packed words from the 24 bytes at @upIn, without reading past them
+GECO_TARGET_AVX2
+static inline __m256i LoadXYRecordsAVX2(const uchar* upIn)
+{
+    // the high lane is loaded from byte 8, its records start at 4
+    const __m256i kShuffle = _mm256_setr_epi8(
+        GECO_PACK3_BYTES(0), -1, GECO_PACK3_BYTES(3), -1, GECO_PACK3_BYTES(6), -1, GECO_PACK3_BYTES(9), -1,
+        GECO_PACK3_BYTES(4), -1, GECO_PACK3_BYTES(7), -1, GECO_PACK3_BYTES(10), -1, GECO_PACK3_BYTES(13), -1);
+    __m256i kBytes = _mm256_inserti128_si256(_mm256_castsi128_si256(
+        _mm_loadu_si128((const __m128i*) upIn)), _mm_loadu_si128((const __m128i*) (upIn + 8)), 1);
+    return _mm256_shuffle_epi8(kBytes, kShuffle);
+}
+GECO_TARGET_AVX2
+static uint UnpackXYAVX2(float* fpX, float* fpY, const GecoPackedXY* pIn, uint uiCount)
+{
+    const uchar* p = (const uchar*) pIn;
+    uint i = 0;
+    for (; i + 8 <= uiCount; i += 8)
+    {
+        __m256 kX, kY;
+        UnpackXYLanesAVX2(LoadXYRecordsAVX2(p + i * 3), kX, kY);
+        _mm256_storeu_ps(fpX + i, kX);
+        _mm256_storeu_ps(fpY + i, kY);
+    }
+    return i;
+}
+GECO_TARGET_AVX2
+static uint XYErrorAVX2(float* fpXError, float* fpYError, const GecoPackedXY* pIn, uint uiCount)
+{
+    const __m256i kSeven = _mm256_set1_epi32(7);
+    const uchar* p = (const uchar*) pIn;
+    uint i = 0;
+    for (; i + 8 <= uiCount; i += 8)
+    {
+        __m256i kData = LoadXYRecordsAVX2(p + i * 3);
+        _mm256_storeu_ps(fpXError + i, ErrorLanesAVX2(_mm256_and_si256(_mm256_srli_epi32(kData, 20), kSeven), 8));
+        _mm256_storeu_ps(fpYError + i, ErrorLanesAVX2(_mm256_and_si256(_mm256_srli_epi32(kData, 8), kSeven), 8));
+    }
+    return i;
+}
+GECO_TARGET_AVX2
+static uint PackXYZAVX2(GecoPackedXYZ* pOut, const float* fpX, const float* fpY, const float* fpZ,
+    uint uiCount)
+{
+    // 2 records from [xy0, z0, xy1, z1], the padding byte is zeroed
+    const __m256i kShuffle = _mm256_setr_epi8(
+        GECO_PACK3_BYTES(0), -1, 4, 5, GECO_PACK3_BYTES(8), -1, 12, 13, -1, -1, -1, -1,
+        GECO_PACK3_BYTES(0), -1, 4, 5, GECO_PACK3_BYTES(8), -1, 12, 13, -1, -1, -1, -1);
+    uchar* p = (uchar*) pOut;
+    uint i = 0;
+    for (; i + 8 <= uiCount; i += 8)
+    {
+        __m256i kData = PackXYLanesAVX2(_mm256_loadu_ps(fpX + i), _mm256_loadu_ps(fpY + i));
+        __m256i kZData = PackZLanesAVX2(_mm256_loadu_ps(fpZ + i));
+        // records 0 1 | 4 5 and 2 3 | 6 7
+        __m256i kLow = _mm256_shuffle_epi8(_mm256_unpacklo_epi32(kData, kZData), kShuffle);
+        __m256i kHigh = _mm256_shuffle_epi8(_mm256_unpackhi_epi32(kData, kZData), kShuffle);
+        uchar* pRecords = p + i * sizeof(GecoPackedXYZ);
+        Store12BytesAVX2(pRecords, _mm256_castsi256_si128(kLow));
+        Store12BytesAVX2(pRecords + 12, _mm256_castsi256_si128(kHigh));
+        Store12BytesAVX2(pRecords + 24, _mm256_extracti128_si256(kLow, 1));
+        Store12BytesAVX2(pRecords + 36, _mm256_extracti128_si256(kHigh, 1));
+    }
+    return i;
+}
+/// the receiving side, records are gathered one by one
+GECO_TARGET_AVX2
+static inline void LoadXYZRecordsAVX2(const GecoPackedXYZ* pIn, __m256i& kData, __m256i& kZData)
+{
+    kData = _mm256_setr_epi32(
+        GECO_UNPACK3((const char*) pIn[0].m_acData), GECO_UNPACK3((const char*) pIn[1].m_acData),
+        GECO_UNPACK3((const char*) pIn[2].m_acData), GECO_UNPACK3((const char*) pIn[3].m_acData),
+        GECO_UNPACK3((const char*) pIn[4].m_acData), GECO_UNPACK3((const char*) pIn[5].m_acData),
+        GECO_UNPACK3((const char*) pIn[6].m_acData), GECO_UNPACK3((const char*) pIn[7].m_acData));
+    kZData = _mm256_setr_epi32(pIn[0].m_acZShort, pIn[1].m_acZShort, pIn[2].m_acZShort,
+        pIn[3].m_acZShort, pIn[4].m_acZShort, pIn[5].m_acZShort, pIn[6].m_acZShort, pIn[7].m_acZShort);
+}
+GECO_TARGET_AVX2
+static uint UnpackXYZAVX2(float* fpX, float* fpY, float* fpZ, const GecoPackedXYZ* pIn, uint uiCount)
+{
+    uint i = 0;
+    for (; i + 8 <= uiCount; i += 8)
+    {
+        __m256i kData, kZData;
+        LoadXYZRecordsAVX2(pIn + i, kData, kZData);
+        __m256 kX, kY;
+        UnpackXYLanesAVX2(kData, kX, kY);
+        _mm256_storeu_ps(fpX + i, kX);
+        _mm256_storeu_ps(fpY + i, kY);
+        _mm256_storeu_ps(fpZ + i, UnpackZLanesAVX2(kZData));
+    }
+    return i;
+}
+#endif // GECO_BATCH_X86
+
+//----------------------------------------------------------------------------
+void GecoPackedXY::PackXYBatch(GecoPackedXY* pOut, const float* fpX, const float* fpY,
+    uint uiCount)
+{
+    uint i = 0;
+#if GECO_BATCH_X86
+    GecoBatchIsa eIsa = GecoBatchGetIsa();
+    if (eIsa == GECO_BATCH_AVX2)
+        i = PackXYAVX2(pOut, fpX, fpY, uiCount);
+    else if (eIsa == GECO_BATCH_SSE2)
+        i = PackXYSSE2(pOut, fpX, fpY, uiCount);
+#endif
+    for (; i < uiCount; i++)
+        pOut[i].PackXY(fpX[i], fpY[i]);
+}
+void GecoPackedXY::UnpackXYBatch(float* fpX, float* fpY, const GecoPackedXY* pIn, uint uiCount)
+{
+    uint i = 0;
+#if GECO_BATCH_X86
+    GecoBatchIsa eIsa = GecoBatchGetIsa();
+    if (eIsa == GECO_BATCH_AVX2)
+        i = UnpackXYAVX2(fpX, fpY, pIn, uiCount);
+    else if (eIsa == GECO_BATCH_SSE2)
+        i = UnpackXYSSE2(fpX, fpY, pIn, uiCount);
+#endif
+    for (; i < uiCount; i++)
+        pIn[i].UnpackXY(fpX[i], fpY[i]);
+}
+void GecoPackedXY::GetXYErrorBatch(float* fpXError, float* fpYError, const GecoPackedXY* pIn,
+    uint uiCount)
+{
+    uint i = 0;
+#if GECO_BATCH_X86
+    GecoBatchIsa eIsa = GecoBatchGetIsa();
+    if (eIsa == GECO_BATCH_AVX2)
+        i = XYErrorAVX2(fpXError, fpYError, pIn, uiCount);
+    else if (eIsa == GECO_BATCH_SSE2)
+        i = XYErrorSSE2(fpXError, fpYError, pIn, sizeof(GecoPackedXY), uiCount);
+#endif
+    for (; i < uiCount; i++)
+        pIn[i].GetXYError(fpXError[i], fpYError[i]);
+}
+void GecoPackedXYZ::PackXYZBatch(GecoPackedXYZ* pOut, const float* fpX, const float* fpY,
+    const float* fpZ, uint uiCount)
+{
+    uint i = 0;
+#if GECO_BATCH_X86
+    GecoBatchIsa eIsa = GecoBatchGetIsa();
+    if (eIsa == GECO_BATCH_AVX2)
+        i = PackXYZAVX2(pOut, fpX, fpY, fpZ, uiCount);
+    else if (eIsa == GECO_BATCH_SSE2)
+        i = PackXYZSSE2(pOut, fpX, fpY, fpZ, uiCount);
+#endif
+    for (; i < uiCount; i++)
+        pOut[i].PackXYZ(fpX[i], fpY[i], fpZ[i]);
+}
+void GecoPackedXYZ::UnpackXYZBatch(float* fpX, float* fpY, float* fpZ, const GecoPackedXYZ* pIn,
+    uint uiCount)
+{
+    uint i = 0;
+#if GECO_BATCH_X86
+    GecoBatchIsa eIsa = GecoBatchGetIsa();
+    if (eIsa == GECO_BATCH_AVX2)
+        i = UnpackXYZAVX2(fpX, fpY, fpZ, pIn, uiCount);
+    else if (eIsa == GECO_BATCH_SSE2)
+        i = UnpackXYZSSE2(fpX, fpY, fpZ, pIn, uiCount);
+#endif
+    for (; i < uiCount; i++)
+        pIn[i].UnpackXYZ(fpX[i], fpY[i], fpZ[i]);
+}
+void GecoPackedXYZ::ZErrorBatch(float* fpZError, const GecoPackedXYZ* pIn, uint uiCount)
+{
+    uint i = 0;
+#if GECO_BATCH_X86
+    // 4 lanes are enough, the gather is the cost
+    if (GecoBatchGetIsa() != GECO_BATCH_SCALAR)
+        i = ZErrorSSE2(fpZError, pIn, uiCount);
+#endif
+    for (; i < uiCount; i++)
+        fpZError[i] = pIn[i].ZError();
+}
+
 static bool s_networkInitted = false;
 void InitNetwork()
 {
@@ -0,0 +1,363 @@
+#include "network-interface.h"
+
+#include <math.h>
+#include <limits.h>
+
+/// events of one epoll_wait(), grown when a wait fills them
+static const int INITIAL_EVENTS = 256;
+
+GecoNetworkInterface::GecoNetworkInterface() :
+        numRegistered_(0),
+#ifdef __linux__
+        epollFd_(::epoll_create1(EPOLL_CLOEXEC)),
+        events_(INITIAL_EVENTS),
+#endif
+        pPackets_(NULL),
+        breakProcessing_(false),
+        spareTime_(0)
+{
+#ifdef __linux__
+    if (epollFd_ < 0)
+        network_logger()->critical("GecoNetworkInterface::GecoNetworkInterface(): epoll_create1 failed {}",
+            strerror(errno));
+#endif
+    for (int i = 0; i < GecoNetEndpoint::MMSG_BATCH; i++)
+        packetPtrs_[i] = NULL;
+}
+
+GecoNetworkInterface::~GecoNetworkInterface()
+{
+    if (endpoint_.Good())
+        this->deregisterEndpoint(endpoint_);
+#ifdef __linux__
+    if (epollFd_ >= 0)
+        ::close(epollFd_);
+#endif
+    delete[] pPackets_;
+}
+
+bool GecoNetworkInterface::initEndpoint(ushort port, const char * host, GecoNetDatagramHandler * pHandler)
+{
+    GecoNetAddress bindAddr(port, host);
+    endpoint_.Socket(saddr_family(&bindAddr.su), SOCK_DGRAM);
+    if (!endpoint_.Good() || endpoint_.Bind(bindAddr) != 0 || endpoint_.GetLocalAddress(&address_) != 0)
+    {
+        network_logger()->error("GecoNetworkInterface::initEndpoint(): could not bind to {}:{}, {}",
+            host == NULL ? "" : host, port, strerror(errno));
+        endpoint_.Close();
+        return false;
+    }
+    return this->registerEndpoint(endpoint_, pHandler);
+}
+
+GecoNetworkInterface::Registration * GecoNetworkInterface::find(int fd)
+{
+    return (fd >= 0 && fd < (int) fds_.size()) ? &fds_[fd] : NULL;
+}
+
+/**
+ *	This method sets the registration of @fd and tells the kernel what to
+ *	wait for, nothing removes it.
+ */
+bool GecoNetworkInterface::update(int fd, const Registration & newState)
+{
+    if (fd < 0)
+        return false;
+    if (fd >= (int) fds_.size())
+    {
+        Registration none = { NULL, NULL, NULL, NULL };
+        fds_.resize(fd + 1, none);
+    }
+    Registration & reg = fds_[fd];
+    bool wasRegistered = reg.pInput_ || reg.pOutput_ || reg.pDatagrams_;
+    bool isRegistered = newState.pInput_ || newState.pOutput_ || newState.pDatagrams_;
+
+#ifdef __linux__
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.data.fd = fd;
+    ev.events = EPOLLET;
+    if (newState.pInput_ || newState.pDatagrams_)
+        ev.events |= EPOLLIN;
+    if (newState.pOutput_)
+        ev.events |= EPOLLOUT;
+    int op = !isRegistered ? EPOLL_CTL_DEL : wasRegistered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (::epoll_ctl(epollFd_, op, fd, &ev) != 0)
+    {
+        network_logger()->error("GecoNetworkInterface::update(): epoll_ctl({}) on fd {} failed, {}",
+            op, fd, strerror(errno));
+        // a closed descriptor is already gone from the epoll set
+        if (op != EPOLL_CTL_DEL)
+            return false;
+    }
+#endif
+
+    reg = newState;
+    numRegistered_ += int(isRegistered) - int(wasRegistered);
+    return true;
+}
+
+bool GecoNetworkInterface::registerFileDescriptor(int fd, GecoNetInputNotificationHandler * pHandler)
+{
+    Registration * pReg = this->find(fd);
+    if (pReg != NULL && (pReg->pInput_ || pReg->pDatagrams_))
+    {
+        network_logger()->warn("GecoNetworkInterface::registerFileDescriptor(): fd {} is already registered", fd);
+        return false;
+    }
+    Registration reg = { pHandler, pReg ? pReg->pOutput_ : NULL, NULL, NULL };
+    return this->update(fd, reg);
+}
+
+bool GecoNetworkInterface::deregisterFileDescriptor(int fd)
+{
+    Registration * pReg = this->find(fd);
+    if (pReg == NULL || pReg->pInput_ == NULL)
+        return false;
+    Registration reg = *pReg;
+    reg.pInput_ = NULL;
+    return this->update(fd, reg);
+}
+
+bool GecoNetworkInterface::registerWriteFileDescriptor(int fd, GecoNetOutputNotificationHandler * pHandler)
+{
+    Registration * pReg = this->find(fd);
+    if (pReg != NULL && pReg->pOutput_)
+    {
+        network_logger()->warn("GecoNetworkInterface::registerWriteFileDescriptor(): fd {} is already registered",
+            fd);
+        return false;
+    }
+    Registration reg = { NULL, pHandler, NULL, NULL };
+    if (pReg != NULL)
+    {
+        reg = *pReg;
+        reg.pOutput_ = pHandler;
+    }
+    return this->update(fd, reg);
+}
+
+bool GecoNetworkInterface::deregisterWriteFileDescriptor(int fd)
+{
+    Registration * pReg = this->find(fd);
+    if (pReg == NULL || pReg->pOutput_ == NULL)
+        return false;
+    Registration reg = *pReg;
+    reg.pOutput_ = NULL;
+    return this->update(fd, reg);
+}
+
+bool GecoNetworkInterface::registerEndpoint(GecoNetEndpoint & endpoint, GecoNetDatagramHandler * pHandler)
+{
+    int fd = (int) endpoint;
+    Registration * pReg = this->find(fd);
+    if (pReg != NULL && (pReg->pInput_ || pReg->pDatagrams_))
+    {
+        network_logger()->warn("GecoNetworkInterface::registerEndpoint(): fd {} is already registered", fd);
+        return false;
+    }
+    if (pPackets_ == NULL)
+    {
+        pPackets_ = new GecoNetPacket[GecoNetEndpoint::MMSG_BATCH];
+        for (int i = 0; i < GecoNetEndpoint::MMSG_BATCH; i++)
+            packetPtrs_[i] = pPackets_ + i;
+    }
+    // edge triggered, the drain must end on EAGAIN instead of blocking
+    endpoint.SetNonblocking(true);
+    Registration reg = { NULL, pReg ? pReg->pOutput_ : NULL, &endpoint, pHandler };
+    return this->update(fd, reg);
+}
+
+bool GecoNetworkInterface::deregisterEndpoint(GecoNetEndpoint & endpoint)
+{
+    Registration * pReg = this->find((int) endpoint);
+    if (pReg == NULL || pReg->pDatagrams_ == NULL)
+        return false;
+    Registration reg = *pReg;
+    reg.pEndpoint_ = NULL;
+    reg.pDatagrams_ = NULL;
+    return this->update((int) endpoint, reg);
+}
+
+TimerID GecoNetworkInterface::addTimer(int64 microseconds, TimerHandler * pHandler, void * pUser)
+{
+    uint64 interval = uint64(double(microseconds) * stamps_per_sec_double() / 1000000.0);
+    if (interval == 0)
+        interval = 1;
+    return timers_.add(gettimestamp() + interval, interval, pHandler, pUser);
+}
+
+TimerID GecoNetworkInterface::addOnceOffTimer(int64 microseconds, TimerHandler * pHandler, void * pUser)
+{
+    uint64 delay = uint64(double(microseconds) * stamps_per_sec_double() / 1000000.0);
+    return timers_.add(gettimestamp() + delay, 0, pHandler, pUser);
+}
+
+/**
+ *	This method receives the queued datagrams of the endpoint on @fd a batch at
+ *	a time. The handler may deregister the endpoint, so the registration is
+ *	looked up again for every batch.
+ */
+void GecoNetworkInterface::drainEndpoint(int fd)
+{
+    for (;;)
+    {
+        Registration * pReg = this->find(fd);
+        if (pReg == NULL || pReg->pDatagrams_ == NULL)
+            return;
+        GecoNetEndpoint & endpoint = *pReg->pEndpoint_;
+        int count = endpoint.RecvMany(packetPtrs_, srcs_, GecoNetEndpoint::MMSG_BATCH);
+        if (count <= 0)
+            return;
+        pReg->pDatagrams_->handleDatagrams(endpoint, packetPtrs_, srcs_, count);
+#ifdef __linux__
+        // recvmmsg stopped short on an empty queue, the next datagram is a
+        // new edge
+        if (count < GecoNetEndpoint::MMSG_BATCH)
+            return;
+#endif
+    }
+}
+
+int GecoNetworkInterface::waitMilliseconds(double maxWaitSeconds, uint64 now) const
+{
+    double wait = maxWaitSeconds;
+    if (!timers_.empty())
+    {
+        double timerWait = stamps2sec(timers_.nextExp(now));
+        if (wait < 0.0 || timerWait < wait)
+            wait = timerWait;
+    }
+    if (wait < 0.0)
+        return -1;
+    // round up, waking before the timer is due would only spin
+    double ms = ceil(wait * 1000.0);
+    return ms > double(INT_MAX) ? INT_MAX : int(ms);
+}
+
+int GecoNetworkInterface::processOnce(double maxWaitSeconds)
+{
+    uint64 startWait = gettimestamp();
+    int timeout = this->waitMilliseconds(maxWaitSeconds, startWait);
+    int dispatched = 0;
+
+#ifdef __linux__
+    int countReady = ::epoll_wait(epollFd_, &events_[0], (int) events_.size(), timeout);
+    spareTime_ += gettimestamp() - startWait;
+    if (countReady < 0)
+    {
+        if (errno != EINTR)
+        {
+            network_logger()->warn("GecoNetworkInterface::processOnce(): epoll_wait failed, {}", strerror(errno));
+            return -1;
+        }
+        countReady = 0;
+    }
+
+    for (int i = 0; i < countReady; i++)
+    {
+        int fd = events_[i].data.fd;
+        uint events = events_[i].events;
+        // an earlier handler may have deregistered it, and registering others
+        // may move fds_, so nothing is kept across the calls
+        Registration * pReg = this->find(fd);
+        if (pReg == NULL)
+            continue;
+        if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+        {
+            if (pReg->pDatagrams_)
+            {
+                this->drainEndpoint(fd);
+                ++dispatched;
+            }
+            else if (pReg->pInput_)
+            {
+                pReg->pInput_->handleInputNotification(fd);
+                ++dispatched;
+            }
+        }
+        pReg = this->find(fd);
+        if ((events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && pReg->pOutput_)
+        {
+            pReg->pOutput_->handleOutputNotification(fd);
+            ++dispatched;
+        }
+    }
+    if (countReady == (int) events_.size())
+        events_.resize(events_.size() * 2);
+#else
+    fd_set readFDs, writeFDs;
+    FD_ZERO(&readFDs);
+    FD_ZERO(&writeFDs);
+    int fdLargest = -1;
+    bool anyWrite = false;
+    for (int fd = 0; fd < (int) fds_.size(); fd++)
+    {
+        if (fds_[fd].pInput_ || fds_[fd].pDatagrams_)
+            FD_SET(fd, &readFDs);
+        if (fds_[fd].pOutput_)
+        {
+            FD_SET(fd, &writeFDs);
+            anyWrite = true;
+        }
+        if (fds_[fd].pInput_ || fds_[fd].pDatagrams_ || fds_[fd].pOutput_)
+            fdLargest = fd;
+    }
+    timeval tv;
+    timeval * pTimeout = NULL;
+    if (timeout >= 0)
+    {
+        tv.tv_sec = timeout / 1000;
+        tv.tv_usec = (timeout % 1000) * 1000;
+        pTimeout = &tv;
+    }
+    int countReady = ::select(fdLargest + 1, &readFDs, anyWrite ? &writeFDs : NULL, NULL, pTimeout);
+    spareTime_ += gettimestamp() - startWait;
+    if (countReady < 0)
+    {
+        network_logger()->warn("GecoNetworkInterface::processOnce(): select failed");
+        return -1;
+    }
+    for (int fd = 0; countReady > 0 && fd <= fdLargest; fd++)
+    {
+        if (FD_ISSET(fd, &readFDs))
+        {
+            --countReady;
+            Registration * pReg = this->find(fd);
+            if (pReg->pDatagrams_)
+            {
+                this->drainEndpoint(fd);
+                ++dispatched;
+            }
+            else if (pReg->pInput_)
+            {
+                pReg->pInput_->handleInputNotification(fd);
+                ++dispatched;
+            }
+        }
+        if (anyWrite && FD_ISSET(fd, &writeFDs))
+        {
+            --countReady;
+            Registration * pReg = this->find(fd);
+            if (pReg->pOutput_)
+            {
+                pReg->pOutput_->handleOutputNotification(fd);
+                ++dispatched;
+            }
+        }
+    }
+#endif
+
+    dispatched += timers_.process(gettimestamp());
+    return dispatched;
+}
+
+void GecoNetworkInterface::processContinuously()
+{
+    breakProcessing_ = false;
+    while (!breakProcessing_)
+    {
+        if (this->processOnce() < 0)
+            break;
+    }
+}
@@ -0,0 +1,204 @@
+//{future header message}
+#ifndef __GecoNetworkInterface_H__
+#define __GecoNetworkInterface_H__
+
+#include "end-point.h"
+#include "dispatch-table.h"
+#include "common/debugging/timer_queue_t.h"
+
+#include <vector>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+/**
+ *	This class is notified when a registered file descriptor becomes readable.
+ *	The interface waits edge triggered, so the handler must read until the
+ *	descriptor would block, it is not notified again for data it left behind.
+ *
+ *	@ingroup network
+ */
+struct GecoNetInputNotificationHandler
+{
+        virtual ~GecoNetInputNotificationHandler()
+        {
+        }
+        virtual int handleInputNotification(int fd) = 0;
+};
+
+/**
+ *	This class is notified when a registered file descriptor becomes writable,
+ *	edge triggered as well: write until the descriptor would block.
+ *
+ *	@ingroup network
+ */
+struct GecoNetOutputNotificationHandler
+{
+        virtual ~GecoNetOutputNotificationHandler()
+        {
+        }
+        virtual int handleOutputNotification(int fd) = 0;
+};
+
+/**
+ *	This class receives the datagrams of an endpoint registered with
+ *	GecoNetworkInterface::registerEndpoint(), up to GecoNetEndpoint::MMSG_BATCH
+ *	per call. The packets and addresses are reused by the next batch.
+ *
+ *	@ingroup network
+ */
+struct GecoNetDatagramHandler
+{
+        virtual ~GecoNetDatagramHandler()
+        {
+        }
+        virtual void handleDatagrams(GecoNetEndpoint & endpoint, GecoNetPacket* const * packets,
+            const GecoNetAddress* srcs, int count) = 0;
+};
+
+/**
+ *	This class is the event loop of a server process. It replaces the select()
+ *	loop of the old nub, which rebuilt its fd_sets and scanned up to the
+ *	largest descriptor on every iteration: on linux every descriptor is
+ *	registered once with an edge triggered epoll instance, so a wait costs
+ *	O(ready descriptors) however many links are registered. Other platforms
+ *	fall back to select().
+ *
+ *	Timers live in a TimeQueue64 of gettimestamp() stamps, the earliest one
+ *	bounds the wait. Datagram endpoints are drained with RecvMany().
+ *
+ *	@ingroup network
+ */
+class GECOAPI GecoNetworkInterface
+{
+    public:
+        GecoNetworkInterface();
+        ~GecoNetworkInterface();
+
+        /// @name The interface's own endpoint
+        //@{
+        /**
+         *	This method binds the interface's udp endpoint to @port on @host,
+         *	0 picks a free port, and registers it with @pHandler.
+         *
+         *	@return true on success.
+         */
+        bool initEndpoint(ushort port, const char * host, GecoNetDatagramHandler * pHandler);
+        GecoNetEndpoint & endpoint()
+        {
+            return endpoint_;
+        }
+        /// the address the endpoint is bound to
+        const GecoNetAddress & address() const
+        {
+            return address_;
+        }
+        //@}
+
+        /// @name Registration
+        //@{
+        bool registerFileDescriptor(int fd, GecoNetInputNotificationHandler * pHandler);
+        bool deregisterFileDescriptor(int fd);
+        bool registerWriteFileDescriptor(int fd, GecoNetOutputNotificationHandler * pHandler);
+        bool deregisterWriteFileDescriptor(int fd);
+        /// @a endpoint is made non blocking, its datagrams go to @pHandler
+        bool registerEndpoint(GecoNetEndpoint & endpoint, GecoNetDatagramHandler * pHandler);
+        bool deregisterEndpoint(GecoNetEndpoint & endpoint);
+        /// the number of registered descriptors
+        int numRegistered() const
+        {
+            return numRegistered_;
+        }
+        /// the messages of the interface registered with
+        /// GecoInterfaceMinder::registerWithInterface()
+        GecoNetDispatchTable & dispatchTable()
+        {
+            return dispatchTable_;
+        }
+        //@}
+
+        /// @name Timers
+        //@{
+        /// fires every @microseconds until cancelled
+        TimerID addTimer(int64 microseconds, TimerHandler * pHandler, void * pUser = NULL);
+        TimerID addOnceOffTimer(int64 microseconds, TimerHandler * pHandler, void * pUser = NULL);
+        TimeQueue64 & timers()
+        {
+            return timers_;
+        }
+        //@}
+
+        /// @name Processing
+        //@{
+        /**
+         *	This method waits for at most @maxWaitSeconds, less when a timer is
+         *	due sooner, then calls the handlers of the ready descriptors and the
+         *	due timers. A negative wait only ends with an event or a timer.
+         *
+         *	@return the number of handlers and timers called, -1 if the wait
+         *	failed.
+         */
+        int processOnce(double maxWaitSeconds = -1.0);
+        /// process until breakProcessing() is called from a handler
+        void processContinuously();
+        void breakProcessing(bool breakState = true)
+        {
+            breakProcessing_ = breakState;
+        }
+        bool processingBroken() const
+        {
+            return breakProcessing_;
+        }
+        /// stamps spent waiting for events since the last clearSpareTime()
+        uint64 spareTime() const
+        {
+            return spareTime_;
+        }
+        void clearSpareTime()
+        {
+            spareTime_ = 0;
+        }
+        //@}
+
+    private:
+        struct Registration
+        {
+                GecoNetInputNotificationHandler * pInput_;
+                GecoNetOutputNotificationHandler * pOutput_;
+                GecoNetEndpoint * pEndpoint_;
+                GecoNetDatagramHandler * pDatagrams_;
+        };
+
+        Registration * find(int fd);
+        bool update(int fd, const Registration & newState);
+        void drainEndpoint(int fd);
+        int waitMilliseconds(double maxWaitSeconds, uint64 now) const;
+
+        GecoNetworkInterface(const GecoNetworkInterface &);
+        GecoNetworkInterface & operator=(const GecoNetworkInterface &);
+
+        /// indexed by descriptor, all NULL when unregistered
+        std::vector<Registration> fds_;
+        int numRegistered_;
+#ifdef __linux__
+        int epollFd_;
+        std::vector<epoll_event> events_;
+#endif
+        TimeQueue64 timers_;
+
+        GecoNetEndpoint endpoint_;
+        GecoNetAddress address_;
+        GecoNetDispatchTable dispatchTable_;
+
+        /// the batch drainEndpoint() receives into, allocated with the first
+        /// registered endpoint
+        GecoNetPacket * pPackets_;
+        GecoNetPacket * packetPtrs_[GecoNetEndpoint::MMSG_BATCH];
+        GecoNetAddress srcs_[GecoNetEndpoint::MMSG_BATCH];
+
+        bool breakProcessing_;
+        uint64 spareTime_;
+};
+
+#endif // __GecoNetworkInterface_H__
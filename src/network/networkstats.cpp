@@ -8,6 +8,11 @@
 #include "../common/ultils/ultils.h"
 #include "networkstats.h"
 #include <iosfwd>
+#include <fstream>
+#include <map>
+#include <string>
+#include <atomic>
+#include <stdint.h>
 
 DECLARE_DEBUG_COMPONENT2("networkstats", 0)
 
@@ -257,7 +262,6 @@ void Profiler::flushHistory()
 // ================= Profiler Definitions Ends ================ 
 
 
-#include <stdint.h>
 // ================= ProfileVal Definitions Starts ================ 
 time_stamp_t ProfileVal::s_warningPeriod_(UINT64_MAX);
 void ProfileVal::setWarningPeriod(time_stamp_t warningPeriod)
@@ -555,6 +559,408 @@ void ProfileGroupResetter::resetIfDesired(ProfileVal & val)
 // ================= ProfileGroupResetter Definitions Ends ================ 
 
 
+// ================= ProfileCapture Definitions Starts ================ 
+std::atomic<bool> ProfileCapture::s_enabled_(false);
+
+namespace
+{
+	struct CaptureEvent
+	{
+		uint64 stamp_;
+		const ProfileVal * pVal_;
+		uint32 type_;
+	};
+
+	struct CaptureTick
+	{
+		uint64 number_;
+		uint64 firstEvent_;
+		uint64 endEvent_;
+		uint64 start_;
+		uint64 end_;
+	};
+
+	uint32 roundUpPowerOf2(uint32 val)
+	{
+		uint32 pow2 = 1;
+		while (pow2 < val) pow2 <<= 1;
+		return pow2;
+	}
+
+	/// One per thread, only ever touched by its own thread.
+	struct CaptureBuffer
+	{
+		CaptureBuffer(uint32 maxEvents, uint32 maxTicks, uint32 tid) :
+			events_(roundUpPowerOf2(maxEvents < 2 ? 2 : maxEvents)),
+			eventHead_(0),
+			ticks_(maxTicks < 1 ? 1 : maxTicks),
+			tickHead_(0),
+			tickStart_(gettimestamp()),
+			tickFirstEvent_(0),
+			tid_(tid)
+		{
+			open_.reserve(64);
+		}
+
+		void push(const ProfileVal * pVal, uint32 type, uint64 stamp)
+		{
+			CaptureEvent & event = events_[eventHead_ & (events_.size() - 1)];
+			event.stamp_ = stamp;
+			event.pVal_ = pVal;
+			event.type_ = type;
+			++eventHead_;
+		}
+
+		eastl::vector<CaptureEvent> events_;
+		uint64 eventHead_;
+		eastl::vector<CaptureTick> ticks_;
+		uint64 tickHead_;
+		uint64 tickStart_;
+		uint64 tickFirstEvent_;
+		/// profiles started and not stopped yet, outermost first
+		eastl::vector<const ProfileVal *> open_;
+		uint32 tid_;
+	};
+
+	std::atomic<uint32> s_captureMaxEvents(1 << 16);
+	std::atomic<uint32> s_captureMaxTicks(64);
+	uint64 s_captureBudget = 0;
+	std::string s_captureBudgetPrefix = "slow-tick";
+	std::atomic<uint32> s_captureThreads(0);
+
+	struct CaptureBufferHolder
+	{
+		CaptureBufferHolder() : pBuffer_(NULL) {}
+		~CaptureBufferHolder() { delete pBuffer_; }
+		CaptureBuffer * pBuffer_;
+	};
+	thread_local CaptureBufferHolder t_captureBuffer;
+
+	CaptureBuffer & captureBuffer()
+	{
+		CaptureBuffer *& pBuffer = t_captureBuffer.pBuffer_;
+		if (pBuffer == NULL)
+		{
+			pBuffer = new CaptureBuffer(
+				s_captureMaxEvents.load(std::memory_order_relaxed),
+				s_captureMaxTicks.load(std::memory_order_relaxed),
+				++s_captureThreads);
+		}
+		return *pBuffer;
+	}
+
+	/**
+	*	The last @numTicks ticks whose events have not been overwritten yet,
+	*	oldest first.
+	*/
+	void capturedTicks(const CaptureBuffer & buf, uint32 numTicks,
+		eastl::vector<CaptureTick> & ticks)
+	{
+		uint64 count = std::min<uint64>(buf.tickHead_, buf.ticks_.size());
+		if (numTicks != 0 && numTicks < count)
+		{
+			count = numTicks;
+		}
+		for (uint64 number = buf.tickHead_ - count; number < buf.tickHead_; ++number)
+		{
+			const CaptureTick & tick = buf.ticks_[number % buf.ticks_.size()];
+			if (buf.eventHead_ - tick.firstEvent_ <= buf.events_.size())
+			{
+				ticks.push_back(tick);
+			}
+		}
+	}
+
+	struct CaptureFrame
+	{
+		const ProfileVal * pVal_;
+		uint64 start_;
+		uint64 childTime_;
+	};
+
+	/**
+	*	Replays the events of @tick, calling @onSpan(stack, frame, end) for
+	*	every profile stopped in it, with @stack holding its parents. Ticks
+	*	are balanced by tick(), so every stop has its start.
+	*/
+	template <class ON_SPAN>
+	void replayTick(const CaptureBuffer & buf, const CaptureTick & tick,
+		ON_SPAN & onSpan)
+	{
+		eastl::vector<CaptureFrame> stack;
+		for (uint64 i = tick.firstEvent_; i < tick.endEvent_; ++i)
+		{
+			const CaptureEvent & event = buf.events_[i & (buf.events_.size() - 1)];
+			if (event.type_ == ProfileCapture::EVENT_START)
+			{
+				CaptureFrame frame = { event.pVal_, event.stamp_, 0 };
+				stack.push_back(frame);
+			}
+			else if (!stack.empty())
+			{
+				CaptureFrame frame = stack.back();
+				stack.pop_back();
+				onSpan(stack, frame, event.stamp_);
+				if (!stack.empty())
+				{
+					stack.back().childTime_ += event.stamp_ - frame.start_;
+				}
+			}
+		}
+	}
+
+	void writeJsonString(std::ostream & os, const char * str)
+	{
+		os << '"';
+		for (; *str; ++str)
+		{
+			unsigned char c = (unsigned char)*str;
+			if (c == '"' || c == '\\')
+			{
+				os << '\\' << (char)c;
+			}
+			else if (c < 0x20)
+			{
+				char buf[8];
+				geco_snprintf(buf, sizeof(buf), "\\u%04x", c);
+				os << buf;
+			}
+			else
+			{
+				os << (char)c;
+			}
+		}
+		os << '"';
+	}
+
+	struct ChromeTraceWriter
+	{
+		std::ostream & os_;
+		uint64 base_;
+		double usPerStamp_;
+		uint32 tid_;
+		bool first_;
+
+		void write(const char * name, uint64 start, uint64 end)
+		{
+			char buf[128];
+			os_ << (first_ ? "\n" : ",\n") << "{\"name\":";
+			first_ = false;
+			writeJsonString(os_, name);
+			geco_snprintf(buf, sizeof(buf),
+				",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+				(start - base_) * usPerStamp_, (end - start) * usPerStamp_, tid_);
+			os_ << buf;
+		}
+
+		void operator()(const eastl::vector<CaptureFrame> &,
+			const CaptureFrame & frame, uint64 end)
+		{
+			this->write(frame.pVal_->c_str(), frame.start_, end);
+		}
+	};
+
+	struct CollapsedStackWriter
+	{
+		std::map<std::string, uint64> selfTimes_;
+		uint64 topLevelTime_;
+
+		static void append(std::string & path, const char * name)
+		{
+			path += ';';
+			for (; *name; ++name)
+			{
+				path += (*name == ';') ? ':' : *name;
+			}
+		}
+
+		void operator()(const eastl::vector<CaptureFrame> & stack,
+			const CaptureFrame & frame, uint64 end)
+		{
+			std::string path = "tick";
+			for (size_t i = 0; i < stack.size(); ++i)
+			{
+				append(path, stack[i].pVal_->c_str());
+			}
+			append(path, frame.pVal_->c_str());
+			selfTimes_[path] += (end - frame.start_) - frame.childTime_;
+			if (stack.empty())
+			{
+				topLevelTime_ += end - frame.start_;
+			}
+		}
+	};
+}
+
+void ProfileCapture::enable(bool on, uint32 maxEvents, uint32 maxTicks)
+{
+	s_captureMaxEvents.store(maxEvents, std::memory_order_relaxed);
+	s_captureMaxTicks.store(maxTicks, std::memory_order_relaxed);
+	s_enabled_.store(on, std::memory_order_relaxed);
+}
+
+void ProfileCapture::record(const ProfileVal & val, EventType type, uint64 stamp)
+{
+	CaptureBuffer & buf = captureBuffer();
+	if (type == EVENT_START)
+	{
+		buf.open_.push_back(&val);
+	}
+	else
+	{
+		// started before capturing was enabled
+		if (buf.open_.empty() || buf.open_.back() != &val)
+		{
+			return;
+		}
+		buf.open_.pop_back();
+	}
+	buf.push(&val, type, stamp);
+}
+
+void ProfileCapture::tick()
+{
+	if (!isEnabled())
+	{
+		return;
+	}
+
+	CaptureBuffer & buf = captureBuffer();
+	const uint64 now = gettimestamp();
+
+	// Stop whatever is still running at the end of this tick and restart it
+	// at the beginning of the next, so every tick can be replayed alone.
+	for (size_t i = buf.open_.size(); i-- > 0;)
+	{
+		buf.push(buf.open_[i], EVENT_STOP, now);
+	}
+
+	CaptureTick & tick = buf.ticks_[buf.tickHead_ % buf.ticks_.size()];
+	tick.number_ = buf.tickHead_++;
+	tick.firstEvent_ = buf.tickFirstEvent_;
+	tick.endEvent_ = buf.eventHead_;
+	tick.start_ = buf.tickStart_;
+	tick.end_ = now;
+
+	buf.tickStart_ = now;
+	buf.tickFirstEvent_ = buf.eventHead_;
+	for (size_t i = 0; i < buf.open_.size(); ++i)
+	{
+		buf.push(buf.open_[i], EVENT_START, now);
+	}
+
+	if (s_captureBudget != 0 && tick.end_ - tick.start_ > s_captureBudget)
+	{
+		char path[512];
+		geco_snprintf(path, sizeof(path), "%s-%llu",
+			s_captureBudgetPrefix.c_str(), (unsigned long long)tick.number_);
+		WARNING_MSG("ProfileCapture::tick: tick %llu took %.2f ms, saved to %s.json\n",
+			(unsigned long long)tick.number_,
+			stamps2sec(tick.end_ - tick.start_) * 1000.0, path);
+		exportToFiles(path, 1);
+	}
+}
+
+void ProfileCapture::setTickBudget(double seconds, const char * pathPrefix)
+{
+	s_captureBudget = (seconds > 0.0) ?
+		uint64(seconds * stamps_per_sec_double()) : 0;
+	s_captureBudgetPrefix = pathPrefix ? pathPrefix : "slow-tick";
+}
+
+uint32 ProfileCapture::numCapturedTicks()
+{
+	eastl::vector<CaptureTick> ticks;
+	capturedTicks(captureBuffer(), 0, ticks);
+	return uint32(ticks.size());
+}
+
+void ProfileCapture::clear()
+{
+	CaptureBuffer & buf = captureBuffer();
+	buf.eventHead_ = 0;
+	buf.tickHead_ = 0;
+	buf.tickFirstEvent_ = 0;
+	buf.tickStart_ = gettimestamp();
+	buf.open_.clear();
+}
+
+bool ProfileCapture::exportChromeTrace(std::ostream & os, uint32 numTicks)
+{
+	const CaptureBuffer & buf = captureBuffer();
+	eastl::vector<CaptureTick> ticks;
+	capturedTicks(buf, numTicks, ticks);
+	if (ticks.empty())
+	{
+		return false;
+	}
+
+	ChromeTraceWriter writer = { os, ticks.front().start_,
+		1000000.0 / stamps_per_sec_double(), buf.tid_, true };
+	os << "{\"traceEvents\":[";
+	for (size_t i = 0; i < ticks.size(); ++i)
+	{
+		char name[32];
+		geco_snprintf(name, sizeof(name), "tick %llu",
+			(unsigned long long)ticks[i].number_);
+		writer.write(name, ticks[i].start_, ticks[i].end_);
+		replayTick(buf, ticks[i], writer);
+	}
+	os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+	return true;
+}
+
+bool ProfileCapture::exportCollapsedStacks(std::ostream & os, uint32 numTicks)
+{
+	const CaptureBuffer & buf = captureBuffer();
+	eastl::vector<CaptureTick> ticks;
+	capturedTicks(buf, numTicks, ticks);
+	if (ticks.empty())
+	{
+		return false;
+	}
+
+	CollapsedStackWriter writer;
+	uint64 tickTime = 0;
+	writer.topLevelTime_ = 0;
+	for (size_t i = 0; i < ticks.size(); ++i)
+	{
+		tickTime += ticks[i].end_ - ticks[i].start_;
+		replayTick(buf, ticks[i], writer);
+	}
+	// time of the tick not covered by any profile
+	writer.selfTimes_["tick"] += tickTime - writer.topLevelTime_;
+
+	const double usPerStamp = 1000000.0 / stamps_per_sec_double();
+	for (std::map<std::string, uint64>::const_iterator iter =
+		writer.selfTimes_.begin(); iter != writer.selfTimes_.end(); ++iter)
+	{
+		uint64 us = uint64(iter->second * usPerStamp + 0.5);
+		if (us != 0)
+		{
+			os << iter->first << ' ' << us << '\n';
+		}
+	}
+	return true;
+}
+
+bool ProfileCapture::exportToFiles(const char * pathPrefix, uint32 numTicks)
+{
+	std::string prefix = pathPrefix;
+	std::ofstream json((prefix + ".json").c_str());
+	std::ofstream folded((prefix + ".folded").c_str());
+	if (!json || !folded)
+	{
+		ERROR_MSG("ProfileCapture::exportToFiles: cannot write %s.json/.folded\n",
+			pathPrefix);
+		return false;
+	}
+	return exportChromeTrace(json, numTicks) &&
+		exportCollapsedStacks(folded, numTicks);
+}
+// ================= ProfileCapture Definitions Ends ================ 
+
+
 static stat_watcher_factory_t<uint> uint_stat_watcher_factory_;
 static stat_watcher_factory_t<float> float_stat_watcher_factory_; //not used
 stat_watcher_factory_t<uint>& read_uint_stat_watcher_factory()
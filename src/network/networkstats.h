@@ -30,6 +30,8 @@
 #define SRC_NETWORK_NETWORKSTATS_H_
 
 #include <thread>
+#include <atomic>
+#include <iosfwd>
 #include "../common/ds/eastl/EASTL/utility.h"
 #include "../common/ds/eastl/EASTL/vector.h"
 #include "../common/ds/eastl/EASTL/hash_map.h"
@@ -101,6 +103,68 @@ private:
 	static ProfileGroup* s_pDefaultGroup_;
 };
 
+/**
+*	This class captures the start/stop stream of every ProfileVal into a per
+*	thread ring buffer, split into ticks, so that a single slow tick can be
+*	looked at after the fact instead of through averages.
+*
+*	ProfileCapture::enable(true);
+*	ProfileCapture::setTickBudget(0.1, "slow-tick");	// dump ticks over 100ms
+*	while (running)
+*	{
+*		... game tick, SCOPED_PROFILE()s ...
+*		ProfileCapture::tick();
+*	}
+*	ProfileCapture::exportToFiles("capture");	// capture.json + capture.folded
+*
+*	The .json file loads in chrome://tracing or Perfetto, the .folded file is
+*	collapsed stacks for flamegraph.pl, in microseconds of self time.
+*
+*	Recording costs one branch per start/stop while disabled. While enabled
+*	events go to the calling thread's buffer without locks; the buffer is
+*	allocated by the thread's first event, after which only profiles nested
+*	more than 64 deep allocate.
+*	Exports read the calling thread's buffer only, call them from the
+*	thread that calls tick(). ProfileVals must outlive the capture of them.
+*/
+class GECOAPI ProfileCapture
+{
+public:
+	enum EventType
+	{
+		EVENT_START,
+		EVENT_STOP
+	};
+
+	/// Starts or stops recording. The sizes apply to buffers created after
+	/// the call, one per thread on its first event.
+	static void enable(bool on, uint32 maxEvents = 1 << 16, uint32 maxTicks = 64);
+	static bool isEnabled() { return s_enabled_.load(std::memory_order_relaxed); }
+
+	/// Called by ProfileVal::start()/stop() while enabled.
+	static void record(const ProfileVal & val, EventType type, uint64 stamp);
+
+	/// Ends the calling thread's current tick and starts the next one. Ticks
+	/// longer than the budget are exported right away.
+	static void tick();
+	/// @param seconds	0 disables the budget
+	/// @param pathPrefix	files are named <pathPrefix>-<tick>.json/.folded
+	static void setTickBudget(double seconds, const char * pathPrefix = "slow-tick");
+
+	/// Number of complete ticks still held by the calling thread's buffer.
+	static uint32 numCapturedTicks();
+	/// Drops everything the calling thread has captured.
+	static void clear();
+
+	/// Export the last @numTicks complete ticks, 0 for all of them.
+	/// @return false if nothing was captured
+	static bool exportChromeTrace(std::ostream & os, uint32 numTicks = 0);
+	static bool exportCollapsedStacks(std::ostream & os, uint32 numTicks = 0);
+	static bool exportToFiles(const char * pathPrefix, uint32 numTicks = 0);
+
+	static std::atomic<bool> s_enabled_;
+};
+
 /**
 *	This class is used to profile the performance of parts of the code.
 *  as there maybe some other pairs of starts/stops invovled by this start and stop
@@ -141,6 +205,8 @@ public:
 	void start()
 	{
 		time_stamp_t now = gettimestamp();
+		if (ProfileCapture::isEnabled())
+			ProfileCapture::record(*this, ProfileCapture::EVENT_START, now);
 		// 记录第几次处理
 		if (inProgress_++ == 0) lastTime_ = now;
 		// 如果栈中有对象则自己是从上一个ProfileVal函数进入调用的
@@ -165,6 +231,8 @@ public:
 	void stop(uint32 qty = 0)
 	{
 		time_stamp_t now = gettimestamp();
+		if (ProfileCapture::isEnabled())
+			ProfileCapture::record(*this, ProfileCapture::EVENT_STOP, now);
 		// 如果为0则表明自己是调用栈的产生着在此我们可以得到这个函数总共耗费的时间
 		if (--inProgress_ == 0)
 		{
@@ -0,0 +1,384 @@
+#include "packet-filter.h"
+#include "math/geco-math-batch.h"
+
+#include "openssl/evp.h"
+#include "openssl/hmac.h"
+#include "openssl/crypto.h"
+
+#if GECO_BATCH_X86
+#include <nmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if OPENSSL_VERSION_NUMBER >= 0x10001000L
+#define GECO_NET_HAS_AES_128_GCM 1
+#else
+// OpenSSL before 1.0.1 has no AEAD cipher, evp_cipher()
+// finds none and the contexts using these are never created
+#define GECO_NET_HAS_AES_128_GCM 0
+#define EVP_CTRL_GCM_SET_IVLEN 0x9
+#define EVP_CTRL_GCM_GET_TAG 0x10
+#define EVP_CTRL_GCM_SET_TAG 0x11
+#endif
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(OPENSSL_NO_CHACHA) && !defined(OPENSSL_NO_POLY1305)
+#define GECO_NET_HAS_CHACHA20_POLY1305 1
+#else
+#define GECO_NET_HAS_CHACHA20_POLY1305 0
+#endif
+
+const int GecoNetChecksumFilter::CHECKSUM_SIZE;
+const int GecoNetChannelKeys::KEY_SIZE;
+const int GecoNetChannelKeys::SALT_SIZE;
+const int GecoNetAeadFilter::SEQ_SIZE;
+const int GecoNetAeadFilter::TAG_SIZE;
+const int GecoNetAeadFilter::REPLAY_WINDOW;
+
+static const int FLAGS_SIZE = sizeof(GecoNetPacket::Flags);
+
+// -----------------------------------------------------------------------------
+// Section: CRC32C
+// -----------------------------------------------------------------------------
+/// the reflected Castagnoli polynomial
+static const uint32 CRC32C_POLY = 0x82F63B78;
+
+struct crc32c_tables_t
+{
+        uint32 table[8][256];
+        crc32c_tables_t()
+        {
+            for (uint32 i = 0; i < 256; i++)
+            {
+                uint32 crc = i;
+                for (int bit = 0; bit < 8; bit++)
+                    crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+                table[0][i] = crc;
+            }
+            for (uint32 i = 0; i < 256; i++)
+            {
+                for (int slice = 1; slice < 8; slice++)
+                    table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xFF];
+            }
+        }
+};
+static const crc32c_tables_t crc32c_tables;
+
+uint32 GecoCrc32cSoftware(const void * pData, size_t length, uint32 crc)
+{
+    const uchar * p = (const uchar*) pData;
+    const uint32 (*t)[256] = crc32c_tables.table;
+    crc = ~crc;
+    for (; length >= 8; length -= 8, p += 8)
+    {
+        // byte order independent, the table walk is defined on bytes
+        uint32 lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32) p[3] << 24));
+        uint32 hi = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32) p[7] << 24);
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+            t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    }
+    while (length--)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+    return ~crc;
+}
+
+#if GECO_BATCH_X86
+GECO_TARGET_SSE42
+static uint32 Crc32cSSE42(const void * pData, size_t length, uint32 crc)
+{
+    const uchar * p = (const uchar*) pData;
+#if defined(__x86_64__) || defined(_M_X64)
+    uint64 crc64 = ~crc;
+    for (; length >= 8; length -= 8, p += 8)
+    {
+        uint64 word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32) crc64;
+#else
+    crc = ~crc;
+#endif
+    for (; length >= 4; length -= 4, p += 4)
+    {
+        uint32 word;
+        memcpy(&word, p, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+    }
+    while (length--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return ~crc;
+}
+
+static bool DetectSSE42()
+{
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+#elif defined(_MSC_VER)
+    int aiRegs[4];
+    __cpuid(aiRegs, 1);
+    return (aiRegs[2] & (1 << 20)) != 0;
+#else
+    return false;
+#endif
+}
+static const bool crc32c_sse42 = DetectSSE42();
+#endif
+
+bool GecoCrc32cHardware()
+{
+#if GECO_BATCH_X86
+    return crc32c_sse42;
+#else
+    return false;
+#endif
+}
+
+uint32 GecoCrc32c(const void * pData, size_t length, uint32 crc)
+{
+#if GECO_BATCH_X86
+    if (crc32c_sse42)
+        return Crc32cSSE42(pData, length, crc);
+#endif
+    return GecoCrc32cSoftware(pData, length, crc);
+}
+
+static INLINE GecoNetPacket::Flags get_flags(const GecoNetPacket * pPacket)
+{
+    GecoNetPacket::Flags flags;
+    memcpy(&flags, pPacket->m_acData, FLAGS_SIZE);
+    return GECO_HTONS(flags);
+}
+static INLINE void set_flags(GecoNetPacket * pPacket, GecoNetPacket::Flags flags)
+{
+    flags = GECO_HTONS(flags);
+    memcpy(pPacket->m_acData, &flags, FLAGS_SIZE);
+}
+
+// -----------------------------------------------------------------------------
+// Section: GecoNetChecksumFilter
+// -----------------------------------------------------------------------------
+bool GecoNetChecksumFilter::send(GecoNetPacket * pPacket)
+{
+    if (pPacket->m_iMsgEndOffset < FLAGS_SIZE || pPacket->m_iMsgEndOffset + CHECKSUM_SIZE > PACKET_MAX_SIZE)
+        return false;
+    set_flags(pPacket, get_flags(pPacket) | GecoNetPacket::FLAG_HAS_CHECKSUM);
+    uint32 crc = GECO_HTONL(GecoCrc32c(pPacket->m_acData, pPacket->m_iMsgEndOffset));
+    memcpy(pPacket->Back(), &crc, CHECKSUM_SIZE);
+    pPacket->m_iMsgEndOffset += CHECKSUM_SIZE;
+    return true;
+}
+
+bool GecoNetChecksumFilter::recv(GecoNetPacket * pPacket)
+{
+    if (pPacket->m_iMsgEndOffset < FLAGS_SIZE + CHECKSUM_SIZE ||
+        !(get_flags(pPacket) & GecoNetPacket::FLAG_HAS_CHECKSUM))
+        return false;
+    pPacket->m_iMsgEndOffset -= CHECKSUM_SIZE;
+    uint32 crc;
+    memcpy(&crc, pPacket->Back(), CHECKSUM_SIZE);
+    return GECO_HTONL(crc) == GecoCrc32c(pPacket->m_acData, pPacket->m_iMsgEndOffset);
+}
+
+// -----------------------------------------------------------------------------
+// Section: GecoNetChannelKeys
+// -----------------------------------------------------------------------------
+/// HMAC-SHA256(secret, label | channel id | role | purpose), @outLength <= 32
+static void derive_key(uchar * pOut, int outLength, const uchar * pSecret, int secretLength,
+    GecoNetChannelID channelID, char role, char purpose)
+{
+    uchar info[32];
+    static const char LABEL[] = "geco channel key";
+    int len = sizeof(LABEL) - 1;
+    memcpy(info, LABEL, len);
+    uint32 id = htonl((uint32) channelID);
+    memcpy(info + len, &id, sizeof(id));
+    len += sizeof(id);
+    info[len++] = role;
+    info[len++] = purpose;
+
+    uchar digest[EVP_MAX_MD_SIZE];
+    uint digestLength = 0;
+    HMAC(EVP_sha256(), pSecret, secretLength, info, len, digest, &digestLength);
+    memcpy(pOut, digest, outLength);
+    OPENSSL_cleanse(digest, sizeof(digest));
+}
+
+GecoNetChannelKeys::GecoNetChannelKeys(const uchar * pSecret, int secretLength, GecoNetChannelID channelID,
+    bool isServer)
+{
+    // keys are named after the side that sends with them
+    char self = isServer ? 's' : 'c';
+    char peer = isServer ? 'c' : 's';
+    derive_key(sendKey_, KEY_SIZE, pSecret, secretLength, channelID, self, 'k');
+    derive_key(sendSalt_, SALT_SIZE, pSecret, secretLength, channelID, self, 'n');
+    derive_key(recvKey_, KEY_SIZE, pSecret, secretLength, channelID, peer, 'k');
+    derive_key(recvSalt_, SALT_SIZE, pSecret, secretLength, channelID, peer, 'n');
+}
+
+GecoNetChannelKeys::~GecoNetChannelKeys()
+{
+    OPENSSL_cleanse(sendKey_, sizeof(sendKey_));
+    OPENSSL_cleanse(recvKey_, sizeof(recvKey_));
+}
+
+// -----------------------------------------------------------------------------
+// Section: GecoNetAeadFilter
+// -----------------------------------------------------------------------------
+static const EVP_CIPHER * evp_cipher(GecoNetCipher cipher)
+{
+    switch (cipher)
+    {
+#if GECO_NET_HAS_AES_128_GCM
+        case GECO_NET_CIPHER_AES_128_GCM:
+            return EVP_aes_128_gcm();
+#endif
+#if GECO_NET_HAS_CHACHA20_POLY1305
+        case GECO_NET_CIPHER_CHACHA20_POLY1305:
+            return EVP_chacha20_poly1305();
+#endif
+        default:
+            return NULL;
+    }
+}
+
+/// the salt then the big endian sequence number
+static INLINE void make_nonce(uchar * pNonce, const uchar * pSalt, uint64 seq)
+{
+    memcpy(pNonce, pSalt, GecoNetChannelKeys::SALT_SIZE);
+    for (int i = 0; i < GecoNetAeadFilter::SEQ_SIZE; i++)
+        pNonce[GecoNetChannelKeys::SALT_SIZE + i] = uchar(seq >> (56 - 8 * i));
+}
+
+/// a context keyed once, each packet only sets its nonce
+static EVP_CIPHER_CTX * new_context(const EVP_CIPHER * pCipher, const uchar * pKey, bool encrypt)
+{
+    EVP_CIPHER_CTX * pCtx = EVP_CIPHER_CTX_new();
+    if (pCtx == NULL)
+        return NULL;
+    if (EVP_CipherInit_ex(pCtx, pCipher, NULL, NULL, NULL, encrypt) != 1 ||
+        EVP_CIPHER_CTX_ctrl(pCtx, EVP_CTRL_GCM_SET_IVLEN,
+            GecoNetChannelKeys::SALT_SIZE + GecoNetAeadFilter::SEQ_SIZE, NULL) != 1 ||
+        EVP_CipherInit_ex(pCtx, NULL, NULL, pKey, NULL, encrypt) != 1)
+    {
+        EVP_CIPHER_CTX_free(pCtx);
+        return NULL;
+    }
+    return pCtx;
+}
+
+bool GecoNetAeadFilter::isSupported(GecoNetCipher cipher)
+{
+    return evp_cipher(cipher) != NULL;
+}
+
+GecoNetAeadFilter::GecoNetAeadFilter(GecoNetCipher cipher, const GecoNetChannelKeys & keys) :
+        pSendCtx_(NULL),
+        pRecvCtx_(NULL),
+        sendSeq_(0),
+        recvHighest_(0),
+        recvWindow_(0),
+        numForged_(0),
+        numReplayed_(0)
+{
+    memcpy(sendSalt_, keys.sendSalt_, sizeof(sendSalt_));
+    memcpy(recvSalt_, keys.recvSalt_, sizeof(recvSalt_));
+    const EVP_CIPHER * pCipher = evp_cipher(cipher);
+    if (pCipher == NULL)
+    {
+        network_logger()->error("GecoNetAeadFilter::GecoNetAeadFilter(): cipher {} is not supported by {}",
+            (int) cipher, OPENSSL_VERSION_TEXT);
+        return;
+    }
+    pSendCtx_ = new_context(pCipher, keys.sendKey_, true);
+    pRecvCtx_ = new_context(pCipher, keys.recvKey_, false);
+    if (!this->good())
+        network_logger()->error("GecoNetAeadFilter::GecoNetAeadFilter(): cipher {} failed to initialise",
+            (int) cipher);
+}
+
+GecoNetAeadFilter::~GecoNetAeadFilter()
+{
+    if (pSendCtx_)
+        EVP_CIPHER_CTX_free(pSendCtx_);
+    if (pRecvCtx_)
+        EVP_CIPHER_CTX_free(pRecvCtx_);
+}
+
+bool GecoNetAeadFilter::send(GecoNetPacket * pPacket)
+{
+    int length = pPacket->m_iMsgEndOffset;
+    if (!this->good() || length < FLAGS_SIZE || length + this->maxSpareSize() > PACKET_MAX_SIZE)
+        return false;
+
+    // sequence numbers start at 1, 0 is never accepted
+    uint64 seq = ++sendSeq_;
+    uchar nonce[GecoNetChannelKeys::SALT_SIZE + SEQ_SIZE];
+    make_nonce(nonce, sendSalt_, seq);
+
+    uchar * pData = (uchar*) pPacket->m_acData;
+    int outLength = 0;
+    if (EVP_EncryptInit_ex(pSendCtx_, NULL, NULL, NULL, nonce) != 1 ||
+        EVP_EncryptUpdate(pSendCtx_, NULL, &outLength, pData, FLAGS_SIZE) != 1 ||
+        EVP_EncryptUpdate(pSendCtx_, pData + FLAGS_SIZE, &outLength, pData + FLAGS_SIZE,
+            length - FLAGS_SIZE) != 1 ||
+        EVP_EncryptFinal_ex(pSendCtx_, pData + length, &outLength) != 1)
+        return false;
+
+    memcpy(pData + length, nonce + GecoNetChannelKeys::SALT_SIZE, SEQ_SIZE);
+    if (EVP_CIPHER_CTX_ctrl(pSendCtx_, EVP_CTRL_GCM_GET_TAG, TAG_SIZE, pData + length + SEQ_SIZE) != 1)
+        return false;
+    pPacket->m_iMsgEndOffset = length + SEQ_SIZE + TAG_SIZE;
+    return true;
+}
+
+bool GecoNetAeadFilter::recv(GecoNetPacket * pPacket)
+{
+    int length = pPacket->m_iMsgEndOffset - SEQ_SIZE - TAG_SIZE;
+    if (!this->good() || length < FLAGS_SIZE)
+        return false;
+
+    uchar * pData = (uchar*) pPacket->m_acData;
+    uint64 seq = 0;
+    for (int i = 0; i < SEQ_SIZE; i++)
+        seq = (seq << 8) | pData[length + i];
+
+    // cheap checks first, a replay costs no decryption
+    if (seq == 0 || (seq <= recvHighest_ &&
+        (recvHighest_ - seq >= REPLAY_WINDOW || (recvWindow_ >> (recvHighest_ - seq)) & 1)))
+    {
+        numReplayed_++;
+        return false;
+    }
+
+    uchar nonce[GecoNetChannelKeys::SALT_SIZE + SEQ_SIZE];
+    make_nonce(nonce, recvSalt_, seq);
+    int outLength = 0;
+    if (EVP_DecryptInit_ex(pRecvCtx_, NULL, NULL, NULL, nonce) != 1 ||
+        EVP_DecryptUpdate(pRecvCtx_, NULL, &outLength, pData, FLAGS_SIZE) != 1 ||
+        EVP_DecryptUpdate(pRecvCtx_, pData + FLAGS_SIZE, &outLength, pData + FLAGS_SIZE,
+            length - FLAGS_SIZE) != 1 ||
+        EVP_CIPHER_CTX_ctrl(pRecvCtx_, EVP_CTRL_GCM_SET_TAG, TAG_SIZE, pData + length + SEQ_SIZE) != 1 ||
+        EVP_DecryptFinal_ex(pRecvCtx_, pData + length, &outLength) != 1)
+    {
+        numForged_++;
+        return false;
+    }
+
+    // only authentic packets move the window
+    if (seq > recvHighest_)
+    {
+        uint64 shift = seq - recvHighest_;
+        recvWindow_ = shift >= REPLAY_WINDOW ? 0 : recvWindow_ << shift;
+        recvWindow_ |= 1;
+        recvHighest_ = seq;
+    }
+    else
+    {
+        recvWindow_ |= uint64(1) << (recvHighest_ - seq);
+    }
+    pPacket->m_iMsgEndOffset = length;
+    return true;
+}
@@ -0,0 +1,170 @@
+//{future header message}
+#ifndef __GecoNetPacketFilter_H__
+#define __GecoNetPacketFilter_H__
+
+#include "net-types.h"
+
+typedef struct evp_cipher_ctx_st EVP_CIPHER_CTX;
+
+/**
+ *	This function returns the CRC32C (Castagnoli) of @length bytes of @pData,
+ *	continuing @crc. It uses the SSE4.2 crc32 instruction, 8 bytes at a time,
+ *	when the cpu has it and a slicing-by-8 table otherwise.
+ */
+GECOAPI uint32 GecoCrc32c(const void * pData, size_t length, uint32 crc = 0);
+/// the table version, whatever the cpu
+GECOAPI uint32 GecoCrc32cSoftware(const void * pData, size_t length, uint32 crc = 0);
+/// true when GecoCrc32c() uses the crc32 instruction
+GECOAPI bool GecoCrc32cHardware();
+
+/**
+ *	This class transforms packets on their way to and from the wire, after a
+ *	GecoNetBundle is finalised and before the packet is processed. The
+ *	transform is in place in m_acData, m_iMsgEndOffset is the packet length,
+ *	the flags in the first two bytes stay readable.
+ *
+ *	@ingroup network
+ */
+class GECOAPI GecoNetPacketFilter
+{
+    public:
+        virtual ~GecoNetPacketFilter()
+        {
+        }
+        /**
+         *	This method prepares @pPacket for sending, it grows by at most
+         *	maxSpareSize() bytes, which the bundle leaves free through its
+         *	extraFilterSize.
+         *
+         *	@return false when the packet has no room for the filter.
+         */
+        virtual bool send(GecoNetPacket * pPacket) = 0;
+        /**
+         *	This method undoes send().
+         *
+         *	@return false when the packet is corrupted, forged or replayed, it
+         *	must be dropped.
+         */
+        virtual bool recv(GecoNetPacket * pPacket) = 0;
+        virtual int maxSpareSize() const = 0;
+};
+
+/**
+ *	This filter appends the CRC32C of the packet and sets
+ *	GecoNetPacket::FLAG_HAS_CHECKSUM. It replaces the word by word xor
+ *	checksum of the old nub for packets that are not encrypted.
+ *
+ *	@ingroup network
+ */
+class GECOAPI GecoNetChecksumFilter: public GecoNetPacketFilter
+{
+    public:
+        static const int CHECKSUM_SIZE = sizeof(uint32);
+
+        virtual bool send(GecoNetPacket * pPacket);
+        virtual bool recv(GecoNetPacket * pPacket);
+        virtual int maxSpareSize() const
+        {
+            return CHECKSUM_SIZE;
+        }
+};
+
+enum GecoNetCipher
+{
+    GECO_NET_CIPHER_AES_128_GCM = 0,
+    GECO_NET_CIPHER_CHACHA20_POLY1305 = 1
+};
+
+/**
+ *	This class is the key schedule of one channel. Both ends derive it from
+ *	the secret agreed at login and the channel id with HMAC-SHA256, a key
+ *	and a nonce salt per direction, so no two channels or directions ever
+ *	share a key and nonce. The client's send keys are the server's receive
+ *	keys.
+ *
+ *	@ingroup network
+ */
+class GECOAPI GecoNetChannelKeys
+{
+    public:
+        /// enough for either cipher, AES-128 uses the first 16 bytes
+        static const int KEY_SIZE = 32;
+        static const int SALT_SIZE = 4;
+
+        GecoNetChannelKeys(const uchar * pSecret, int secretLength, GecoNetChannelID channelID, bool isServer);
+        ~GecoNetChannelKeys();
+
+        uchar sendKey_[KEY_SIZE];
+        uchar sendSalt_[SALT_SIZE];
+        uchar recvKey_[KEY_SIZE];
+        uchar recvSalt_[SALT_SIZE];
+};
+
+/**
+ *	This filter encrypts and authenticates packets with an AEAD cipher of
+ *	OpenSSL's EVP interface, AES-128-GCM, which runs on AES-NI, or
+ *	ChaCha20-Poly1305 for cpus without it. It replaces the Blowfish ECB filter
+ *	that encrypted one 8 byte block per call and authenticated nothing.
+ *
+ *	The flags are authenticated but left in the clear. The packet gets an 8
+ *	byte sequence number, which with the direction's salt makes the nonce,
+ *	and a 16 byte tag. Packets older than the last REPLAY_WINDOW received or
+ *	seen before are dropped.
+ *
+ *	The cipher contexts are keyed once, a packet only sets its nonce.
+ *
+ *	@ingroup network
+ */
+class GECOAPI GecoNetAeadFilter: public GecoNetPacketFilter
+{
+    public:
+        static const int SEQ_SIZE = sizeof(uint64);
+        static const int TAG_SIZE = 16;
+        static const int REPLAY_WINDOW = 64;
+
+        /// AES-128-GCM needs OpenSSL 1.0.1, ChaCha20-Poly1305 1.1.0
+        static bool isSupported(GecoNetCipher cipher);
+
+        GecoNetAeadFilter(GecoNetCipher cipher, const GecoNetChannelKeys & keys);
+        virtual ~GecoNetAeadFilter();
+
+        /// false when the cipher is not supported or OpenSSL failed
+        bool good() const
+        {
+            return pSendCtx_ != NULL && pRecvCtx_ != NULL;
+        }
+
+        virtual bool send(GecoNetPacket * pPacket);
+        virtual bool recv(GecoNetPacket * pPacket);
+        virtual int maxSpareSize() const
+        {
+            return SEQ_SIZE + TAG_SIZE;
+        }
+
+        uint numForged() const
+        {
+            return numForged_;
+        }
+        uint numReplayed() const
+        {
+            return numReplayed_;
+        }
+
+    private:
+        GecoNetAeadFilter(const GecoNetAeadFilter &);
+        GecoNetAeadFilter & operator=(const GecoNetAeadFilter &);
+
+        EVP_CIPHER_CTX * pSendCtx_;
+        EVP_CIPHER_CTX * pRecvCtx_;
+        uchar sendSalt_[GecoNetChannelKeys::SALT_SIZE];
+        uchar recvSalt_[GecoNetChannelKeys::SALT_SIZE];
+        uint64 sendSeq_;
+        /// the highest sequence number received, bit i of the window is
+        /// recvHighest_ - i
+        uint64 recvHighest_;
+        uint64 recvWindow_;
+        uint numForged_;
+        uint numReplayed_;
+};
+
+#endif // __GecoNetPacketFilter_H__
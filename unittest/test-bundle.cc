@@ -0,0 +1,273 @@
+/*
+ * test-bundle.cc
+ *
+ *  GecoNetBundle message coalescing and the per tick packet arena
+ */
+
+#include <string.h>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "network/bundle.h"
+#include "common/debugging/timestamp.h"
+
+static GecoNetInterfaceElement fixed_ie("fixed", 1, FIXED_LENGTH_MESSAGE, sizeof(int64));
+static GecoNetInterfaceElement variable_ie("variable", 2, VARIABLE_LENGTH_MESSAGE, 2);
+static GecoNetInterfaceElement request_ie("request", 3, VARIABLE_LENGTH_MESSAGE, 1);
+static GecoNetInterfaceElement short_ie("short", 4, VARIABLE_LENGTH_MESSAGE, 1);
+
+/// appends message @i: every 7th a request, else fixed and variable in turn
+static void add_test_message(GecoNetBundle & bundle, int i)
+{
+    if (i % 7 == 0)
+    {
+        bundle.startRequest(request_ie, i);
+        bundle << int32(i);
+    }
+    else if (i % 2)
+    {
+        bundle.startMessage(fixed_ie);
+        bundle << int64(i);
+    }
+    else
+    {
+        bundle.startMessage(variable_ie);
+        char * pBody = (char*) bundle.reserve(i % 50);
+        memset(pBody, i & 0xFF, i % 50);
+    }
+}
+
+TEST(network, test_bundle_coalesces_and_chains_requests)
+{
+    const int COUNT = 2000;
+    GecoNetPacketPool pool;
+    GecoNetBundle bundle(pool);
+    int bytes = 0;
+    for (int i = 0; i < COUNT; i++)
+    {
+        add_test_message(bundle, i);
+        bytes += i % 7 == 0 ? 2 + GecoNetBundle::REQUEST_HEADER_SIZE + 4 + 2 : i % 2 ? 1 + 8 : 3 + i % 50;
+    }
+    bundle.finalise();
+    ASSERT_EQ(COUNT, bundle.numMessages());
+    // as few datagrams as the bytes need, and one request footer each
+    int perPacket = PACKET_MAX_SIZE - sizeof(GecoNetPacket::Flags) - sizeof(GecoNetPacket::Offset);
+    ASSERT_LE(bundle.numPackets(), bytes / perPacket + 2);
+
+    // every packet's request chain, from its footer
+    int requests = 0;
+    std::vector<char> stream;
+    for (GecoNetPacket * pPacket = bundle.pFirstPacket(); pPacket; pPacket = pPacket->Next())
+    {
+        ASSERT_LE(pPacket->m_iMsgEndOffset, PACKET_MAX_SIZE);
+        ushort flags = GECO_HTONS(*(ushort*) pPacket->m_acData);
+        int end = pPacket->m_iMsgEndOffset;
+        ushort offset = 0;
+        if (flags & GecoNetPacket::FLAG_HAS_REQUESTS)
+        {
+            end -= sizeof(GecoNetPacket::Offset);
+            offset = GECO_HTONS(*(ushort*) (pPacket->m_acData + end));
+            ASSERT_NE(0, offset);
+        }
+        while (offset)
+        {
+            ASSERT_LT(offset, end);
+            const char * pHeader = pPacket->m_acData + offset;
+            ASSERT_EQ(request_ie.GetID(), (GecoNetMessageID ) pHeader[0]);
+            ASSERT_EQ(4, (uchar )pHeader[1]);
+            ASSERT_EQ(requests * 7, (int )GECO_HTONL(*(uint32*) (pHeader + 2)));
+            offset = GECO_HTONS(*(ushort*) (pHeader + 6));
+            requests++;
+        }
+        stream.insert(stream.end(), (const char*) pPacket->Body(), (const char*) pPacket->m_acData + end);
+    }
+    ASSERT_EQ((COUNT + 6) / 7, requests);
+
+    // bodies continue across packets, the messages read back as one stream
+    const char * pCurr = &stream[0];
+    for (int i = 0; i < COUNT; i++)
+    {
+        GecoNetMessageID id = *pCurr++;
+        if (i % 7 == 0)
+        {
+            ASSERT_EQ(request_ie.GetID(), id);
+            pCurr += 1 + GecoNetBundle::REQUEST_HEADER_SIZE;
+            ASSERT_EQ(i, *(int32*) pCurr);
+            pCurr += 4;
+        }
+        else if (i % 2)
+        {
+            ASSERT_EQ(fixed_ie.GetID(), id);
+            ASSERT_EQ(i, *(int64*) pCurr);
+            pCurr += 8;
+        }
+        else
+        {
+            ASSERT_EQ(variable_ie.GetID(), id);
+            ASSERT_EQ(i % 50, GECO_HTONS(*(ushort*) pCurr));
+            pCurr += 2;
+            for (int b = 0; b < i % 50; b++)
+                ASSERT_EQ((char )(i & 0xFF), *pCurr++);
+        }
+    }
+    ASSERT_EQ(&stream[0] + stream.size(), pCurr);
+
+    // a body larger than a packet is spread over several
+    bundle.clear();
+    ASSERT_EQ(1, bundle.numPackets());
+    std::vector<char> blob(PACKET_MAX_SIZE * 3, 'b');
+    bundle.startMessage(variable_ie);
+    bundle.addBlob(&blob[0], blob.size());
+    bundle.finalise();
+    ASSERT_EQ(4, bundle.numPackets());
+    ASSERT_EQ((int )blob.size() + 3 + 4 * 2, bundle.size());
+}
+
+TEST(network, test_bundle_drops_what_its_length_cannot_hold)
+{
+    GecoNetPacketPool pool;
+    GecoNetBundle bundle(pool);
+    std::vector<char> blob(PACKET_MAX_SIZE * 2, 'b');
+    bundle.startMessage(fixed_ie);
+    bundle << int64(1);
+    // a one byte length would send 300 as 44
+    bundle.startMessage(short_ie);
+    bundle.addBlob(&blob[0], 300);
+    bundle.startRequest(request_ie, 7);
+    bundle.addBlob(&blob[0], 300);
+    // with the packets the body went on to
+    bundle.startMessage(short_ie);
+    bundle.addBlob(&blob[0], blob.size());
+    bundle.startMessage(fixed_ie);
+    bundle << int64(2);
+    bundle.finalise();
+
+    ASSERT_EQ(2, bundle.numMessages());
+    ASSERT_EQ(1, bundle.numPackets());
+    ASSERT_EQ(pool.numAllocated() - 1, pool.numFree());
+    const GecoNetPacket * pPacket = bundle.pFirstPacket();
+    ASSERT_EQ(0, GECO_HTONS(*(ushort*) pPacket->m_acData));
+    ASSERT_EQ(int(sizeof(GecoNetPacket::Flags)) + 2 * 9, pPacket->m_iMsgEndOffset);
+    const char * pBody = pPacket->Body();
+    ASSERT_EQ(fixed_ie.GetID(), (GecoNetMessageID ) pBody[0]);
+    ASSERT_EQ(1, *(int64*) (pBody + 1));
+    ASSERT_EQ(fixed_ie.GetID(), (GecoNetMessageID ) pBody[9]);
+    ASSERT_EQ(2, *(int64*) (pBody + 10));
+
+    // a value larger than a packet is streamed like a blob
+    struct big_t
+    {
+        char bytes[PACKET_MAX_SIZE * 2];
+    };
+    static big_t big;
+    memset(big.bytes, 'g', sizeof(big.bytes));
+    bundle.clear();
+    bundle.startMessage(variable_ie);
+    bundle << big;
+    bundle.finalise();
+    ASSERT_EQ(1, bundle.numMessages());
+    ASSERT_EQ(3, bundle.numPackets());
+    ASSERT_EQ((int )sizeof(big) + 3 + 3 * 2, bundle.size());
+}
+
+TEST(network, test_bundle_arena_recycles_packets)
+{
+    const int DESTINATIONS = 3;
+    const int COUNT = 3000;
+    GecoNetEndpoint sender;
+    sender.Socket(AF_INET, SOCK_DGRAM);
+    GecoNetEndpoint receivers[DESTINATIONS];
+    GecoNetAddress addrs[DESTINATIONS];
+    for (int d = 0; d < DESTINATIONS; d++)
+    {
+        GecoNetAddress bindAddr(0, "127.0.0.1");
+        receivers[d].Socket(AF_INET, SOCK_DGRAM);
+        ASSERT_EQ(0, receivers[d].Bind(bindAddr));
+        ASSERT_EQ(0, receivers[d].GetLocalAddress(&addrs[d]));
+    }
+
+    GecoNetPacketPool pool;
+    GecoNetBundleArena arena(pool);
+    static GecoNetPacket received[64];
+    GecoNetPacket * in[64];
+    GecoNetAddress from[64];
+    for (int i = 0; i < 64; i++)
+        in[i] = &received[i];
+
+    int allocated = 0;
+    for (int tick = 0; tick < 3; tick++)
+    {
+        int bytes[DESTINATIONS] = { 0 };
+        for (int i = 0; i < COUNT; i++)
+            add_test_message(arena.bundle(addrs[i % DESTINATIONS]), i);
+        ASSERT_EQ(DESTINATIONS, arena.numBundles());
+        int packets = 0;
+        for (int d = 0; d < DESTINATIONS; d++)
+        {
+            GecoNetBundle & bundle = arena.bundle(addrs[d]);
+            ASSERT_EQ(COUNT / DESTINATIONS, bundle.numMessages());
+            bundle.finalise();
+            packets += bundle.numPackets();
+            bytes[d] = bundle.size();
+        }
+        // the second tick reuses the first tick's packets
+        if (tick == 0)
+            allocated = pool.numAllocated();
+        ASSERT_EQ(allocated, pool.numAllocated());
+
+        ASSERT_EQ(packets, arena.send(sender));
+        ASSERT_EQ(0, arena.numBundles());
+        // all back in the pool but the empty packet each bundle appends to
+        ASSERT_EQ(pool.numAllocated() - DESTINATIONS, pool.numFree());
+
+        for (int d = 0; d < DESTINATIONS; d++)
+        {
+            int got = 0;
+            while (got < bytes[d])
+            {
+                int n = receivers[d].RecvMany(in, from, 64);
+                ASSERT_GT(n, 0);
+                for (int i = 0; i < n; i++)
+                    got += in[i]->m_iMsgEndOffset;
+            }
+            ASSERT_EQ(bytes[d], got);
+        }
+    }
+}
+
+TEST(network, test_bundle_benchmark)
+{
+    const int COUNT = 1000000;
+    GecoNetPacketPool pool;
+    GecoNetBundle bundle(pool);
+    for (int i = 0; i < COUNT; i++)
+    {
+        bundle.startMessage(fixed_ie);
+        bundle << int64(i);
+    }
+    bundle.clear();
+
+    // the pool is warm, what is left is the per message cost
+    uint64 start = gettimestamp();
+    for (int i = 0; i < COUNT; i++)
+    {
+        bundle.startMessage(fixed_ie);
+        bundle << int64(i);
+    }
+    bundle.finalise();
+    double fixedNs = stamps2sec(gettimestamp() - start) * 1e9 / COUNT;
+    int packets = bundle.numPackets();
+    bundle.clear();
+
+    start = gettimestamp();
+    for (int i = 0; i < COUNT; i++)
+    {
+        bundle.startMessage(variable_ie);
+        memset(bundle.reserve(16), 0, 16);
+    }
+    bundle.finalise();
+    double variableNs = stamps2sec(gettimestamp() - start) * 1e9 / COUNT;
+    printf("bundle: fixed 8 byte message %.1f ns, variable 16 byte message %.1f ns, %.1f messages a datagram\n",
+        fixedNs, variableNs, double(COUNT) / packets);
+    ASSERT_EQ((COUNT + 162) / 163, packets);
+}
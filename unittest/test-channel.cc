@@ -0,0 +1,247 @@
+/*
+ * test-channel.cc
+ *
+ *  GecoNetChannel over a lossy loopback link driven by a virtual clock
+ */
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "network/channel.h"
+#include "common/debugging/timestamp.h"
+
+/// a one way link that drops, delays and reorders packets
+struct lossy_link_t: public GecoNetChannelTransport
+{
+    struct in_flight_t
+    {
+        uint64 arrival;
+        GecoNetPacket packet;
+    };
+
+    lossy_link_t(const uint64 & now, int lossPercent, uint64 delay, uint64 jitter) :
+            now(now), lossPercent(lossPercent), delay(delay), jitter(jitter), pPeer(NULL), sent(0), dropped(0)
+    {
+    }
+    virtual void sendPacket(GecoNetPacket * pPacket)
+    {
+        sent++;
+        if ((int) (GecoRand() % 100) < lossPercent)
+        {
+            dropped++;
+            return;
+        }
+        in_flight_t * pFlight = new in_flight_t;
+        pFlight->arrival = now + delay + (jitter ? GecoRand() % jitter : 0);
+        memcpy(pFlight->packet.m_acData, pPacket->m_acData, pPacket->m_iMsgEndOffset);
+        pFlight->packet.m_iMsgEndOffset = pPacket->m_iMsgEndOffset;
+        flights.push_back(pFlight);
+    }
+    /// hands the packets due by @now to the peer channel
+    void deliver()
+    {
+        for (size_t i = 0; i < flights.size();)
+        {
+            if (flights[i]->arrival > now)
+            {
+                i++;
+                continue;
+            }
+            in_flight_t * pFlight = flights[i];
+            flights.erase(flights.begin() + i);
+            EXPECT_EQ(GECO_NET_REASON_SUCCESS, pPeer->receive(pFlight->packet, now));
+            delete pFlight;
+        }
+    }
+    ~lossy_link_t()
+    {
+        for (size_t i = 0; i < flights.size(); i++)
+            delete flights[i];
+    }
+
+    const uint64 & now;
+    int lossPercent;
+    uint64 delay;
+    uint64 jitter;
+    GecoNetChannel * pPeer;
+    std::vector<in_flight_t*> flights;
+    int sent;
+    int dropped;
+};
+
+/// checks the messages arrive once and in order, and when
+struct ordered_receiver_t: public GecoNetChannelReceiver
+{
+    ordered_receiver_t(const uint64 & now, const std::vector<uint64> & sentAt) :
+            now(now), sentAt(sentAt), next(0)
+    {
+    }
+    virtual void handleMessage(const char * data, int length)
+    {
+        ASSERT_EQ((int) sizeof(int), length);
+        int index;
+        memcpy(&index, data, sizeof(index));
+        ASSERT_EQ(next, index);
+        latencies.push_back(now - sentAt[index]);
+        next++;
+    }
+    const uint64 & now;
+    const std::vector<uint64> & sentAt;
+    int next;
+    std::vector<uint64> latencies;
+};
+
+struct channel_run_t
+{
+    double meanMs;
+    double p99Ms;
+    double maxMs;
+    uint resent;
+    uint fastRetransmits;
+    uint timeouts;
+};
+
+/**
+ *	Sends @count messages from a to b, two per 10ms tick, both ways losing
+ *	@lossPercent of the packets with a 30-40ms one way delay.
+ */
+static channel_run_t run_lossy_loopback(int count, int lossPercent, bool fixedResend)
+{
+    const uint64 ms = stamps_per_sec() / 1000;
+    uint64 now = 0;
+    std::vector<uint64> sentAt(count);
+    lossy_link_t aToB(now, lossPercent, 30 * ms, 10 * ms);
+    lossy_link_t bToA(now, lossPercent, 30 * ms, 10 * ms);
+    ordered_receiver_t atB(now, sentAt);
+    ordered_receiver_t atA(now, sentAt);
+    GecoNetChannel a(&aToB, &atA);
+    GecoNetChannel b(&bToA, &atB);
+    aToB.pPeer = &b;
+    bToA.pPeer = &a;
+    if (fixedResend)
+    {
+        // the old channel: one resend delay, no fast retransmit
+        a.setRtoBounds(1000 * 1000, 1000 * 1000, 1000 * 1000);
+        a.fastRetransmit(false);
+    }
+
+    int queued = 0;
+    for (int tick = 0; atB.next < count && tick < 100000; tick++)
+    {
+        for (int i = 0; i < 2 && queued < count; i++)
+        {
+            if (a.windowFull())
+                break;
+            sentAt[queued] = now;
+            EXPECT_EQ(GECO_NET_REASON_SUCCESS, a.send((const char*) &queued, sizeof(queued), now));
+            queued++;
+        }
+        for (int step = 0; step < 10; step++)
+        {
+            now += ms;
+            aToB.deliver();
+            bToA.deliver();
+        }
+        a.tick(now);
+        b.tick(now);
+    }
+    // the last acks are still on their way
+    for (int tick = 0; a.numUnacked() && tick < 1000; tick++)
+    {
+        now += 10 * ms;
+        aToB.deliver();
+        bToA.deliver();
+        a.tick(now);
+        b.tick(now);
+    }
+
+    channel_run_t run;
+    std::vector<uint64> & latencies = atB.latencies;
+    EXPECT_EQ(count, (int )latencies.size());
+    std::sort(latencies.begin(), latencies.end());
+    double total = 0;
+    for (size_t i = 0; i < latencies.size(); i++)
+        total += latencies[i];
+    run.meanMs = total / latencies.size() / ms;
+    run.p99Ms = double(latencies[latencies.size() * 99 / 100]) / ms;
+    run.maxMs = double(latencies.back()) / ms;
+    run.resent = a.numPacketsResent();
+    run.fastRetransmits = a.numFastRetransmits();
+    run.timeouts = a.numTimeouts();
+    EXPECT_EQ(0, a.numUnacked());
+    return run;
+}
+
+TEST(network, test_channel_sack_and_fast_retransmit)
+{
+    const uint64 ms = stamps_per_sec() / 1000;
+    uint64 now = 0;
+    std::vector<uint64> sentAt(8);
+    lossy_link_t aToB(now, 0, 0, 0);
+    lossy_link_t bToA(now, 0, 0, 0);
+    ordered_receiver_t atB(now, sentAt);
+    ordered_receiver_t atA(now, sentAt);
+    GecoNetChannel a(&aToB, &atA);
+    GecoNetChannel b(&bToA, &atB);
+    aToB.pPeer = &b;
+    bToA.pPeer = &a;
+
+    // a first round trip for the estimate
+    int index = 0;
+    ASSERT_EQ(GECO_NET_REASON_SUCCESS, a.send((const char*) &index, sizeof(index), now));
+    now += 20 * ms;
+    aToB.deliver();
+    b.tick(now);
+    now += 20 * ms;
+    bToA.deliver();
+    ASSERT_EQ(0, a.numUnacked());
+    ASSERT_NEAR(40000.0, a.srttMicros(), 1000.0);
+    ASSERT_GE(a.rtoMicros(), a.srttMicros());
+
+    // message 1 is lost, 2..5 arrive out of order and are selectively acked
+    for (index = 1; index < 6; index++)
+    {
+        aToB.lossPercent = index == 1 ? 100 : 0;
+        ASSERT_EQ(GECO_NET_REASON_SUCCESS, a.send((const char*) &index, sizeof(index), now));
+    }
+    now += ms;
+    aToB.deliver();
+    ASSERT_EQ(1, atB.next);
+    bToA.deliver();
+    // the holes were resent on the third duplicate ack, well inside the timeout
+    ASSERT_EQ(1u, a.numFastRetransmits());
+    ASSERT_EQ(0u, a.numTimeouts());
+    ASSERT_EQ(5, a.numUnacked());
+    aToB.deliver();
+    ASSERT_EQ(6, atB.next);
+    bToA.deliver();
+    ASSERT_EQ(0, a.numUnacked());
+
+    // a full window is refused
+    for (index = 0; index < GecoNetChannel::WINDOW_SIZE; index++)
+        ASSERT_EQ(GECO_NET_REASON_SUCCESS, a.send("x", 1, now));
+    ASSERT_TRUE(a.windowFull());
+    ASSERT_EQ(GECO_NET_REASON_WINDOW_OVERFLOW, a.send("x", 1, now));
+}
+
+TEST(network, test_channel_lossy_loopback)
+{
+    const int COUNT = 3000;
+    for (int loss = 2; loss <= 5; loss += 3)
+    {
+        GecoSrand(4321);
+        channel_run_t fixed = run_lossy_loopback(COUNT, loss, true);
+        GecoSrand(4321);
+        channel_run_t adaptive = run_lossy_loopback(COUNT, loss, false);
+        printf("%d%% loss, ordered delivery latency mean/p99/max ms: fixed 1s resend %.1f/%.1f/%.1f, "
+            "rtt driven %.1f/%.1f/%.1f (%u resent, %u fast, %u timeouts)\n", loss, fixed.meanMs, fixed.p99Ms,
+            fixed.maxMs, adaptive.meanMs, adaptive.p99Ms, adaptive.maxMs, adaptive.resent,
+            adaptive.fastRetransmits, adaptive.timeouts);
+        EXPECT_LT(adaptive.meanMs, fixed.meanMs);
+        EXPECT_LT(adaptive.p99Ms * 2, fixed.p99Ms);
+        EXPECT_LT(adaptive.maxMs, 1000.0);
+        EXPECT_GT(adaptive.fastRetransmits, 0u);
+    }
+}
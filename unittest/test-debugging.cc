@@ -3,13 +3,21 @@
 #include <string.h>
 #include <assert.h>
 #include <limits.h>
+#include <signal.h>
 #include <functional>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
 
 #include "gtest/gtest.h"
 #include "common/geco-plateform.h"
 #include "common/ultils/ultils.h"
 #include "common/debugging/debug.h"
 #include "common/debugging/stack_tracker_t.h"
+#include "common/debugging/timestamp.h"
 #include "common/ds/eastl/EASTL/fixed_vector.h"
 
 using namespace geco::debugging;
@@ -65,8 +73,10 @@ TEST(GECO_DEBUGGING_MSGLOG, test_msg_cb)
 {
     debug_msg_cb_t dcb = std::bind(debugcallback, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3,
             std::placeholders::_4);
-    log_msg_filter_t::get_instance().add_debug_cb(&dcb);
+    uint idx = log_msg_filter_t::get_instance().add_debug_cb(&dcb);
     VERBOSE_MSG("VERBOSE_MSG\n");
+    // dcb goes out of scope
+    log_msg_filter_t::get_instance().remove_debug_cb(idx);
     ASSERT_EQ(debug_cb_is_called, true);
 }
 
@@ -138,3 +148,185 @@ TEST(GECO_DEBUGGING_MSGLOG, geco_asset_dev_if_not_does_block_codes_will_not_run_
     EXPECT_FALSE(runblockcodes);
 }
 
+static std::mutex async_lines_mutex;
+static std::vector<std::string> async_lines;
+static std::vector<std::string> async_formats;
+static bool asynccallback(int component_priority, int msg_priority, const char * format, va_list args_list)
+{
+    char buf[512];
+    vsnprintf(buf, sizeof(buf), format, args_list);
+    std::lock_guard<std::mutex> lock(async_lines_mutex);
+    async_lines.push_back(buf);
+    async_formats.push_back(format);
+    // swallow it, keeps the console quiet
+    return true;
+}
+TEST(GECO_DEBUGGING_MSGLOG, test_async_log)
+{
+    debug_msg_cb_t dcb = std::bind(asynccallback, std::placeholders::_1, std::placeholders::_2,
+            std::placeholders::_3, std::placeholders::_4);
+    uint idx = log_msg_filter_t::get_instance().add_debug_cb(&dcb);
+    ASSERT_TRUE(async_log_t::start(64 * 1024, async_log_t::OVERFLOW_BLOCK));
+    EXPECT_TRUE(async_log_t::install_crash_flush());
+
+    // every argument kind, strings are copied into the record
+    char expected[512];
+    std::string temp("temporary");
+    // with a precision only that many bytes are read
+    const char unterminated[4] = { 'w', 'x', 'y', 'z' };
+    snprintf(expected, sizeof(expected), "async %d %u %lld %5.2f %s %c %p %%|%-4s|%.*s|%.2s|%hhd|%zu\n",
+            -7, 7u, 1LL << 40, 3.14159, temp.c_str(), 'x', (void*)0x10, "ab", 3, "abcdef", unterminated,
+            300, (size_t)42);
+    WARNING_MSG("async %d %u %lld %5.2f %s %c %p %%|%-4s|%.*s|%.2s|%hhd|%zu\n",
+            -7, 7u, 1LL << 40, 3.14159, temp.c_str(), 'x', (void*)0x10, "ab", 3, "abcdef", unterminated,
+            300, (size_t)42);
+    temp.assign("overwritten");
+    // so is the format, it need not outlive the call
+    char format[32];
+    strcpy(format, "format %d\n");
+    INFO_MSG(format, 1);
+    strcpy(format, "clobbered %d\n");
+    async_log_t::flush();
+    {
+        std::lock_guard<std::mutex> lock(async_lines_mutex);
+        ASSERT_EQ(async_lines.size(), 2u);
+        EXPECT_STREQ(async_lines[0].c_str(), expected);
+        EXPECT_STREQ(async_lines[1].c_str(), "format 1\n");
+        async_lines.clear();
+        // callbacks get the text the log thread formatted
+        ASSERT_EQ(async_formats.size(), 2u);
+        EXPECT_STREQ(async_formats[1].c_str(), "%s");
+        async_formats.clear();
+    }
+
+    // blocking loses nothing
+    const uint COUNT = 20000;
+    for (uint i = 0; i < COUNT; i++)
+        INFO_MSG("block %u\n", i);
+    async_log_t::flush();
+    EXPECT_EQ(async_log_t::dropped(), 0u);
+    EXPECT_EQ(async_log_t::written(), COUNT + 2);
+    {
+        std::lock_guard<std::mutex> lock(async_lines_mutex);
+        ASSERT_EQ(async_lines.size(), COUNT);
+        EXPECT_STREQ(async_lines[COUNT - 1].c_str(), "block 19999\n");
+        async_lines.clear();
+    }
+
+    // a burst into a small ring drops, every message is either written or counted
+    async_log_t::stop();
+    ASSERT_TRUE(async_log_t::start(4096, async_log_t::OVERFLOW_DROP));
+    std::thread burst([COUNT]()
+    {
+        for (uint i = 0; i < COUNT; i++)
+            INFO_MSG("drop %u %s\n", i, "payload");
+    });
+    burst.join();
+    async_log_t::flush();
+    uint64 dropped = async_log_t::dropped();
+    EXPECT_GT(dropped, 0u);
+    EXPECT_EQ(async_log_t::written() + dropped, COUNT);
+    async_log_t::stop();
+    {
+        std::lock_guard<std::mutex> lock(async_lines_mutex);
+        uint written = 0, notices = 0;
+        for (size_t i = 0; i < async_lines.size(); i++)
+        {
+            if (async_lines[i].compare(0, 5, "drop ") == 0)
+                written++;
+            else if (async_lines[i].find("dropped") != std::string::npos)
+                notices++;
+        }
+        EXPECT_EQ(written, COUNT - dropped);
+        EXPECT_GT(notices, 0u);
+        async_lines.clear();
+    }
+
+    // stop() while other threads log, what they pushed is still written
+    ASSERT_TRUE(async_log_t::start(64 * 1024, async_log_t::OVERFLOW_BLOCK));
+    std::vector<std::thread> loggers;
+    for (int t = 0; t < 4; t++)
+    {
+        loggers.push_back(std::thread([]()
+        {
+            for (uint i = 0; i < 2000; i++)
+                INFO_MSG("stop %u\n", i);
+        }));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    async_log_t::stop();
+    for (size_t t = 0; t < loggers.size(); t++)
+        loggers[t].join();
+    {
+        std::lock_guard<std::mutex> lock(async_lines_mutex);
+        EXPECT_EQ(std::count_if(async_lines.begin(), async_lines.end(),
+                [](const std::string& line) { return line.compare(0, 5, "stop ") == 0; }), 8000);
+        async_lines.clear();
+    }
+
+    // cost on the calling thread, with a ring large enough for the burst.
+    // the thread takes over the 4096 byte ring of the one before, start()
+    // has resized it so nothing is dropped
+    ASSERT_TRUE(async_log_t::start(4 * 1024 * 1024, async_log_t::OVERFLOW_DROP));
+    // the median, the log thread may preempt the burst on a single core
+    std::vector<uint64> stamps(COUNT);
+    std::thread timed([&stamps, COUNT]()
+    {
+        for (uint i = 0; i < COUNT; i++)
+        {
+            uint64 start = gettimestamp();
+            INFO_MSG("drop %u %s\n", i, "payload");
+            stamps[i] = gettimestamp() - start;
+        }
+    });
+    timed.join();
+    EXPECT_EQ(async_log_t::dropped(), 0u);
+    async_log_t::stop();
+    async_lines.clear();
+    std::sort(stamps.begin(), stamps.end());
+    double asyncNs = stamps2sec(stamps[COUNT / 2]) * 1e9;
+
+    // the same message formatted on the calling thread
+    for (uint i = 0; i < COUNT; i++)
+    {
+        uint64 start = gettimestamp();
+        INFO_MSG("drop %u %s\n", i, "payload");
+        stamps[i] = gettimestamp() - start;
+    }
+    std::sort(stamps.begin(), stamps.end());
+    double syncNs = stamps2sec(stamps[COUNT / 2]) * 1e9;
+    printf("log call median: async %.1fns, sync %.1fns\n", asyncNs, syncNs);
+    log_msg_filter_t::get_instance().remove_debug_cb(idx);
+    async_lines.clear();
+    async_formats.clear();
+}
+
+#ifndef _WIN32
+static std::atomic<bool> crash_draining(false);
+static bool crashcallback(int component_priority, int msg_priority, const char * format, va_list args_list)
+{
+    // hold the log thread in its first message, the rest stays queued
+    crash_draining = true;
+    for (;;)
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    return true;
+}
+static void crash_with_queued_messages()
+{
+    debug_msg_cb_t dcb = crashcallback;
+    log_msg_filter_t::get_instance().add_debug_cb(&dcb);
+    async_log_t::start(64 * 1024, async_log_t::OVERFLOW_DROP);
+    async_log_t::install_crash_flush();
+    INFO_MSG("first\n");
+    while (!crash_draining)
+        std::this_thread::yield();
+    INFO_MSG("queued %d %u %x %s %c %.2f\n", -12, 34u, 0xabu, "text", 'z', 1.5);
+    abort();
+}
+TEST(GECO_DEBUGGING_MSGLOG, test_async_log_crash_flush)
+{
+    // the handler renders what is queued with write(2) only
+    EXPECT_EXIT(crash_with_queued_messages(), ::testing::KilledBySignal(SIGABRT),
+            "queued -12 34 ab text z %\\.2f");
+}
+#endif
@@ -0,0 +1,390 @@
+/*
+ * test-ds-queues.cc
+ *
+ *  correctness and two-thread benchmarks of the lock-free queues in common/ds
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "gtest/gtest.h"
+#include "common/geco-plateform.h"
+#include "common/ds/spsc-queue.h"
+#include "common/ds/mpmc-queue.h"
+#include "common/debugging/timestamp.h"
+
+using namespace geco::debugging;
+using namespace geco::ds;
+
+/// message like the ones the network thread hands to the game tick
+struct queue_msg_t
+{
+	uint64 seq;
+	uint64 sent_stamp;
+	uint payload[6];
+};
+
+TEST(GECO_DS_QUEUES, test_spsc_queue_single_thread)
+{
+	spsc_queue_t<int, 6> q;
+	EXPECT_EQ(8u, q.Capacity());
+	EXPECT_TRUE(q.IsEmpty());
+
+	for (int i = 0; i < 8; i++)
+		EXPECT_TRUE(q.try_push(i));
+	EXPECT_FALSE(q.try_push(8));
+	EXPECT_EQ(8u, q.Size());
+	EXPECT_EQ(3, q[3]);
+
+	int v = -1;
+	q.pop_front(v);
+	EXPECT_EQ(0, v);
+	EXPECT_EQ(1, *q.front());
+	EXPECT_TRUE(q.pop());
+
+	/// batch ops wrap around the end of the ring
+	int in[5] = { 8, 9, 10, 11, 12 };
+	EXPECT_EQ(2u, q.try_push_n(in, 5));
+	int out[16];
+	EXPECT_EQ(8u, q.try_pop_n(out, 16));
+	for (int i = 0; i < 8; i++)
+		EXPECT_EQ(i + 2, out[i]);
+	EXPECT_TRUE(q.IsEmpty());
+	EXPECT_EQ(0u, q.try_pop_n(out, 16));
+	EXPECT_FALSE(q.try_pop(v));
+	EXPECT_TRUE(q.front() == 0);
+}
+
+TEST(GECO_DS_QUEUES, test_spsc_queue_emplace_consume_in_place)
+{
+	spsc_queue_t<std::string, 4> q;
+	EXPECT_TRUE(q.try_emplace(3u, 'a'));
+	EXPECT_TRUE(q.try_emplace("geco"));
+	std::string moved("moved");
+	EXPECT_TRUE(q.try_push(std::move(moved)));
+
+	std::string got;
+	EXPECT_TRUE(q.try_consume([&got](std::string& s)
+	{	got.swap(s);}));
+	EXPECT_EQ("aaa", got);
+	EXPECT_EQ(2u, q.Size());
+	/// dtor of the ring destroys whatever is left
+}
+
+TEST(GECO_DS_QUEUES, test_spsc_queue_two_threads_keep_order)
+{
+	const uint64 count = 1000000;
+	spsc_queue_t<uint64, 256> q;
+	std::thread producer([&q, count]()
+	{
+		uint64 batch[32];
+		uint64 next = 0;
+		while (next < count)
+		{
+			/// mix single and batch pushes
+			if (next & 1)
+			{
+				if (q.try_push(next))
+				next++;
+				else
+				std::this_thread::yield();
+				continue;
+			}
+			uint n = 0;
+			for (; n < 32 && next + n < count; n++)
+			batch[n] = next + n;
+			if (q.try_push_n(batch, n) == 0)
+			std::this_thread::yield();
+			else
+			next += n;
+		}
+	});
+
+	uint64 expected = 0;
+	bool ordered = true;
+	uint64 batch[17];
+	while (expected < count)
+	{
+		uint n = q.try_pop_n(batch, 17);
+		for (uint i = 0; i < n; i++)
+			ordered &= batch[i] == expected++;
+		uint64 v;
+		if (q.try_pop(v))
+			ordered &= v == expected++;
+		else if (n == 0)
+			std::this_thread::yield();
+	}
+	producer.join();
+	EXPECT_TRUE(ordered);
+	EXPECT_TRUE(q.IsEmpty());
+}
+
+/// throughput and one-way latency of network thread -> game tick hand off
+TEST(GECO_DS_QUEUES, test_spsc_queue_two_threads_benchmark)
+{
+	const uint64 count = 2000000;
+	const uint batch_size = 32;
+	spsc_queue_t<queue_msg_t, 1024> q;
+
+	/// 1. one element per op
+	std::thread producer([&q, count]()
+	{
+		queue_msg_t msg;
+		memset(&msg, 0, sizeof(msg));
+		for (uint64 i = 0; i < count; i++)
+		{
+			msg.seq = i;
+			while (!q.try_push(msg))
+			std::this_thread::yield();
+		}
+	});
+	uint64 start = gettimestamp();
+	queue_msg_t msg;
+	uint64 sum = 0;
+	for (uint64 i = 0; i < count; i++)
+	{
+		while (!q.try_pop(msg))
+			std::this_thread::yield();
+		sum += msg.seq;
+	}
+	double single_secs = stamps2sec(gettimestamp() - start);
+	producer.join();
+	EXPECT_EQ(count * (count - 1) / 2, sum);
+
+	/// 2. batches, one index publish per batch
+	std::thread batch_producer([&q, count, batch_size]()
+	{
+		std::vector<queue_msg_t> msgs(batch_size);
+		uint64 next = 0;
+		while (next < count)
+		{
+			uint n = (uint)std::min<uint64>(batch_size, count - next);
+			for (uint i = 0; i < n; i++)
+			msgs[i].seq = next + i;
+			uint pushed = q.try_push_n(&msgs[0], n);
+			if (pushed == 0)
+			std::this_thread::yield();
+			next += pushed;
+		}
+	});
+	start = gettimestamp();
+	std::vector<queue_msg_t> msgs(batch_size);
+	sum = 0;
+	for (uint64 got = 0; got < count;)
+	{
+		uint n = q.try_pop_n(&msgs[0], batch_size);
+		for (uint i = 0; i < n; i++)
+			sum += msgs[i].seq;
+		if (n == 0)
+			std::this_thread::yield();
+		got += n;
+	}
+	double batch_secs = stamps2sec(gettimestamp() - start);
+	batch_producer.join();
+	EXPECT_EQ(count * (count - 1) / 2, sum);
+
+	/// 3. ping-pong latency, the consumer stamps the time it sees each
+	/// message, the producer waits for the ack so only one is in flight
+	const uint rounds = 100000;
+	spsc_queue_t<uint64, 64> acks;
+	std::vector<uint64> latencies(rounds);
+	std::thread pinger([&q, &acks, rounds]()
+	{
+		queue_msg_t msg;
+		memset(&msg, 0, sizeof(msg));
+		uint64 ack;
+		for (uint i = 0; i < rounds; i++)
+		{
+			msg.seq = i;
+			msg.sent_stamp = gettimestamp();
+			while (!q.try_push(msg))
+			std::this_thread::yield();
+			while (!acks.try_pop(ack))
+			std::this_thread::yield();
+		}
+	});
+	for (uint i = 0; i < rounds; i++)
+	{
+		while (!q.try_consume([&latencies, i](queue_msg_t& m)
+		{	latencies[i] = gettimestamp() - m.sent_stamp;}))
+			std::this_thread::yield();
+		while (!acks.try_push(i))
+			std::this_thread::yield();
+	}
+	pinger.join();
+	std::sort(latencies.begin(), latencies.end());
+
+	printf("spsc %llu msgs of %u bytes: single %.3f ms (%.1f M/s), "
+			"batch(%u) %.3f ms (%.1f M/s)\n", (unsigned long long) count,
+			(uint) sizeof(queue_msg_t), single_secs * 1000,
+			count / single_secs / 1e6, batch_size, batch_secs * 1000,
+			count / batch_secs / 1e6);
+	printf("spsc one-way latency: p50 %.0f ns, p99 %.0f ns, p99.9 %.0f ns\n",
+			stamps2sec(latencies[rounds / 2]) * 1e9,
+			stamps2sec(latencies[rounds * 99 / 100]) * 1e9,
+			stamps2sec(latencies[rounds * 999 / 1000]) * 1e9);
+}
+
+TEST(GECO_DS_QUEUES, test_mpmc_queue_single_thread)
+{
+	mpmc_queue_t<std::string, 3, spin_wait_strategy_t> q;
+	EXPECT_EQ(4u, q.Capacity());
+	EXPECT_TRUE(q.try_emplace(2u, 'x'));
+	EXPECT_TRUE(q.try_push("b"));
+	std::string in[3] = { "c", "d", "e" };
+	EXPECT_EQ(2u, q.try_push_n(in, 3));
+	EXPECT_FALSE(q.try_push("f"));
+	EXPECT_EQ(4u, q.Size());
+
+	std::string out[8];
+	EXPECT_EQ(1u, q.try_pop_n(out, 1));
+	EXPECT_EQ("xx", out[0]);
+	EXPECT_TRUE(q.try_consume([](std::string& s)
+	{	EXPECT_EQ("b", s);}));
+	/// wraps around the end of the cells
+	EXPECT_EQ(1u, q.try_push_n(in + 2, 1));
+	EXPECT_EQ(3u, q.try_pop_n(out, 8));
+	EXPECT_EQ("c", out[0]);
+	EXPECT_EQ("d", out[1]);
+	EXPECT_EQ("e", out[2]);
+	EXPECT_TRUE(q.IsEmpty());
+	EXPECT_FALSE(q.try_pop(out[0]));
+	EXPECT_EQ(0u, q.try_pop_n(out, 8));
+}
+
+/// pushed once per consumer after the last job to unblock pop_n()
+static const uint64 queue_stop_msg = ~(uint64) 0;
+
+/// @producers threads push @per_producer tagged values each into @q,
+/// @consumers threads drain it with the blocking pop_n().
+/// @return false if a value was lost, duplicated or a producer's values
+/// were seen out of order by one consumer
+template<class QUEUE>
+static bool run_queue_producers(QUEUE& q, uint producers, uint consumers,
+		uint per_producer, double& secs)
+{
+	const uint total = producers * per_producer;
+	std::atomic<uint> popped(0);
+	std::atomic<uint64> sum(0);
+	std::atomic<bool> ordered(true);
+	std::vector<std::thread> consumer_threads, producer_threads;
+
+	uint64 start = gettimestamp();
+	for (uint c = 0; c < consumers; c++)
+	{
+		consumer_threads.push_back(std::thread([&, producers, total]()
+		{
+			std::vector<int64> last(producers, -1);
+			uint64 batch[64];
+			uint64 local_sum = 0;
+			bool local_ordered = true;
+			while (popped.load(std::memory_order_relaxed) < total)
+			{
+				uint n = q.pop_n(batch, 64);
+				uint jobs = 0;
+				for (uint i = 0; i < n; i++)
+				{
+					if (batch[i] == queue_stop_msg)
+					continue;
+					uint p = (uint)(batch[i] >> 32);
+					int64 v = (int64)(batch[i] & 0xFFFFFFFF);
+					local_ordered &= v > last[p];
+					last[p] = v;
+					local_sum += batch[i];
+					jobs++;
+				}
+				popped.fetch_add(jobs, std::memory_order_relaxed);
+			}
+			sum.fetch_add(local_sum);
+			if (!local_ordered)
+			ordered = false;
+		}));
+	}
+	for (uint p = 0; p < producers; p++)
+	{
+		producer_threads.push_back(std::thread([&q, p, per_producer]()
+		{
+			for (uint i = 0; i < per_producer; i++)
+			q.push(((uint64)p << 32) | i);
+		}));
+	}
+	for (auto& t : producer_threads)
+		t.join();
+	/// consumers still parked once all jobs are taken need a wake up call
+	while (popped.load(std::memory_order_relaxed) < total)
+		std::this_thread::yield();
+	for (uint c = 0; c < consumers; c++)
+		q.push(queue_stop_msg);
+	for (auto& t : consumer_threads)
+		t.join();
+	secs = stamps2sec(gettimestamp() - start);
+
+	uint64 stop;
+	while (q.try_pop(stop))
+		ordered = ordered && stop == queue_stop_msg;
+
+	uint64 expected = 0;
+	for (uint p = 0; p < producers; p++)
+		expected += ((uint64) p << 32) * per_producer
+				+ (uint64) per_producer * (per_producer - 1) / 2;
+	return ordered && popped == total && sum == expected && q.IsEmpty();
+}
+
+TEST(GECO_DS_QUEUES, test_mpsc_queue_futex_consumer_sleeps_and_wakes)
+{
+	mpsc_queue_t<uint64, 64, futex_wait_strategy_t> q;
+	uint64 got[4] = { 0 };
+	uint n = 0;
+	std::thread consumer([&q, &got, &n]()
+	{	n = q.pop_n(got, 4);});
+	/// give the consumer time to park
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	q.push(7);
+	consumer.join();
+	EXPECT_EQ(1u, n);
+	EXPECT_EQ(7u, got[0]);
+}
+
+/// one logic thread fed by 1/2/4/8 job producers, with each wait strategy
+/// that does not need a dedicated core
+TEST(GECO_DS_QUEUES, test_mpsc_queue_producers_benchmark)
+{
+	const uint total = 400000;
+	const uint producers[] = { 1, 2, 4, 8 };
+	for (uint p : producers)
+	{
+		double yield_secs, futex_secs;
+		{
+			mpsc_queue_t<uint64, 1024, yield_wait_strategy_t> q;
+			EXPECT_TRUE(run_queue_producers(q, p, 1, total / p, yield_secs));
+		}
+		{
+			mpsc_queue_t<uint64, 1024, futex_wait_strategy_t> q;
+			EXPECT_TRUE(run_queue_producers(q, p, 1, total / p, futex_secs));
+		}
+		printf("mpsc %u producers, %u msgs: yield %.3f ms (%.1f M/s), "
+				"futex %.3f ms (%.1f M/s)\n", p, total, yield_secs * 1000,
+				total / yield_secs / 1e6, futex_secs * 1000,
+				total / futex_secs / 1e6);
+	}
+}
+
+TEST(GECO_DS_QUEUES, test_mpmc_queue_producers_benchmark)
+{
+	const uint total = 400000;
+	const uint producers[] = { 1, 2, 4, 8 };
+	for (uint p : producers)
+	{
+		double secs;
+		mpmc_queue_t<uint64, 1024, futex_wait_strategy_t> q;
+		EXPECT_TRUE(run_queue_producers(q, p, 2, total / p, secs));
+		printf("mpmc %u producers 2 consumers, %u msgs: futex %.3f ms (%.1f M/s)\n",
+				p, total, secs * 1000, total / secs / 1e6);
+	}
+}
@@ -7,6 +7,8 @@
 
 #include "gtest/gtest.h"
 #include "network/end-point.h"
+#include "math/geco-math-batch.h"
+#include "common/debugging/timestamp.h"
 
 TEST(network, test_geco_net_addr)
 {
@@ -38,3 +40,314 @@ TEST(network, test_geco_endpoint)
 
 }
 
+
+/// a bound udp endpoint on @host and the address it got
+static void open_loopback_endpoint(GecoNetEndpoint& ep, GecoNetAddress& addr, const char* host)
+{
+    GecoNetAddress bindAddr(0, host);
+    ep.Socket(saddr_family(&bindAddr.su), SOCK_DGRAM);
+    ASSERT_TRUE(ep.Good());
+    ASSERT_EQ(0, ep.Bind(bindAddr));
+    ASSERT_EQ(0, ep.GetLocalAddress(&addr));
+    ASSERT_EQ(saddr_family(&bindAddr.su), saddr_family(&addr.su));
+}
+
+TEST(network, test_geco_endpoint_send_recv_many)
+{
+    const int COUNT = 100;
+    static GecoNetPacket packets[COUNT], received[COUNT];
+    GecoNetPacket* out[COUNT];
+    GecoNetPacket* in[COUNT];
+    GecoNetAddress to[COUNT], from[COUNT];
+
+    // ipv6 needs the full sockaddr_in6 length that sizeof(sockaddr) cut off
+    const char* hosts[2] = { "127.0.0.1", "::1" };
+    for (int h = 0; h < 2; h++)
+    {
+        GecoNetEndpoint sender, receiver;
+        GecoNetAddress senderAddr, receiverAddr;
+        open_loopback_endpoint(sender, senderAddr, hosts[h]);
+        open_loopback_endpoint(receiver, receiverAddr, hosts[h]);
+        receiver.SetNonblocking(true);
+
+        for (int i = 0; i < COUNT; i++)
+        {
+            packets[i].m_iMsgEndOffset = 8 + i;
+            memset(packets[i].m_acData, i, packets[i].m_iMsgEndOffset);
+            out[i] = &packets[i];
+            in[i] = &received[i];
+            to[i] = receiverAddr;
+        }
+        // more than one batch each way
+        ASSERT_EQ(COUNT, sender.SendMany(out, to, COUNT));
+        ASSERT_EQ(COUNT, receiver.RecvMany(in, from, COUNT));
+        for (int i = 0; i < COUNT; i++)
+        {
+            ASSERT_EQ(packets[i].m_iMsgEndOffset, received[i].m_iMsgEndOffset);
+            ASSERT_EQ(0, memcmp(packets[i].m_acData, received[i].m_acData, received[i].m_iMsgEndOffset));
+            ASSERT_TRUE(from[i] == senderAddr) << hosts[h];
+        }
+        // nothing queued
+        ASSERT_EQ(-1, receiver.RecvMany(in, from, COUNT));
+        ASSERT_TRUE(errno == EAGAIN || errno == EWOULDBLOCK);
+
+        // and the single datagram calls
+        ASSERT_EQ(8, sender.SendTo(packets[0].m_acData, 8, receiverAddr));
+        GecoNetAddress src;
+        ASSERT_EQ(8, receiver.RecvFrom(received[0].m_acData, PACKET_MAX_SIZE, src));
+        ASSERT_TRUE(src == senderAddr) << hosts[h];
+    }
+}
+
+TEST(network, test_geco_endpoint_recv_many_benchmark)
+{
+    const int BURST = 32;
+    const int ROUNDS = 2000;
+    static GecoNetPacket packets[BURST];
+    GecoNetPacket* pkts[BURST];
+    GecoNetAddress to[BURST], from[BURST];
+
+    GecoNetEndpoint sender, receiver;
+    GecoNetAddress senderAddr, receiverAddr;
+    open_loopback_endpoint(sender, senderAddr, "127.0.0.1");
+    open_loopback_endpoint(receiver, receiverAddr, "127.0.0.1");
+    receiver.SetNonblocking(true);
+    for (int i = 0; i < BURST; i++)
+    {
+        packets[i].m_iMsgEndOffset = 200;
+        pkts[i] = &packets[i];
+        to[i] = receiverAddr;
+    }
+
+    // loopback delivers during the send, so every burst is queued when the
+    // receive starts
+    int single = 0;
+    uint64 start = gettimestamp();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        for (int i = 0; i < BURST; i++)
+            sender.SendTo(packets[i].m_acData, packets[i].m_iMsgEndOffset, to[i]);
+        for (int i = 0; i < BURST; i++)
+            single += receiver.RecvFrom(packets[i].m_acData, PACKET_MAX_SIZE, from[i]) > 0;
+    }
+    double singlePps = single / stamps2sec(gettimestamp() - start);
+
+    int batched = 0;
+    start = gettimestamp();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        sender.SendMany(pkts, to, BURST);
+        int n = receiver.RecvMany(pkts, from, BURST);
+        batched += n > 0 ? n : 0;
+    }
+    double batchedPps = batched / stamps2sec(gettimestamp() - start);
+
+    printf("loopback %d datagram bursts: sendto/recvfrom %.0f pps, sendmmsg/recvmmsg %.0f pps\n",
+        BURST, singlePps, batchedPps);
+    ASSERT_EQ(BURST * ROUNDS, single);
+    ASSERT_EQ(BURST * ROUNDS, batched);
+}
+
+TEST(network, test_schema_stream_operators)
+{
+    GECO_STATIC_ASSERT(GecoYawPitchRollSchema::fixed_bytes == 3, yaw_pitch_roll_is_3_bytes);
+    GECO_STATIC_ASSERT(GecoPackedXYZSchema::fixed_bytes == 5, packed_xyz_is_5_bytes);
+    GECO_STATIC_ASSERT(!InterfaceListenerMsgSchema::is_fixed_size, listener_name_is_a_string);
+
+    for (int compressed = 0; compressed < 2; compressed++)
+    {
+        geco_bit_stream_t os;
+        compressed ? os.enable_compression() : os.disable_compression();
+
+        GecoYawPitchRoll ypr;
+        ypr.m_uiYaw = 1;
+        ypr.m_uiPitch = 2;
+        ypr.m_uiRoll = 3;
+        os << ypr;
+        if (!compressed)
+        {
+            ASSERT_EQ(GecoYawPitchRollSchema::fixed_bytes, os.get_written_bytes());
+        }
+
+        GecoPackedXYZ xyz;
+        xyz.PackXYZ(12.5f, -3.25f, 100.f);
+        os << xyz;
+
+        InterfaceListenerMsg msg(0x7f000001, 2017, 9, "cellapp01");
+        os << msg;
+
+        GecoYawPitchRoll ypr2;
+        GecoPackedXYZ xyz2;
+        InterfaceListenerMsg msg2;
+        os >> ypr2 >> xyz2 >> msg2;
+        ASSERT_TRUE(ypr == ypr2);
+        float x, y, z, x2, y2, z2;
+        xyz.UnpackXYZ(x, y, z);
+        xyz2.UnpackXYZ(x2, y2, z2);
+        ASSERT_EQ(x, x2);
+        ASSERT_EQ(y, y2);
+        ASSERT_EQ(z, z2);
+        ASSERT_EQ(msg.uiIP, msg2.uiIP);
+        ASSERT_EQ(msg.uiPort, msg2.uiPort);
+        ASSERT_EQ(msg.uiUserID, msg2.uiUserID);
+        ASSERT_STREQ("cellapp01", msg2.kName);
+        ASSERT_EQ(0u, os.get_payloads());
+    }
+}
+
+/// positions over the packable range plus the edges of PackXY: zeros, the
+/// [509.5, 510) rounding overflow, out of range values and the 2 bias
+static void make_batch_positions(std::vector<float>& x, std::vector<float>& y,
+    std::vector<float>& z, uint count)
+{
+    static const float edges[] = { 0.f, -0.f, 1e-7f, -1e-7f, 2.f, -2.f, 0.00390625f, 509.5f,
+        -509.5f, 509.99f, -509.99f, 510.f, 600.f, -1000.f, 131069.f, -131069.f };
+    GecoSrand(4321);
+    x.resize(count);
+    y.resize(count);
+    z.resize(count);
+    for (uint i = 0; i < count; i++)
+    {
+        x[i] = GecoRangeRandomf(-509.f, 509.f);
+        y[i] = GecoRangeRandomf(-509.f, 509.f);
+        z[i] = GecoRangeRandomf(-131000.f, 131000.f);
+    }
+    uint edgeCount = sizeof(edges) / sizeof(edges[0]);
+    for (uint i = 0; i < edgeCount && i * 3 < count; i++)
+    {
+        x[i * 3] = edges[i];
+        y[i * 3 + 1] = edges[edgeCount - 1 - i];
+        if (fabsf(edges[i]) < 131070.f)
+            z[i * 3 + 2] = edges[i];
+    }
+}
+
+TEST(network, test_packed_xy_batch_matches_scalar)
+{
+    const uint COUNT = 1003;
+    std::vector<float> x, y, z;
+    make_batch_positions(x, y, z, COUNT);
+
+    std::vector<GecoPackedXY> xy(COUNT), xyBatch(COUNT);
+    std::vector<GecoPackedXYZ> xyz(COUNT), xyzBatch(COUNT);
+    for (uint i = 0; i < COUNT; i++)
+    {
+        xy[i].PackXY(x[i], y[i]);
+        xyz[i].PackXYZ(x[i], y[i], z[i]);
+    }
+
+    std::vector<float> ux(COUNT), uy(COUNT), uz(COUNT), ex(COUNT), ey(COUNT), ez(COUNT);
+    GecoBatchIsa supported = GecoBatchSupportedIsa();
+    for (int isa = GECO_BATCH_SCALAR; isa <= supported; isa++)
+    {
+        GecoBatchSetIsa((GecoBatchIsa) isa);
+        GecoPackedXY::PackXYBatch(&xyBatch[0], &x[0], &y[0], COUNT);
+        GecoPackedXYZ::PackXYZBatch(&xyzBatch[0], &x[0], &y[0], &z[0], COUNT);
+        for (uint i = 0; i < COUNT; i++)
+        {
+            ASSERT_EQ(0, memcmp(xy[i].m_acData, xyBatch[i].m_acData, 3)) << "isa " << isa << " at " << i;
+            ASSERT_EQ(0, memcmp(xyz[i].m_acData, xyzBatch[i].m_acData, 3)) << "isa " << isa << " at " << i;
+            ASSERT_EQ(xyz[i].m_acZShort, xyzBatch[i].m_acZShort) << "isa " << isa << " at " << i;
+        }
+
+        GecoPackedXY::UnpackXYBatch(&ux[0], &uy[0], &xy[0], COUNT);
+        GecoPackedXY::GetXYErrorBatch(&ex[0], &ey[0], &xy[0], COUNT);
+        for (uint i = 0; i < COUNT; i++)
+        {
+            float sx, sy, sex, sey;
+            xy[i].UnpackXY(sx, sy);
+            xy[i].GetXYError(sex, sey);
+            // compare bits, -0 and 0 differ
+            ASSERT_EQ(0, memcmp(&sx, &ux[i], 4)) << "isa " << isa << " at " << i;
+            ASSERT_EQ(0, memcmp(&sy, &uy[i], 4)) << "isa " << isa << " at " << i;
+            ASSERT_EQ(sex, ex[i]);
+            ASSERT_EQ(sey, ey[i]);
+            if (fabsf(x[i]) < 509.f && fabsf(y[i]) < 509.f)
+            {
+                ASSERT_LE(fabsf(ux[i] - x[i]), ex[i]);
+                ASSERT_LE(fabsf(uy[i] - y[i]), ey[i]);
+            }
+        }
+
+        GecoPackedXYZ::UnpackXYZBatch(&ux[0], &uy[0], &uz[0], &xyz[0], COUNT);
+        GecoPackedXYZ::ZErrorBatch(&ez[0], &xyz[0], COUNT);
+        for (uint i = 0; i < COUNT; i++)
+        {
+            float sx, sy, sz;
+            xyz[i].UnpackXYZ(sx, sy, sz);
+            ASSERT_EQ(0, memcmp(&sx, &ux[i], 4)) << "isa " << isa << " at " << i;
+            ASSERT_EQ(0, memcmp(&sy, &uy[i], 4)) << "isa " << isa << " at " << i;
+            ASSERT_EQ(0, memcmp(&sz, &uz[i], 4)) << "isa " << isa << " at " << i;
+            ASSERT_EQ(xyz[i].ZError(), ez[i]);
+        }
+    }
+    GecoBatchSetIsa(supported);
+}
+
+TEST(network, test_packed_xy_batch_benchmark)
+{
+    const uint COUNT = 4096;
+    const int LOOPS = 200;
+    std::vector<float> x, y, z;
+    make_batch_positions(x, y, z, COUNT);
+    std::vector<GecoPackedXY> xy(COUNT);
+    std::vector<GecoPackedXYZ> xyz(COUNT);
+    std::vector<float> ux(COUNT), uy(COUNT), uz(COUNT);
+    volatile uint sink = 0;
+
+    // one PackXY per entity as the witnesses do today
+    uint64 start = gettimestamp();
+    for (int l = 0; l < LOOPS; l++)
+    {
+        for (uint i = 0; i < COUNT; i++)
+            xy[i].PackXY(x[i], y[i]);
+        sink = sink + xy[l].m_acData[0];
+    }
+    double scalarXY = LOOPS * COUNT / stamps2sec(gettimestamp() - start);
+    start = gettimestamp();
+    for (int l = 0; l < LOOPS; l++)
+    {
+        for (uint i = 0; i < COUNT; i++)
+            xyz[i].PackXYZ(x[i], y[i], z[i]);
+        sink = sink + xyz[l].m_acData[0];
+    }
+    double scalarXYZ = LOOPS * COUNT / stamps2sec(gettimestamp() - start);
+    start = gettimestamp();
+    for (int l = 0; l < LOOPS; l++)
+    {
+        for (uint i = 0; i < COUNT; i++)
+            xyz[i].UnpackXYZ(ux[i], uy[i], uz[i]);
+        sink = sink + (uint) ux[l];
+    }
+    double scalarUnpack = LOOPS * COUNT / stamps2sec(gettimestamp() - start);
+    printf("scalar      Mentities/s: packXY %.1f packXYZ %.1f unpackXYZ %.1f\n",
+        scalarXY / 1e6, scalarXYZ / 1e6, scalarUnpack / 1e6);
+
+    GecoBatchIsa supported = GecoBatchSupportedIsa();
+    double batchXY = 0, batchXYZ = 0;
+    for (int isa = GECO_BATCH_SCALAR; isa <= supported; isa++)
+    {
+        GecoBatchSetIsa((GecoBatchIsa) isa);
+        start = gettimestamp();
+        for (int l = 0; l < LOOPS; l++)
+            GecoPackedXY::PackXYBatch(&xy[0], &x[0], &y[0], COUNT);
+        batchXY = LOOPS * COUNT / stamps2sec(gettimestamp() - start);
+        start = gettimestamp();
+        for (int l = 0; l < LOOPS; l++)
+            GecoPackedXYZ::PackXYZBatch(&xyz[0], &x[0], &y[0], &z[0], COUNT);
+        batchXYZ = LOOPS * COUNT / stamps2sec(gettimestamp() - start);
+        start = gettimestamp();
+        for (int l = 0; l < LOOPS; l++)
+            GecoPackedXYZ::UnpackXYZBatch(&ux[0], &uy[0], &uz[0], &xyz[0], COUNT);
+        double batchUnpack = LOOPS * COUNT / stamps2sec(gettimestamp() - start);
+        printf("batch %-6s Mentities/s: packXY %.1f packXYZ %.1f unpackXYZ %.1f\n",
+            isa == GECO_BATCH_AVX2 ? "avx2" : isa == GECO_BATCH_SSE2 ? "sse2" : "scalar",
+            batchXY / 1e6, batchXYZ / 1e6, batchUnpack / 1e6);
+    }
+    GecoBatchSetIsa(supported);
+    if (supported != GECO_BATCH_SCALAR)
+    {
+        EXPECT_GT(batchXY, scalarXY);
+        EXPECT_GT(batchXYZ, scalarXYZ);
+    }
+}
@@ -11,11 +11,14 @@
 #include <assert.h>
 #include <limits.h>
 #include <functional>
+#include <thread>
 
 #include "gtest/gtest.h"
 #include "common/debugging/debug.h"
 #include "common/ds/geco-bit-stream.h"
+#include "common/ds/geco-segmented-bit-stream.h"
 #include "common/geco-plateform.h"
+#include "common/debugging/timestamp.h"
 
 using namespace geco::debugging;
 using namespace geco::ultils;
@@ -531,3 +534,406 @@ TEST(GecoMemoryStreamTestCase, test_all_reads_and_writes_un_compressed) {
 		s9.reset();
 	}
 }
+
+/// one entity update of mostly sub-byte fields as we send them every tick
+struct bench_update_t {
+	bool moved;
+	uchar yaw;   // 5 bits
+	uchar pitch; // 3 bits
+	uchar flags; // 7 bits
+	ushort id;
+	uint pos;
+};
+static void fill_bench_updates(std::vector<bench_update_t>& updates) {
+	srand(2016);
+	for (auto& u : updates) {
+		u.moved = (rand() & 1) != 0;
+		u.yaw = (uchar)(rand() & 0x1f);
+		u.pitch = (uchar)(rand() & 0x07);
+		u.flags = (uchar)(rand() & 0x7f);
+		u.id = (ushort)rand();
+		u.pos = (uint)rand();
+	}
+}
+TEST(GecoMemoryStreamTestCase, test_word_accumulator_same_bytes_and_throughput) {
+	const uint count = 200000;
+	std::vector<bench_update_t> updates(count);
+	fill_bench_updates(updates);
+
+	geco_bit_stream_t bytewise(count * 16);
+	uint64 start = gettimestamp();
+	for (auto& u : updates) {
+		bytewise.Write(u.moved);
+		bytewise.WriteBits(&u.yaw, 5);
+		bytewise.WriteBits(&u.pitch, 3);
+		bytewise.WriteBits(&u.flags, 7);
+		bytewise.Write(u.id);
+		bytewise.Write(u.pos);
+	}
+	double bytewise_secs = stamps2sec(gettimestamp() - start);
+
+	geco_bit_stream_t wordwise(count * 16);
+	start = gettimestamp();
+	{
+		geco_bit_accumulator_t acc(wordwise);
+		for (auto& u : updates) {
+			acc.write(u.moved);
+			acc.write_bits(u.yaw, 5);
+			acc.write_bits(u.pitch, 3);
+			acc.write_bits(u.flags, 7);
+			acc.write(u.id);
+			acc.write(u.pos);
+		}
+	}
+	double wordwise_secs = stamps2sec(gettimestamp() - start);
+
+	EXPECT_EQ(bytewise.get_written_bits(), wordwise.get_written_bits());
+	EXPECT_EQ(0, memcmp(bytewise.uchar_data(), wordwise.uchar_data(),
+		bytewise.get_written_bytes()));
+
+	start = gettimestamp();
+	{
+		geco_bit_accumulator_t acc(wordwise);
+		for (auto& u : updates) {
+			bool moved;
+			ushort id;
+			uint pos;
+			acc.read(moved);
+			EXPECT_EQ(u.moved, moved);
+			EXPECT_EQ(u.yaw, acc.read_bits(5));
+			EXPECT_EQ(u.pitch, acc.read_bits(3));
+			EXPECT_EQ(u.flags, acc.read_bits(7));
+			acc.read(id);
+			EXPECT_EQ(u.id, id);
+			acc.read(pos);
+			EXPECT_EQ(u.pos, pos);
+		}
+	}
+	double word_read_secs = stamps2sec(gettimestamp() - start);
+	wordwise.AssertStreamEmpty();
+
+	start = gettimestamp();
+	for (auto& u : updates) {
+		bool moved;
+		uchar yaw, pitch, flags;
+		ushort id;
+		uint pos;
+		bytewise.Read(moved);
+		bytewise.ReadBits(&yaw, 5);
+		bytewise.ReadBits(&pitch, 3);
+		bytewise.ReadBits(&flags, 7);
+		bytewise.Read(id);
+		bytewise.Read(pos);
+		EXPECT_EQ(u.pos, pos);
+	}
+	double byte_read_secs = stamps2sec(gettimestamp() - start);
+
+	printf("write %u updates: stream %.3f ms (%.1f M/s), accumulator %.3f ms (%.1f M/s)\n",
+		count, bytewise_secs * 1000, count / bytewise_secs / 1e6,
+		wordwise_secs * 1000, count / wordwise_secs / 1e6);
+	printf("read  %u updates: stream %.3f ms (%.1f M/s), accumulator %.3f ms (%.1f M/s)\n",
+		count, byte_read_secs * 1000, count / byte_read_secs / 1e6,
+		word_read_secs * 1000, count / word_read_secs / 1e6);
+}
+
+TEST(GecoMemoryStreamTestCase, test_word_accumulator_mixed_with_stream_writes) {
+	geco_bit_stream_t expected;
+	geco_bit_stream_t actual;
+	uchar partial = 0x05;
+	uint64 big = 0x0123456789abcdefULL;
+
+	expected.WriteBits(&partial, 3);
+	actual.WriteBits(&partial, 3);
+	for (int i = 0; i < 100; i++) {
+		expected.Write(big);
+		expected.Write((i & 1) == 0);
+		expected.WriteBits(&partial, 3);
+	}
+	{
+		/// starts in the middle of a byte written by the stream
+		geco_bit_accumulator_t acc(actual);
+		for (int i = 0; i < 100; i++) {
+			acc.write(big);
+			acc.write((i & 1) == 0);
+			acc.write_bits(&partial, 3);
+		}
+	}
+	expected.WriteBits(&partial, 3);
+	actual.WriteBits(&partial, 3);
+
+	EXPECT_EQ(expected.get_written_bits(), actual.get_written_bits());
+	EXPECT_EQ(0, memcmp(expected.uchar_data(), actual.uchar_data(),
+		expected.get_written_bytes()));
+}
+
+TEST(GecoMemoryStreamTestCase, test_segmented_stream_same_bytes_across_segments) {
+	const uint count = 20000;
+	std::vector<bench_update_t> updates(count);
+	fill_bench_updates(updates);
+	uchar blob[3000];
+	for (uint i = 0; i < sizeof(blob); i++)
+		blob[i] = (uchar)(i * 7);
+
+	geco_stream_segment_pool_t pool;
+	geco_segmented_bit_stream_t segmented(pool);
+	geco_bit_stream_t flat;
+	for (auto& u : updates) {
+		segmented.Write(u.moved);
+		segmented.WriteBits(&u.yaw, 5);
+		segmented.WriteBits(&u.pitch, 3);
+		segmented.WriteBits(&u.flags, 7);
+		segmented.Write(u.id);
+		segmented.Write(u.pos);
+		flat.Write(u.moved);
+		flat.WriteBits(&u.yaw, 5);
+		flat.WriteBits(&u.pitch, 3);
+		flat.WriteBits(&u.flags, 7);
+		flat.Write(u.id);
+		flat.Write(u.pos);
+	}
+	/// unaligned then aligned blob that spans several segments
+	segmented.WriteBits(blob, BYTES_TO_BITS(sizeof(blob)));
+	flat.WriteBits(blob, BYTES_TO_BITS(sizeof(blob)));
+	segmented.WriteBits(blob, 5);
+	flat.WriteBits(blob, 5);
+	EXPECT_EQ(flat.get_written_bits(), segmented.get_written_bits());
+	EXPECT_GT(segmented.get_segments_size(), 1u);
+
+	/// iovecs cover exactly the written bytes in order
+	std::vector<geco_iovec_t> vecs(segmented.get_segments_size());
+	uint vecs_size = segmented.get_iovecs(&vecs[0], (uint)vecs.size());
+	EXPECT_EQ(segmented.get_segments_size(), vecs_size);
+	byte_size_t offset = 0;
+	for (uint i = 0; i < vecs_size; i++) {
+		EXPECT_EQ(0, memcmp(flat.uchar_data() + offset, GECO_IOVEC_BASE(vecs[i]),
+			GECO_IOVEC_LEN(vecs[i])));
+		offset += (byte_size_t)GECO_IOVEC_LEN(vecs[i]);
+	}
+	EXPECT_EQ(flat.get_written_bytes(), offset);
+
+	geco_bit_stream_t flattened;
+	segmented.flatten_to(flattened);
+	EXPECT_EQ(flat.get_written_bits(), flattened.get_written_bits());
+	EXPECT_EQ(0, memcmp(flat.uchar_data(), flattened.uchar_data(),
+		flat.get_written_bytes()));
+
+	for (auto& u : updates) {
+		bool moved;
+		uchar yaw, pitch, flags;
+		ushort id;
+		uint pos;
+		segmented.Read(moved);
+		segmented.ReadBits(&yaw, 5);
+		segmented.ReadBits(&pitch, 3);
+		segmented.ReadBits(&flags, 7);
+		segmented.Read(id);
+		segmented.Read(pos);
+		EXPECT_EQ(u.moved, moved);
+		EXPECT_EQ(u.yaw, yaw);
+		EXPECT_EQ(u.pitch, pitch);
+		EXPECT_EQ(u.flags, flags);
+		EXPECT_EQ(u.id, id);
+		EXPECT_EQ(u.pos, pos);
+	}
+	uchar readback[sizeof(blob)];
+	segmented.ReadBits(readback, BYTES_TO_BITS(sizeof(blob)));
+	EXPECT_EQ(0, memcmp(blob, readback, sizeof(blob)));
+	uchar tail;
+	segmented.ReadBits(&tail, 5);
+	EXPECT_EQ(blob[0] & 0x1f, tail);
+	EXPECT_EQ(0u, segmented.get_payloads());
+
+	/// segments go back to the pool and are reused by the next stream
+	uint segments = segmented.get_segments_size();
+	segmented.reset();
+	EXPECT_EQ(segments, pool.free_segments());
+	segmented.write_aligned_bytes(blob, sizeof(blob));
+	EXPECT_EQ(segments, pool.allocated_segments());
+}
+
+TEST(GecoMemoryStreamTestCase, test_segmented_stream_growth_throughput) {
+	const uint count = 200000;
+	std::vector<bench_update_t> updates(count);
+	fill_bench_updates(updates);
+
+	/// flat stream starting small so that it reallocs while growing,
+	/// the segmented stream chains pooled segments instead
+	uint64 start = gettimestamp();
+	geco_bit_stream_t* flat = new geco_bit_stream_t;
+	for (auto& u : updates) {
+		flat->WriteBits(&u.flags, 7);
+		flat->Write(u.id);
+		flat->Write(u.pos);
+	}
+	double flat_secs = stamps2sec(gettimestamp() - start);
+
+	geco_stream_segment_pool_t pool;
+	{
+		/// warm up the pool like a long running server would be
+		geco_segmented_bit_stream_t warmup(pool);
+		for (auto& u : updates)
+			warmup.Write(u.pos);
+	}
+	start = gettimestamp();
+	geco_segmented_bit_stream_t* segmented = new geco_segmented_bit_stream_t(pool);
+	for (auto& u : updates) {
+		segmented->WriteBits(&u.flags, 7);
+		segmented->Write(u.id);
+		segmented->Write(u.pos);
+	}
+	double segmented_secs = stamps2sec(gettimestamp() - start);
+
+	EXPECT_EQ(flat->get_written_bits(), segmented->get_written_bits());
+	geco_bit_stream_t flattened;
+	segmented->flatten_to(flattened);
+	EXPECT_EQ(0, memcmp(flat->uchar_data(), flattened.uchar_data(),
+		flat->get_written_bytes()));
+
+	printf("grow to %u bytes: realloc stream %.3f ms, segmented stream %.3f ms (%u segments)\n",
+		flat->get_written_bytes(), flat_secs * 1000, segmented_secs * 1000,
+		segmented->get_segments_size());
+	delete segmented;
+	delete flat;
+}
+
+TEST(GecoMemoryStreamTestCase, test_static_factory_thread_pool) {
+	geco_bit_stream_pool_stats_t before, after;
+	geco_bit_stream_t::get_pool_stats(before);
+
+	/// a reclaimed stream comes back clean and keeps its small heap buffer
+	geco_bit_stream_t* s = geco_bit_stream_t::get_instance();
+	uchar blob[4096] = { 1, 2, 3 };
+	s->WriteBits(blob, BYTES_TO_BITS(sizeof(blob)));
+	uchar* heap = s->uchar_data();
+	geco_bit_stream_t::reclaim_instance(s);
+	geco_bit_stream_t* again = geco_bit_stream_t::get_instance();
+	EXPECT_EQ(s, again);
+	EXPECT_EQ(heap, again->uchar_data());
+	EXPECT_EQ(0u, again->get_written_bits());
+	EXPECT_EQ(0u, again->get_payloads());
+	again->Write(0x12345678u);
+	uint value;
+	again->Read(value);
+	EXPECT_EQ(0x12345678u, value);
+
+	/// a buffer over the retained cap is given back on reclaim
+	uchar* big = new uchar[GECO_STREAM_POOL_MAX_RETAINED_BUFFER_BYTES * 2];
+	again->WriteBits(big, BYTES_TO_BITS(GECO_STREAM_POOL_MAX_RETAINED_BUFFER_BYTES * 2));
+	delete[] big;
+	geco_bit_stream_t::reclaim_instance(again);
+	geco_bit_stream_t::get_pool_stats(after);
+	EXPECT_EQ(before.retained_heap_bytes, after.retained_heap_bytes);
+	EXPECT_EQ(before.hits + 1, after.hits);
+
+	/// streams got on other threads count too
+	std::thread t([]() {
+		geco_bit_stream_t::reclaim_instance(geco_bit_stream_t::get_instance());
+		geco_bit_stream_t::reclaim_instance(geco_bit_stream_t::get_instance());
+	});
+	t.join();
+	geco_bit_stream_pool_stats_t threaded;
+	geco_bit_stream_t::get_pool_stats(threaded);
+	EXPECT_EQ(after.hits + 1, threaded.hits);
+	EXPECT_EQ(after.misses + 1, threaded.misses);
+
+	const uint count = 1000000;
+	uint64 start = gettimestamp();
+	for (uint i = 0; i < count; i++) {
+		geco_bit_stream_t* stream = new geco_bit_stream_t;
+		stream->Write(i);
+		delete stream;
+	}
+	double new_secs = stamps2sec(gettimestamp() - start);
+	start = gettimestamp();
+	for (uint i = 0; i < count; i++) {
+		geco_bit_stream_t* stream = geco_bit_stream_t::get_instance();
+		stream->Write(i);
+		geco_bit_stream_t::reclaim_instance(stream);
+	}
+	double pool_secs = stamps2sec(gettimestamp() - start);
+	printf("%u streams: new/delete %.3f ms, get_instance/reclaim_instance %.3f ms\n",
+		count, new_secs * 1000, pool_secs * 1000);
+}
+
+TEST(GecoMemoryStreamTestCase, test_haffman_table_decoder_same_as_tree_walk) {
+	HuffmanEncodingTree tree;
+	tree.GenerateFromFrequencyTable();
+
+	/// random bytes hit the long codes of the rarely used chars,
+	/// the odd start bit checks unaligned input
+	srand(2017);
+	std::vector<uchar> random(4099);
+	for (auto& c : random)
+		c = (uchar)rand();
+	geco_bit_stream_t compressed;
+	compressed.WriteBits(random.data(), 5);
+	tree.EncodeArray(random.data(), random.size(), &compressed);
+	bit_size_t bits = compressed.get_written_bits() - 5;
+
+	std::vector<uchar> walked(random.size()), looked_up(random.size());
+	uchar skip;
+	compressed.ReadBits(&skip, 5);
+	unsigned walked_size = tree.DecodeArrayByTreeWalk(&compressed, bits,
+		walked.size(), walked.data());
+	compressed.readable_bit_pos(5);
+	unsigned looked_up_size = tree.DecodeArray(&compressed, bits,
+		looked_up.size(), looked_up.data());
+	EXPECT_EQ(compressed.get_written_bits(), compressed.readable_bit_pos());
+	EXPECT_EQ(walked_size, looked_up_size);
+	EXPECT_TRUE(walked == looked_up);
+	EXPECT_TRUE(random == looked_up);
+
+	/// truncated input and a too small output buffer behave the same
+	for (bit_size_t cut = 1; cut < 64; cut += 3) {
+		compressed.readable_bit_pos(5);
+		walked_size = tree.DecodeArrayByTreeWalk(&compressed, bits - cut, 100,
+			walked.data());
+		compressed.readable_bit_pos(5);
+		looked_up_size = tree.DecodeArray(&compressed, bits - cut, 100,
+			looked_up.data());
+		EXPECT_EQ(walked_size, looked_up_size);
+		EXPECT_EQ(0, memcmp(walked.data(), looked_up.data(), 100));
+	}
+}
+
+TEST(GecoMemoryStreamTestCase, test_haffman_table_decoder_throughput) {
+	HuffmanEncodingTree tree;
+	tree.GenerateFromFrequencyTable();
+	const char* chats[] = {
+		"gg wp, see you in the next match",
+		"Anyone up for the raid tonight? Need a healer and two tanks.",
+		"Selling 20x iron ore, whisper me with offers",
+		"brb, dinner",
+		"The quick brown fox jumps over the lazy dog." };
+	std::string text;
+	while (text.size() < 64 * 1024)
+		text += chats[rand() % 5];
+
+	geco_bit_stream_t compressed;
+	tree.EncodeArray((uchar*)text.data(), text.size(), &compressed);
+	bit_size_t bits = compressed.get_written_bits();
+	std::vector<uchar> output(text.size());
+
+	const int rounds = 50;
+	uint64 start = gettimestamp();
+	for (int i = 0; i < rounds; i++) {
+		compressed.readable_bit_pos(0);
+		tree.DecodeArrayByTreeWalk(&compressed, bits, output.size(), output.data());
+	}
+	double walk_secs = stamps2sec(gettimestamp() - start);
+	EXPECT_EQ(0, memcmp(text.data(), output.data(), text.size()));
+
+	memset(output.data(), 0, output.size());
+	start = gettimestamp();
+	for (int i = 0; i < rounds; i++) {
+		compressed.readable_bit_pos(0);
+		tree.DecodeArray(&compressed, bits, output.size(), output.data());
+	}
+	double table_secs = stamps2sec(gettimestamp() - start);
+	EXPECT_EQ(0, memcmp(text.data(), output.data(), text.size()));
+
+	double mbytes = text.size() * rounds / 1024.0 / 1024.0;
+	printf("huffman decode %.1f MB: tree walk %.3f ms (%.1f MB/s), table %.3f ms (%.1f MB/s)\n",
+		mbytes, walk_secs * 1000, mbytes / walk_secs, table_secs * 1000,
+		mbytes / table_secs);
+}
@@ -0,0 +1,219 @@
+/*
+ * test-math.cc
+ *
+ *  batch math kernels against the scalar routines of geco-math-power.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "common/debugging/timestamp.h"
+#include "math/geco-math-power.h"
+#include "math/geco-math-direction.h"
+#include "math/geco-math-batch.h"
+
+static const char* isa_name(GecoBatchIsa isa)
+{
+    return isa == GECO_BATCH_AVX2 ? "avx2" : isa == GECO_BATCH_SSE2 ? "sse2" : "scalar";
+}
+
+/// entity positions spread over a 2km square, an odd count to exercise the tails
+struct batch_points_t
+{
+    explicit batch_points_t(uint count) : x(count), y(count), z(count)
+    {
+        GecoSrand(1234);
+        for (uint i = 0; i < count; i++)
+        {
+            x[i] = GecoRangeRandomf(-1000.f, 1000.f);
+            y[i] = GecoRangeRandomf(-50.f, 50.f);
+            z[i] = GecoRangeRandomf(-1000.f, 1000.f);
+        }
+    }
+    std::vector<float> x, y, z;
+};
+
+TEST(GECO_MATH_BATCH, results_match_scalar_routines)
+{
+    const uint COUNT = 1003;
+    batch_points_t points(COUNT);
+    float center[3] = { 12.5f, -3.f, 400.25f };
+    float mat[16];
+    GecoMatrixRotationYawPitchRoll4f(mat, 0.7f, -0.2f, 0.1f);
+    mat[12] = 10.f;
+    mat[13] = -4.f;
+    mat[14] = 2.5f;
+
+    std::vector<float> dist(COUNT), nx(COUNT), ny(COUNT), nz(COUNT), tx(COUNT), ty(COUNT), tz(COUNT);
+    std::vector<float> yaw(COUNT), pitch(COUNT);
+    std::vector<uchar> pyaw(COUNT), ppitch(COUNT);
+    for (uint i = 0; i < COUNT; i++)
+    {
+        yaw[i] = GecoRangeRandomf(-GECO_MATH_PI_F, GECO_MATH_PI_F);
+        pitch[i] = GecoRangeRandomf(-GECO_MATH_PI_2_F, GECO_MATH_PI_2_F);
+    }
+
+    GecoBatchIsa supported = GecoBatchSupportedIsa();
+    for (int isa = GECO_BATCH_SCALAR; isa <= supported; isa++)
+    {
+        EXPECT_EQ(GecoBatchSetIsa((GecoBatchIsa)isa), isa);
+        EXPECT_EQ(GecoBatchGetIsa(), isa);
+
+        GecoBatchDistanceSqr3f(&dist[0], &points.x[0], &points.y[0], &points.z[0], COUNT, center);
+        nx = points.x;
+        ny = points.y;
+        nz = points.z;
+        nx[5] = ny[5] = nz[5] = 0.f;
+        GecoBatchNormalize3f(&nx[0], &ny[0], &nz[0], COUNT);
+        GecoBatchTransformCoordM4f(&tx[0], &ty[0], &tz[0], &points.x[0], &points.y[0], &points.z[0],
+            COUNT, mat);
+        GecoBatchPackYawPitch(&pyaw[0], &ppitch[0], &yaw[0], &pitch[0], COUNT);
+
+        for (uint i = 0; i < COUNT; i++)
+        {
+            float p[3] = { points.x[i], points.y[i], points.z[i] };
+            float d[3];
+            GecoSub3f(d, p, center);
+            EXPECT_FLOAT_EQ(dist[i], GecoLengthSqr3f(d));
+
+            if (i == 5)
+            {
+                EXPECT_EQ(nx[i], 0.f);
+            }
+            else
+            {
+                float n[3];
+                GecoNormalize3f(n, p);
+                EXPECT_FLOAT_EQ(nx[i], n[0]);
+                EXPECT_FLOAT_EQ(ny[i], n[1]);
+                EXPECT_FLOAT_EQ(nz[i], n[2]);
+            }
+
+            float t[3];
+            GecoVector3TransformCoordM4f(t, p, mat);
+            EXPECT_FLOAT_EQ(tx[i], t[0]);
+            EXPECT_FLOAT_EQ(ty[i], t[1]);
+            EXPECT_FLOAT_EQ(tz[i], t[2]);
+
+            EXPECT_EQ(pyaw[i], AngleToInt8(yaw[i]));
+            EXPECT_EQ(ppitch[i], HalfAngleToInt8(pitch[i]));
+        }
+    }
+    // the edges of the packed ranges
+    float edgeYaw[8] = { -GECO_MATH_PI_F, -1e-7f, 0.f, 1e-7f, GECO_MATH_PI_F - 1e-6f, 3.f, -3.f, 1.f };
+    float edgePitch[8] = { -GECO_MATH_PI_2_F, GECO_MATH_PI_2_F - 1e-6f, 1.2f, -1.2f, 0.f, -1e-7f, 1.5f, -1.5f };
+    uchar eyaw[8], epitch[8];
+    GecoBatchPackYawPitch(eyaw, epitch, edgeYaw, edgePitch, 8);
+    for (uint i = 0; i < 8; i++)
+    {
+        EXPECT_EQ(eyaw[i], AngleToInt8(edgeYaw[i]));
+        EXPECT_EQ(epitch[i], HalfAngleToInt8(edgePitch[i]));
+    }
+    GecoBatchSetIsa(supported);
+}
+
+TEST(GECO_MATH_BATCH, benchmark_against_scalar_routines)
+{
+    const uint COUNT = 4096;
+    const int LOOPS = 200;
+    batch_points_t points(COUNT);
+    float center[3] = { 12.5f, -3.f, 400.25f };
+    float mat[16];
+    GecoMatrixRotationYawPitchRoll4f(mat, 0.7f, -0.2f, 0.1f);
+    std::vector<float> out(COUNT), nx(COUNT), ny(COUNT), nz(COUNT), tx(COUNT), ty(COUNT), tz(COUNT);
+    std::vector<float> aos(COUNT * 3);
+    std::vector<uchar> pyaw(COUNT), ppitch(COUNT);
+    for (uint i = 0; i < COUNT; i++)
+    {
+        aos[i * 3] = points.x[i];
+        aos[i * 3 + 1] = points.y[i];
+        aos[i * 3 + 2] = points.z[i];
+    }
+    volatile float sink = 0.f;
+
+    // scalar routines, one vector per call as the callers use them today
+    double scalarNs[4];
+    uint64 start = gettimestamp();
+    for (int l = 0; l < LOOPS; l++)
+    {
+        for (uint i = 0; i < COUNT; i++)
+        {
+            float d[3];
+            GecoSub3f(d, &aos[i * 3], center);
+            out[i] = GecoLengthSqr3f(d);
+        }
+        sink = sink + out[l];
+    }
+    scalarNs[0] = stamps2sec(gettimestamp() - start) * 1e9 / (LOOPS * COUNT);
+    start = gettimestamp();
+    for (int l = 0; l < LOOPS; l++)
+    {
+        for (uint i = 0; i < COUNT; i++)
+            GecoNormalize3f(&aos[i * 3], &aos[i * 3]);
+        sink = sink + aos[l];
+    }
+    scalarNs[1] = stamps2sec(gettimestamp() - start) * 1e9 / (LOOPS * COUNT);
+    start = gettimestamp();
+    for (int l = 0; l < LOOPS; l++)
+    {
+        for (uint i = 0; i < COUNT; i++)
+            GecoVector3TransformCoordM4f(&out[0], &aos[i * 3], mat);
+        sink = sink + out[0];
+    }
+    scalarNs[2] = stamps2sec(gettimestamp() - start) * 1e9 / (LOOPS * COUNT);
+    start = gettimestamp();
+    for (int l = 0; l < LOOPS; l++)
+    {
+        for (uint i = 0; i < COUNT; i++)
+        {
+            pyaw[i] = AngleToInt8(points.x[i] * 0.003f);
+            ppitch[i] = HalfAngleToInt8(points.y[i] * 0.03f);
+        }
+        sink = sink + pyaw[l];
+    }
+    scalarNs[3] = stamps2sec(gettimestamp() - start) * 1e9 / (LOOPS * COUNT);
+    printf("scalar  ns/elem: distSqr %.2f normalize %.2f transform %.2f packYawPitch %.2f\n",
+        scalarNs[0], scalarNs[1], scalarNs[2], scalarNs[3]);
+
+    for (uint i = 0; i < COUNT; i++)
+    {
+        points.x[i] *= 0.003f;
+        points.y[i] *= 0.03f;
+    }
+    GecoBatchIsa supported = GecoBatchSupportedIsa();
+    double batchNs[4];
+    for (int isa = GECO_BATCH_SCALAR; isa <= supported; isa++)
+    {
+        GecoBatchSetIsa((GecoBatchIsa)isa);
+        start = gettimestamp();
+        for (int l = 0; l < LOOPS; l++)
+            GecoBatchDistanceSqr3f(&out[0], &points.x[0], &points.y[0], &points.z[0], COUNT, center);
+        batchNs[0] = stamps2sec(gettimestamp() - start) * 1e9 / (LOOPS * COUNT);
+        nx = points.x;
+        ny = points.y;
+        nz = points.z;
+        start = gettimestamp();
+        for (int l = 0; l < LOOPS; l++)
+            GecoBatchNormalize3f(&nx[0], &ny[0], &nz[0], COUNT);
+        batchNs[1] = stamps2sec(gettimestamp() - start) * 1e9 / (LOOPS * COUNT);
+        start = gettimestamp();
+        for (int l = 0; l < LOOPS; l++)
+            GecoBatchTransformCoordM4f(&tx[0], &ty[0], &tz[0], &points.x[0], &points.y[0],
+                &points.z[0], COUNT, mat);
+        batchNs[2] = stamps2sec(gettimestamp() - start) * 1e9 / (LOOPS * COUNT);
+        start = gettimestamp();
+        for (int l = 0; l < LOOPS; l++)
+            GecoBatchPackYawPitch(&pyaw[0], &ppitch[0], &points.x[0], &points.y[0], COUNT);
+        batchNs[3] = stamps2sec(gettimestamp() - start) * 1e9 / (LOOPS * COUNT);
+        printf("batch %-6s ns/elem: distSqr %.2f normalize %.2f transform %.2f packYawPitch %.2f\n",
+            isa_name((GecoBatchIsa)isa), batchNs[0], batchNs[1], batchNs[2], batchNs[3]);
+    }
+    GecoBatchSetIsa(supported);
+    // the widest kernels must beat one call per vector
+    for (int k = 0; k < 4; k++)
+        EXPECT_LT(batchNs[k], scalarNs[k]);
+}
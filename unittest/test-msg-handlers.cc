@@ -5,9 +5,14 @@
  *      Author: jackiez
  */
 
+#include <new>
+#include <type_traits>
 #include "gtest/gtest.h"
 
 #include "network/net-types.h"
+#include "network/bundle.h"
+#include "network/network-interface.h"
+#include "common/debugging/timestamp.h"
 #include "test-msg-handlers.h"
 
 struct cell
@@ -18,6 +23,7 @@ struct cell
 		if (instance_)
 			return instance_;
 		instance_ = new cell;
+		return instance_;
 	}
 
 	int invoke_entity_mtd(const CELLAPP::cell_invoke_entity_mtd_with_cbidStructArgsType& invoke_entity_mtd_with_cbStructArgs)
@@ -130,6 +136,86 @@ void /*ProcessSocketStatsHelper::*/stopMessageHandling(network_recv_stats_t& rec
 	recv_stats.mercuryTimer_.stop();
 }
 
+/// counts what it is given, cheap so that the dispatch is what is measured
+struct CountingMsgHandler : public GecoNetInputMessageHandler
+{
+	uint64 numMessages_;
+	uint64 numBytes_;
+
+	CountingMsgHandler() : numMessages_(0), numBytes_(0)
+	{
+	}
+	int HandleMessage(const GecoNetAddress & from, GecoNetInterfaceElement& ie, geco_bit_stream_t & msgbody)
+	{
+		++numMessages_;
+		numBytes_ += BITS_TO_BYTES(msgbody.get_payloads());
+		return 0;
+	}
+};
+
+/// appends message @i: fixed, fixed, variable, unhandled in turn, every 9th
+/// a request when @requests. returns the body bytes a handler will see.
+static int add_dispatch_message(GecoNetBundle& bundle, GecoNetInterfaceElement& fixed_ie,
+	GecoNetInterfaceElement& variable_ie, GecoNetInterfaceElement& unhandled_ie, int i, bool requests)
+{
+	switch (i % 4)
+	{
+	case 0:
+	case 1:
+		if (requests && i % 9 == 0)
+			bundle.startRequest(fixed_ie, i);
+		else
+			bundle.startMessage(fixed_ie);
+		bundle << int64(i);
+		return sizeof(int64);
+	case 2:
+		if (requests && i % 9 == 0)
+			bundle.startRequest(variable_ie, i);
+		else
+			bundle.startMessage(variable_ie);
+		memset(bundle.reserve(i % 16), i & 0xFF, i % 16);
+		return i % 16;
+	default:
+		bundle.startMessage(unhandled_ie);
+		bundle << int32(i);
+		return 0;
+	}
+}
+
+/**
+*	This is the receive loop before the dispatch table: the element is looked
+*	up in the minder, the filter and the handler are called virtually. The
+*	messages of @pPacket must not continue in the next packet.
+*/
+static int dispatch_through_minder(GecoInterfaceMinder& minder, GecoMessageFilter* pFilter,
+	const GecoNetAddress& from, GecoNetPacket* pPacket)
+{
+	geco_bit_stream_t stream((uchar*)pPacket->m_acData, pPacket->m_iMsgEndOffset, false);
+	int numHandled = 0;
+	int offset = sizeof(GecoNetPacket::Flags);
+	while (offset < pPacket->m_iMsgEndOffset)
+	{
+		GecoNetInterfaceElementWithStats& ie = minder.elements_[(GecoNetMessageID)pPacket->m_acData[offset]];
+		int length = ie.NominalBodySize();
+		if (ie.LengthStyle() == VARIABLE_LENGTH_MESSAGE)
+			length = GECO_HTONS(*(ushort*)(pPacket->m_acData + offset + 1));
+		offset += ie.HeaderSize();
+		stream.readable_bit_pos(BYTES_TO_BITS(offset));
+		stream.writable_bit_pos(BYTES_TO_BITS(offset + length));
+		offset += length;
+		if (!pFilter->filterMessage(from, ie, stream) && ie.GetHandler())
+		{
+			if (g_enable_stats)
+				ie.startProfile();
+			ie.GetHandler()->HandleMessage(from, ie, stream);
+			if (g_enable_stats)
+				ie.stopProfile(length);
+			++numHandled;
+		}
+	}
+	return numHandled;
+}
+
 TEST(geco_engine_network, test_msg_handler_macros)
 {
 	// sctp receive() returns a complete msg at one time and so msg is the smallest logic unit.
@@ -189,8 +275,186 @@ TEST(geco_engine_network, test_msg_handler_macros)
 	{
 		stream.Read(msgid);
 		// 6. find ie vased on id here we just assign it as we are testing
-		ie = CLIENTAPP::client_invoke_entity_mtd;
-		CLIENTAPP::client_invoke_entity_mtd.GetHandler()->HandleMessage(from, ie, stream);
+		GecoNetInterfaceElementWithStats& reply_ie = CLIENTAPP::client_invoke_entity_mtd;
+		reply_ie.GetHandler()->HandleMessage(from, reply_ie, stream);
 	}
 }
 
+
+TEST(geco_engine_network, test_msg_dispatch_table)
+{
+	// 1. the macros tell the minder the handler types, the table calls them directly
+	GecoNetworkInterface networkInterface;
+	CELLAPP::registerWithInterface(networkInterface);
+	GecoNetDispatchTable& table = networkInterface.dispatchTable();
+	ASSERT_EQ((int)CELLAPP::gMinder.elements_.size(), table.numRegistered());
+	const GecoNetDispatchEntry& cellEntry = table.entry(CELLAPP::cell_invoke_entity_mtd_with_cbid.GetID());
+	ASSERT_TRUE(cellEntry.pFunc_ == &GecoNetCallMessageHandler<CellEntityMsgHandler>);
+	ASSERT_EQ(&CELLAPP::cell_invoke_entity_mtd_with_cbid, cellEntry.pElement_);
+	ASSERT_EQ(FIXED_LENGTH_MESSAGE, cellEntry.lengthStyle_);
+	// its HandleMessage() is private, the virtual call
+	CLIENTAPP::registerWithInterface(networkInterface);
+	ASSERT_TRUE(table.entry(CLIENTAPP::client_invoke_entity_mtd.GetID()).pFunc_ ==
+		&GecoNetCallMessageHandler<GecoNetInputMessageHandler>);
+
+	// 2. a bundle's packets, requests and all, walk back to the messages added
+	CountingMsgHandler handler;
+	GecoInterfaceMinder minder("DISPATCH");
+	GecoNetInterfaceElementWithStats& fixed_ie = minder.add("fixed", FIXED_LENGTH_MESSAGE, sizeof(int64), &handler);
+	GecoNetInterfaceElementWithStats& variable_ie = minder.add("variable", VARIABLE_LENGTH_MESSAGE, 2, &handler);
+	GecoNetInterfaceElementWithStats& unhandled_ie = minder.add("unhandled", FIXED_LENGTH_MESSAGE, sizeof(int32));
+	minder.registerWithInterface(networkInterface);
+	ASSERT_EQ(3, table.numRegistered());
+	ASSERT_TRUE(table.entry(fixed_ie.GetID()).pFunc_ == &GecoNetCallMessageHandler<CountingMsgHandler>);
+	ASSERT_TRUE(table.entry(unhandled_ie.GetID()).pFunc_ == NULL);
+	ASSERT_EQ(INVALID_MESSAGE, table.entry(200).lengthStyle_);
+
+	const int COUNT = 5000;
+	GecoNetPacketPool pool;
+	GecoNetBundle bundle(pool);
+	uint64 bytes = 0;
+	for (int i = 0; i < COUNT; i++)
+		bytes += add_dispatch_message(bundle, fixed_ie, variable_ie, unhandled_ie, i, true);
+	bundle.finalise();
+	ASSERT_GT(bundle.numPackets(), 1);
+
+	// some variable bodies continue in the next packet
+	const GecoNetAddress from;
+	int handled = table.processBundle(from, bundle.pFirstPacket());
+	ASSERT_EQ(COUNT - COUNT / 4, handled);
+	ASSERT_EQ((uint64)handled, handler.numMessages_);
+	ASSERT_EQ(bytes, handler.numBytes_);
+	ASSERT_EQ(uint64(COUNT / 2), fixed_ie.NumMessagesReceived());
+
+	// 3. filtered messages do not reach their handler
+	struct DropMsgFilter : public GecoMessageFilter
+	{
+		GecoNetMessageID id_;
+		bool filterMessage(const GecoNetAddress & from, GecoNetInterfaceElement& ie, geco_bit_stream_t & msgbody)
+		{
+			return ie.GetID() == id_;
+		}
+	} dropFixed;
+	dropFixed.id_ = fixed_ie.GetID();
+	ASSERT_EQ(COUNT / 4, table.processBundle(from, bundle.pFirstPacket(), &dropFixed));
+
+	// 4. a cut packet or an id nobody registered stops the walk
+	bundle.clear();
+	bundle.startMessage(fixed_ie);
+	bundle << int64(1);
+	bundle.finalise();
+	GecoNetPacket* pPacket = bundle.pFirstPacket();
+	pPacket->m_iMsgEndOffset -= 3;
+	ASSERT_EQ(-1, table.processBundle(from, pPacket));
+	pPacket->m_iMsgEndOffset += 3;
+	ASSERT_EQ(1, table.processBundle(from, pPacket));
+	pPacket->m_acData[sizeof(GecoNetPacket::Flags)] = 200;
+	ASSERT_EQ(-1, table.processBundle(from, pPacket));
+
+	// 5. a handler of a derived class added as its base gets the virtual call
+	struct DerivedMsgHandler : public CountingMsgHandler
+	{
+		int numDerived_;
+		DerivedMsgHandler() : numDerived_(0)
+		{
+		}
+		int HandleMessage(const GecoNetAddress & from, GecoNetInterfaceElement& ie, geco_bit_stream_t & msgbody)
+		{
+			++numDerived_;
+			return CountingMsgHandler::HandleMessage(from, ie, msgbody);
+		}
+	} derived;
+	GecoInterfaceMinder derivedMinder("DERIVED");
+	CountingMsgHandler* pBase = &derived;
+	GecoNetInterfaceElementWithStats& derived_ie = derivedMinder.add("derived", FIXED_LENGTH_MESSAGE,
+		sizeof(int64), pBase);
+	derivedMinder.registerWithInterface(networkInterface);
+	ASSERT_TRUE(table.entry(derived_ie.GetID()).pFunc_ == &GecoNetCallMessageHandler<GecoNetInputMessageHandler>);
+	bundle.clear();
+	bundle.startMessage(derived_ie);
+	bundle << int64(1);
+	bundle.finalise();
+	ASSERT_EQ(1, table.processBundle(from, bundle.pFirstPacket()));
+	ASSERT_EQ(1, derived.numDerived_);
+
+	// 6. a handler constructed after add(), as when GECO_MESSAGE runs before
+	// the handler's own static initialiser, still gets the direct call
+	GecoInterfaceMinder lateMinder("LATE");
+	std::aligned_storage<sizeof(CountingMsgHandler), alignof(CountingMsgHandler)>::type lateStorage;
+	CountingMsgHandler* pLate = reinterpret_cast<CountingMsgHandler*>(&lateStorage);
+	GecoNetInterfaceElementWithStats& late_ie = lateMinder.add("late", FIXED_LENGTH_MESSAGE,
+		sizeof(int64), pLate);
+	new (pLate) CountingMsgHandler();
+	lateMinder.registerWithInterface(networkInterface);
+	ASSERT_TRUE(table.entry(late_ie.GetID()).pFunc_ == &GecoNetCallMessageHandler<CountingMsgHandler>);
+	pLate->~CountingMsgHandler();
+}
+
+TEST(geco_engine_network, test_msg_dispatch_table_benchmark)
+{
+	const int COUNT = 100000;
+	const int ROUNDS = 20;
+	CountingMsgHandler handler;
+	GecoInterfaceMinder minder("BENCH");
+	GecoNetInterfaceElementWithStats& fixed_ie = minder.add("fixed", FIXED_LENGTH_MESSAGE, sizeof(int64), &handler);
+	GecoNetInterfaceElementWithStats& unhandled_ie = minder.add("unhandled", FIXED_LENGTH_MESSAGE, sizeof(int32));
+	GecoNetworkInterface networkInterface;
+	minder.registerWithInterface(networkInterface);
+	GecoNetDispatchTable& table = networkInterface.dispatchTable();
+
+	// fixed length messages only, which never continue in the next packet
+	GecoNetPacketPool pool;
+	GecoNetBundle bundle(pool);
+	for (int i = 0; i < COUNT; i++)
+	{
+		if (i % 4 == 3)
+		{
+			bundle.startMessage(unhandled_ie);
+			bundle << int32(i);
+		}
+		else
+		{
+			bundle.startMessage(fixed_ie);
+			bundle << int64(i);
+		}
+	}
+	bundle.finalise();
+
+	// the profiles cost the same either way, leave them out of the dispatch
+	bool enable_stats = g_enable_stats;
+	g_enable_stats = false;
+	const GecoNetAddress from;
+	// the filter comes from the channel, the compiler must not see its type
+	MyMsgFilter filter;
+	GecoMessageFilter* volatile pFilter = &filter;
+	// the best of a few interleaved repeats, the machine is shared
+	double rates[3] = { 0, 0, 0 };
+	for (int repeat = 0; repeat < 5; repeat++)
+	{
+		for (int pass = 0; pass < 3; pass++)
+		{
+			handler.numMessages_ = 0;
+			uint64 start = gettimestamp();
+			for (int round = 0; round < ROUNDS; round++)
+			{
+				if (pass == 0)
+				{
+					for (GecoNetPacket* pPacket = bundle.pFirstPacket(); pPacket; pPacket = pPacket->Next())
+						dispatch_through_minder(minder, pFilter, from, pPacket);
+				}
+				else
+				{
+					table.processBundle(from, bundle.pFirstPacket(), pass == 1 ? pFilter : NULL);
+				}
+			}
+			double rate = double(COUNT) * ROUNDS / stamps2sec(gettimestamp() - start);
+			if (rate > rates[pass])
+				rates[pass] = rate;
+			ASSERT_EQ(uint64(COUNT - COUNT / 4) * ROUNDS, handler.numMessages_);
+		}
+	}
+	g_enable_stats = enable_stats;
+
+	printf("dispatch: minder and virtual calls %.1f M msgs/s, table with filter %.1f M msgs/s, "
+		"table without filter %.1f M msgs/s\n", rates[0] / 1e6, rates[1] / 1e6, rates[2] / 1e6);
+}
@@ -0,0 +1,234 @@
+/*
+ * test-network-interface.cc
+ *
+ *  epoll event loop of GecoNetworkInterface
+ */
+
+#include <sys/socket.h>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "network/network-interface.h"
+#include "common/debugging/timestamp.h"
+
+struct counting_datagram_handler_t: public GecoNetDatagramHandler
+{
+    counting_datagram_handler_t() :
+            datagrams(0), batches(0), bytes(0)
+    {
+    }
+    virtual void handleDatagrams(GecoNetEndpoint & endpoint, GecoNetPacket* const * packets,
+        const GecoNetAddress* srcs, int count)
+    {
+        datagrams += count;
+        batches++;
+        for (int i = 0; i < count; i++)
+            bytes += packets[i]->m_iMsgEndOffset;
+    }
+    int datagrams;
+    int batches;
+    int bytes;
+};
+
+static void break_timeout(TimerID id, void * pUser)
+{
+    ((GecoNetworkInterface*) pUser)->breakProcessing();
+}
+static void count_timeout(TimerID id, void * pUser)
+{
+    ++*(int*) pUser;
+}
+static void ignore_release(TimerID id, void * pUser)
+{
+}
+
+TEST(network, test_network_interface_datagrams_and_timers)
+{
+    const int COUNT = 150;
+    GecoNetworkInterface ni;
+    counting_datagram_handler_t handler;
+    ASSERT_TRUE(ni.initEndpoint(0, "127.0.0.1", &handler));
+    ASSERT_EQ(1, ni.numRegistered());
+    ASSERT_NE(0, ntohs(ni.address().su.sin.sin_port));
+
+    GecoNetEndpoint sender;
+    sender.Socket(AF_INET, SOCK_DGRAM);
+    static GecoNetPacket packets[COUNT];
+    GecoNetPacket* out[COUNT];
+    GecoNetAddress to[COUNT];
+    for (int i = 0; i < COUNT; i++)
+    {
+        packets[i].m_iMsgEndOffset = 10;
+        out[i] = &packets[i];
+        to[i] = ni.address();
+    }
+    ASSERT_EQ(COUNT, sender.SendMany(out, to, COUNT));
+
+    // the repeating timer ticks while the once off one is pending, then the
+    // loop breaks
+    TimerHandler breaker, ticker;
+    breaker.handleTimeout = break_timeout;
+    breaker.onRelease = ignore_release;
+    ticker.handleTimeout = count_timeout;
+    ticker.onRelease = ignore_release;
+    int ticks = 0;
+    TimerID tickID = ni.addTimer(5000, &ticker, &ticks);
+    ni.addOnceOffTimer(30000, &breaker, &ni);
+    uint64 start = gettimestamp();
+    ni.processContinuously();
+    double elapsed = stamps2sec(gettimestamp() - start);
+    tickID.cancel();
+
+    ASSERT_EQ(COUNT, handler.datagrams);
+    ASSERT_EQ(COUNT * 10, handler.bytes);
+    // 150 datagrams in 64 datagram batches
+    ASSERT_EQ(3, handler.batches);
+    ASSERT_GE(ticks, 4);
+    ASSERT_GE(elapsed, 0.029);
+    // the wait ended on the timers instead of spinning
+    ASSERT_GT(ni.spareTime(), 0u);
+
+    ASSERT_TRUE(ni.deregisterEndpoint(ni.endpoint()));
+    ASSERT_FALSE(ni.deregisterEndpoint(ni.endpoint()));
+    ASSERT_EQ(0, ni.numRegistered());
+    ASSERT_EQ(0, ni.processOnce(0.0));
+}
+
+/// reads until EAGAIN as the edge triggered wait requires
+struct draining_input_handler_t: public GecoNetInputNotificationHandler
+{
+    draining_input_handler_t() :
+            notifications(0)
+    {
+    }
+    virtual int handleInputNotification(int fd)
+    {
+        char buf[64];
+        while (::recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+        {
+        }
+        notifications++;
+        return 0;
+    }
+    int notifications;
+};
+
+struct writable_handler_t: public GecoNetOutputNotificationHandler
+{
+    writable_handler_t() :
+            notifications(0)
+    {
+    }
+    virtual int handleOutputNotification(int fd)
+    {
+        notifications++;
+        return 0;
+    }
+    int notifications;
+};
+
+TEST(network, test_network_interface_edge_triggered_links)
+{
+    int sv[2];
+    ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+    GecoNetworkInterface ni;
+    draining_input_handler_t input;
+    writable_handler_t output;
+    ASSERT_TRUE(ni.registerFileDescriptor(sv[0], &input));
+    ASSERT_FALSE(ni.registerFileDescriptor(sv[0], &input));
+    ASSERT_TRUE(ni.registerWriteFileDescriptor(sv[0], &output));
+    ASSERT_EQ(1, ni.numRegistered());
+
+    // writable once, the edge is not reported again
+    ASSERT_EQ(1, ni.processOnce(0.0));
+    ASSERT_EQ(1, output.notifications);
+    ASSERT_EQ(0, ni.processOnce(0.0));
+
+    // the new edge reports the whole ready mask, writable again included
+    ASSERT_EQ(3, ::send(sv[1], "abc", 3, 0));
+    ASSERT_GE(ni.processOnce(0.0), 1);
+    ASSERT_EQ(1, input.notifications);
+    ASSERT_EQ(0, ni.processOnce(0.0));
+
+    ASSERT_TRUE(ni.deregisterWriteFileDescriptor(sv[0]));
+    ASSERT_TRUE(ni.deregisterFileDescriptor(sv[0]));
+    ASSERT_EQ(0, ni.numRegistered());
+    ASSERT_EQ(3, ::send(sv[1], "abc", 3, 0));
+    ASSERT_EQ(0, ni.processOnce(0.0));
+    ::close(sv[0]);
+    ::close(sv[1]);
+}
+
+TEST(network, test_network_interface_dispatch_benchmark)
+{
+    // select() cannot go past FD_SETSIZE, it gets the links that fit
+    const int LINKS = 2000;
+    const int SELECT_LINKS = (FD_SETSIZE - 64) / 2;
+    const int ROUNDS = 5000;
+    std::vector<int> ours, theirs;
+    for (int i = 0; i < LINKS; i++)
+    {
+        int sv[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+            break;
+        ours.push_back(sv[0]);
+        theirs.push_back(sv[1]);
+    }
+    int links = (int) ours.size();
+    ASSERT_GT(links, SELECT_LINKS);
+
+    draining_input_handler_t handler;
+    GecoNetworkInterface ni;
+    for (int i = 0; i < links; i++)
+        ASSERT_TRUE(ni.registerFileDescriptor(ours[i], &handler));
+
+    // one link ready per wait, as a busy server sees most of the time
+    GecoSrand(99);
+    uint64 start = gettimestamp();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        ::send(theirs[GecoRand() % links], "x", 1, 0);
+        ni.processOnce(0.0);
+    }
+    double epollUs = stamps2sec(gettimestamp() - start) * 1e6 / ROUNDS;
+    ASSERT_EQ(ROUNDS, handler.notifications);
+
+    // the old nub's loop over the first SELECT_LINKS
+    int selected = 0;
+    int fdLargest = 0;
+    for (int i = 0; i < SELECT_LINKS; i++)
+        fdLargest = ours[i] > fdLargest ? ours[i] : fdLargest;
+    ASSERT_LT(fdLargest, FD_SETSIZE);
+    start = gettimestamp();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        ::send(theirs[GecoRand() % SELECT_LINKS], "x", 1, 0);
+        fd_set readFDs;
+        FD_ZERO(&readFDs);
+        for (int i = 0; i < SELECT_LINKS; i++)
+            FD_SET(ours[i], &readFDs);
+        timeval tv = { 0, 0 };
+        int countReady = ::select(fdLargest + 1, &readFDs, NULL, NULL, &tv);
+        for (int i = 0; countReady > 0 && i < SELECT_LINKS; i++)
+        {
+            if (FD_ISSET(ours[i], &readFDs))
+            {
+                handler.handleInputNotification(ours[i]);
+                selected++;
+                countReady--;
+            }
+        }
+    }
+    double selectUs = stamps2sec(gettimestamp() - start) * 1e6 / ROUNDS;
+    ASSERT_EQ(ROUNDS, selected);
+
+    printf("one ready link per wait: epoll %d links %.2f us, select %d links %.2f us\n",
+        links, epollUs, SELECT_LINKS, selectUs);
+
+    for (int i = 0; i < links; i++)
+    {
+        ni.deregisterFileDescriptor(ours[i]);
+        ::close(ours[i]);
+        ::close(theirs[i]);
+    }
+}
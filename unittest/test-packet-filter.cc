@@ -0,0 +1,292 @@
+/*
+ * test-packet-filter.cc
+ *
+ *  CRC32C, the AEAD filter and its key schedule, against the legacy
+ *  xor checksum and Blowfish ECB filter
+ */
+
+#include <string.h>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "network/packet-filter.h"
+#include "network/bundle.h"
+#include "common/debugging/timestamp.h"
+#include "openssl/blowfish.h"
+
+static const uchar test_secret[] = "session secret agreed at login";
+
+/// a packet of @length bytes after the flags, filled from @seed
+static void fill_packet(GecoNetPacket & packet, int length, int seed)
+{
+    memset(packet.m_acData, 0, 2);
+    for (int i = 0; i < length; i++)
+        packet.m_acData[2 + i] = char(seed * 31 + i * 7);
+    packet.m_iMsgEndOffset = 2 + length;
+}
+
+TEST(network, test_crc32c)
+{
+    ASSERT_EQ(0xE3069283u, GecoCrc32c("123456789", 9));
+    ASSERT_EQ(0xE3069283u, GecoCrc32cSoftware("123456789", 9));
+    ASSERT_EQ(0u, GecoCrc32c("", 0));
+
+    // every length and alignment, in one go and continued
+    std::vector<char> buf(600);
+    for (size_t i = 0; i < buf.size(); i++)
+        buf[i] = char(GecoRand());
+    for (int offset = 0; offset < 8; offset++)
+    {
+        for (int length = 0; length < 520; length += 1 + length / 16)
+        {
+            uint32 crc = GecoCrc32cSoftware(&buf[offset], length);
+            ASSERT_EQ(crc, GecoCrc32c(&buf[offset], length));
+            int half = length / 3;
+            ASSERT_EQ(crc, GecoCrc32c(&buf[offset + half], length - half, GecoCrc32c(&buf[offset], half)));
+        }
+    }
+    printf("crc32c uses the %s\n", GecoCrc32cHardware() ? "sse4.2 instruction" : "slicing-by-8 table");
+}
+
+TEST(network, test_checksum_filter)
+{
+    GecoNetChecksumFilter filter;
+    GecoNetPacket packet;
+    fill_packet(packet, 100, 1);
+    ASSERT_TRUE(filter.send(&packet));
+    ASSERT_EQ(2 + 100 + GecoNetChecksumFilter::CHECKSUM_SIZE, packet.m_iMsgEndOffset);
+    GecoNetPacket copy = packet;
+    ASSERT_TRUE(filter.recv(&copy));
+    ASSERT_EQ(102, copy.m_iMsgEndOffset);
+
+    packet.m_acData[50] ^= 0x10;
+    ASSERT_FALSE(filter.recv(&packet));
+
+    // no room left for the checksum
+    fill_packet(packet, PACKET_MAX_SIZE - 2, 1);
+    ASSERT_FALSE(filter.send(&packet));
+}
+
+TEST(network, test_aead_filter)
+{
+    for (int cipher = GECO_NET_CIPHER_AES_128_GCM; cipher <= GECO_NET_CIPHER_CHACHA20_POLY1305; cipher++)
+    {
+        if (!GecoNetAeadFilter::isSupported((GecoNetCipher) cipher))
+        {
+            printf("cipher %d is not supported by this OpenSSL\n", cipher);
+            continue;
+        }
+        GecoNetChannelKeys clientKeys(test_secret, sizeof(test_secret), 7, false);
+        GecoNetChannelKeys serverKeys(test_secret, sizeof(test_secret), 7, true);
+        GecoNetChannelKeys otherChannel(test_secret, sizeof(test_secret), 8, true);
+        ASSERT_EQ(0, memcmp(clientKeys.sendKey_, serverKeys.recvKey_, GecoNetChannelKeys::KEY_SIZE));
+        ASSERT_EQ(0, memcmp(clientKeys.recvSalt_, serverKeys.sendSalt_, GecoNetChannelKeys::SALT_SIZE));
+        ASSERT_NE(0, memcmp(clientKeys.sendKey_, clientKeys.recvKey_, GecoNetChannelKeys::KEY_SIZE));
+        ASSERT_NE(0, memcmp(serverKeys.recvKey_, otherChannel.recvKey_, GecoNetChannelKeys::KEY_SIZE));
+
+        GecoNetAeadFilter client((GecoNetCipher) cipher, clientKeys);
+        GecoNetAeadFilter server((GecoNetCipher) cipher, serverKeys);
+        GecoNetAeadFilter other((GecoNetCipher) cipher, otherChannel);
+        ASSERT_TRUE(client.good());
+        ASSERT_TRUE(server.good());
+
+        // both ways, the body is not readable on the wire
+        GecoNetPacket packets[4], plain;
+        for (int i = 0; i < 4; i++)
+        {
+            fill_packet(packets[i], 200 + i, i);
+            packets[i].m_acData[0] = 0x01;
+            plain = packets[i];
+            ASSERT_TRUE(client.send(&packets[i]));
+            ASSERT_EQ(plain.m_iMsgEndOffset + client.maxSpareSize(), packets[i].m_iMsgEndOffset);
+            ASSERT_EQ(0x01, packets[i].m_acData[0]);
+            ASSERT_NE(0, memcmp(plain.m_acData + 2, packets[i].m_acData + 2, 200));
+        }
+        GecoNetPacket reply;
+        fill_packet(reply, 30, 9);
+        plain = reply;
+        ASSERT_TRUE(server.send(&reply));
+        ASSERT_TRUE(client.recv(&reply));
+        ASSERT_EQ(plain.m_iMsgEndOffset, reply.m_iMsgEndOffset);
+        ASSERT_EQ(0, memcmp(plain.m_acData, reply.m_acData, plain.m_iMsgEndOffset));
+
+        // a forged flag, body or tag, or the wrong channel, is refused
+        GecoNetPacket forged = packets[0];
+        forged.m_acData[0] = 0x03;
+        ASSERT_FALSE(server.recv(&forged));
+        forged = packets[0];
+        forged.m_acData[100] ^= 1;
+        ASSERT_FALSE(server.recv(&forged));
+        forged = packets[0];
+        forged.m_acData[forged.m_iMsgEndOffset - 1] ^= 1;
+        ASSERT_FALSE(server.recv(&forged));
+        forged = packets[0];
+        ASSERT_FALSE(other.recv(&forged));
+        ASSERT_EQ(3u, server.numForged());
+
+        // reordered packets are fine, replayed ones are not
+        GecoNetPacket replay = packets[3];
+        ASSERT_TRUE(server.recv(&packets[3]));
+        ASSERT_TRUE(server.recv(&packets[1]));
+        ASSERT_TRUE(server.recv(&packets[0]));
+        ASSERT_FALSE(server.recv(&replay));
+        ASSERT_EQ(1u, server.numReplayed());
+        fill_packet(plain, 202, 2);
+        plain.m_acData[0] = 0x01;
+        ASSERT_TRUE(server.recv(&packets[2]));
+        ASSERT_EQ(0, memcmp(plain.m_acData, packets[2].m_acData, plain.m_iMsgEndOffset));
+
+        // older than the replay window
+        GecoNetPacket old;
+        fill_packet(old, 10, 0);
+        ASSERT_TRUE(client.send(&old));
+        for (int i = 0; i < GecoNetAeadFilter::REPLAY_WINDOW; i++)
+        {
+            fill_packet(reply, 10, 0);
+            ASSERT_TRUE(client.send(&reply));
+            ASSERT_TRUE(server.recv(&reply));
+        }
+        ASSERT_FALSE(server.recv(&old));
+    }
+}
+
+TEST(network, test_aead_filter_on_bundle_arena)
+{
+    if (!GecoNetAeadFilter::isSupported(GECO_NET_CIPHER_AES_128_GCM))
+    {
+        printf("aes-128-gcm is not supported by this OpenSSL\n");
+        return;
+    }
+    GecoNetEndpoint sender, receiver;
+    GecoNetAddress addr(0, "127.0.0.1");
+    sender.Socket(AF_INET, SOCK_DGRAM);
+    receiver.Socket(AF_INET, SOCK_DGRAM);
+    ASSERT_EQ(0, receiver.Bind(addr));
+    ASSERT_EQ(0, receiver.GetLocalAddress(&addr));
+
+    GecoNetChannelKeys clientKeys(test_secret, sizeof(test_secret), 1, false);
+    GecoNetChannelKeys serverKeys(test_secret, sizeof(test_secret), 1, true);
+    GecoNetAeadFilter client(GECO_NET_CIPHER_AES_128_GCM, clientKeys);
+    GecoNetAeadFilter server(GECO_NET_CIPHER_AES_128_GCM, serverKeys);
+
+    GecoNetPacketPool pool;
+    GecoNetBundleArena arena(pool, client.maxSpareSize());
+    GecoNetInterfaceElement ie("fixed", 1, FIXED_LENGTH_MESSAGE, sizeof(int64));
+    const int COUNT = 500;
+    GecoNetBundle & bundle = arena.bundle(addr, &client);
+    for (int i = 0; i < COUNT; i++)
+    {
+        bundle.startMessage(ie);
+        bundle << int64(i);
+    }
+    int packets = bundle.numPackets();
+    ASSERT_EQ(packets, arena.send(sender));
+
+    // full packets still fit with the tag
+    static GecoNetPacket received[16];
+    GecoNetPacket * in[16];
+    GecoNetAddress from[16];
+    for (int i = 0; i < 16; i++)
+        in[i] = &received[i];
+    ASSERT_EQ(packets, receiver.RecvMany(in, from, 16));
+    int messages = 0;
+    for (int p = 0; p < packets; p++)
+    {
+        ASSERT_TRUE(server.recv(in[p]));
+        for (const char * pMsg = in[p]->Body(); pMsg < in[p]->Back(); pMsg += 9, messages++)
+        {
+            ASSERT_EQ(1, pMsg[0]);
+            ASSERT_EQ(messages, *(int64*) (pMsg + 1));
+        }
+    }
+    ASSERT_EQ(COUNT, messages);
+}
+
+/// the old nub's checksum, a xor of the packet's words
+static uint32 legacy_xor_checksum(const GecoNetPacket & packet)
+{
+    uint32 sum = 0;
+    const uint32 * pWord = (const uint32*) packet.m_acData;
+    for (int i = 0; i < packet.m_iMsgEndOffset / 4; i++)
+        sum ^= pWord[i];
+    return sum;
+}
+
+TEST(network, test_packet_filter_benchmark)
+{
+    const int COUNT = 20000;
+    const int LENGTH = 1400;
+    GecoNetPacket packet;
+    fill_packet(packet, LENGTH, 5);
+    double mb = double(COUNT) * LENGTH / (1024 * 1024);
+    volatile uint32 sink = 0;
+
+    uint64 start = gettimestamp();
+    for (int i = 0; i < COUNT; i++)
+        sink = sink + legacy_xor_checksum(packet);
+    double xorMBs = mb / stamps2sec(gettimestamp() - start);
+    start = gettimestamp();
+    for (int i = 0; i < COUNT; i++)
+        sink = sink + GecoCrc32cSoftware(packet.m_acData, packet.m_iMsgEndOffset);
+    double crcSoftMBs = mb / stamps2sec(gettimestamp() - start);
+    start = gettimestamp();
+    for (int i = 0; i < COUNT; i++)
+        sink = sink + GecoCrc32c(packet.m_acData, packet.m_iMsgEndOffset);
+    double crcMBs = mb / stamps2sec(gettimestamp() - start);
+
+    // the old encryption filter, one BF_ecb_encrypt per 8 byte block. the
+    // low level cipher calls are deprecated since OpenSSL 3.0
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#elif defined(_MSC_VER)
+#pragma warning(push)
+#pragma warning(disable: 4996)
+#endif
+    BF_KEY bfKey;
+    BF_set_key(&bfKey, sizeof(test_secret), test_secret);
+    start = gettimestamp();
+    for (int i = 0; i < COUNT; i++)
+    {
+        uchar * pData = (uchar*) packet.m_acData;
+        for (int b = 0; b + 8 <= LENGTH; b += 8)
+            BF_ecb_encrypt(pData + b, pData + b, &bfKey, BF_ENCRYPT);
+    }
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#elif defined(_MSC_VER)
+#pragma warning(pop)
+#endif
+    double blowfishMBs = mb / stamps2sec(gettimestamp() - start);
+
+    printf("checksum MB/s: legacy xor %.0f, crc32c table %.0f, crc32c %.0f\n", xorMBs, crcSoftMBs, crcMBs);
+    printf("encryption MB/s: legacy blowfish ecb %.0f (no authentication)", blowfishMBs);
+    GecoNetChannelKeys keys(test_secret, sizeof(test_secret), 3, false);
+    double aesMBs = 0;
+    for (int cipher = GECO_NET_CIPHER_AES_128_GCM; cipher <= GECO_NET_CIPHER_CHACHA20_POLY1305; cipher++)
+    {
+        if (!GecoNetAeadFilter::isSupported((GecoNetCipher) cipher))
+            continue;
+        GecoNetAeadFilter filter((GecoNetCipher) cipher, keys);
+        start = gettimestamp();
+        for (int i = 0; i < COUNT; i++)
+        {
+            packet.m_iMsgEndOffset = 2 + LENGTH;
+            filter.send(&packet);
+        }
+        double MBs = mb / stamps2sec(gettimestamp() - start);
+        if (cipher == GECO_NET_CIPHER_AES_128_GCM)
+            aesMBs = MBs;
+        printf(", %s %.0f", cipher == GECO_NET_CIPHER_AES_128_GCM ? "aes-128-gcm" : "chacha20-poly1305", MBs);
+    }
+    printf("\n");
+
+    if (GecoCrc32cHardware())
+    {
+        EXPECT_GT(crcMBs, crcSoftMBs);
+    }
+    if (GecoNetAeadFilter::isSupported(GECO_NET_CIPHER_AES_128_GCM))
+    {
+        EXPECT_GT(aesMBs, blowfishMBs);
+    }
+}
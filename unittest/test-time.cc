@@ -14,14 +14,22 @@
 #include <functional>
 #include <math.h>
 #include <stdlib.h> 
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <algorithm>
 
 #include "gtest/gtest.h"
 
 #include "common/debugging/debug.h"
 #include "common/geco-plateform.h"
 #include "common/ultils/geco-ds-wheel-timer.h"
+#include "common/ultils/geco-ds-iwheel-timer.h"
 #include "common/debugging/timestamp.h"
 #include "common/debugging/timer_queue_t.h"
+#include "common/debugging/concurrent_profile_t.h"
+#include "common/debugging/gecowatchert.h"
 #include "network/networkstats.h"
 
 using namespace geco::debugging;
@@ -46,6 +54,216 @@ TEST(TIME, test_profile)
 	std::cout << _localProfile;
 }
 
+TEST(TIME, test_profile_capture)
+{
+	ProfileGroup group;
+	ProfileVal outer("capture_outer", &group);
+	ProfileVal inner("capture_inner", &group);
+	ProfileVal spanning("capture_spanning", &group);
+
+	ProfileCapture::enable(true, 1024, 8);
+	ProfileCapture::clear();
+	const char* prefix = "geco-capture-test";
+	ProfileCapture::setTickBudget(0.015, prefix);
+
+	// started in one tick and stopped in the next
+	spanning.start();
+	for (int tick = 0; tick < 12; tick++)
+	{
+		outer.start();
+		for (int i = 0; i < 2; i++)
+		{
+			inner.start();
+			if (tick == 10 && i == 1)
+				std::this_thread::sleep_for(std::chrono::milliseconds(20)); // blows the budget
+			inner.stop();
+		}
+		outer.stop();
+		if (tick == 3)
+			spanning.stop();
+		ProfileCapture::tick();
+	}
+	ProfileCapture::enable(false);
+	ProfileCapture::setTickBudget(0);
+
+	// the ring holds the last 8 ticks
+	EXPECT_EQ(ProfileCapture::numCapturedTicks(), 8u);
+
+	std::ostringstream trace;
+	EXPECT_TRUE(ProfileCapture::exportChromeTrace(trace, 2));
+	EXPECT_NE(trace.str().find("\"name\":\"tick 10\""), std::string::npos);
+	EXPECT_NE(trace.str().find("\"name\":\"capture_inner\""), std::string::npos);
+	EXPECT_EQ(trace.str().find("tick 9\""), std::string::npos);
+
+	std::ostringstream folded;
+	EXPECT_TRUE(ProfileCapture::exportCollapsedStacks(folded));
+	EXPECT_NE(folded.str().find("tick;capture_outer;capture_inner "), std::string::npos);
+	EXPECT_EQ(folded.str().find("capture_spanning"), std::string::npos);
+
+	// the slow tick was saved on its own
+	char path[128];
+	geco_snprintf(path, sizeof(path), "%s-10.folded", prefix);
+	FILE* fp = fopen(path, "r");
+	ASSERT_TRUE(fp != NULL);
+	char line[256];
+	bool found = false;
+	while (fgets(line, sizeof(line), fp))
+	{
+		uint us = 0;
+		if (sscanf(line, "tick;capture_outer;capture_inner %u", &us) == 1)
+			found = us >= 20000;
+	}
+	fclose(fp);
+	EXPECT_TRUE(found);
+	remove(path);
+	geco_snprintf(path, sizeof(path), "%s-10.json", prefix);
+	EXPECT_EQ(remove(path), 0);
+}
+
+TEST(TIME, test_clock)
+{
+	printf("clock source %s, invariant tsc %d, %.3f MHz, mult %llu\n",
+		geco_clock_t::source() == CLOCK_SOURCE_TSC ? "tsc" : "os",
+		geco_clock_t::invariant_tsc(), stamps_per_sec_double() / 1e6,
+		(unsigned long long)geco_clock_t::mult());
+	EXPECT_NEAR(double(geco_clock_t::stamps2ns(stamps_per_sec())), 1e9, 1e3);
+	EXPECT_NEAR(stamps2sec(stamps_per_sec()), 1.0, 1e-6);
+
+	// cost per read
+	const uint LOOPS = 1000000;
+	uint64 sink = 0;
+	uint64 start = gettimestamp();
+	for (uint i = 0; i < LOOPS; i++)
+		sink += gettimestamp();
+	double stampNs = stamps2sec(gettimestamp() - start) * 1e9 / LOOPS;
+
+	uint64 last = geco_clock_t::now_ns();
+	bool monotonic = true;
+	start = gettimestamp();
+	for (uint i = 0; i < LOOPS; i++)
+	{
+		uint64 now = geco_clock_t::now_ns();
+		monotonic &= now >= last;
+		last = now;
+	}
+	double nowNs = stamps2sec(gettimestamp() - start) * 1e9 / LOOPS;
+	EXPECT_TRUE(monotonic);
+
+#if defined(__linux__)
+	struct timespec ts;
+	start = gettimestamp();
+	for (uint i = 0; i < LOOPS; i++)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		sink += ts.tv_nsec;
+	}
+	double monoNs = stamps2sec(gettimestamp() - start) * 1e9 / LOOPS;
+	printf("per read: gettimestamp %.1fns, now_ns %.1fns, clock_gettime %.1fns (%llu)\n",
+		stampNs, nowNs, monoNs, (unsigned long long)(sink & 1));
+
+	// drift against CLOCK_MONOTONIC_RAW across a few re-syncs
+	if (geco_clock_t::source() == CLOCK_SOURCE_TSC)
+	{
+		for (int i = 0; i < 5; i++)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			EXPECT_TRUE(geco_clock_t::resync());
+			printf("re-sync %d drift %lldns\n", i,
+				(long long)geco_clock_t::last_drift_ns());
+		}
+		// slewed, not stepped, the offset shrinks but need not vanish
+		EXPECT_LT(llabs(geco_clock_t::last_drift_ns()), 1000000);
+		clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+		int64 offset = int64(uint64(ts.tv_sec) * 1000000000ULL + ts.tv_nsec)
+			- int64(geco_clock_t::now_ns());
+		printf("now_ns - CLOCK_MONOTONIC_RAW %lldns\n", (long long)-offset);
+		EXPECT_LT(llabs(offset), 1000000);
+	}
+#else
+	printf("per read: gettimestamp %.1fns, now_ns %.1fns (%llu)\n",
+		stampNs, nowNs, (unsigned long long)(sink & 1));
+#endif
+}
+
+TEST(TIME, test_concurrent_profile)
+{
+	// every value lies in its bucket and buckets are contiguous
+	for (uint i = 0; i + 1 < LatencyHistogram::BUCKETS; i++)
+	{
+		EXPECT_EQ(LatencyHistogram::bucketOf(LatencyHistogram::lowestOf(i)), i);
+		EXPECT_EQ(LatencyHistogram::bucketOf(LatencyHistogram::highestOf(i)), i);
+		EXPECT_EQ(LatencyHistogram::highestOf(i) + 1, LatencyHistogram::lowestOf(i + 1));
+	}
+	EXPECT_EQ(LatencyHistogram::bucketOf(~uint64(0)), LatencyHistogram::BUCKETS - 1);
+	const double maxError = 1.0 / LatencyHistogram::HALF_COUNT;
+
+	ConcurrentProfile profile("test_concurrent");
+	const uint THREADS = 4;
+	const uint SAMPLES = 200000;
+	std::vector<std::thread> threads;
+	for (uint t = 0; t < THREADS; t++)
+	{
+		threads.push_back(std::thread([&profile, t]()
+		{
+			// 1..100000 from every thread, offset so the threads interleave
+			for (uint i = 0; i < SAMPLES; i++)
+				profile.record((i * 7 + t * 1000) % 100000 + 1);
+		}));
+	}
+	for (uint t = 0; t < THREADS; t++)
+		threads[t].join();
+
+	LatencyHistogram h;
+	profile.snapshot(h);
+	EXPECT_EQ(h.count(), uint64(THREADS) * SAMPLES);
+	EXPECT_EQ(h.max(), 100000u);
+	EXPECT_NEAR(h.mean(), 50000.5, 1.0);
+	EXPECT_NEAR(double(h.valueAtPercentile(50.0)), 50000.0, 50000.0 * maxError);
+	EXPECT_NEAR(double(h.valueAtPercentile(99.0)), 99000.0, 99000.0 * maxError);
+	EXPECT_NEAR(double(h.valueAtPercentile(99.9)), 99900.0, 99900.0 * maxError);
+	EXPECT_EQ(h.valueAtPercentile(100.0), 100000u);
+
+	// live through the watcher tree
+	std::string value, comment;
+	WatcherMode mode;
+	geco_watcher_base_t::get_root_watcher().get_as_string(0,
+		"Profiles/Concurrent/test_concurrent/count", value, comment, mode);
+	EXPECT_EQ(strtoull(value.c_str(), NULL, 10), uint64(THREADS) * SAMPLES);
+	geco_watcher_base_t::get_root_watcher().get_as_string(0,
+		"Profiles/Concurrent/test_concurrent/p99Us", value, comment, mode);
+	EXPECT_NEAR(atof(value.c_str()), stamps2sec(99000) * 1000000.0,
+		stamps2sec(99000) * 1000000.0 * maxError);
+
+	// a reset starts a new window, old shards are skipped until reused
+	geco_watcher_base_t::get_root_watcher().set_from_string(0,
+		"Profiles/Concurrent/test_concurrent/reset", "true");
+	profile.snapshot(h);
+	EXPECT_EQ(h.count(), 0u);
+	profile.record(10);
+	profile.snapshot(h);
+	EXPECT_EQ(h.count(), 1u);
+	EXPECT_EQ(h.max(), 10u);
+
+	// cost of a scoped sample against ProfileVal
+	const uint LOOPS = 1000000;
+	ProfileVal val("test_concurrent_baseline");
+	uint64 start = gettimestamp();
+	for (uint i = 0; i < LOOPS; i++)
+	{
+		SCOPED_CONCURRENT_PROFILE(profile);
+	}
+	double concurrentNs = stamps2sec(gettimestamp() - start) * 1e9 / LOOPS;
+	start = gettimestamp();
+	for (uint i = 0; i < LOOPS; i++)
+	{
+		val.start();
+		val.stop();
+	}
+	double profileValNs = stamps2sec(gettimestamp() - start) * 1e9 / LOOPS;
+	printf("scoped sample: ConcurrentProfile %.1fns, ProfileVal %.1fns\n",
+		concurrentNs, profileValNs);
+}
+
 static void timeoutcb(TimerID id, void * pUser)
 {
 	static int times = 0;
@@ -88,6 +306,179 @@ TEST(TIME, test_timer_queue)
 	}
 }
 
+struct timer_queue_probe_t
+{
+	uint start;
+	uint fires;
+};
+
+static void probe_timeout(TimerID id, void * pUser)
+{
+	timer_queue_probe_t & probe = *(timer_queue_probe_t*)pUser;
+	probe.fires++;
+}
+static void probe_release(TimerID id, void * pUser)
+{
+}
+
+template <class QUEUE>
+static void check_timer_queue()
+{
+	const uint count = 20000;
+	QUEUE queue;
+	TimerHandler th;
+	th.handleTimeout = probe_timeout;
+	th.onRelease = probe_release;
+	timer_queue_probe_t* probes = new timer_queue_probe_t[count];
+	TimerID* ids = new TimerID[count];
+	uint seed = 777;
+	for (uint i = 0; i < count; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		probes[i].start = 1 + (seed >> 8) % 5000;
+		probes[i].fires = 0;
+		ids[i] = queue.add(probes[i].start, (i % 11 == 0) ? 1000 : 0, &th, probes + i);
+	}
+	EXPECT_EQ(queue.size(), count);
+	// cancelled timers leave the queue right away
+	for (uint i = 0; i < count; i += 3)
+		ids[i].cancel();
+	EXPECT_EQ(queue.size(), count - (count + 2) / 3);
+	EXPECT_FALSE(queue.legal(ids[0]));
+	EXPECT_TRUE(queue.legal(ids[1]));
+
+	uint now = 0;
+	while (now < 5000)
+	{
+		now += 7;
+		queue.process(now);
+		// everything due has fired
+		if (!queue.empty())
+		{
+			EXPECT_GT(queue.nextExp(now), 0u);
+		}
+	}
+	for (uint i = 0; i < count; i++)
+	{
+		if (i % 3 == 0)
+			EXPECT_EQ(probes[i].fires, 0u);
+		else if (i % 11 == 0)
+			EXPECT_EQ(probes[i].fires, 1 + (now - probes[i].start) / 1000);
+		else
+			EXPECT_EQ(probes[i].fires, 1u);
+	}
+	// only the repeating ones are left
+	uint repeating = 0;
+	for (uint i = 0; i < count; i++)
+		repeating += (i % 3 != 0 && i % 11 == 0);
+	EXPECT_EQ(queue.size(), repeating);
+	queue.clear();
+	EXPECT_TRUE(queue.empty());
+	delete[] ids;
+	delete[] probes;
+}
+
+TEST(TIME, test_timer_queue_backends)
+{
+	check_timer_queue<TimeQueue>();
+	check_timer_queue<TickTimeQueue>();
+}
+
+static std::vector<uint> order_fired;
+static void order_timeout(TimerID id, void * pUser)
+{
+	order_fired.push_back(*(uint*)pUser);
+}
+
+template <class QUEUE>
+static void check_timer_queue_order()
+{
+	// the later timers go in before the earlier ones
+	uint times[] = { 100, 60, 70, 65, 1200, 61 };
+	const uint count = sizeof(times) / sizeof(times[0]);
+	TimerHandler th;
+	QUEUE queue;
+	th.handleTimeout = order_timeout;
+	th.onRelease = probe_release;
+	for (uint i = 0; i < count; i++)
+		queue.add(times[i], 0, &th, times + i);
+
+	order_fired.clear();
+	std::vector<uint> sorted(times, times + count);
+	std::sort(sorted.begin(), sorted.end());
+	for (uint i = 0; i < count; i++)
+	{
+		// each one fires on its own tick, not before and not later
+		queue.process(sorted[i] - 1);
+		EXPECT_EQ(order_fired.size(), i);
+		queue.process(sorted[i]);
+		ASSERT_EQ(order_fired.size(), i + 1);
+		EXPECT_EQ(order_fired[i], sorted[i]);
+	}
+	EXPECT_TRUE(queue.empty());
+}
+
+TEST(TIME, test_timer_queue_order)
+{
+	check_timer_queue_order<TimeQueue>();
+	check_timer_queue_order<TickTimeQueue>();
+}
+
+static uint bench_fired = 0;
+static void bench_timeout(TimerID id, void * pUser)
+{
+	bench_fired++;
+}
+
+template <class QUEUE>
+static void bench_timer_queue(const char* name)
+{
+	const uint count = 1000000;
+	QUEUE* queue = new QUEUE;
+	TimerHandler th;
+	th.handleTimeout = bench_timeout;
+	th.onRelease = probe_release;
+	TimerID* ids = new TimerID[count];
+	uint* times = new uint[count];
+	uint seed = 4242;
+	for (uint i = 0; i < count; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		times[i] = 1 + (seed >> 8) % 60000;
+	}
+
+	uint64 start = gettimestamp();
+	for (uint i = 0; i < count; i++)
+		ids[i] = queue->add(times[i], 0, &th, NULL);
+	double add = stamps2sec(gettimestamp() - start);
+
+	start = gettimestamp();
+	for (uint i = 0; i < count; i += 2)
+		ids[i].cancel();
+	double cancel = stamps2sec(gettimestamp() - start);
+
+	bench_fired = 0;
+	start = gettimestamp();
+	for (uint now = 1; now <= 60000; now++)
+		queue->process(now);
+	double fire = stamps2sec(gettimestamp() - start);
+	EXPECT_EQ(bench_fired, count / 2);
+	EXPECT_TRUE(queue->empty());
+
+	printf("%s %u timers: add %.1f ns, cancel %.1f ns, fire %.1f ns per timer\n",
+		name, count, add * 1e9 / count, cancel * 1e9 / (count / 2),
+		fire * 1e9 / (count / 2));
+	delete[] times;
+	delete[] ids;
+	delete queue;
+}
+
+TEST(TIME, test_timer_queue_benchmark)
+{
+	bench_timer_queue<TimeQueue>("TimeQueue(4-ary heap)");
+	bench_timer_queue<TickTimeQueue>("TickTimeQueue(calendar)");
+}
+
 //static int naive_clz(int bits, uint64_t v)
 //{
 //    int r = 0;
@@ -568,3 +959,136 @@ struct rand_cfg
    //    printf("%s\n", buf);
    //}
 
+struct iwtimer_probe_t
+{
+	iwtimer_t timer;
+	timeout_t fired_at;
+	uint fires;
+};
+
+TEST(TIME, test_iwheel_timer_expiry)
+{
+	const uint count = 20000;
+	iwtimers_t timers;
+	iwtimer_probe_t* probes = new iwtimer_probe_t[count];
+	uint seed = 12345;
+	for (uint i = 0; i < count; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		iwtimer_probe_t* probe = probes + i;
+		probe->fired_at = 0;
+		probe->fires = 0;
+		probe->timer.set_callback([probe, &timers](iwtimer_t*)
+		{
+			probe->fired_at = timers.get_curtime();
+			probe->fires++;
+		});
+		// spread over all four wheels
+		timers.add_timer(&probe->timer, 1 + (seed >> 8) % 300000);
+	}
+	// cancel every 7th, they must never fire
+	for (uint i = 0; i < count; i += 7)
+		probes[i].timer.stop();
+
+	iwtimer_t repeat(iwtimer_t::REPEAT);
+	uint repeats = 0;
+	repeat.set_callback([&repeats](iwtimer_t*)
+	{	repeats++;});
+	timers.add_timer(&repeat, 1000);
+
+	timeout_t now = 0;
+	while (now < 310000)
+	{
+		seed = seed * 1103515245 + 12345;
+		timeout_t step = 1 + (seed >> 8) % 64;
+		// the wheel may wake us early but never after the earliest timer
+		timeout_t earliest = ~timeout_t(0);
+		if ((now & 127) < step)
+		{
+			for (uint i = 0; i < count; i++)
+				if (probes[i].timer.pending() && probes[i].timer.get_expires() - now < earliest)
+					earliest = probes[i].timer.get_expires() - now;
+			if (repeat.get_expires() - now < earliest)
+				earliest = repeat.get_expires() - now;
+			EXPECT_LE(timers.timeout(), earliest);
+		}
+		now += step;
+		timers.expire(now);
+	}
+
+	for (uint i = 0; i < count; i++)
+	{
+		if (i % 7 == 0)
+		{
+			EXPECT_EQ(probes[i].fires, 0u);
+			continue;
+		}
+		ASSERT_EQ(probes[i].fires, 1u);
+		// fired by the first update at or after its expiration
+		EXPECT_GE(probes[i].fired_at, probes[i].timer.get_expires());
+		EXPECT_LT(probes[i].fired_at - probes[i].timer.get_expires(), 64u);
+	}
+	EXPECT_GE(repeats, 305);
+	EXPECT_LE(repeats, 310);
+	EXPECT_TRUE(repeat.pending_wheel());
+	EXPECT_FALSE(timers.has_expired_timer());
+	delete[] probes;
+	// repeat unlinks itself from timers on destruction
+}
+
+TEST(TIME, test_iwheel_timer_benchmark)
+{
+	const uint count = 100000;
+	iwtimers_t timers;
+	iwtimer_t* nodes = new iwtimer_t[count];
+	timeout_t* timeouts = new timeout_t[count];
+	uint fired = 0;
+	uint seed = 54321;
+	for (uint i = 0; i < count; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		timeouts[i] = 1 + (seed >> 8) % 65536;
+		nodes[i].set_callback([&fired](iwtimer_t*)
+		{	fired++;});
+	}
+
+	uint64 start = gettimestamp();
+	for (uint i = 0; i < count; i++)
+		timers.add_timer(nodes + i, timeouts[i]);
+	double sche = stamps2sec(gettimestamp() - start);
+
+	// entity style: every timer is pushed back each tick
+	const uint ticks = 10;
+	start = gettimestamp();
+	for (uint t = 0; t < ticks; t++)
+	{
+		timers.expire(timers.get_curtime() + 1);
+		for (uint i = 0; i < count; i++)
+			timers.add_timer(nodes + i, timeouts[i]);
+	}
+	double resche = stamps2sec(gettimestamp() - start);
+
+	start = gettimestamp();
+	for (uint i = 0; i < count; i++)
+		timers.stop_timer(nodes + i);
+	double cancel = stamps2sec(gettimestamp() - start);
+	EXPECT_FALSE(timers.has_expiring_timer());
+
+	for (uint i = 0; i < count; i++)
+		timers.add_timer(nodes + i, timeouts[i]);
+	fired = 0;
+	start = gettimestamp();
+	while (fired < count)
+		timers.expire(timers.get_curtime() + 16);
+	double expire = stamps2sec(gettimestamp() - start);
+	EXPECT_EQ(fired, count);
+
+	printf("iwtimers_t %u timers: schedule %.1f ns, reschedule %.1f ns, "
+		"cancel %.1f ns, expire %.1f ns per timer\n", count,
+		sche * 1e9 / count, resche * 1e9 / (count * ticks),
+		cancel * 1e9 / count, expire * 1e9 / count);
+	printf("sizeof(iwtimer_t) %zu, sizeof(iwtimers_t) %zu\n", sizeof(iwtimer_t),
+		sizeof(iwtimers_t));
+	delete[] timeouts;
+	delete[] nodes;
+}
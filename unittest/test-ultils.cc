@@ -5,9 +5,22 @@
  *      Author: jackiez
  */
 
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
 #include "gtest/gtest.h"
 #include "common/debugging/debug.h"
+#include "common/debugging/timestamp.h"
 #include "common/ultils/geco-cmdline.h"
+#include "common/ultils/geco-ds-malloc.h"
+#include "common/ultils/geco-malloc.h"
+#include "common/ultils/geco-malloc-tracker.h"
+#include <signal.h>
+#include <stdio.h>
+
+using namespace geco::debugging;
 
 TEST(GECO_ULTILS, test_geco_cmdline_t)
 {
@@ -29,4 +42,208 @@ TEST(GECO_ULTILS, test_geco_cmdline_t)
 
 }
 
+TEST(GECO_ULTILS, test_thread_cached_alloc_batches_and_cross_thread_free)
+{
+	typedef geco::ds::thread_cached_alloc<1> alloc_t;
+	const size_t size = 48;
+	const int units = 3 * GECO_TCACHE_MAX_BATCH;
+
+	std::vector<char*> ptrs;
+	for (int i = 0; i < units; i++)
+	{
+		char* p = (char*)alloc_t::allocate(size);
+		memset(p, i, size);
+		ptrs.push_back(p);
+	}
+	/// no unit is handed out twice
+	for (int i = 0; i < units; i++)
+		EXPECT_EQ((char)i, ptrs[i][size - 1]);
+	EXPECT_LT(alloc_t::cached_units(size), GECO_TCACHE_MAX_BATCH);
+
+	/// freeing more than two batches sends one batch back to the central pool
+	for (int i = 0; i < units; i++)
+		alloc_t::deallocate(ptrs[i], size);
+	EXPECT_LE(alloc_t::cached_units(size), 2 * GECO_TCACHE_MAX_BATCH);
+
+	/// units allocated here and freed by another thread go to its cache,
+	/// and back to the central pool when it exits
+	for (int i = 0; i < units; i++)
+		ptrs[i] = (char*)alloc_t::allocate(size);
+	std::thread t([&ptrs, size]()
+	{
+		for (size_t i = 0; i < ptrs.size(); i++)
+		alloc_t::deallocate(ptrs[i], size);
+		EXPECT_GT(alloc_t::cached_units(size), 0);
+	});
+	t.join();
+
+	/// a thread that only frees gave all of them back when it exited, a new
+	/// thread is handed exactly those units first
+	std::thread t2([&ptrs, size]()
+	{
+		std::vector<char*> again;
+		for (size_t i = 0; i < ptrs.size(); i++)
+		again.push_back((char*)alloc_t::allocate(size));
+		size_t reused = 0;
+		for (size_t i = 0; i < again.size(); i++)
+		reused += std::find(ptrs.begin(), ptrs.end(), again[i]) != ptrs.end();
+		EXPECT_EQ(ptrs.size(), reused);
+		for (size_t i = 0; i < again.size(); i++)
+		alloc_t::deallocate(again[i], size);
+	});
+	t2.join();
+
+	/// big blocks bypass the caches
+	void* big = alloc_t::allocate(geco::ds::MAX_BYTES + 1);
+	ASSERT_TRUE(big != NULL);
+	alloc_t::deallocate(big, geco::ds::MAX_BYTES + 1);
+}
+
+/// the same default_alloc behind one mutex, what every call paid before
+struct locked_default_alloc_t
+{
+	static std::mutex lock;
+	static geco::ds::default_alloc<false, 2> pool;
+	static void* allocate(size_t size)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return pool.allocate(size);
+	}
+	static void deallocate(void* p, size_t size)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		pool.deallocate(p, size);
+	}
+};
+std::mutex locked_default_alloc_t::lock;
+geco::ds::default_alloc<false, 2> locked_default_alloc_t::pool;
+
+template<class ALLOC>
+static double run_small_allocs(uint threads, uint rounds)
+{
+	std::vector<std::thread> workers;
+	uint64 start = gettimestamp();
+	for (uint t = 0; t < threads; t++)
+	{
+		workers.push_back(std::thread([rounds]()
+		{
+			void* live[64];
+			for (uint r = 0; r < rounds; r++)
+			{
+				for (uint i = 0; i < 64; i++)
+				live[i] = ALLOC::allocate(16 + (i & 7) * 24);
+				for (uint i = 0; i < 64; i++)
+				ALLOC::deallocate(live[i], 16 + (i & 7) * 24);
+			}
+		}));
+	}
+	for (auto& w : workers)
+		w.join();
+	return stamps2sec(gettimestamp() - start);
+}
 
+TEST(GECO_ULTILS, test_thread_cached_alloc_contention_benchmark)
+{
+	const uint ops = 1 << 21;
+	const uint threads[] = { 1, 2, 4, 8 };
+	for (uint t : threads)
+	{
+		uint rounds = ops / 128 / t;
+		double locked = run_small_allocs<locked_default_alloc_t>(t, rounds);
+		double cached = run_small_allocs<geco::ds::thread_cached_alloc<3> >(t, rounds);
+		printf("%u threads, %u alloc+free: global lock %.3f ms (%.1f M/s), "
+			"thread cache %.3f ms (%.1f M/s)\n", t, ops, locked * 1000,
+			ops / locked / 1e6, cached * 1000, ops / cached / 1e6);
+	}
+}
+
+TEST(GECO_ULTILS, test_alloc_tracker_charges_frees_to_allocating_site)
+{
+	geco_alloc_tracker_t::enable(true);
+	const uint site_a_line = __LINE__ + 3;
+	std::vector<void*> blocks;
+	for (int i = 0; i < 10; i++)
+		blocks.push_back(geco_malloc_ext(100, __FILE__, __LINE__));
+	void* other = geco_malloc_ext(5000, FILE_AND_LINE);
+
+	geco_alloc_site_t* site_a = NULL;
+	for (uint id = 1; id <= GECO_ALLOC_MAX_SITES; id++)
+	{
+		geco_alloc_site_t* site = geco_alloc_tracker_t::site(id);
+		if (site->ready && site->line == site_a_line && strcmp(site->file, __FILE__) == 0)
+			site_a = site;
+	}
+	ASSERT_TRUE(site_a != NULL);
+	EXPECT_EQ(1000u, site_a->live_bytes.load());
+	EXPECT_EQ(10u, site_a->live_count.load());
+
+	/// freed on another thread and from another line, still charged to site a
+	std::thread t([&blocks]()
+	{
+		for (int i = 0; i < 5; i++)
+		geco_free_ext(blocks[i], FILE_AND_LINE);
+	});
+	t.join();
+	EXPECT_EQ(500u, site_a->live_bytes.load());
+	EXPECT_EQ(1000u, site_a->peak_bytes.load());
+	EXPECT_EQ(10u, site_a->allocs.load());
+	EXPECT_EQ(5u, site_a->frees.load());
+
+	/// realloc moves the block to the site of the realloc
+	blocks[5] = geco_realloc_ext(blocks[5], 2000, FILE_AND_LINE);
+	EXPECT_EQ(400u, site_a->live_bytes.load());
+
+	/// report of the dump signal, windows has no signal to install so dump directly
+	FILE* report = tmpfile();
+	ASSERT_TRUE(report != NULL);
+#ifndef _WIN32
+	ASSERT_TRUE(geco_alloc_tracker_t::install_dump_signal(SIGUSR2, fileno(report), 8));
+	raise(SIGUSR2);
+	signal(SIGUSR2, SIG_DFL);
+#else
+	geco_alloc_tracker_t::dump(_fileno(report), 8);
+#endif
+	rewind(report);
+	char text[4096];
+	size_t len = fread(text, 1, sizeof(text) - 1, report);
+	text[len] = 0;
+	fclose(report);
+	char where[256];
+	snprintf(where, sizeof(where), "%s:%u", __FILE__, site_a_line);
+	EXPECT_TRUE(strstr(text, where) != NULL);
+	printf("%s", text);
+
+	/// blocks allocated while disabled are never charged
+	geco_alloc_tracker_t::enable(false);
+	void* untracked = geco_malloc_ext(64, FILE_AND_LINE);
+	geco_alloc_tracker_t::enable(true);
+	geco_free_ext(untracked, FILE_AND_LINE);
+	for (size_t i = 5; i < blocks.size(); i++)
+		geco_free_ext(blocks[i], FILE_AND_LINE);
+	geco_free_ext(other, FILE_AND_LINE);
+	EXPECT_EQ(0u, site_a->live_bytes.load());
+	EXPECT_EQ(0u, site_a->live_count.load());
+	geco_alloc_tracker_t::enable(false);
+}
+
+TEST(GECO_ULTILS, test_alloc_tracker_overhead_benchmark)
+{
+	const uint rounds = 200000;
+	void* live[16];
+	for (int tracked = 0; tracked < 2; tracked++)
+	{
+		geco_alloc_tracker_t::enable(tracked != 0);
+		uint64 start = gettimestamp();
+		for (uint r = 0; r < rounds; r++)
+		{
+			for (uint i = 0; i < 16; i++)
+				live[i] = geco_malloc_ext(32 + i * 8, FILE_AND_LINE);
+			for (uint i = 0; i < 16; i++)
+				geco_free_ext(live[i], FILE_AND_LINE);
+		}
+		double secs = stamps2sec(gettimestamp() - start);
+		printf("geco_malloc_ext/geco_free_ext %s: %.1f ns per pair\n",
+			tracked ? "tracked" : "untracked", secs * 1e9 / (rounds * 16));
+	}
+	geco_alloc_tracker_t::enable(false);
+}
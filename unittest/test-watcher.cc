@@ -16,6 +16,7 @@
 #include "common/ultils/ultils.h"
 #include "common/debugging/debug.h"
 #include "common/debugging/gecowatchert.h"
+#include "common/debugging/timestamp.h"
 using namespace geco::debugging;
 using namespace geco::ultils;
 using namespace geco::ds;
@@ -293,3 +294,182 @@ TEST(GECO_DEBUGGING_WATCHER, test_watcher_path_request_v2)
     //valuereq.set_watcher_value();
     ///////////////////////////////////////////////////////////////////////////////////////////////////////
 }
+
+static void batch_walk_cb(watcher_value_query_t & pathRequest, int32 retcode)
+{
+}
+TEST(GECO_DEBUGGING_WATCHER, test_watcher_batch_query)
+{
+    const int DIRS = 8;
+    const int VALUES = 8;
+    const int LOOPS = 2000;
+
+    static int values[DIRS * VALUES];
+    ExampleClass examples[DIRS];
+    std::vector<std::string> paths;
+    for (int d = 0; d < DIRS; d++)
+    {
+        int a = 1000 + d;
+        examples[d].setValue(a);
+        for (int v = 0; v < VALUES; v++)
+        {
+            char path[64];
+            sprintf(path, "batch/dir%d/value%d", d, v);
+            paths.push_back(path);
+            values[d * VALUES + v] = d * VALUES + v;
+            if (v == 0)
+                GECO_WATCH(path, examples[d], CAST_METHOD_RW(int, ExampleClass, getValue, setValue));
+            else
+                GECO_WATCH(path, values[d * VALUES + v], WT_READ_ONLY);
+        }
+    }
+
+    watcher_batch_query_t query;
+    for (size_t i = 0; i < paths.size(); i++)
+        query.add_path(paths[i].c_str());
+    query.add_path("batch/dir0/nothere");
+    query.add_path("batch/dir0");
+    EXPECT_EQ(query.compile(), paths.size() + 1);
+
+    // every value in path order, then the two paths without value
+    geco_bit_stream_t result;
+    query.snapshot(result);
+    uint count;
+    ushort type;
+    ushort mode;
+    int intval;
+    result.Read(count);
+    EXPECT_EQ(count, paths.size() + 2);
+    for (int i = 0; i < DIRS * VALUES; i++)
+    {
+        read_watcher_value_from_stream(result, intval, type, mode);
+        EXPECT_EQ(type, WVT_INT32);
+        EXPECT_EQ(intval, i % VALUES == 0 ? 1000 + i / VALUES : i);
+        EXPECT_EQ(mode, i % VALUES == 0 ? WT_READ_WRITE : WT_READ_ONLY);
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        result.Read(type);
+        result.Read(mode);
+        EXPECT_EQ(type, WVT_UNKNOWN);
+        EXPECT_EQ(mode, WT_INVALID);
+    }
+    EXPECT_FALSE(query.resolved(DIRS * VALUES));
+
+    // removing a watcher invalidates the cached handles
+    EXPECT_TRUE(geco_watcher_base_t::get_root_watcher().remove_watcher(paths[1].c_str()));
+    result.reset();
+    query.snapshot(result);
+    EXPECT_FALSE(query.resolved(1));
+    EXPECT_TRUE(query.resolved(2));
+    result.Read(count);
+    read_watcher_value_from_stream(result, intval, type, mode);
+    result.Read(type);
+    result.Read(mode);
+    EXPECT_EQ(type, WVT_UNKNOWN);
+    read_watcher_value_from_stream(result, intval, type, mode);
+    EXPECT_EQ(intval, 2);
+    GECO_WATCH(paths[1].c_str(), values[1], WT_READ_ONLY);
+
+    // scrape all paths, one query per path against one batch snapshot
+    int threshold = log_msg_filter_t::get_instance().filter_threshold_;
+    log_msg_filter_t::get_instance().filter_threshold_ = LOG_MSG_WARNING;
+    uint64 start = gettimestamp();
+    for (int l = 0; l < LOOPS; l++)
+    {
+        for (size_t i = 0; i < paths.size(); i++)
+        {
+            watcher_value_query_t valuereq(paths[i].c_str(), batch_walk_cb, false);
+            valuereq.get_watcher_value();
+        }
+    }
+    double walkUs = stamps2sec(gettimestamp() - start) * 1000000.0 / LOOPS;
+
+    start = gettimestamp();
+    for (int l = 0; l < LOOPS; l++)
+    {
+        result.reset();
+        query.snapshot(result);
+    }
+    double batchUs = stamps2sec(gettimestamp() - start) * 1000000.0 / LOOPS;
+    log_msg_filter_t::get_instance().filter_threshold_ = threshold;
+
+    printf("scrape of %d paths: per path walk %.2fus, batch snapshot %.2fus (%d bytes)\n",
+        (int)paths.size(), walkUs, batchUs, (int)BITS_TO_BYTES(result.get_payloads()));
+    EXPECT_LT(batchUs, walkUs);
+
+    geco_watcher_base_t::get_root_watcher().remove_watcher("batch");
+}
+
+TEST(GECO_DEBUGGING_WATCHER, test_watcher_director_index)
+{
+    const int CHILDREN = 512;
+    const int LOOPS = 200;
+
+    static int values[CHILDREN];
+    char path[64];
+    for (int i = 0; i < CHILDREN; i++)
+    {
+        values[i] = i;
+        sprintf(path, "index/stats/msg%d", i);
+        EXPECT_TRUE(GECO_WATCH(path, values[i], WT_READ_WRITE) != NULL);
+    }
+    // labels are interned once whatever directory uses them
+    EXPECT_EQ(watcher_intern_label("msg7", 4), watcher_intern_label("index/stats/msg7" + 12, 4));
+
+    geco_watcher_base_t& root = geco_watcher_base_t::get_root_watcher();
+    std::string result;
+    std::string desc;
+    WatcherMode mode;
+    for (int i = 0; i < CHILDREN; i++)
+    {
+        sprintf(path, "index/stats/msg%d", i);
+        EXPECT_TRUE(root.get_as_string(0, path, result, desc, mode));
+        EXPECT_EQ(atoi(result.c_str()), i);
+    }
+    EXPECT_FALSE(root.get_as_string(0, "index/stats/msg", result, desc, mode));
+    EXPECT_FALSE(root.get_as_string(0, "index/stats/msg1/x", result, desc, mode));
+    EXPECT_TRUE(root.get_as_string(0, "index/stats", result, desc, mode));
+    EXPECT_EQ(mode, WT_DIRECTORY);
+
+    // the cached lookup of a path must follow removal and re-adding
+    EXPECT_EQ(root.set_from_string(0, "index/stats/msg42", "4242"), WatcherSucceeds);
+    EXPECT_EQ(values[42], 4242);
+    EXPECT_TRUE(root.remove_watcher("index/stats/msg42"));
+    EXPECT_FALSE(root.get_as_string(0, "index/stats/msg42", result, desc, mode));
+    EXPECT_FALSE(root.remove_watcher("index/stats/msg42"));
+    static int other = 7;
+    GECO_WATCH("index/stats/msg42", other, WT_READ_ONLY);
+    EXPECT_TRUE(root.get_as_string(0, "index/stats/msg42", result, desc, mode));
+    EXPECT_STREQ(result.c_str(), "7");
+
+    // children are still walked in label order
+    std::string tmp = "index/";
+    std::string paths;
+    int num = 0;
+    ((geco_watcher_director_t&)root).find_child("index")->watcher->walk_all_files(tmp, paths,
+        num, false);
+    EXPECT_EQ(num, CHILDREN);
+    EXPECT_EQ(paths.find("index/stats/msg0\n"), 0U);
+    EXPECT_LT(paths.find("index/stats/msg10\n"), paths.find("index/stats/msg2\n"));
+
+    std::vector<std::string> lookups;
+    for (int i = 0; i < CHILDREN; i++)
+    {
+        sprintf(path, "index/stats/msg%d", i);
+        lookups.push_back(path);
+    }
+    const void* base;
+    uint found = 0;
+    uint64 start = gettimestamp();
+    for (int l = 0; l < LOOPS; l++)
+    {
+        for (int i = 0; i < CHILDREN; i++)
+            found += root.resolve(NULL, lookups[i].c_str(), base) != NULL;
+    }
+    double lookupNs = stamps2sec(gettimestamp() - start) * 1e9 / (LOOPS * CHILDREN);
+    printf("path lookup in a directory of %d children: %.1fns\n", CHILDREN, lookupNs);
+    EXPECT_EQ(found, (uint)(LOOPS * CHILDREN));
+
+    root.remove_watcher("index");
+}